@@ -13,6 +13,7 @@ This design allows for multiple backend implementations (Perfetto, VCD, custom)
 while maintaining a consistent, Pythonic interface.
 """
 
+import os
 from typing import Protocol, Optional, Union, runtime_checkable
 from enum import IntEnum
 
@@ -210,13 +211,19 @@ class ITrace(Protocol):
         ...
 
 
-def create_trace(filename: str, name: str, time_units: str) -> ITrace:
+def create_trace(filename: str, name: str, time_units: str,
+                 compress: bool = False, backend: Optional[str] = None) -> ITrace:
     """Factory function to create a new trace
     
     Args:
         filename: Output trace filename (e.g., 'trace.perfetto')
         name: Trace name for display/identification
         time_units: Time unit string (e.g., '1ns', '1ps', '1us')
+        compress: Write packets as zlib-compressed chunks
+        backend: 'native' to record through libdvtt, 'python' for the pure
+            Python implementation, or 'auto' to use libdvtt when it can be
+            loaded. Defaults to the DVTT_BACKEND environment variable, else
+            'auto'.
     
     Returns:
         A new trace object implementing ITrace protocol
@@ -228,5 +235,15 @@ def create_trace(filename: str, name: str, time_units: str) -> ITrace:
             txn.add_uint('addr', 0x1000, Radix.HEX)
             txn.close(2000)
     """
+    if backend is None:
+        backend = os.environ.get('DVTT_BACKEND', 'auto')
+    if backend not in ('auto', 'native', 'python'):
+        raise ValueError(f"Unknown backend '{backend}'")
+    
+    if backend != 'python':
+        from .impl import native_impl
+        if backend == 'native' or native_impl.is_available():
+            return native_impl.NativeTrace(filename, name, time_units, compress=compress)
+    
     from .impl.perfetto_impl import PerfettoTrace
-    return PerfettoTrace(filename, name, time_units)
+    return PerfettoTrace(filename, name, time_units, compress=compress)
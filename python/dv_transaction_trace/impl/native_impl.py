@@ -0,0 +1,472 @@
+"""Native implementation of DV Transaction Trace API on top of libdvtt
+
+This module implements the ITrace, IStream, and ITransaction protocols by
+calling the C library through ctypes. Packets are encoded and buffered in
+chunks by libdvtt, so Python does no protobuf work per event.
+
+Crossing into C costs far more per argument than per byte, so the hot path
+follows the DPI binding: names are registered once and passed as integer
+ids, attributes are packed into one buffer as they are added, and a
+transaction is written by a single dvtt_record_packed() call when it
+closes. A transaction only becomes a native object when something has to
+refer to it while it is open: a child transaction, a link or a blob
+attribute.
+
+The library is found through the DVTT_LIBRARY environment variable or
+the system library path.
+"""
+
+import ctypes
+import ctypes.util
+import os
+import struct
+from typing import Optional, List, Dict
+from ..api import ITrace, IStream, ITransaction, Radix, LinkType
+
+
+# dvtt_compression_t
+_COMPRESSION_NONE = 0
+_COMPRESSION_DEFLATE = 1
+
+
+class _TraceOptions(ctypes.Structure):
+    """Mirror of dvtt_trace_options_t
+
+    The trailing reserve absorbs fields added to the C struct later, which
+    dvtt_trace_options_init() fills with their defaults.
+    """
+    _fields_ = [
+        ('chunk_size', ctypes.c_size_t),
+        ('async_writer', ctypes.c_int),
+        ('ring_chunks', ctypes.c_size_t),
+        ('ring_full_policy', ctypes.c_int),
+        ('free_on_close', ctypes.c_int),
+        ('raw_bits', ctypes.c_int),
+        ('multi_thread', ctypes.c_int),
+        ('rotate_bytes', ctypes.c_size_t),
+        ('rotate_time', ctypes.c_uint64),
+        ('compression', ctypes.c_int),
+        ('compression_level', ctypes.c_int),
+        ('flight_recorder_bytes', ctypes.c_size_t),
+        ('reorder_window', ctypes.c_uint64),
+        ('reorder_fallback', ctypes.c_int),
+        ('flush_time', ctypes.c_uint64),
+        ('flush_packets', ctypes.c_uint64),
+        ('flush_sync', ctypes.c_int),
+        ('mmap_window', ctypes.c_size_t),
+        ('stats_interval', ctypes.c_uint64),
+        ('id_namespace', ctypes.c_uint32),
+        ('_reserved', ctypes.c_ubyte * 256),
+    ]
+
+
+_lib = None
+
+
+def _library_candidates() -> List[str]:
+    """Paths to try for libdvtt, most specific first"""
+    candidates = []
+    env = os.environ.get('DVTT_LIBRARY')
+    if env:
+        candidates.append(env)
+    system = ctypes.util.find_library('dvtt')
+    if system:
+        candidates.append(system)
+    return candidates
+
+
+def load_library() -> ctypes.CDLL:
+    """Load libdvtt and declare the functions used here
+
+    Raises:
+        OSError: if the library cannot be found or loaded
+    """
+    global _lib
+    if _lib is not None:
+        return _lib
+
+    errors = []
+    lib = None
+    for path in _library_candidates():
+        if os.path.sep in path and not os.path.exists(path):
+            continue
+        try:
+            lib = ctypes.CDLL(path)
+            break
+        except OSError as e:
+            errors.append(str(e))
+    if lib is None:
+        raise OSError("libdvtt not found (set DVTT_LIBRARY)" +
+                      (": " + "; ".join(errors) if errors else ""))
+
+    p, s, i, u64 = ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_uint64
+    signatures = {
+        'dvtt_trace_options_init': (None, [ctypes.POINTER(_TraceOptions)]),
+        'dvtt_create_trace_ex': (p, [s, s, s, ctypes.POINTER(_TraceOptions)]),
+        'dvtt_close_trace': (None, [p]),
+        'dvtt_open_stream': (p, [p, s, s, s]),
+        'dvtt_close_stream': (None, [p]),
+        'dvtt_register_name': (i, [p, s]),
+        'dvtt_open_transaction_id': (p, [p, i, u64, i, p]),
+        'dvtt_add_packed_attributes': (None, [p, s, i]),
+        'dvtt_record_packed': (i, [p, i, i, u64, u64, p, s, i]),
+        'dvtt_add_attr_blob': (None, [p, s, s, ctypes.c_size_t]),
+        'dvtt_add_link': (None, [p, p, i, s]),
+        'dvtt_close_transaction': (None, [p, u64]),
+        'dvtt_free_transaction': (None, [p, u64]),
+        'dvtt_get_last_error': (i, []),
+        'dvtt_error_string': (s, [i]),
+    }
+    for name, (restype, argtypes) in signatures.items():
+        func = getattr(lib, name)
+        func.restype = restype
+        func.argtypes = argtypes
+    _lib = lib
+    return lib
+
+
+def is_available() -> bool:
+    """Check whether the native backend can be used"""
+    try:
+        load_library()
+        return True
+    except OSError:
+        return False
+
+
+def _last_error(lib: ctypes.CDLL) -> str:
+    return lib.dvtt_error_string(lib.dvtt_get_last_error()).decode()
+
+
+# Packed attribute headers (DVTT_PACKED_HEADER in dvtt.h)
+_ATTR32 = struct.Struct('<III')
+_ATTR64 = struct.Struct('<IIQ')
+_MASK64 = (1 << 64) - 1
+
+
+def _header(radix: int, num_bits: int) -> int:
+    return (int(radix) << 24) | (num_bits & 0xFFFFFF)
+
+
+class NativeTransaction(ITransaction):
+    """libdvtt-backed transaction implementation"""
+
+    __slots__ = ('_stream', '_name', '_type_name', '_start_time', '_end_time',
+                 '_is_open', '_parent', '_words', '_blobs', '_handle', '_open_children')
+
+    def __init__(self, stream: 'NativeStream', name: str, start_time: int,
+                 type_name: Optional[str] = None,
+                 parent: Optional['NativeTransaction'] = None):
+        self._stream = stream
+        self._name = name
+        self._type_name = type_name
+        self._start_time = start_time
+        self._end_time = 0
+        self._is_open = True
+        self._parent = parent
+        self._words = bytearray()
+        self._blobs: List[tuple] = []
+        self._handle = None
+        self._open_children = 0
+
+        if parent:
+            # Children are recorded under the parent's native transaction
+            parent._ensure_handle()
+            parent._open_children += 1
+
+    @property
+    def name(self) -> str:
+        return self._name
+
+    @property
+    def type_name(self) -> Optional[str]:
+        return self._type_name
+
+    @property
+    def start_time(self) -> int:
+        return self._start_time
+
+    @property
+    def end_time(self) -> int:
+        return self._end_time
+
+    def is_open(self) -> bool:
+        return self._is_open
+
+    def is_closed(self) -> bool:
+        return not self._is_open and self._end_time > 0
+
+    def close(self, end_time: int) -> None:
+        """Close the transaction and write it to the trace"""
+        if not self._is_open:
+            return
+
+        self._end_time = end_time
+        self._is_open = False
+        stream = self._stream
+        trace = stream._trace
+        lib = trace._lib
+        stream._open.pop(id(self), None)
+
+        if self._handle is None:
+            parent = self._parent._handle if self._parent else None
+            words = bytes(self._words)
+            lib.dvtt_record_packed(stream._handle, trace._name_id(self._name),
+                                   trace._type_id(self._type_name),
+                                   self._start_time, end_time, parent,
+                                   words, len(words) // 4)
+        else:
+            if self._words:
+                words = bytes(self._words)
+                lib.dvtt_add_packed_attributes(self._handle, words, len(words) // 4)
+            for name, data in self._blobs:
+                lib.dvtt_add_attr_blob(self._handle, name.encode(), data, len(data))
+            lib.dvtt_close_transaction(self._handle, end_time)
+            self._release()
+        self._words = None
+        self._blobs = None
+
+        if self._parent:
+            self._parent._open_children -= 1
+            self._parent._release()
+
+    def add_int(self, name: str, value: int, radix: Radix = Radix.HEX) -> None:
+        """Add signed integer attribute"""
+        if self._is_open:
+            self._words += _ATTR64.pack(self._stream._trace._name_id(name),
+                                        _header(radix, 64), value & _MASK64)
+
+    def add_uint(self, name: str, value: int, radix: Radix = Radix.HEX) -> None:
+        """Add unsigned integer attribute"""
+        if not self._is_open:
+            return
+        name_id = self._stream._trace._name_id(name)
+        if radix == Radix.DEC and value >> 63:
+            # Packed DEC values are signed; one more bit keeps this one positive
+            self._words += _ATTR32.pack(name_id, _header(radix, 65), value & 0xFFFFFFFF)
+            self._words += struct.pack('<II', (value >> 32) & 0xFFFFFFFF, 0)
+        else:
+            self._words += _ATTR64.pack(name_id, _header(radix, 64), value & _MASK64)
+
+    def add_float(self, name: str, value: float) -> None:
+        """Add floating-point attribute"""
+        if self._is_open:
+            self._words += struct.pack('<IId', self._stream._trace._name_id(name),
+                                       _header(Radix.REAL, 64), value)
+
+    def add_string(self, name: str, value: str) -> None:
+        """Add string attribute
+
+        Values are registered like names, so repeated values cost one id.
+        """
+        if self._is_open:
+            trace = self._stream._trace
+            self._words += _ATTR32.pack(trace._name_id(name), _header(Radix.STRING, 32),
+                                        trace._name_id(value))
+
+    def add_time(self, name: str, value: int) -> None:
+        """Add time attribute"""
+        self.add_uint(name, value, Radix.TIME)
+
+    def add_bits(self, name: str, bits: bytes, num_bits: int,
+                 radix: Radix = Radix.HEX) -> None:
+        """Add bit vector attribute (recorded as an integer up to 64 bits)"""
+        if not self._is_open:
+            return
+        value = bytes(bits[:(num_bits + 7) // 8])
+        size = ((num_bits + 31) // 32) * 4
+        self._words += struct.pack('<II', self._stream._trace._name_id(name),
+                                   _header(radix, num_bits))
+        self._words += value.ljust(size, b'\0')
+
+    def add_blob(self, name: str, data: bytes) -> None:
+        """Add binary blob attribute"""
+        if self._is_open:
+            self._ensure_handle()
+            self._blobs.append((name, bytes(data)))
+
+    def add_link(self, target: ITransaction, link_type: LinkType = LinkType.RELATED,
+                 relation_name: Optional[str] = None) -> None:
+        """Create a link to another transaction"""
+        if not isinstance(target, NativeTransaction):
+            raise TypeError("Target must be a NativeTransaction")
+        if not self._is_open or not target._is_open:
+            return
+        self._ensure_handle()
+        target._ensure_handle()
+        self._stream._trace._lib.dvtt_add_link(
+            self._handle, target._handle, int(link_type),
+            relation_name.encode() if relation_name else None)
+
+    def _ensure_handle(self) -> None:
+        """Open the native transaction this one is recorded as"""
+        if self._handle is not None:
+            return
+        parent = None
+        if self._parent:
+            self._parent._ensure_handle()
+            parent = self._parent._handle
+        trace = self._stream._trace
+        handle = trace._lib.dvtt_open_transaction_id(
+            self._stream._handle, trace._name_id(self._name), self._start_time,
+            trace._type_id(self._type_name), parent)
+        if not handle:
+            raise RuntimeError(f"dvtt_open_transaction failed: {_last_error(trace._lib)}")
+        self._handle = handle
+
+    def _depth(self) -> int:
+        depth = 0
+        txn = self._parent
+        while txn:
+            txn = txn._parent
+            depth += 1
+        return depth
+
+    def _release(self) -> None:
+        """Free the native transaction once it is closed and has no open children"""
+        if self._handle is not None and not self._is_open and not self._open_children:
+            self._stream._trace._lib.dvtt_free_transaction(self._handle, 0)
+            self._handle = None
+
+
+class NativeStream(IStream):
+    """libdvtt-backed stream implementation"""
+
+    def __init__(self, trace: 'NativeTrace', name: str,
+                 scope: Optional[str] = None, type_name: Optional[str] = None):
+        self._trace = trace
+        self._name = name
+        self._scope = scope
+        self._type_name = type_name
+        self._is_open = True
+        self._open: Dict[int, NativeTransaction] = {}
+        self._handle = trace._lib.dvtt_open_stream(
+            trace._handle, name.encode(),
+            scope.encode() if scope else None,
+            type_name.encode() if type_name else None)
+        if not self._handle:
+            raise RuntimeError(f"dvtt_open_stream failed: {_last_error(trace._lib)}")
+
+    @property
+    def name(self) -> str:
+        return self._name
+
+    @property
+    def scope(self) -> Optional[str]:
+        return self._scope
+
+    @property
+    def type_name(self) -> Optional[str]:
+        return self._type_name
+
+    def is_open(self) -> bool:
+        return self._is_open
+
+    def is_closed(self) -> bool:
+        return not self._is_open
+
+    def close(self) -> None:
+        """Close the stream and all open transactions"""
+        if not self._is_open:
+            return
+
+        # Children first, so parents are still open when they are recorded
+        for txn in sorted(self._open.values(), key=lambda t: -t._depth()):
+            txn.close(txn.start_time)
+        self._trace._lib.dvtt_close_stream(self._handle)
+        self._is_open = False
+
+    def begin_transaction(self, name: str, start_time: int,
+                         type_name: Optional[str] = None,
+                         parent: Optional[ITransaction] = None) -> ITransaction:
+        """Open a new transaction on this stream"""
+        if not self._is_open:
+            raise RuntimeError("Cannot create transaction on closed stream")
+        if parent is not None and not isinstance(parent, NativeTransaction):
+            raise TypeError("Parent must be a NativeTransaction")
+
+        txn = NativeTransaction(self, name, start_time, type_name, parent)
+        self._open[id(txn)] = txn
+        return txn
+
+
+class NativeTrace(ITrace):
+    """libdvtt-backed trace implementation
+
+    Takes the same arguments as PerfettoTrace. With compress=True the
+    library writes compressed_packets chunks, which requires libdvtt to be
+    built with zlib.
+    """
+
+    def __init__(self, filename: str, name: str, time_units: str,
+                 compress: bool = False, chunk_size: int = 64 * 1024):
+        self._lib = load_library()
+        self._filename = filename
+        self._name = name
+        self._time_units = time_units
+        self._streams: List[NativeStream] = []
+        self._names: Dict[str, int] = {}
+
+        options = _TraceOptions()
+        self._lib.dvtt_trace_options_init(ctypes.byref(options))
+        options.chunk_size = chunk_size
+        options.compression = _COMPRESSION_DEFLATE if compress else _COMPRESSION_NONE
+        self._handle = self._lib.dvtt_create_trace_ex(
+            filename.encode(), name.encode(), time_units.encode(), ctypes.byref(options))
+        if not self._handle:
+            raise OSError(f"Cannot create trace '{filename}': {_last_error(self._lib)}")
+
+    @property
+    def name(self) -> str:
+        return self._name
+
+    @property
+    def filename(self) -> str:
+        return self._filename
+
+    @property
+    def time_units(self) -> str:
+        return self._time_units
+
+    @property
+    def streams(self) -> List[NativeStream]:
+        """List of streams in this trace"""
+        return self._streams
+
+    def create_stream(self, name: str, scope: Optional[str] = None,
+                     type_name: Optional[str] = None) -> IStream:
+        """Create and open a new transaction stream"""
+        stream = NativeStream(self, name, scope, type_name)
+        self._streams.append(stream)
+        return stream
+
+    def close(self) -> None:
+        """Close the trace and flush to file"""
+        if not self._handle:
+            return
+        for stream in self._streams:
+            stream.close()
+        self._lib.dvtt_close_trace(self._handle)
+        self._handle = None
+
+    def __enter__(self) -> 'NativeTrace':
+        """Context manager entry"""
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb) -> None:
+        """Context manager exit"""
+        self.close()
+
+    # Internal helper methods
+
+    def _name_id(self, name: str) -> int:
+        """Id of a registered name, registering it on first use"""
+        try:
+            return self._names[name]
+        except KeyError:
+            name_id = self._lib.dvtt_register_name(self._handle, name.encode())
+            self._names[name] = name_id
+            return name_id
+
+    def _type_id(self, type_name: Optional[str]) -> int:
+        return self._name_id(type_name) if type_name else 0
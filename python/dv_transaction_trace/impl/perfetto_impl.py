@@ -9,6 +9,7 @@ in the Perfetto UI (ui.perfetto.dev) or analyzed with the trace processor.
 
 from typing import Optional, List, Dict
 import struct
+import zlib
 from ..api import ITrace, IStream, ITransaction, Radix, LinkType
 
 # Import Perfetto protobuf messages
@@ -250,13 +251,22 @@ class PerfettoTrace(ITrace):
     
     This implementation writes Perfetto protobuf messages to a .perfetto file
     that can be opened in ui.perfetto.dev or analyzed with trace_processor.
+    
+    Packets are collected into chunks of about chunk_size bytes before they
+    are written. With compress=True each chunk is written as one
+    zlib-compressed TracePacket.compressed_packets, which trace_processor
+    expands on load.
     """
     
-    def __init__(self, filename: str, name: str, time_units: str):
+    def __init__(self, filename: str, name: str, time_units: str,
+                 compress: bool = False, chunk_size: int = 64 * 1024):
         self._filename = filename
         self._name = name
         self._time_units = time_units
         self._file = open(filename, 'wb')
+        self._compress = compress
+        self._chunk_size = chunk_size
+        self._chunk = bytearray()
         self._streams: List[PerfettoStream] = []
         
         # ID generation
@@ -304,6 +314,7 @@ class PerfettoTrace(ITrace):
                 stream.close()
         
         if self._file:
+            self._flush_chunk()
             self._file.flush()  # Ensure data is written
             self._file.close()
             self._file = None
@@ -337,21 +348,39 @@ class PerfettoTrace(ITrace):
         return flow_id
     
     def _write_packet(self, packet: pb.TracePacket) -> None:
-        """Write a TracePacket to the output file"""
-        # Serialize the packet
-        data = packet.SerializeToString()
-        
-        # Write length-delimited packet (varint length + data)
-        self._write_varint(len(data))
-        self._file.write(data)
-        self._file.flush()  # Ensure data is written immediately
+        """Buffer a TracePacket for the output file"""
+        # Collect Trace.packet fields (tag + varint length + data) and
+        # write them a chunk at a time
+        self._chunk += self._encode_trace_packet(packet.SerializeToString())
+        if len(self._chunk) >= self._chunk_size:
+            self._flush_chunk()
+    
+    def _flush_chunk(self) -> None:
+        """Write the collected packets, as one compressed_packets packet if compressing"""
+        if not self._chunk:
+            return
+        if self._compress:
+            packet = pb.TracePacket()
+            packet.compressed_packets = zlib.compress(bytes(self._chunk))
+            self._file.write(self._encode_trace_packet(packet.SerializeToString()))
+        else:
+            self._file.write(self._chunk)
+        self._chunk.clear()
     
-    def _write_varint(self, value: int) -> None:
-        """Write a varint-encoded integer"""
+    @staticmethod
+    def _encode_trace_packet(data: bytes) -> bytes:
+        """Encode serialized packet bytes as a Trace.packet field"""
+        return b'\x0a' + PerfettoTrace._encode_varint(len(data)) + data
+    
+    @staticmethod
+    def _encode_varint(value: int) -> bytes:
+        """Encode an integer as a varint"""
+        out = bytearray()
         while value >= 0x80:
-            self._file.write(bytes([(value & 0x7F) | 0x80]))
+            out.append((value & 0x7F) | 0x80)
             value >>= 7
-        self._file.write(bytes([value & 0x7F]))
+        out.append(value & 0x7F)
+        return bytes(out)
     
     def _emit_clock_snapshot(self) -> None:
         """Emit initial clock snapshot packet"""
@@ -1,141 +1,1316 @@
 #include "dvtt_impl.h"
+#include "dvtt_merge.h"
 #include <cstring>
 #include <cstdlib>
 #include <cstdio>
-#include <sstream>
-#include <iomanip>
+#include <csignal>
 
 namespace dvtt {
 
-// Protobuf wire types
-enum WireType {
-    VARINT = 0,
-    FIXED64 = 1,
-    LENGTH_DELIMITED = 2,
-    FIXED32 = 5
+// Suffix appended to attribute names to record the display radix
+const char* radix_suffix(dvtt_radix_t radix) {
+    switch (radix) {
+        case DVTT_RADIX_BIN: return "[bin]";
+        case DVTT_RADIX_OCT: return "[oct]";
+        case DVTT_RADIX_DEC: return "[dec]";
+        case DVTT_RADIX_HEX: return "[hex]";
+        case DVTT_RADIX_UNSIGNED: return "[u]";
+        case DVTT_RADIX_TIME: return "[time]";
+        default: return "";
+    }
+}
+
+// Returns the iid for 'str' on the sequence, queueing its definition for
+// the current packet's InternedData if it is new
+static uint64_t intern(SequenceImpl* seq, InternTable& table, uint32_t field,
+                       std::string_view str) {
+    bool added;
+    uint64_t iid = table.intern(str, added);
+    if (added) {
+        seq->pending_interns.push_back({field, iid, str});
+        seq->interned_strings.add(1);
+    }
+    return iid;
+}
+
+// Returns the iid for the name of field 'field' of 'schema', interning it
+// once per generation of the sequence's tables
+static uint64_t schema_name_iid(SequenceImpl* seq, const SchemaImpl* schema, uint32_t field) {
+    if (schema->index >= seq->schema_name_iids.size()) {
+        seq->schema_name_iids.resize(schema->index + 1);
+    }
+    SequenceImpl::SchemaNameIids& names = seq->schema_name_iids[schema->index];
+    if (names.generation != seq->intern_generation || names.iids.empty()) {
+        names.generation = seq->intern_generation;
+        names.iids.assign(schema->fields.size(), 0);
+    }
+    uint64_t& iid = names.iids[field];
+    if (!iid) {
+        iid = intern(seq, seq->debug_annotation_names, pb::InternedData::debug_annotation_names,
+                     schema->fields[field].name);
+    }
+    return iid;
+}
+
+// Writes the transaction's pre-encoded attributes as debug annotations.
+// Only the name iid is produced here; value fields are copied verbatim.
+void encode_attributes(SequenceImpl* seq, const AttrBuffer& attrs) {
+    PacketWriter& w = *seq->writer;
+    attrs.for_each([&](std::string_view name, const SchemaImpl* schema, uint32_t field,
+                       const uint8_t* value, size_t size) {
+        size_t ann = w.begin_nested(pb::TrackEvent::debug_annotations);
+        w.write_uint64_field(pb::DebugAnnotation::name_iid, schema ?
+            schema_name_iid(seq, schema, field) :
+            intern(seq, seq->debug_annotation_names,
+                   pb::InternedData::debug_annotation_names, name));
+        w.write_raw(value, size);
+        w.end_nested(ann);
+    });
+}
+
+// Drops all interned strings. The next packet on the sequence carries
+// SEQ_INCREMENTAL_STATE_CLEARED so readers discard their copy as well.
+static void reset_incremental_state(SequenceImpl* seq) {
+    seq->event_names.clear();
+    seq->event_categories.clear();
+    seq->debug_annotation_names.clear();
+    seq->intern_generation++;
+    seq->interned_strings.set(0);
+    seq->state_reset_pending = true;
+}
+
+// Hands the packets encoded so far to the file
+static void checkpoint(SequenceImpl* seq, bool sync) {
+    seq->writer->checkpoint(sync);
+}
+
+// Nanoseconds in one of each time unit, scaled by 10^6 so that units down
+// to femtoseconds are whole numbers
+static const struct {
+    const char* name;
+    uint64_t fs;
+} TIME_UNITS[] = {
+    {"s", 1000000000000000ull},
+    {"ms", 1000000000000ull},
+    {"us", 1000000000ull},
+    {"ns", 1000000ull},
+    {"ps", 1000ull},
+    {"fs", 1ull}
 };
 
-void write_varint(FILE* f, uint64_t value) {
-    while (value >= 0x80) {
-        uint8_t byte = (value & 0x7F) | 0x80;
-        fwrite(&byte, 1, 1, f);
-        value >>= 7;
+uint64_t parse_unit_multiplier_ns(const char* time_units) {
+    const char* p = time_units;
+    while (*p == ' ') p++;
+    uint64_t count = 0;
+    bool has_count = false;
+    while (*p >= '0' && *p <= '9' && count < 1000000) {
+        count = count * 10 + static_cast<uint64_t>(*p++ - '0');
+        has_count = true;
+    }
+    if (!has_count) {
+        count = 1;
+    }
+    while (*p == ' ') p++;
+    for (const auto& unit : TIME_UNITS) {
+        if (std::strcmp(p, unit.name) == 0) {
+            uint64_t fs = count * unit.fs;
+            return fs >= 1000000 && fs % 1000000 == 0 ? fs / 1000000 : 1;
+        }
+    }
+    return 1;
+}
+
+// Starts a sequence's incremental state over: a packet carrying
+// SEQ_INCREMENTAL_STATE_CLEARED and the sequence's clocks. Both clocks
+// start at 0, so the next packet carries its absolute time; the ClockSnapshot
+// ties them to the trace clock at the same origin, in units of
+// 'unit_multiplier_ns' nanoseconds.
+static void emit_clock_snapshot(SequenceImpl* seq) {
+    PacketWriter& w = *seq->writer;
+    w.begin_packet();
+    w.write_uint64_field(pb::TracePacket::trusted_packet_sequence_id, seq->sequence_id);
+    w.write_uint64_field(pb::TracePacket::sequence_flags,
+                         pb::TracePacket::SEQ_INCREMENTAL_STATE_CLEARED);
+    if (seq->packets_lost) {
+        w.write_bool_field(pb::TracePacket::previous_packet_dropped, true);
+    }
+    size_t snapshot = w.begin_nested(pb::TracePacket::clock_snapshot);
+    for (uint32_t clock_id : {pb::BUILTIN_CLOCK_BOOTTIME, CLOCK_INCREMENTAL, CLOCK_ABSOLUTE}) {
+        size_t clock = w.begin_nested(pb::ClockSnapshot::clocks);
+        w.write_uint64_field(pb::ClockSnapshot::Clock::clock_id, clock_id);
+        w.write_uint64_field(pb::ClockSnapshot::Clock::timestamp, 0);
+        if (clock_id != pb::BUILTIN_CLOCK_BOOTTIME) {
+            if (clock_id == CLOCK_INCREMENTAL) {
+                w.write_bool_field(pb::ClockSnapshot::Clock::is_incremental, true);
+            }
+            w.write_uint64_field(pb::ClockSnapshot::Clock::unit_multiplier_ns,
+                                 seq->unit_multiplier_ns);
+        }
+        w.end_nested(clock);
+    }
+    w.end_nested(snapshot);
+    size_t defaults = w.begin_nested(pb::TracePacket::trace_packet_defaults);
+    w.write_uint64_field(pb::TracePacketDefaults::timestamp_clock_id, CLOCK_INCREMENTAL);
+    w.end_nested(defaults);
+    // The packets relying on it follow in the same chunk
+    w.end_packet(false);
+    
+    seq->clock_time = 0;
+    seq->state_reset_pending = false;
+    seq->packets_lost = false;
+}
+
+// One packet in this many is timed for the encode_ns estimate
+constexpr uint64_t ENCODE_SAMPLE_INTERVAL = 64;
+
+// Starts a TracePacket carrying the fields common to every packet.
+// 'flags' are the TracePacket.sequence_flags for the packet.
+static void begin_packet(SequenceImpl* seq, dvtt_time_t timestamp, uint32_t flags) {
+    PacketWriter& w = *seq->writer;
+    
+    if (seq->flush_time && timestamp >= seq->next_checkpoint_time) {
+        seq->next_checkpoint_time = (timestamp / seq->flush_time + 1) * seq->flush_time;
+        checkpoint(seq, seq->flush_sync);
+    }
+    if (w.take_packets_lost()) {
+        // A dropped chunk may have carried interned definitions
+        seq->packets_lost = true;
+        reset_incremental_state(seq);
+    } else if (seq->chunk_local_state && w.empty()) {
+        // First packet of a flight-recorder chunk
+        reset_incremental_state(seq);
+    } else if (seq->event_names.size() > MAX_INTERN_ENTRIES ||
+               seq->event_categories.size() > MAX_INTERN_ENTRIES ||
+               seq->debug_annotation_names.size() > MAX_INTERN_ENTRIES) {
+        reset_incremental_state(seq);
+    }
+    
+    if (seq->packets.get() % ENCODE_SAMPLE_INTERVAL == 0) {
+        seq->encode_start = monotonic_ns();
+    }
+    if (seq->state_reset_pending) {
+        emit_clock_snapshot(seq);
+    }
+    seq->packets.add(1);
+    w.begin_packet();
+    if (timestamp >= seq->clock_time) {
+        // Events mostly close in time order, so this is usually a byte or two
+        w.write_uint64_field(pb::TracePacket::timestamp, timestamp - seq->clock_time);
+        seq->clock_time = timestamp;
+    } else {
+        w.write_uint64_field(pb::TracePacket::timestamp, timestamp);
+        w.write_uint64_field(pb::TracePacket::timestamp_clock_id, CLOCK_ABSOLUTE);
+    }
+    w.write_uint64_field(pb::TracePacket::trusted_packet_sequence_id, seq->sequence_id);
+    if (flags) {
+        w.write_uint64_field(pb::TracePacket::sequence_flags, flags);
+    }
+}
+
+// Completes a TracePacket, appending definitions for newly interned strings.
+// With 'may_flush' false the next packet stays in the same chunk.
+static void end_packet(SequenceImpl* seq, bool may_flush = true) {
+    PacketWriter& w = *seq->writer;
+    if (!seq->pending_interns.empty()) {
+        size_t data = w.begin_nested(pb::TracePacket::interned_data);
+        for (const auto& entry : seq->pending_interns) {
+            size_t msg = w.begin_nested(entry.field);
+            w.write_uint64_field(pb::InternedString::iid, entry.iid);
+            w.write_string_field(pb::InternedString::name, entry.str.data(), entry.str.size());
+            w.end_nested(msg);
+        }
+        w.end_nested(data);
+        seq->pending_interns.clear();
+    }
+    if (seq->encode_start) {
+        seq->encode_ns.add((monotonic_ns() - seq->encode_start) * ENCODE_SAMPLE_INTERVAL);
+        seq->encode_start = 0;
+    }
+    w.end_packet(may_flush);
+    if (seq->flush_packets && --seq->packets_to_checkpoint == 0) {
+        seq->packets_to_checkpoint = seq->flush_packets;
+        checkpoint(seq, seq->flush_sync);
     }
-    uint8_t byte = value & 0x7F;
-    fwrite(&byte, 1, 1, f);
 }
 
-void write_tag(FILE* f, uint32_t field_number, uint32_t wire_type) {
-    write_varint(f, (field_number << 3) | wire_type);
+void emit_track_descriptor(TraceImpl* trace, StreamImpl* stream) {
+    SequenceImpl* seq = current_sequence(trace);
+    PacketWriter& w = *seq->writer;
+    begin_packet(seq, 0, 0);
+    size_t desc = w.begin_nested(pb::TracePacket::track_descriptor);
+    w.write_uint64_field(pb::TrackDescriptor::uuid, stream->uuid);
+    w.write_string_field(pb::TrackDescriptor::name, stream->name);
+    w.end_nested(desc);
+    end_packet(seq);
+}
+
+// Child transaction track, nested under the parent transaction's track
+static void emit_child_track_descriptor(TraceImpl* trace, uint64_t uuid, std::string_view name,
+                                        uint64_t parent_uuid) {
+    SequenceImpl* seq = current_sequence(trace);
+    PacketWriter& w = *seq->writer;
+    begin_packet(seq, 0, 0);
+    size_t desc = w.begin_nested(pb::TracePacket::track_descriptor);
+    w.write_uint64_field(pb::TrackDescriptor::uuid, uuid);
+    w.write_string_field(pb::TrackDescriptor::name, name.data(), name.size());
+    if (parent_uuid) {
+        w.write_uint64_field(pb::TrackDescriptor::parent_uuid, parent_uuid);
+    }
+    w.end_nested(desc);
+    // A flight recorder keeps the descriptor in the chunk of its events
+    end_packet(seq, !seq->chunk_local_state);
 }
 
-void write_length_delimited(FILE* f, uint32_t field_number, const void* data, size_t size) {
-    write_tag(f, field_number, LENGTH_DELIMITED);
-    write_varint(f, size);
-    fwrite(data, 1, size, f);
+void emit_track_descriptor(TraceImpl* trace, TransactionImpl* txn) {
+    emit_child_track_descriptor(trace, txn->track_uuid, txn->name, txn->parent_track_uuid);
 }
 
-void write_string_field(FILE* f, uint32_t field_number, const std::string& str) {
-    write_length_delimited(f, field_number, str.data(), str.size());
+// Lanes for children named 'name' under the track 'parent_uuid'
+static ChildLanes* find_child_lanes(StreamImpl* stream, uint64_t parent_uuid,
+                                    std::string_view name) {
+    std::unique_ptr<ChildLanes>* slot = &stream->child_lanes[parent_uuid];
+    while (*slot && (*slot)->name != name) {
+        slot = &(*slot)->next;
+    }
+    if (!*slot) {
+        slot->reset(new ChildLanes());
+        (*slot)->parent_uuid = parent_uuid;
+        (*slot)->name.assign(name.data(), name.size());
+    }
+    return slot->get();
+}
+
+// Takes an idle lane whose last occupant ended by 'start_time', or adds a
+// new one. Ends at the same time are written before begins, so a lane may
+// be reused back to back.
+static uint32_t acquire_lane(TraceImpl* trace, ChildLanes* lanes, dvtt_time_t start_time) {
+    for (size_t i = lanes->idle.size(); i-- > 0;) {
+        uint32_t lane = lanes->idle[i];
+        if (lanes->lanes[lane].end_time <= start_time) {
+            lanes->idle.erase(lanes->idle.begin() + static_cast<ptrdiff_t>(i));
+            return lane;
+        }
+    }
+    ChildLanes::Lane lane;
+    lane.uuid = trace->next_track_uuid.fetch_add(1, std::memory_order_relaxed);
+    lane.end_time = 0;
+    lane.segment = NO_SEGMENT;
+    lanes->lanes.push_back(lane);
+    return static_cast<uint32_t>(lanes->lanes.size() - 1);
+}
+
+static void release_lane(ChildLanes* lanes, uint32_t lane, dvtt_time_t end_time) {
+    lanes->lanes[lane].end_time = end_time;
+    lanes->idle.push_back(lane);
+}
+
+// Describes a lane unless the current file already has its descriptor.
+// Flight recorders describe it with every occupant, so the descriptor is
+// retained as long as the events are.
+static void describe_lane(TraceImpl* trace, ChildLanes* lanes, uint32_t lane) {
+    ChildLanes::Lane& l = lanes->lanes[lane];
+    if (l.segment != trace->segment || trace->flight_recorder) {
+        l.segment = trace->segment;
+        emit_child_track_descriptor(trace, l.uuid, lanes->name, lanes->parent_uuid);
+    }
 }
 
-void write_uint64_field(FILE* f, uint32_t field_number, uint64_t value) {
-    write_tag(f, field_number, VARINT);
-    write_varint(f, value);
+// Counter track, nested under 'parent_uuid' if set
+static void emit_counter_track_descriptor(TraceImpl* trace, uint64_t uuid, std::string_view name,
+                                          pb::CounterDescriptor::Unit unit,
+                                          std::string_view unit_name, uint64_t parent_uuid) {
+    SequenceImpl* seq = current_sequence(trace);
+    PacketWriter& w = *seq->writer;
+    begin_packet(seq, 0, 0);
+    size_t desc = w.begin_nested(pb::TracePacket::track_descriptor);
+    w.write_uint64_field(pb::TrackDescriptor::uuid, uuid);
+    w.write_string_field(pb::TrackDescriptor::name, name.data(), name.size());
+    if (parent_uuid) {
+        w.write_uint64_field(pb::TrackDescriptor::parent_uuid, parent_uuid);
+    }
+    size_t counter = w.begin_nested(pb::TrackDescriptor::counter);
+    if (unit != pb::CounterDescriptor::UNIT_UNSPECIFIED) {
+        w.write_uint64_field(pb::CounterDescriptor::unit, unit);
+    }
+    if (!unit_name.empty()) {
+        w.write_string_field(pb::CounterDescriptor::unit_name, unit_name.data(),
+                             unit_name.size());
+    }
+    w.end_nested(counter);
+    w.end_nested(desc);
+    end_packet(seq);
 }
 
-void write_int64_field(FILE* f, uint32_t field_number, int64_t value) {
-    // ZigZag encoding for signed integers
-    uint64_t encoded = (value << 1) ^ (value >> 63);
-    write_uint64_field(f, field_number, encoded);
+static void emit_counter_descriptor(TraceImpl* trace, CounterImpl* counter) {
+    emit_counter_track_descriptor(trace, counter->uuid, counter->name,
+                                  pb::CounterDescriptor::UNIT_UNSPECIFIED, counter->unit,
+                                  counter->stream->uuid);
 }
 
-void write_double_field(FILE* f, uint32_t field_number, double value) {
-    write_tag(f, field_number, FIXED64);
-    fwrite(&value, sizeof(double), 1, f);
+// TYPE_COUNTER event setting a counter track at 'time'; 'write_value'
+// writes the value field
+template <typename F> static void emit_counter_event(TraceImpl* trace, uint64_t track_uuid,
+                                                     dvtt_time_t time, F write_value) {
+    SequenceImpl* seq = current_sequence(trace);
+    PacketWriter& w = *seq->writer;
+    begin_packet(seq, time, 0);
+    size_t ev = w.begin_nested(pb::TracePacket::track_event);
+    w.write_uint64_field(pb::TrackEvent::type, pb::TrackEvent::TYPE_COUNTER);
+    w.write_uint64_field(pb::TrackEvent::track_uuid, track_uuid);
+    write_value(w);
+    w.end_nested(ev);
+    end_packet(seq);
 }
 
-std::string format_radix_name(const std::string& name, dvtt_radix_t radix) {
-    const char* suffix = "";
-    switch (radix) {
-        case DVTT_RADIX_BIN: suffix = "[bin]"; break;
-        case DVTT_RADIX_OCT: suffix = "[oct]"; break;
-        case DVTT_RADIX_DEC: suffix = "[dec]"; break;
-        case DVTT_RADIX_HEX: suffix = "[hex]"; break;
-        case DVTT_RADIX_UNSIGNED: suffix = "[u]"; break;
-        case DVTT_RADIX_TIME: suffix = "[time]"; break;
-        default: break;
-    }
-    return name + suffix;
-}
-
-std::string bits_to_string(const void* bits, size_t num_bits, dvtt_radix_t radix) {
-    const uint8_t* bytes = static_cast<const uint8_t*>(bits);
-    size_t num_bytes = (num_bits + 7) / 8;
-    std::ostringstream oss;
-    
-    if (radix == DVTT_RADIX_HEX) {
-        oss << "0x";
-        for (int i = num_bytes - 1; i >= 0; i--) {
-            oss << std::hex << std::setw(2) << std::setfill('0') << (int)bytes[i];
-        }
-    } else if (radix == DVTT_RADIX_BIN) {
-        oss << "0b";
-        for (int i = num_bytes - 1; i >= 0; i--) {
-            for (int bit = 7; bit >= 0; bit--) {
-                oss << ((bytes[i] >> bit) & 1);
+static void emit_counter_value(TraceImpl* trace, uint64_t track_uuid, dvtt_time_t time,
+                               int64_t value) {
+    emit_counter_event(trace, track_uuid, time, [value](PacketWriter& w) {
+        w.write_int64_field(pb::TrackEvent::counter_value, value);
+    });
+}
+
+static void emit_counter_value(TraceImpl* trace, uint64_t track_uuid, dvtt_time_t time,
+                               double value) {
+    emit_counter_event(trace, track_uuid, time, [value](PacketWriter& w) {
+        w.write_double_field(pb::TrackEvent::double_counter_value, value);
+    });
+}
+
+static void encode_links(PacketWriter& w, const SliceLinks& links) {
+    for (uint64_t id : links.flow_ids) {
+        w.write_fixed64_field(pb::TrackEvent::flow_ids, id);
+    }
+    if (links.anchor) {
+        w.write_fixed64_field(pb::TrackEvent::flow_ids, links.anchor);
+    }
+    for (uint64_t id : links.terminating_flow_ids) {
+        w.write_fixed64_field(pb::TrackEvent::terminating_flow_ids, id);
+    }
+}
+
+// TYPE_SLICE_BEGIN event carrying the name, category, attributes and
+// flows. Strings are interned; only their iids are written after first use.
+static void emit_slice_begin(TraceImpl* trace, uint64_t track_uuid, dvtt_time_t time,
+                             std::string_view name, std::string_view type_name,
+                             const AttrBuffer* attrs, const SliceLinks* links = nullptr) {
+    SequenceImpl* seq = current_sequence(trace);
+    PacketWriter& w = *seq->writer;
+    begin_packet(seq, time, pb::TracePacket::SEQ_NEEDS_INCREMENTAL_STATE);
+    size_t ev = w.begin_nested(pb::TracePacket::track_event);
+    w.write_uint64_field(pb::TrackEvent::type, pb::TrackEvent::TYPE_SLICE_BEGIN);
+    w.write_uint64_field(pb::TrackEvent::track_uuid, track_uuid);
+    w.write_uint64_field(pb::TrackEvent::name_iid,
+        intern(seq, seq->event_names, pb::InternedData::event_names, name));
+    if (!type_name.empty()) {
+        w.write_uint64_field(pb::TrackEvent::category_iids,
+            intern(seq, seq->event_categories, pb::InternedData::event_categories, type_name));
+    }
+    if (attrs) {
+        encode_attributes(seq, *attrs);
+    }
+    if (links) {
+        encode_links(w, *links);
+    }
+    w.end_nested(ev);
+    // A flight recorder never retains a begin without its end
+    end_packet(seq, !seq->chunk_local_state);
+}
+
+// TYPE_SLICE_END event. Attributes and flows are only written here for
+// slices whose begin went out before the transaction closed.
+static void emit_slice_end(TraceImpl* trace, uint64_t track_uuid, dvtt_time_t time,
+                           const AttrBuffer* attrs = nullptr,
+                           const SliceLinks* links = nullptr) {
+    SequenceImpl* seq = current_sequence(trace);
+    PacketWriter& w = *seq->writer;
+    begin_packet(seq, time, attrs ? pb::TracePacket::SEQ_NEEDS_INCREMENTAL_STATE : 0);
+    size_t ev = w.begin_nested(pb::TracePacket::track_event);
+    w.write_uint64_field(pb::TrackEvent::type, pb::TrackEvent::TYPE_SLICE_END);
+    w.write_uint64_field(pb::TrackEvent::track_uuid, track_uuid);
+    if (attrs) {
+        encode_attributes(seq, *attrs);
+    }
+    if (links) {
+        encode_links(w, *links);
+    }
+    w.end_nested(ev);
+    end_packet(seq);
+}
+
+void emit_track_event_begin(TraceImpl* trace, TransactionImpl* txn) {
+    emit_slice_begin(trace, txn->track_uuid, txn->start_time, txn->name, txn->type_name,
+                     txn->attributes, &txn->links);
+}
+
+void emit_track_event_end(TraceImpl* trace, TransactionImpl* txn) {
+    emit_slice_end(trace, txn->track_uuid, txn->end_time);
+}
+
+// Last sequence used by this thread, so the common case needs no lookup.
+// The serial guards against a new trace reusing a closed trace's address.
+struct SequenceCache {
+    const TraceImpl* trace;
+    uint64_t serial;
+    SequenceImpl* sequence;
+};
+static thread_local SequenceCache t_sequence_cache = {nullptr, 0, nullptr};
+static std::atomic<uint64_t> g_next_trace_serial(1);
+
+static SequenceImpl* new_sequence(TraceImpl* trace) {
+    SequenceImpl* seq = new SequenceImpl;
+    seq->sequence_id = trace->next_sequence_id.fetch_add(1, std::memory_order_relaxed);
+    seq->writer = new PacketWriter(trace->sink, trace->chunk_size);
+    seq->intern_generation = 0;
+    seq->state_reset_pending = true;
+    seq->packets_lost = false;
+    seq->chunk_local_state = trace->flight_recorder != nullptr;
+    seq->clock_time = 0;
+    seq->unit_multiplier_ns = trace->unit_multiplier_ns;
+    seq->reorder_now = 0;
+    seq->encode_start = 0;
+    seq->flush_time = trace->options.flush_time;
+    seq->flush_packets = trace->options.flush_packets;
+    seq->flush_sync = trace->options.flush_sync != 0;
+    seq->next_checkpoint_time = trace->options.flush_time;
+    seq->packets_to_checkpoint = trace->options.flush_packets;
+    trace->sequences.push_back(seq);
+    return seq;
+}
+
+SequenceImpl* current_sequence(TraceImpl* trace) {
+    if (!trace->options.multi_thread) {
+        return trace->sequence;
+    }
+    SequenceCache& cache = t_sequence_cache;
+    if (cache.trace == trace && cache.serial == trace->serial) {
+        return cache.sequence;
+    }
+    
+    std::lock_guard<std::mutex> lock(trace->mutex);
+    SequenceImpl*& seq = trace->thread_sequences[std::this_thread::get_id()];
+    if (!seq) {
+        seq = new_sequence(trace);
+    }
+    cache.trace = trace;
+    cache.serial = trace->serial;
+    cache.sequence = seq;
+    return seq;
+}
+
+// Returns a pooled object to the sequence it was taken from
+template <typename T, size_t N> static void release_to_owner(
+        SequenceImpl* current, SlabPool<T, N> SequenceImpl::*pool, T* obj) {
+    if (obj->owner == current) {
+        (current->*pool).release(obj);
+    } else {
+        (obj->owner->*pool).release_remote(obj);
+    }
+}
+
+// The calling thread's sequence on 'trace' if it has one, without creating it
+static SequenceImpl* own_sequence(TraceImpl* trace) {
+    if (!trace->options.multi_thread) {
+        return trace->sequence;
+    }
+    const SequenceCache& cache = t_sequence_cache;
+    return cache.trace == trace && cache.serial == trace->serial ? cache.sequence : nullptr;
+}
+
+// Sums the self-instrumentation counters of every sequence and the sinks
+static void collect_stats(TraceImpl* trace, dvtt_trace_stats_t& stats) {
+    std::memset(&stats, 0, sizeof(stats));
+    uint64_t opened = 0, closed = 0, freed = 0;
+    SequenceImpl* own = own_sequence(trace);
+    {
+        std::lock_guard<std::mutex> lock(trace->mutex);
+        for (auto* seq : trace->sequences) {
+            stats.packets_written += seq->packets.get();
+            // Other threads' buffers are theirs to read
+            stats.bytes_written += seq == own ? seq->writer->bytes_written() :
+                                                seq->writer->flushed_bytes();
+            stats.interned_strings += seq->interned_strings.get();
+            stats.encode_ns += seq->encode_ns.get();
+            stats.io_ns += seq->writer->io_ns();
+            opened += seq->opened.get();
+            closed += seq->closed.get();
+            freed += seq->freed.get();
+        }
+    }
+    // Counters of different threads are read at slightly different times
+    stats.open_transactions = opened > closed ? opened - closed : 0;
+    stats.retained_transactions = closed > freed ? closed - freed : 0;
+    stats.registered_names = trace->names.size();
+    if (trace->async_writer) {
+        trace->async_writer->ring_stats(stats.ring_high_water, stats.ring_stalls,
+                                        stats.ring_drops);
+    }
+}
+
+// Counter tracks written by the stats_interval option, in uuid order after
+// the "dvtt" group track
+struct StatsCounter {
+    const char* name;
+    pb::CounterDescriptor::Unit unit;
+    uint64_t dvtt_trace_stats_t::*value;
+};
+static const StatsCounter STATS_COUNTERS[] = {
+    {"bytes written", pb::CounterDescriptor::UNIT_SIZE_BYTES, &dvtt_trace_stats_t::bytes_written},
+    {"open transactions", pb::CounterDescriptor::UNIT_COUNT,
+     &dvtt_trace_stats_t::open_transactions},
+    {"retained transactions", pb::CounterDescriptor::UNIT_COUNT,
+     &dvtt_trace_stats_t::retained_transactions},
+    {"encode time", pb::CounterDescriptor::UNIT_TIME_NS, &dvtt_trace_stats_t::encode_ns},
+    {"I/O time", pb::CounterDescriptor::UNIT_TIME_NS, &dvtt_trace_stats_t::io_ns},
+    {"ring stalls", pb::CounterDescriptor::UNIT_COUNT, &dvtt_trace_stats_t::ring_stalls},
+    {"ring drops", pb::CounterDescriptor::UNIT_COUNT, &dvtt_trace_stats_t::ring_drops},
+};
+constexpr size_t NUM_STATS_COUNTERS = sizeof(STATS_COUNTERS) / sizeof(STATS_COUNTERS[0]);
+
+static void emit_stats_descriptors(TraceImpl* trace) {
+    emit_child_track_descriptor(trace, trace->stats_track_uuid, "dvtt", 0);
+    for (size_t i = 0; i < NUM_STATS_COUNTERS; i++) {
+        emit_counter_track_descriptor(trace, trace->stats_track_uuid + 1 + i,
+                                      STATS_COUNTERS[i].name, STATS_COUNTERS[i].unit, "",
+                                      trace->stats_track_uuid);
+    }
+}
+
+// Writes the stats counters if 'time' has reached the next stats_interval
+// multiple. In multi-threaded traces one thread writes each sample.
+static void maybe_write_stats(TraceImpl* trace, dvtt_time_t time) {
+    dvtt_time_t due = trace->next_stats_time.load(std::memory_order_relaxed);
+    if (time < due) {
+        return;
+    }
+    dvtt_time_t interval = trace->options.stats_interval;
+    if (!trace->next_stats_time.compare_exchange_strong(due, (time / interval + 1) * interval,
+                                                        std::memory_order_relaxed)) {
+        return;
+    }
+    if (!trace->stats_described.exchange(true, std::memory_order_relaxed)) {
+        emit_stats_descriptors(trace);
+    }
+    dvtt_trace_stats_t stats;
+    collect_stats(trace, stats);
+    for (size_t i = 0; i < NUM_STATS_COUNTERS; i++) {
+        emit_counter_value(trace, trace->stats_track_uuid + 1 + i, time,
+                           static_cast<int64_t>(stats.*STATS_COUNTERS[i].value));
+    }
+}
+
+// Segment 0 uses the trace filename; later ones insert ".<index>" before
+// the extension, e.g. run.perfetto, run.1.perfetto, run.2.perfetto
+std::string segment_filename(const std::string& filename, uint32_t index) {
+    if (index == 0) {
+        return filename;
+    }
+    size_t slash = filename.find_last_of("/\\");
+    size_t dot = filename.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash) ||
+            dot == (slash == std::string::npos ? 0 : slash + 1)) {
+        dot = filename.size();
+    }
+    return filename.substr(0, dot) + "." + std::to_string(index) + filename.substr(dot);
+}
+
+// Marks rotate_time windows that have not been entered yet
+static const dvtt_time_t NO_WINDOW = ~dvtt_time_t(0);
+
+// Switches output to the next file and makes it self-contained: the clock
+// snapshot, descriptors for every open stream and open child track, and a
+// fresh intern state are written before any further events
+static void rotate_segment(TraceImpl* trace) {
+    SequenceImpl* seq = trace->sequence;
+    seq->writer->flush();
+    if (!trace->sink->rotate(segment_filename(trace->filename, trace->segment + 1))) {
+        // Stay on the current file and retry once another segment's worth
+        // has been written
+        trace->segment_start_bytes = seq->writer->bytes_written();
+        return;
+    }
+    trace->segment++;
+    trace->segment_start_bytes = seq->writer->bytes_written();
+    
+    reset_incremental_state(seq);
+    if (trace->stats_described) {
+        emit_stats_descriptors(trace);
+    }
+    for (auto* stream : trace->streams) {
+        if (stream->state != STATE_OPEN || !stream->described) {
+            continue;
+        }
+        emit_track_descriptor(trace, stream);
+        for (auto* txn : stream->transactions) {
+            if (txn->lanes) {
+                describe_lane(trace, txn->lanes, txn->lane);
+            }
+        }
+        for (auto* counter : stream->counters) {
+            if (counter->described) {
+                emit_counter_descriptor(trace, counter);
             }
         }
+    }
+}
+
+// Rotates before writing an event at 'time' if the current segment is full
+// or 'time' falls in a later rotate_time window
+static void maybe_rotate(TraceImpl* trace, dvtt_time_t time) {
+    const dvtt_trace_options_t& opts = trace->options;
+    bool rotate = false;
+    if (opts.rotate_time) {
+        dvtt_time_t window = time / opts.rotate_time;
+        if (trace->segment_window == NO_WINDOW) {
+            trace->segment_window = window;
+        } else if (window > trace->segment_window) {
+            trace->segment_window = window;
+            rotate = true;
+        }
+    }
+    if (opts.rotate_bytes &&
+            trace->sequence->writer->bytes_written() - trace->segment_start_bytes >=
+                opts.rotate_bytes) {
+        rotate = true;
+    }
+    if (rotate) {
+        rotate_segment(trace);
+    }
+}
+
+// The calling thread's sequence, or NULL if finding it would take the
+// trace mutex because the thread has not used the trace lately
+static SequenceImpl* signal_sequence(TraceImpl* trace) {
+    if (!trace->options.multi_thread) {
+        return trace->sequence;
+    }
+    const SequenceCache& cache = t_sequence_cache;
+    return cache.trace == trace && cache.serial == trace->serial ? cache.sequence : nullptr;
+}
+
+// Writes a flight recorder's retained chunks to 'filename' behind a header
+// holding the clock snapshot and the descriptors of every described stream
+// and open child track. Child tracks of closed transactions are described
+// inside the retained chunks themselves. In a signal handler the stream
+// descriptors are left out if the trace mutex is taken, since the
+// interrupted code may hold it.
+static bool dump_flight_recorder(TraceImpl* trace, const std::string& filename,
+                                 bool in_signal = false) {
+    SequenceImpl* seq = in_signal ? signal_sequence(trace) : current_sequence(trace);
+    if (!seq) {
+        return false;
+    }
+    seq->writer->flush();
+    trace->sink->flush();
+    
+    // The header chunk also restarts the incremental state, as every
+    // flight-recorder chunk does
+    trace->flight_recorder->begin_header();
+    if (trace->stats_described) {
+        emit_stats_descriptors(trace);
+    }
+    std::unique_lock<std::mutex> lock(trace->mutex, std::defer_lock);
+    if (in_signal) {
+        lock.try_lock();
     } else {
-        // Default to hex
-        oss << "0x";
-        for (int i = num_bytes - 1; i >= 0; i--) {
-            oss << std::hex << std::setw(2) << std::setfill('0') << (int)bytes[i];
+        lock.lock();
+    }
+    if (lock.owns_lock()) {
+        for (auto* stream : trace->streams) {
+            if (!stream->described) {
+                continue;
+            }
+            emit_track_descriptor(trace, stream);
+            for (auto* txn : stream->transactions) {
+                if (txn->parent_track_uuid) {
+                    emit_track_descriptor(trace, txn);
+                }
+            }
+            for (auto* counter : stream->counters) {
+                if (counter->described) {
+                    emit_counter_descriptor(trace, counter);
+                }
+            }
         }
+        lock.unlock();
     }
+    seq->writer->flush();
+    trace->sink->flush();
+    trace->flight_recorder->end_header();
     
-    return oss.str();
+    return trace->flight_recorder->dump(filename);
+}
+
+// Returned in place of transactions that are not recorded. Its null impl
+// makes every call on it take the existing invalid-handle early return.
+static dvtt_transaction_s g_disabled_transaction = { nullptr };
+
+// Matches 'text' against a glob with '*' (any run) and '?' (any character)
+static bool glob_match(const char* pattern, const char* text) {
+    const char* star = nullptr;
+    const char* resume = nullptr;
+    while (*text) {
+        if (*pattern == '*') {
+            star = pattern++;
+            resume = text;
+        } else if (*pattern == '?' || *pattern == *text) {
+            pattern++;
+            text++;
+        } else if (star) {
+            // Let the last '*' absorb one more character and retry
+            pattern = star + 1;
+            text = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == '*') {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+static void update_stream_filter(StreamImpl* stream) {
+    stream->filtered.store(!stream->enabled.load(std::memory_order_relaxed) ||
+        stream->sample_one_in > 1 || stream->sample_start || stream->sample_end,
+        std::memory_order_relaxed);
+}
+
+// Sets the stream's enable from the last matching scope rule, if any.
+// Called with the trace mutex held.
+static void apply_scope_rules(TraceImpl* trace, StreamImpl* stream) {
+    if (trace->scope_rules.empty()) {
+        return;
+    }
+    std::string path = stream->scope.empty() ? stream->name : stream->scope + "." + stream->name;
+    for (auto it = trace->scope_rules.rbegin(); it != trace->scope_rules.rend(); ++it) {
+        if (glob_match(it->pattern.c_str(), path.c_str())) {
+            stream->enabled.store(it->enabled, std::memory_order_relaxed);
+            update_stream_filter(stream);
+            return;
+        }
+    }
+}
+
+// Decides whether a root transaction starting at 'start_time' on a
+// filtered stream is recorded
+static bool admit_transaction(StreamImpl* stream, dvtt_time_t start_time, bool is_root) {
+    if (!stream->enabled.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    if (!is_root) {
+        return true;
+    }
+    if (start_time < stream->sample_start ||
+            (stream->sample_end && start_time >= stream->sample_end)) {
+        return false;
+    }
+    if (stream->sample_one_in > 1) {
+        uint32_t n = stream->sample_count++;
+        if (stream->sample_count == stream->sample_one_in) {
+            stream->sample_count = 0;
+        }
+        return n == 0;
+    }
+    return true;
+}
+
+// Removes 'item' from a vector of objects tracking their own position
+template <typename T> static void swap_remove(
+        std::vector<T*>& v, T* item, size_t T::*index) {
+    T* last = v.back();
+    v[item->*index] = last;
+    last->*index = item->*index;
+    v.pop_back();
 }
 
-void emit_clock_snapshot(TraceImpl* trace) {
-    // Emit ClockSnapshot packet with time units
-    std::vector<uint8_t> buffer;
+// Reorder window (reorder_window option). A closed slice's begin and end
+// are queued on the sequence and written once no open transaction starts
+// earlier, and at the latest once they are reorder_window behind the
+// latest time seen, so the output is ordered by timestamp.
+
+// Event ranks: at equal times, ends of slices that started earlier come
+// before begins, and ends of zero-length slices after their begin
+enum {
+    RANK_END = 0,
+    RANK_BEGIN = 1,
+    RANK_END_AFTER_BEGIN = 2
+};
+
+static void release_slice(SequenceImpl* seq, PendingSlice* slice) {
+    if (slice->attributes) {
+        slice->attributes->clear();
+        release_to_owner(seq, &SequenceImpl::attr_pool, slice->attributes);
+        slice->attributes = nullptr;
+    }
+    slice->links.clear();
+    seq->slice_pool.release(slice);
+}
+
+// Writes the queued events at or before 'time'
+static void release_events(TraceImpl* trace, SequenceImpl* seq, dvtt_time_t time) {
+    TimeHeap<PendingSlice>& events = seq->reorder_events;
+    while (!events.empty() && events.top().time <= time) {
+        PendingSlice* slice = events.top().item;
+        bool begin = events.top().rank == RANK_BEGIN;
+        events.pop();
+        if (begin) {
+            emit_slice_begin(trace, slice->track_uuid, slice->start_time, slice->name,
+                             slice->type_name, slice->attributes, &slice->links);
+        } else {
+            emit_slice_end(trace, slice->track_uuid, slice->end_time,
+                           slice->begun ? slice->attributes : nullptr,
+                           slice->begun ? &slice->links : nullptr);
+            release_slice(seq, slice);
+        }
+    }
+}
+
+// Writes the begin of an open transaction that has outlived the window.
+// Attributes and links added from now on go on its end.
+static void split_transaction(TraceImpl* trace, SequenceImpl* seq, TransactionImpl* txn) {
+    release_events(trace, seq, txn->start_time);
+    emit_track_event_begin(trace, txn);
+    if (txn->attributes) {
+        txn->attributes->clear();
+    }
+    txn->links.clear_flows();
+    txn->begun = true;
+}
+
+// Moves the window on to 'time'. Open transactions that fell out of it get
+// the configured fallback; then every queued event that neither the
+// remaining open transactions nor new ones within the window can precede
+// is written.
+static void advance_reorder(TraceImpl* trace, SequenceImpl* seq, dvtt_time_t time) {
+    if (time > seq->reorder_now) {
+        seq->reorder_now = time;
+    }
+    dvtt_time_t window = trace->options.reorder_window;
+    dvtt_time_t horizon = seq->reorder_now > window ? seq->reorder_now - window : 0;
     
-    // Build ClockSnapshot message
-    // Field 6: clocks (repeated Clock)
-    // Clock has: field 1: clock_id, field 2: timestamp, field 6: unit_multiplier_ns
+    TimeHeap<TransactionImpl>& open = seq->reorder_open;
+    while (!open.empty()) {
+        TransactionImpl* txn = open.top().item;
+        if (txn->id != open.top().rank || txn->state != STATE_OPEN ||
+                txn->begun || txn->unsorted) {
+            // Closed, freed or recycled since it was queued
+            open.pop();
+            continue;
+        }
+        if (open.top().time >= horizon) {
+            break;
+        }
+        open.pop();
+        if (trace->options.reorder_fallback == DVTT_REORDER_UNSORTED) {
+            txn->unsorted = true;
+        } else {
+            split_transaction(trace, seq, txn);
+        }
+    }
+    release_events(trace, seq, open.empty() ? horizon : std::min(horizon, open.top().time));
+}
+
+static void track_open_transaction(TraceImpl* trace, TransactionImpl* txn) {
+    SequenceImpl* seq = current_sequence(trace);
+    seq->reorder_open.push(txn->start_time, txn->id, txn);
+    advance_reorder(trace, seq, txn->start_time);
+}
+
+// Queues a closed slice's events, taking over 'attrs' and 'links'. For a
+// slice whose begin is already written only the end is queued.
+static void queue_slice(TraceImpl* trace, SequenceImpl* seq, uint64_t track_uuid,
+                        dvtt_time_t start_time, dvtt_time_t end_time,
+                        std::string_view name, std::string_view type_name,
+                        AttrBuffer* attrs, SliceLinks* links, bool begun) {
+    PendingSlice* slice = seq->slice_pool.alloc();
+    slice->track_uuid = track_uuid;
+    slice->start_time = start_time;
+    slice->end_time = end_time;
+    slice->name.assign(name.data(), name.size());
+    slice->type_name.assign(type_name.data(), type_name.size());
+    slice->attributes = attrs;
+    if (links) {
+        slice->links.swap(*links);
+    }
+    slice->begun = begun;
+    if (begun) {
+        // Written with the begin
+        slice->links.anchor = 0;
+    } else {
+        seq->reorder_events.push(start_time, RANK_BEGIN, slice);
+    }
+    seq->reorder_events.push(end_time, end_time > start_time ? RANK_END : RANK_END_AFTER_BEGIN,
+                             slice);
+    advance_reorder(trace, seq, end_time);
+}
+
+// Writes every queued event, e.g. before the trace is closed
+static void drain_reorder(TraceImpl* trace) {
+    for (auto* seq : trace->sequences) {
+        release_events(trace, seq, ~dvtt_time_t(0));
+        seq->reorder_open.clear();
+    }
+}
+
+// Writes what a trace holds when the process exits without closing it: the
+// buffered and queued packets and the begin of every open transaction,
+// which readers show as unfinished. In multi-threaded traces only the
+// calling thread's packets are written.
+static void finish_on_exit(TraceImpl* trace, const std::string& dump_filename) {
+    if (trace->flight_recorder) {
+        dump_flight_recorder(trace, dump_filename.empty() ? trace->filename : dump_filename);
+        return;
+    }
+    SequenceImpl* seq = current_sequence(trace);
+    // The interrupted packet may have carried interned definitions
+    seq->writer->discard_open_packet();
+    seq->pending_interns.clear();
+    reset_incremental_state(seq);
+    if (trace->options.reorder_window) {
+        drain_reorder(trace);
+    }
+    for (auto* stream : trace->streams) {
+        if (stream->state != STATE_OPEN) {
+            continue;
+        }
+        for (auto* txn : stream->transactions) {
+            if (txn->state == STATE_OPEN && !txn->begun) {
+                emit_track_event_begin(trace, txn);
+            }
+        }
+    }
+    checkpoint(seq, true);
+}
+
+// Begin of an open transaction for finish_on_signal(). The time is on the
+// absolute clock and the strings are inline, so the packet needs nothing
+// interned and leaves the sequence's incremental state alone.
+static void emit_unfinished_begin(SequenceImpl* seq, const TransactionImpl* txn) {
+    PacketWriter& w = *seq->writer;
+    w.begin_packet();
+    w.write_uint64_field(pb::TracePacket::timestamp, txn->start_time);
+    w.write_uint64_field(pb::TracePacket::timestamp_clock_id, CLOCK_ABSOLUTE);
+    w.write_uint64_field(pb::TracePacket::trusted_packet_sequence_id, seq->sequence_id);
+    size_t ev = w.begin_nested(pb::TracePacket::track_event);
+    w.write_uint64_field(pb::TrackEvent::type, pb::TrackEvent::TYPE_SLICE_BEGIN);
+    w.write_uint64_field(pb::TrackEvent::track_uuid, txn->track_uuid);
+    w.write_string_field(pb::TrackEvent::name, txn->name);
+    if (!txn->type_name.empty()) {
+        w.write_string_field(pb::TrackEvent::categories, txn->type_name);
+    }
+    if (txn->attributes) {
+        txn->attributes->for_each([&](std::string_view name, const SchemaImpl* schema,
+                                      uint32_t field, const uint8_t* value, size_t size) {
+            if (schema) {
+                name = schema->fields[field].name;
+            }
+            size_t ann = w.begin_nested(pb::TrackEvent::debug_annotations);
+            w.write_string_field(pb::DebugAnnotation::name, name.data(), name.size());
+            w.write_raw(value, size);
+            w.end_nested(ann);
+        });
+    }
+    encode_links(w, txn->links);
+    w.end_nested(ev);
+    w.end_packet(false);
+}
+
+// finish_on_exit() for a process ended by a signal, run in the handler. It
+// takes no lock another thread or the interrupted code may hold and gives
+// up instead; packets go straight to the file with
+// Sink::write_from_signal(), bypassing the async writer's thread, so
+// nothing waits. Memory is only allocated if a packet outgrows the chunk
+// buffer. Events still held in a reorder window are lost.
+static void finish_on_signal(TraceImpl* trace, const std::string& dump_filename) {
+    if (trace->flight_recorder) {
+        dump_flight_recorder(trace, dump_filename.empty() ? trace->filename : dump_filename,
+                             true);
+        return;
+    }
+    SequenceImpl* seq = signal_sequence(trace);
+    if (!seq) {
+        return;
+    }
+    // Guards the stream list against an interrupted dvtt_open_stream()
+    std::unique_lock<std::mutex> lock(trace->mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return;
+    }
+    PacketWriter& w = *seq->writer;
+    w.discard_open_packet();
+    seq->pending_interns.clear();
+    if (seq->state_reset_pending) {
+        emit_clock_snapshot(seq);
+    }
+    for (auto* stream : trace->streams) {
+        if (stream->state != STATE_OPEN) {
+            continue;
+        }
+        for (auto* txn : stream->transactions) {
+            if (txn->state != STATE_OPEN || txn->begun) {
+                continue;
+            }
+            emit_unfinished_begin(seq, txn);
+            if (w.size() >= trace->chunk_size && !w.flush_from_signal()) {
+                return;
+            }
+        }
+    }
+    if (w.flush_from_signal()) {
+        trace->sink->sync_from_signal();
+    }
+}
+
+// Trace finished by the handlers installed with dvtt_dump_on_abort() and
+// dvtt_flush_on_exit(), and the dump filename for a flight recorder
+static std::atomic<dvtt_trace_t> g_exit_trace(nullptr);
+static std::string g_exit_dump_filename;
+
+// Signals that end a crashed or killed simulation, SIGABRT first
+static const int EXIT_SIGNALS[] = {
+    SIGABRT, SIGSEGV, SIGFPE, SIGILL, SIGTERM,
+#ifdef SIGBUS
+    SIGBUS,
+#endif
+#ifdef SIGXCPU
+    SIGXCPU,
+#endif
+};
+constexpr size_t NUM_EXIT_SIGNALS = sizeof(EXIT_SIGNALS) / sizeof(EXIT_SIGNALS[0]);
+static void (*g_prev_exit_handlers[NUM_EXIT_SIGNALS])(int);
+
+static void finish_hooked_trace(bool in_signal) {
+    dvtt_trace_t trace = g_exit_trace.exchange(nullptr);
+    if (!trace) {
+        return;
+    }
+    if (in_signal) {
+        finish_on_signal(trace->impl, g_exit_dump_filename);
+    } else {
+        finish_on_exit(trace->impl, g_exit_dump_filename);
+    }
+}
+
+static void finish_hooked_trace_at_exit() {
+    finish_hooked_trace(false);
+}
+
+static void exit_signal_handler(int sig) {
+    finish_hooked_trace(true);
+    void (*prev)(int) = SIG_DFL;
+    for (size_t i = 0; i < NUM_EXIT_SIGNALS; i++) {
+        if (EXIT_SIGNALS[i] == sig && g_prev_exit_handlers[i] &&
+                g_prev_exit_handlers[i] != SIG_ERR) {
+            prev = g_prev_exit_handlers[i];
+        }
+    }
+    std::signal(sig, prev);
+    std::raise(sig);
+}
+
+// Installs the handler for the first 'count' exit signals, and the atexit
+// hook if 'at_exit' is set
+static void install_exit_hooks(size_t count, bool at_exit) {
+    for (size_t i = 0; i < count; i++) {
+        void (*prev)(int) = std::signal(EXIT_SIGNALS[i], exit_signal_handler);
+        if (prev != exit_signal_handler) {
+            // Restored before the signal is re-raised
+            g_prev_exit_handlers[i] = prev;
+        }
+    }
+    static bool registered = false;
+    if (at_exit && !registered) {
+        registered = std::atexit(finish_hooked_trace_at_exit) == 0;
+    }
+}
+
+// Emits a transaction and drops everything the trace no longer needs
+// once the events are written. The handle itself stays valid until freed.
+static void close_transaction(TraceImpl* trace, TransactionImpl* txn, dvtt_time_t end_time) {
+    if (trace->options.rotate_bytes || trace->options.rotate_time) {
+        maybe_rotate(trace, end_time);
+    }
+    txn->end_time = end_time;
+    txn->state = STATE_CLOSED;
     
-    // For simplicity, we'll emit a basic clock with BUILTIN_CLOCK_MONOTONIC
-    // This is a simplified implementation - full protobuf generation would be more robust
+    // Flight recorders describe child tracks here rather than at open, so
+    // the descriptor is retained as long as the events are
+    if (txn->lanes) {
+        if (trace->flight_recorder) {
+            describe_lane(trace, txn->lanes, txn->lane);
+        }
+        release_lane(txn->lanes, txn->lane, end_time);
+    }
+    if (trace->options.reorder_window && !txn->unsorted) {
+        // The events keep the attributes and links; the handle keeps its anchor
+        uint64_t anchor = txn->links.anchor;
+        queue_slice(trace, current_sequence(trace), txn->track_uuid, txn->start_time, end_time,
+                    txn->name, txn->type_name, txn->attributes, &txn->links, txn->begun);
+        txn->attributes = nullptr;
+        txn->links.anchor = anchor;
+    } else {
+        emit_track_event_begin(trace, txn);
+        emit_track_event_end(trace, txn);
+    }
+    
+    swap_remove(txn->stream->impl->transactions, txn, &TransactionImpl::stream_index);
+    if (txn->attributes) {
+        txn->attributes->clear();
+        release_to_owner(current_sequence(trace), &SequenceImpl::attr_pool, txn->attributes);
+        txn->attributes = nullptr;
+    }
+    // The anchor stays, so the closed handle remains linkable
+    txn->links.clear_flows();
+    current_sequence(trace)->closed.add(1);
     
-    // Write a comment to the trace indicating time units
-    // (Actual implementation would need proper protobuf encoding)
+    if (trace->options.stats_interval) {
+        maybe_write_stats(trace, end_time);
+    }
 }
 
-void emit_track_descriptor(TraceImpl* trace, StreamImpl* stream) {
-    // Emit TrackDescriptor packet
-    std::vector<uint8_t> track_desc_buf;
-    
-    // Build TrackDescriptor: uuid (field 1), name (field 2)
-    // This is simplified - actual implementation needs proper nested message encoding
+// Decides whether a sample of 'counter' at 'time' is written, describing
+// the track on first use. 'bits' holds the value, for coalescing.
+static bool admit_counter_sample(TraceImpl* trace, CounterImpl* counter, dvtt_time_t time,
+                                 bool is_double, uint64_t bits) {
+    StreamImpl* stream = counter->stream;
+    if (stream->state != STATE_OPEN || !stream->enabled.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    if (counter->coalesce && counter->has_value && counter->is_double == is_double &&
+            counter->last_bits == bits) {
+        return false;
+    }
+    counter->has_value = true;
+    counter->is_double = is_double;
+    counter->last_bits = bits;
+    if (trace->options.rotate_bytes || trace->options.rotate_time) {
+        maybe_rotate(trace, time);
+    }
+    if (!stream->described) {
+        stream->described = true;
+        emit_track_descriptor(trace, stream);
+    }
+    if (!counter->described) {
+        counter->described = true;
+        emit_counter_descriptor(trace, counter);
+    }
+    return true;
+}
+
+// Appends a typed attribute value to 'attrs'. Integer and bit vector names
+// carry the radix suffix, as with the dvtt_add_attr_* calls
+static void add_attr_value(AttrBuffer& attrs, const char* name, dvtt_radix_t radix,
+                           const dvtt_attr_value_t& value, bool raw_bits) {
+    size_t attr;
+    switch (value.type) {
+        case DVTT_ATTR_INT8:
+        case DVTT_ATTR_INT16:
+        case DVTT_ATTR_INT32:
+        case DVTT_ATTR_INT64: {
+            int64_t v = value.type == DVTT_ATTR_INT8 ? value.value.i8 :
+                        value.type == DVTT_ATTR_INT16 ? value.value.i16 :
+                        value.type == DVTT_ATTR_INT32 ? value.value.i32 : value.value.i64;
+            attr = attrs.begin_attr(name, radix_suffix(radix));
+            attrs.write_int64_field(pb::DebugAnnotation::int_value, v);
+            break;
+        }
+        case DVTT_ATTR_UINT8:
+        case DVTT_ATTR_UINT16:
+        case DVTT_ATTR_UINT32:
+        case DVTT_ATTR_UINT64: {
+            uint64_t v = value.type == DVTT_ATTR_UINT8 ? value.value.u8 :
+                         value.type == DVTT_ATTR_UINT16 ? value.value.u16 :
+                         value.type == DVTT_ATTR_UINT32 ? value.value.u32 : value.value.u64;
+            attr = attrs.begin_attr(name, radix_suffix(radix));
+            attrs.write_uint64_field(pb::DebugAnnotation::uint_value, v);
+            break;
+        }
+        case DVTT_ATTR_REAL:
+        case DVTT_ATTR_DOUBLE:
+            attr = attrs.begin_attr(name);
+            attrs.write_double_field(pb::DebugAnnotation::double_value,
+                value.type == DVTT_ATTR_REAL ? value.value.f : value.value.d);
+            break;
+        case DVTT_ATTR_STRING:
+            if (!value.value.str) return;
+            attr = attrs.begin_attr(name);
+            attrs.write_string_field(pb::DebugAnnotation::string_value,
+                value.value.str, strlen(value.value.str));
+            break;
+        case DVTT_ATTR_BITSTRING:
+            if (!value.value.bits.data) return;
+            attr = attrs.begin_attr(name, radix_suffix(radix));
+            if (raw_bits) {
+                attrs.write_bits_raw(value.value.bits.data, value.value.bits.num_bits, radix);
+            } else {
+                attrs.write_bits_field(pb::DebugAnnotation::string_value,
+                    value.value.bits.data, value.value.bits.num_bits, radix);
+            }
+            break;
+        case DVTT_ATTR_BLOB:
+            if (!value.value.blob.data) return;
+            attr = attrs.begin_attr(name);
+            attrs.write_hex_field(pb::DebugAnnotation::string_value,
+                value.value.blob.data, value.value.blob.size_bytes);
+            break;
+        default:
+            return;
+    }
+    attrs.end_attr(attr);
 }
 
-void emit_track_descriptor(TraceImpl* trace, TransactionImpl* txn) {
-    // Emit TrackDescriptor packet for child transaction track
-    // The track should have parent_uuid set to parent transaction's track_uuid
-    // Build TrackDescriptor: uuid, name, parent_uuid
-    // This is simplified - actual implementation needs proper nested message encoding
+// Records a link on its open source as an attribute holding the target's
+// id, named as dvtt_add_stream_link() names its attribute
+static void add_link_attr(TransactionImpl* source, uint64_t target_id,
+                          dvtt_link_type_t link_type, const char* relation_name) {
+    AttrBuffer* attrs = attribute_buffer(source);
+    if (!attrs) return;
+    const char* name = relation_name;
+    if (!name || !*name) {
+        switch (link_type) {
+            case DVTT_LINK_PARENT_CHILD: name = "parent_transaction"; break;
+            case DVTT_LINK_CAUSE_EFFECT: name = "cause_transaction"; break;
+            default: name = "related_transaction"; break;
+        }
+    }
+    size_t attr = attrs->begin_attr(name);
+    attrs->write_uint64_field(pb::DebugAnnotation::uint_value, target_id);
+    attrs->end_attr(attr);
 }
 
-void emit_track_event_begin(TraceImpl* trace, TransactionImpl* txn) {
-    // Emit TYPE_SLICE_BEGIN event with attributes
-    // Use txn->track_uuid instead of stream->uuid
-    // This is a simplified placeholder - actual implementation needs proper protobuf
+TransactionImpl* alloc_transaction(TraceImpl* trace) {
+    SequenceImpl* seq = current_sequence(trace);
+    TransactionNode* node = seq->transaction_pool.alloc();
+    seq->opened.add(1);
+    node->owner = seq;
+    node->handle.impl = &node->impl;
+    node->impl.self = &node->handle;
+    node->impl.node = node;
+    return &node->impl;
 }
 
-void emit_track_event_end(TraceImpl* trace, TransactionImpl* txn) {
-    // Emit TYPE_SLICE_END event
-    // Use txn->track_uuid instead of stream->uuid
+AttrBuffer* attribute_buffer(TransactionImpl* txn) {
+    if (txn->state != STATE_OPEN) {
+        // Attributes are written out at close; later additions are dropped
+        return nullptr;
+    }
+    if (!txn->attributes) {
+        SequenceImpl* seq = current_sequence(txn->stream->impl->trace->impl);
+        txn->attributes = seq->attr_pool.alloc();
+        txn->attributes->owner = seq;
+    }
+    return txn->attributes;
+}
+
+void release_transaction(TraceImpl* trace, TransactionImpl* txn) {
+    txn->state = STATE_FREED;
+    handle_registry().remove(txn->handle);
+    txn->handle = 0;
+    // Stale handles see a NULL impl until the node is reused
+    txn->self->impl = nullptr;
+    SequenceImpl* seq = current_sequence(trace);
+    seq->freed.add(1);
+    release_to_owner(seq, &SequenceImpl::transaction_pool, txn->node);
 }
 
 } // namespace dvtt
@@ -158,10 +1333,22 @@ const char* dvtt_error_string(dvtt_error_t error) {
         case DVTT_ERROR_NOT_INITIALIZED: return "Not initialized";
         case DVTT_ERROR_ALREADY_ENDED: return "Already ended";
         case DVTT_ERROR_NOT_ENDED: return "Not ended";
+        case DVTT_ERROR_INVALID_ARGUMENT: return "Invalid argument";
         default: return "Unknown error";
     }
 }
 
+// Runtime switch read inline by the dvtt.h call-site macros
+int dvtt_runtime_enabled = 1;
+
+void dvtt_set_enabled(int enabled) {
+    dvtt_runtime_enabled = enabled ? 1 : 0;
+}
+
+int dvtt_is_enabled(void) {
+    return dvtt_runtime_enabled;
+}
+
 // Initialization
 dvtt_error_t dvtt_init(void) {
     g_last_error = DVTT_OK;
@@ -173,35 +1360,147 @@ void dvtt_shutdown(void) {
 }
 
 // Trace management
+void dvtt_trace_options_init(dvtt_trace_options_t* options) {
+    if (!options) return;
+    
+    options->chunk_size = dvtt::DEFAULT_CHUNK_SIZE;
+    options->async_writer = 0;
+    options->ring_chunks = dvtt::DEFAULT_RING_CHUNKS;
+    options->ring_full_policy = DVTT_RING_FULL_BLOCK;
+    options->free_on_close = 0;
+    options->raw_bits = 0;
+    options->multi_thread = 0;
+    options->rotate_bytes = 0;
+    options->rotate_time = 0;
+    options->compression = DVTT_COMPRESSION_NONE;
+    options->compression_level = 0;
+    options->flight_recorder_bytes = 0;
+    options->reorder_window = 0;
+    options->reorder_fallback = DVTT_REORDER_SPLIT;
+    options->flush_time = 0;
+    options->flush_packets = 0;
+    options->flush_sync = 0;
+    options->mmap_window = 0;
+    options->stats_interval = 0;
+    options->id_namespace = 0;
+}
+
 dvtt_trace_t dvtt_create_trace(const char* filename, const char* name, const char* time_units) {
+    return dvtt_create_trace_ex(filename, name, time_units, nullptr);
+}
+
+dvtt_trace_t dvtt_create_trace_ex(const char* filename, const char* name, const char* time_units,
+                                  const dvtt_trace_options_t* options) {
     if (!filename || !name || !time_units) {
         g_last_error = DVTT_ERROR_NULL_POINTER;
         return nullptr;
     }
     
+    if (options && options->multi_thread && (options->rotate_bytes || options->rotate_time)) {
+        // Rotation needs a point where no thread is mid-packet
+        g_last_error = DVTT_ERROR_INVALID_ARGUMENT;
+        return nullptr;
+    }
+    if (options && options->reorder_window &&
+            (options->multi_thread || options->flight_recorder_bytes ||
+             options->rotate_bytes || options->rotate_time)) {
+        // The window orders one sequence, and segments must be whole
+        g_last_error = DVTT_ERROR_INVALID_ARGUMENT;
+        return nullptr;
+    }
+    if (options && options->flight_recorder_bytes &&
+            (options->rotate_bytes || options->rotate_time ||
+             options->flush_time || options->flush_packets)) {
+        g_last_error = DVTT_ERROR_INVALID_ARGUMENT;
+        return nullptr;
+    }
+    if (options && options->mmap_window &&
+            (options->flight_recorder_bytes || !dvtt::mmap_supported())) {
+        g_last_error = DVTT_ERROR_INVALID_ARGUMENT;
+        return nullptr;
+    }
+    if (options && options->compression != DVTT_COMPRESSION_NONE &&
+        (options->compression != DVTT_COMPRESSION_DEFLATE || !dvtt::compression_supported())) {
+        g_last_error = DVTT_ERROR_INVALID_ARGUMENT;
+        return nullptr;
+    }
+    if (options && options->id_namespace > dvtt::MAX_ID_NAMESPACE) {
+        g_last_error = DVTT_ERROR_INVALID_ARGUMENT;
+        return nullptr;
+    }
+    
     dvtt_trace_t trace = new dvtt_trace_s;
     trace->impl = new dvtt::TraceImpl;
     
+    if (options) {
+        trace->impl->options = *options;
+    } else {
+        dvtt_trace_options_init(&trace->impl->options);
+    }
+    const dvtt_trace_options_t& opts = trace->impl->options;
+    size_t chunk_size = opts.chunk_size ? opts.chunk_size : dvtt::DEFAULT_CHUNK_SIZE;
+    
     trace->impl->filename = filename;
     trace->impl->name = name;
     trace->impl->time_units = time_units;
-    trace->impl->sequence_id = 1;
+    trace->impl->unit_multiplier_ns = dvtt::parse_unit_multiplier_ns(time_units);
+    trace->impl->chunk_size = chunk_size;
     trace->impl->clock_id = 64; // BUILTIN_CLOCK_MONOTONIC
-    trace->impl->next_stream_handle = 1;
-    trace->impl->next_transaction_handle = 1;
-    trace->impl->next_track_uuid = 1;
-    trace->impl->next_transaction_id = 1;
-    trace->impl->next_flow_id = 1;
-    
-    trace->impl->output_file = fopen(filename, "wb");
-    if (!trace->impl->output_file) {
+    trace->impl->serial = dvtt::g_next_trace_serial.fetch_add(1, std::memory_order_relaxed);
+    trace->impl->segment = 0;
+    trace->impl->segment_start_bytes = 0;
+    trace->impl->segment_window = dvtt::NO_WINDOW;
+    // Ids start at 1 within the trace's namespace
+    uint64_t id_base = static_cast<uint64_t>(opts.id_namespace) << dvtt::ID_NAMESPACE_SHIFT;
+    trace->impl->next_sequence_id = (opts.id_namespace << dvtt::SEQUENCE_NAMESPACE_SHIFT) + 1;
+    trace->impl->next_track_uuid = id_base + 1;
+    trace->impl->next_transaction_id = id_base + 1;
+    trace->impl->next_flow_id = id_base + 1;
+    trace->impl->next_schema_index = 0;
+    trace->impl->next_stats_time = 0;
+    trace->impl->stats_track_uuid = 0;
+    trace->impl->stats_described = false;
+    if (opts.stats_interval) {
+        trace->impl->stats_track_uuid = trace->impl->next_track_uuid.fetch_add(
+            1 + dvtt::NUM_STATS_COUNTERS, std::memory_order_relaxed);
+    }
+    
+    // A flight recorder opens no file until it is dumped
+    trace->impl->flight_recorder = nullptr;
+    if (opts.flight_recorder_bytes) {
+        trace->impl->flight_recorder = new dvtt::RingSink(opts.flight_recorder_bytes);
+        trace->impl->sink = trace->impl->flight_recorder;
+    } else if (opts.mmap_window) {
+        trace->impl->sink = dvtt::MmapSink::open(filename, opts.mmap_window);
+    } else {
+        trace->impl->sink = dvtt::FileSink::open(filename);
+    }
+    if (!trace->impl->sink) {
         delete trace->impl;
         delete trace;
         g_last_error = DVTT_ERROR_MEMORY;
         return nullptr;
     }
+    if (opts.compression == DVTT_COMPRESSION_DEFLATE) {
+        // Below the async writer so the writer thread does the compressing
+        trace->impl->sink = new dvtt::CompressingSink(trace->impl->sink, opts.compression_level);
+    }
+    trace->impl->async_writer = nullptr;
+    if (opts.async_writer) {
+        trace->impl->async_writer = new dvtt::AsyncSink(
+            trace->impl->sink,
+            opts.ring_chunks ? opts.ring_chunks : dvtt::DEFAULT_RING_CHUNKS,
+            chunk_size,
+            opts.ring_full_policy);
+        trace->impl->sink = trace->impl->async_writer;
+    } else if (opts.multi_thread) {
+        trace->impl->sink = new dvtt::LockedSink(trace->impl->sink);
+    }
     
-    dvtt::emit_clock_snapshot(trace->impl);
+    trace->impl->sequence = dvtt::new_sequence(trace->impl);
+    if (opts.multi_thread) {
+        trace->impl->thread_sequences[std::this_thread::get_id()] = trace->impl->sequence;
+    }
     
     g_last_error = DVTT_OK;
     return trace;
@@ -210,22 +1509,49 @@ dvtt_trace_t dvtt_create_trace(const char* filename, const char* name, const cha
 void dvtt_close_trace(dvtt_trace_t trace) {
     if (!trace || !trace->impl) return;
     
+    dvtt_trace_t hooked = trace;
+    dvtt::g_exit_trace.compare_exchange_strong(hooked, nullptr);
+    
     // Close all streams
     for (auto* stream : trace->impl->streams) {
         if (stream->state == dvtt::STATE_OPEN) {
-            dvtt_close_stream((dvtt_stream_t)&stream);
+            dvtt_close_stream(stream->self);
         }
     }
     
-    if (trace->impl->output_file) {
-        fclose(trace->impl->output_file);
+    if (trace->impl->options.reorder_window) {
+        dvtt::drain_reorder(trace->impl);
+    }
+    
+    // Producer threads must have stopped recording by now
+    for (auto* seq : trace->impl->sequences) {
+        seq->writer->flush();
     }
+    trace->impl->sink->close();
+    delete trace->impl->sink;
     
-    // Cleanup
+    // Cleanup. Transactions the caller did not free are released with
+    // their pools; their handles must not outlive them
+    for (auto* seq : trace->impl->sequences) {
+        seq->transaction_pool.for_each_slot([](dvtt::TransactionNode& node) {
+            if (node.impl.state != dvtt::STATE_FREED) {
+                dvtt::handle_registry().remove(node.impl.handle);
+            }
+        });
+        delete seq->writer;
+        delete seq;
+    }
     for (auto* stream : trace->impl->streams) {
-        for (auto* txn : stream->transactions) {
-            delete txn;
+        for (auto* counter : stream->counters) {
+            delete counter->self;
+            delete counter;
+        }
+        for (auto* schema : stream->schemas) {
+            delete schema->self;
+            delete schema;
         }
+        dvtt::handle_registry().remove(stream->handle);
+        delete stream->self;
         delete stream;
     }
     
@@ -257,9 +1583,208 @@ const char* dvtt_get_trace_time_units(dvtt_trace_t trace) {
     return trace->impl->time_units.c_str();
 }
 
-// Stream management
-dvtt_stream_t dvtt_open_stream(dvtt_trace_t trace, const char* name, 
-                               const char* scope, const char* type_name) {
+// Flight recorder
+int dvtt_dump_trace(dvtt_trace_t trace, const char* filename) {
+    if (!trace || !trace->impl) {
+        g_last_error = DVTT_ERROR_NULL_HANDLE;
+        return 0;
+    }
+    if (!trace->impl->flight_recorder) {
+        g_last_error = DVTT_ERROR_INVALID_ARGUMENT;
+        return 0;
+    }
+    if (!dvtt::dump_flight_recorder(trace->impl, filename && *filename ?
+                                    filename : trace->impl->filename)) {
+        g_last_error = DVTT_ERROR_MEMORY;
+        return 0;
+    }
+    g_last_error = DVTT_OK;
+    return 1;
+}
+
+dvtt_trace_t dvtt_create_flight_recorder(const char* filename, const char* name,
+                                         const char* time_units, uint64_t max_bytes) {
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.flight_recorder_bytes = static_cast<size_t>(max_bytes);
+    return dvtt_create_trace_ex(filename, name, time_units, &opts);
+}
+
+void dvtt_dump_on_abort(dvtt_trace_t trace, const char* filename) {
+    if (!trace || !trace->impl) {
+        dvtt::g_exit_trace.store(nullptr);
+        return;
+    }
+    if (!trace->impl->flight_recorder) {
+        g_last_error = DVTT_ERROR_INVALID_ARGUMENT;
+        return;
+    }
+    // Cleared first so the handler never pairs a trace with a stale name
+    dvtt::g_exit_trace.store(nullptr);
+    dvtt::g_exit_dump_filename = filename ? filename : "";
+    dvtt::install_exit_hooks(1, false);
+    dvtt::g_exit_trace.store(trace);
+    g_last_error = DVTT_OK;
+}
+
+void dvtt_flush_trace(dvtt_trace_t trace) {
+    if (!trace || !trace->impl) {
+        g_last_error = DVTT_ERROR_NULL_HANDLE;
+        return;
+    }
+    dvtt::checkpoint(dvtt::current_sequence(trace->impl), trace->impl->options.flush_sync != 0);
+    g_last_error = DVTT_OK;
+}
+
+void dvtt_flush_on_exit(dvtt_trace_t trace) {
+    dvtt::g_exit_trace.store(nullptr);
+    if (!trace || !trace->impl) {
+        return;
+    }
+    dvtt::g_exit_dump_filename.clear();
+    dvtt::install_exit_hooks(dvtt::NUM_EXIT_SIGNALS, true);
+    dvtt::g_exit_trace.store(trace);
+    g_last_error = DVTT_OK;
+}
+
+int dvtt_get_trace_stats(dvtt_trace_t trace, dvtt_trace_stats_t* stats) {
+    if (!trace || !trace->impl) {
+        g_last_error = DVTT_ERROR_NULL_HANDLE;
+        return 0;
+    }
+    if (!stats) {
+        g_last_error = DVTT_ERROR_NULL_POINTER;
+        return 0;
+    }
+    dvtt::collect_stats(trace->impl, *stats);
+    g_last_error = DVTT_OK;
+    return 1;
+}
+
+// Trace merging
+void dvtt_merge_options_init(dvtt_merge_options_t* options) {
+    if (!options) return;
+    options->remap_ids = 1;
+    options->compression = DVTT_COMPRESSION_NONE;
+    options->compression_level = 0;
+    options->chunk_size = 0;
+}
+
+int dvtt_merge_traces(const char* output, const char* const* inputs, int num_inputs,
+                      const dvtt_merge_options_t* options) {
+    if (!output || (!inputs && num_inputs)) {
+        g_last_error = DVTT_ERROR_NULL_POINTER;
+        return 0;
+    }
+    std::vector<std::string> filenames;
+    for (int i = 0; i < num_inputs; i++) {
+        if (!inputs[i]) {
+            g_last_error = DVTT_ERROR_NULL_POINTER;
+            return 0;
+        }
+        filenames.push_back(inputs[i]);
+    }
+    dvtt_merge_options_t defaults;
+    dvtt_merge_options_init(&defaults);
+    g_last_error = dvtt::merge_traces(output, filenames, options ? *options : defaults);
+    return g_last_error == DVTT_OK;
+}
+
+// Stream management
+namespace dvtt {
+
+// Allocates a stream of 'trace' and indexes it by scope and name. Nothing
+// is written until it records: its descriptor goes out with its first
+// transaction or counter sample. Called with the trace mutex held.
+static dvtt_stream_t add_stream(dvtt_trace_t trace, const char* name, const char* scope,
+                                const char* type_name) {
+    dvtt_stream_t stream = new dvtt_stream_s;
+    stream->impl = new StreamImpl;
+    
+    stream->impl->uuid = trace->impl->next_track_uuid.fetch_add(1, std::memory_order_relaxed);
+    stream->impl->name = name;
+    stream->impl->scope = scope ? scope : "";
+    stream->impl->type_name = type_name ? type_name : "";
+    stream->impl->state = STATE_OPEN;
+    stream->impl->trace = trace;
+    stream->impl->self = stream;
+    stream->impl->handle = 0;
+    stream->impl->next_same_key = nullptr;
+    stream->impl->enabled.store(true, std::memory_order_relaxed);
+    stream->impl->filtered.store(false, std::memory_order_relaxed);
+    stream->impl->described = false;
+    stream->impl->sample_one_in = 0;
+    stream->impl->sample_count = 0;
+    stream->impl->sample_start = 0;
+    stream->impl->sample_end = 0;
+    
+    trace->impl->streams.push_back(stream->impl);
+    apply_scope_rules(trace->impl, stream->impl);
+    
+    StreamKey key(stream->impl->scope, stream->impl->name);
+    auto it = trace->impl->stream_index.find(key);
+    if (it == trace->impl->stream_index.end()) {
+        trace->impl->stream_index.emplace(key, stream->impl);
+    } else {
+        StreamImpl* last = it->second;
+        while (last->next_same_key) {
+            last = last->next_same_key;
+        }
+        last->next_same_key = stream->impl;
+    }
+    return stream;
+}
+
+// Takes a freed stream out of the stream index, handing its key to the
+// next stream with the same scope and name. Called with the trace mutex held.
+static void unindex_stream(TraceImpl* trace, StreamImpl* stream) {
+    auto it = trace->stream_index.find(StreamKey(stream->scope, stream->name));
+    if (it == trace->stream_index.end()) {
+        return;
+    }
+    if (it->second == stream) {
+        // The key views this stream's strings, so it is re-keyed
+        StreamImpl* next = stream->next_same_key;
+        trace->stream_index.erase(it);
+        if (next) {
+            trace->stream_index.emplace(StreamKey(next->scope, next->name), next);
+        }
+    } else {
+        StreamImpl* prev = it->second;
+        while (prev->next_same_key && prev->next_same_key != stream) {
+            prev = prev->next_same_key;
+        }
+        if (prev->next_same_key == stream) {
+            prev->next_same_key = stream->next_same_key;
+        }
+    }
+    stream->next_same_key = nullptr;
+}
+
+} // namespace dvtt
+
+dvtt_stream_t dvtt_open_stream(dvtt_trace_t trace, const char* name, 
+                               const char* scope, const char* type_name) {
+    if (!trace || !trace->impl) {
+        g_last_error = DVTT_ERROR_NULL_HANDLE;
+        return nullptr;
+    }
+    if (!name) {
+        g_last_error = DVTT_ERROR_NULL_POINTER;
+        return nullptr;
+    }
+    
+    dvtt_stream_t stream;
+    {
+        std::lock_guard<std::mutex> lock(trace->impl->mutex);
+        stream = dvtt::add_stream(trace, name, scope, type_name);
+    }
+    
+    g_last_error = DVTT_OK;
+    return stream;
+}
+
+dvtt_stream_t dvtt_find_or_open_stream(dvtt_trace_t trace, const char* scope, const char* name) {
     if (!trace || !trace->impl) {
         g_last_error = DVTT_ERROR_NULL_HANDLE;
         return nullptr;
@@ -269,21 +1794,16 @@ dvtt_stream_t dvtt_open_stream(dvtt_trace_t trace, const char* name,
         return nullptr;
     }
     
-    dvtt_stream_t stream = new dvtt_stream_s;
-    stream->impl = new dvtt::StreamImpl;
-    
-    stream->impl->uuid = trace->impl->next_track_uuid++;
-    stream->impl->name = name;
-    stream->impl->scope = scope ? scope : "";
-    stream->impl->type_name = type_name ? type_name : "";
-    stream->impl->state = dvtt::STATE_OPEN;
-    stream->impl->trace = trace;
-    stream->impl->handle = trace->impl->next_stream_handle++;
-    
-    trace->impl->streams.push_back(stream->impl);
-    trace->impl->stream_handles[stream->impl->handle] = stream->impl;
-    
-    dvtt::emit_track_descriptor(trace->impl, stream->impl);
+    dvtt_stream_t stream;
+    {
+        std::lock_guard<std::mutex> lock(trace->impl->mutex);
+        auto it = trace->impl->stream_index.find(dvtt::StreamKey(scope ? scope : "", name));
+        if (it != trace->impl->stream_index.end()) {
+            stream = it->second->self;
+        } else {
+            stream = dvtt::add_stream(trace, name, scope, nullptr);
+        }
+    }
     
     g_last_error = DVTT_OK;
     return stream;
@@ -293,10 +1813,9 @@ void dvtt_close_stream(dvtt_stream_t stream) {
     if (!stream || !stream->impl) return;
     
     // Close all open transactions
-    for (auto* txn : stream->impl->transactions) {
-        if (txn->state == dvtt::STATE_OPEN) {
-            dvtt_close_transaction((dvtt_transaction_t)&txn, txn->start_time);
-        }
+    while (!stream->impl->transactions.empty()) {
+        dvtt::TransactionImpl* txn = stream->impl->transactions.back();
+        dvtt_close_transaction(txn->self, txn->start_time);
     }
     
     stream->impl->state = dvtt::STATE_CLOSED;
@@ -309,7 +1828,16 @@ void dvtt_free_stream(dvtt_stream_t stream) {
         dvtt_close_stream(stream);
     }
     
-    stream->impl->state = dvtt::STATE_FREED;
+    dvtt::TraceImpl* trace = stream->impl->trace->impl;
+    {
+        std::lock_guard<std::mutex> lock(trace->mutex);
+        if (stream->impl->state != dvtt::STATE_FREED) {
+            dvtt::unindex_stream(trace, stream->impl);
+        }
+        stream->impl->state = dvtt::STATE_FREED;
+    }
+    dvtt::handle_registry().remove(stream->impl->handle);
+    stream->impl->handle = 0;
     // Note: Actual cleanup happens when trace is closed
 }
 
@@ -351,13 +1879,51 @@ int dvtt_get_stream_handle(dvtt_stream_t stream) {
     if (!stream || !stream->impl || stream->impl->state == dvtt::STATE_FREED) {
         return 0;
     }
+    // Registered on first request; most streams never need one
+    if (!stream->impl->handle) {
+        stream->impl->handle = dvtt::handle_registry().add(stream, dvtt::HANDLE_KIND_STREAM);
+    }
     return stream->impl->handle;
 }
 
 dvtt_stream_t dvtt_get_stream_from_handle(int handle) {
-    // This requires a global registry or trace context
-    // For now, return nullptr
-    return nullptr;
+    return static_cast<dvtt_stream_t>(
+        dvtt::handle_registry().lookup(handle, dvtt::HANDLE_KIND_STREAM));
+}
+
+// Enables and sampling
+void dvtt_set_stream_enabled(dvtt_stream_t stream, int enabled) {
+    if (!stream || !stream->impl) return;
+    stream->impl->enabled.store(enabled != 0, std::memory_order_relaxed);
+    dvtt::update_stream_filter(stream->impl);
+}
+
+int dvtt_is_stream_enabled(dvtt_stream_t stream) {
+    if (!stream || !stream->impl) return 0;
+    return stream->impl->enabled.load(std::memory_order_relaxed) ? 1 : 0;
+}
+
+void dvtt_set_scope_enabled(dvtt_trace_t trace, const char* pattern, int enabled) {
+    if (!trace || !trace->impl || !pattern) return;
+    
+    std::lock_guard<std::mutex> lock(trace->impl->mutex);
+    trace->impl->scope_rules.push_back(dvtt::ScopeRule{pattern, enabled != 0});
+    for (auto* stream : trace->impl->streams) {
+        dvtt::apply_scope_rules(trace->impl, stream);
+    }
+}
+
+void dvtt_set_stream_sampling(dvtt_stream_t stream, const dvtt_sampling_t* sampling) {
+    if (!stream || !stream->impl) return;
+    stream->impl->sample_one_in = sampling ? sampling->one_in : 0;
+    stream->impl->sample_start = sampling ? sampling->start_time : 0;
+    stream->impl->sample_end = sampling ? sampling->end_time : 0;
+    stream->impl->sample_count = 0;
+    dvtt::update_stream_filter(stream->impl);
+}
+
+int dvtt_is_transaction_enabled(dvtt_transaction_t transaction) {
+    return transaction && transaction->impl ? 1 : 0;
 }
 
 // Transaction management
@@ -377,37 +1943,62 @@ dvtt_transaction_t dvtt_open_transaction(dvtt_stream_t stream, const char* name,
         return nullptr;
     }
     
-    dvtt_transaction_t txn = new dvtt_transaction_s;
-    txn->impl = new dvtt::TransactionImpl;
+    // Reject before anything is allocated or copied
+    if ((parent && !parent->impl) ||
+            (stream->impl->filtered.load(std::memory_order_relaxed) &&
+             !dvtt::admit_transaction(stream->impl, start_time, !parent))) {
+        g_last_error = DVTT_OK;
+        return &dvtt::g_disabled_transaction;
+    }
     
     dvtt::TraceImpl* trace = stream->impl->trace->impl;
+    if (!stream->impl->described) {
+        stream->impl->described = true;
+        dvtt::emit_track_descriptor(trace, stream->impl);
+    }
     
-    txn->impl->id = trace->next_transaction_id++;
-    txn->impl->name = name;
-    txn->impl->type_name = type_name ? type_name : "";
+    // Pooled nodes are recycled with their string capacity intact, so in
+    // steady state opening a transaction does not allocate
+    dvtt::TransactionImpl* impl = dvtt::alloc_transaction(trace);
+    dvtt_transaction_t txn = impl->self;
+    
+    txn->impl->id = trace->next_transaction_id.fetch_add(1, std::memory_order_relaxed);
+    txn->impl->name.assign(name);
+    txn->impl->type_name.assign(type_name ? type_name : "");
     txn->impl->start_time = start_time;
     txn->impl->end_time = 0;
     txn->impl->state = dvtt::STATE_OPEN;
     txn->impl->stream = stream;
-    txn->impl->handle = trace->next_transaction_handle++;
-    txn->impl->attributes_batch_mode = false;
-    txn->impl->parent = parent;
+    txn->impl->handle = 0;
+    txn->impl->attributes = nullptr;
+    txn->impl->links.anchor = 0;
+    txn->impl->begun = false;
+    txn->impl->unsorted = false;
     
     // Allocate track based on parent relationship
     if (parent && parent->impl) {
-        // Child transaction gets its own track with parent relationship
-        txn->impl->track_uuid = trace->next_track_uuid++;
+        // Child transaction takes a lane under the parent's track; only a
+        // new lane needs a descriptor (at close for flight recorders)
+        txn->impl->parent_track_uuid = parent->impl->track_uuid;
+        txn->impl->lanes = dvtt::find_child_lanes(stream->impl, parent->impl->track_uuid,
+                                                  txn->impl->name);
+        txn->impl->lane = dvtt::acquire_lane(trace, txn->impl->lanes, start_time);
+        txn->impl->track_uuid = txn->impl->lanes->lanes[txn->impl->lane].uuid;
+        if (!trace->flight_recorder) {
+            dvtt::describe_lane(trace, txn->impl->lanes, txn->impl->lane);
+        }
     } else {
         // Root transaction uses stream's track
+        txn->impl->parent_track_uuid = 0;
         txn->impl->track_uuid = stream->impl->uuid;
+        txn->impl->lanes = nullptr;
     }
     
+    txn->impl->stream_index = stream->impl->transactions.size();
     stream->impl->transactions.push_back(txn->impl);
-    trace->transaction_handles[txn->impl->handle] = txn->impl;
     
-    // Emit track descriptor for child transactions
-    if (parent && parent->impl) {
-        dvtt::emit_track_descriptor(trace, txn->impl);
+    if (trace->options.reorder_window) {
+        dvtt::track_open_transaction(trace, txn->impl);
     }
     
     g_last_error = DVTT_OK;
@@ -419,23 +2010,23 @@ void dvtt_close_transaction(dvtt_transaction_t transaction, dvtt_time_t end_time
     
     if (transaction->impl->state != dvtt::STATE_OPEN) return;
     
-    transaction->impl->end_time = end_time;
-    transaction->impl->state = dvtt::STATE_CLOSED;
-    
-    // Emit protobuf packets
     dvtt::TraceImpl* trace = transaction->impl->stream->impl->trace->impl;
-    dvtt::emit_track_event_begin(trace, transaction->impl);
-    dvtt::emit_track_event_end(trace, transaction->impl);
+    dvtt::close_transaction(trace, transaction->impl, end_time);
+    
+    if (trace->options.free_on_close) {
+        dvtt::release_transaction(trace, transaction->impl);
+    }
 }
 
 void dvtt_free_transaction(dvtt_transaction_t transaction, dvtt_time_t close_time) {
     if (!transaction || !transaction->impl) return;
     
+    dvtt::TraceImpl* trace = transaction->impl->stream->impl->trace->impl;
     if (transaction->impl->state == dvtt::STATE_OPEN) {
-        dvtt_close_transaction(transaction, close_time);
+        dvtt::close_transaction(trace, transaction->impl, close_time);
     }
     
-    transaction->impl->state = dvtt::STATE_FREED;
+    dvtt::release_transaction(trace, transaction->impl);
 }
 
 int dvtt_is_transaction_open(dvtt_transaction_t transaction) {
@@ -492,25 +2083,29 @@ int dvtt_get_transaction_handle(dvtt_transaction_t transaction) {
     if (!transaction || !transaction->impl || transaction->impl->state == dvtt::STATE_FREED) {
         return 0;
     }
+    // Registered on first request so that opening a transaction stays lock-free
+    if (!transaction->impl->handle) {
+        transaction->impl->handle = dvtt::handle_registry().add(
+            transaction, dvtt::HANDLE_KIND_TRANSACTION);
+    }
     return transaction->impl->handle;
 }
 
 dvtt_transaction_t dvtt_get_transaction_from_handle(int handle) {
-    // Requires global registry
-    return nullptr;
+    return static_cast<dvtt_transaction_t>(
+        dvtt::handle_registry().lookup(handle, dvtt::HANDLE_KIND_TRANSACTION));
 }
 
 // Attribute addition
 void dvtt_add_attr_int64(dvtt_transaction_t transaction, const char* name, int64_t value, dvtt_radix_t radix) {
     if (!transaction || !transaction->impl || !name) return;
     
-    dvtt::DebugAnnotation attr;
-    attr.name = dvtt::format_radix_name(name, radix);
-    attr.type = DVTT_ATTR_INT64;
-    attr.radix = radix;
-    attr.numeric_value.i64 = value;
+    dvtt::AttrBuffer* attrs = dvtt::attribute_buffer(transaction->impl);
+    if (!attrs) return;
     
-    transaction->impl->attributes.push_back(attr);
+    size_t attr = attrs->begin_attr(name, dvtt::radix_suffix(radix));
+    attrs->write_int64_field(dvtt::pb::DebugAnnotation::int_value, value);
+    attrs->end_attr(attr);
 }
 
 void dvtt_add_attr_int32(dvtt_transaction_t transaction, const char* name, int32_t value, dvtt_radix_t radix) {
@@ -528,13 +2123,12 @@ void dvtt_add_attr_int8(dvtt_transaction_t transaction, const char* name, int8_t
 void dvtt_add_attr_uint64(dvtt_transaction_t transaction, const char* name, uint64_t value, dvtt_radix_t radix) {
     if (!transaction || !transaction->impl || !name) return;
     
-    dvtt::DebugAnnotation attr;
-    attr.name = dvtt::format_radix_name(name, radix);
-    attr.type = DVTT_ATTR_UINT64;
-    attr.radix = radix;
-    attr.numeric_value.u64 = value;
+    dvtt::AttrBuffer* attrs = dvtt::attribute_buffer(transaction->impl);
+    if (!attrs) return;
     
-    transaction->impl->attributes.push_back(attr);
+    size_t attr = attrs->begin_attr(name, dvtt::radix_suffix(radix));
+    attrs->write_uint64_field(dvtt::pb::DebugAnnotation::uint_value, value);
+    attrs->end_attr(attr);
 }
 
 void dvtt_add_attr_uint32(dvtt_transaction_t transaction, const char* name, uint32_t value, dvtt_radix_t radix) {
@@ -556,25 +2150,23 @@ void dvtt_add_attr_float(dvtt_transaction_t transaction, const char* name, float
 void dvtt_add_attr_double(dvtt_transaction_t transaction, const char* name, double value) {
     if (!transaction || !transaction->impl || !name) return;
     
-    dvtt::DebugAnnotation attr;
-    attr.name = name;
-    attr.type = DVTT_ATTR_DOUBLE;
-    attr.radix = DVTT_RADIX_REAL;
-    attr.numeric_value.d = value;
+    dvtt::AttrBuffer* attrs = dvtt::attribute_buffer(transaction->impl);
+    if (!attrs) return;
     
-    transaction->impl->attributes.push_back(attr);
+    size_t attr = attrs->begin_attr(name);
+    attrs->write_double_field(dvtt::pb::DebugAnnotation::double_value, value);
+    attrs->end_attr(attr);
 }
 
 void dvtt_add_attr_string(dvtt_transaction_t transaction, const char* name, const char* value) {
     if (!transaction || !transaction->impl || !name || !value) return;
     
-    dvtt::DebugAnnotation attr;
-    attr.name = name;
-    attr.type = DVTT_ATTR_STRING;
-    attr.radix = DVTT_RADIX_STRING;
-    attr.string_value = value;
+    dvtt::AttrBuffer* attrs = dvtt::attribute_buffer(transaction->impl);
+    if (!attrs) return;
     
-    transaction->impl->attributes.push_back(attr);
+    size_t attr = attrs->begin_attr(name);
+    attrs->write_string_field(dvtt::pb::DebugAnnotation::string_value, value, strlen(value));
+    attrs->end_attr(attr);
 }
 
 void dvtt_add_attr_time(dvtt_transaction_t transaction, const char* name, dvtt_time_t value) {
@@ -585,52 +2177,40 @@ void dvtt_add_attr_bits(dvtt_transaction_t transaction, const char* name,
                         const void* bits, size_t num_bits, dvtt_radix_t radix) {
     if (!transaction || !transaction->impl || !name || !bits) return;
     
-    dvtt::DebugAnnotation attr;
-    attr.name = dvtt::format_radix_name(name, radix);
-    attr.type = DVTT_ATTR_BITSTRING;
-    attr.radix = radix;
-    attr.string_value = dvtt::bits_to_string(bits, num_bits, radix);
+    dvtt::AttrBuffer* attrs = dvtt::attribute_buffer(transaction->impl);
+    if (!attrs) return;
     
-    transaction->impl->attributes.push_back(attr);
+    size_t attr = attrs->begin_attr(name, dvtt::radix_suffix(radix));
+    if (transaction->impl->stream->impl->trace->impl->options.raw_bits) {
+        attrs->write_bits_raw(bits, num_bits, radix);
+    } else {
+        attrs->write_bits_field(dvtt::pb::DebugAnnotation::string_value, bits, num_bits, radix);
+    }
+    attrs->end_attr(attr);
 }
 
 void dvtt_add_attr_blob(dvtt_transaction_t transaction, const char* name,
                         const void* data, size_t size) {
     if (!transaction || !transaction->impl || !name || !data) return;
     
-    dvtt::DebugAnnotation attr;
-    attr.name = name;
-    attr.type = DVTT_ATTR_BLOB;
-    attr.radix = DVTT_RADIX_HEX;
-    attr.blob_value.assign(static_cast<const uint8_t*>(data),
-                           static_cast<const uint8_t*>(data) + size);
+    dvtt::AttrBuffer* attrs = dvtt::attribute_buffer(transaction->impl);
+    if (!attrs) return;
     
-    transaction->impl->attributes.push_back(attr);
+    // Rendered as a hex string for display (matches the Python implementation)
+    size_t attr = attrs->begin_attr(name);
+    attrs->write_hex_field(dvtt::pb::DebugAnnotation::string_value, data, size);
+    attrs->end_attr(attr);
 }
 
 void dvtt_add_attribute(dvtt_transaction_t transaction, const char* name,
                         const dvtt_attr_value_t* value) {
-    if (!transaction || !name || !value) return;
+    if (!transaction || !transaction->impl || !name || !value) return;
     
-    switch (value->type) {
-        case DVTT_ATTR_INT64:
-            dvtt_add_attr_int64(transaction, name, value->value.i64, DVTT_RADIX_HEX);
-            break;
-        case DVTT_ATTR_UINT64:
-            dvtt_add_attr_uint64(transaction, name, value->value.u64, DVTT_RADIX_HEX);
-            break;
-        case DVTT_ATTR_DOUBLE:
-            dvtt_add_attr_double(transaction, name, value->value.d);
-            break;
-        case DVTT_ATTR_STRING:
-            dvtt_add_attr_string(transaction, name, value->value.str);
-            break;
-        case DVTT_ATTR_BLOB:
-            dvtt_add_attr_blob(transaction, name, value->value.blob.data, value->value.blob.size_bytes);
-            break;
-        default:
-            break;
-    }
+    dvtt::AttrBuffer* attrs = dvtt::attribute_buffer(transaction->impl);
+    if (!attrs) return;
+    
+    dvtt::add_attr_value(*attrs, name, DVTT_RADIX_HEX, *value,
+        transaction->impl->stream->impl->trace->impl->options.raw_bits);
 }
 
 // Links and relations
@@ -638,25 +2218,629 @@ void dvtt_add_link(dvtt_transaction_t source, dvtt_transaction_t target,
                    dvtt_link_type_t link_type, const char* relation_name) {
     if (!source || !source->impl || !target || !target->impl) return;
     
-    dvtt::TraceImpl* trace = source->impl->stream->impl->trace->impl;
-    uint64_t flow_id = trace->next_flow_id++;
-    
-    source->impl->flow_ids.push_back(flow_id);
-    target->impl->flow_ids.push_back(flow_id);
+    dvtt::TransactionImpl* s = source->impl;
+    dvtt::TransactionImpl* t = target->impl;
+    bool s_open = s->state == dvtt::STATE_OPEN;
+    bool t_open = t->state == dvtt::STATE_OPEN;
+    if (s_open && t_open) {
+        // Both slices are still to be written and carry the same flow id
+        dvtt::TraceImpl* trace = s->stream->impl->trace->impl;
+        uint64_t flow_id = trace->next_flow_id.fetch_add(1, std::memory_order_relaxed);
+        s->links.flow_ids.push_back(flow_id);
+        t->links.flow_ids.push_back(flow_id);
+    } else if (s_open && t->links.anchor) {
+        s->links.terminating_flow_ids.push_back(t->links.anchor);
+    } else if (t_open && s->links.anchor) {
+        t->links.terminating_flow_ids.push_back(s->links.anchor);
+    } else {
+        g_last_error = DVTT_ERROR_ALREADY_ENDED;
+        return;
+    }
+    if (s_open) {
+        dvtt::add_link_attr(s, t->id, link_type, relation_name);
+    }
+    g_last_error = DVTT_OK;
+}
+
+uint64_t dvtt_get_transaction_id(dvtt_transaction_t transaction) {
+    if (!transaction || !transaction->impl) {
+        g_last_error = DVTT_ERROR_NULL_HANDLE;
+        return 0;
+    }
+    if (transaction->impl->state == dvtt::STATE_OPEN && !transaction->impl->begun) {
+        transaction->impl->links.anchor = dvtt::link_anchor_flow(transaction->impl->id);
+    }
+    return transaction->impl->id;
+}
+
+void dvtt_add_link_id(dvtt_transaction_t source, uint64_t target_id,
+                      dvtt_link_type_t link_type, const char* relation_name) {
+    if (!source || !source->impl) return;
+    if (!target_id) {
+        g_last_error = DVTT_ERROR_INVALID_ARGUMENT;
+        return;
+    }
+    if (source->impl->state != dvtt::STATE_OPEN) {
+        g_last_error = DVTT_ERROR_ALREADY_ENDED;
+        return;
+    }
+    source->impl->links.terminating_flow_ids.push_back(dvtt::link_anchor_flow(target_id));
+    dvtt::add_link_attr(source->impl, target_id, link_type, relation_name);
+    g_last_error = DVTT_OK;
 }
 
 void dvtt_add_stream_link(dvtt_stream_t stream, dvtt_transaction_t transaction,
                           dvtt_link_type_t link_type, const char* relation_name) {
-    // Stream links are less common, simplified implementation
+    if (!stream || !stream->impl || !transaction || !transaction->impl) return;
+    
+    dvtt::AttrBuffer* attrs = dvtt::attribute_buffer(transaction->impl);
+    if (!attrs) {
+        g_last_error = DVTT_ERROR_ALREADY_ENDED;
+        return;
+    }
+    const char* name = relation_name;
+    if (!name || !*name) {
+        switch (link_type) {
+            case DVTT_LINK_PARENT_CHILD: name = "parent_stream"; break;
+            case DVTT_LINK_CAUSE_EFFECT: name = "cause_stream"; break;
+            default: name = "related_stream"; break;
+        }
+    }
+    const dvtt::StreamImpl* s = stream->impl;
+    std::string path = s->scope.empty() ? s->name : s->scope + "." + s->name;
+    size_t attr = attrs->begin_attr(name);
+    attrs->write_string_field(dvtt::pb::DebugAnnotation::string_value, path);
+    attrs->end_attr(attr);
+    g_last_error = DVTT_OK;
 }
 
 // Bulk operations
+// Counter tracks
+dvtt_counter_t dvtt_open_counter(dvtt_stream_t stream, const char* name, const char* unit) {
+    if (!stream || !stream->impl) {
+        g_last_error = DVTT_ERROR_NULL_HANDLE;
+        return nullptr;
+    }
+    if (stream->impl->state != dvtt::STATE_OPEN) {
+        g_last_error = DVTT_ERROR_NOT_INITIALIZED;
+        return nullptr;
+    }
+    if (!name) {
+        g_last_error = DVTT_ERROR_NULL_POINTER;
+        return nullptr;
+    }
+    
+    dvtt_counter_t counter = new dvtt_counter_s;
+    counter->impl = new dvtt::CounterImpl;
+    counter->impl->uuid = stream->impl->trace->impl->next_track_uuid.fetch_add(
+        1, std::memory_order_relaxed);
+    counter->impl->name = name;
+    counter->impl->unit = unit ? unit : "";
+    counter->impl->stream = stream->impl;
+    counter->impl->self = counter;
+    counter->impl->described = false;
+    counter->impl->coalesce = false;
+    counter->impl->has_value = false;
+    counter->impl->is_double = false;
+    counter->impl->last_bits = 0;
+    stream->impl->counters.push_back(counter->impl);
+    
+    g_last_error = DVTT_OK;
+    return counter;
+}
+
+void dvtt_counter_set(dvtt_counter_t counter, dvtt_time_t time, int64_t value) {
+    if (!counter || !counter->impl) return;
+    
+    dvtt::TraceImpl* trace = counter->impl->stream->trace->impl;
+    if (dvtt::admit_counter_sample(trace, counter->impl, time, false,
+                                   static_cast<uint64_t>(value))) {
+        dvtt::emit_counter_value(trace, counter->impl->uuid, time, value);
+    }
+}
+
+void dvtt_counter_set_double(dvtt_counter_t counter, dvtt_time_t time, double value) {
+    if (!counter || !counter->impl) return;
+    
+    dvtt::TraceImpl* trace = counter->impl->stream->trace->impl;
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    if (dvtt::admit_counter_sample(trace, counter->impl, time, true, bits)) {
+        dvtt::emit_counter_value(trace, counter->impl->uuid, time, value);
+    }
+}
+
+void dvtt_set_counter_coalescing(dvtt_counter_t counter, int enabled) {
+    if (!counter || !counter->impl) {
+        g_last_error = DVTT_ERROR_NULL_HANDLE;
+        return;
+    }
+    counter->impl->coalesce = enabled != 0;
+    g_last_error = DVTT_OK;
+}
+
 void dvtt_begin_attributes(dvtt_transaction_t transaction) {
     if (!transaction || !transaction->impl) return;
-    transaction->impl->attributes_batch_mode = true;
+    // Acquire the encode buffer once for the whole batch
+    dvtt::attribute_buffer(transaction->impl);
 }
 
 void dvtt_end_attributes(dvtt_transaction_t transaction) {
-    if (!transaction || !transaction->impl) return;
-    transaction->impl->attributes_batch_mode = false;
+    // Nothing to release: the buffer is written out and returned at close
+    (void)transaction;
+}
+
+namespace dvtt {
+
+// Admits a complete transaction and writes the descriptors it needs.
+// Returns the track to record it on, or 0 if it is rejected
+static uint64_t begin_record(TraceImpl* trace, StreamImpl* s, const char* name,
+                             dvtt_time_t start_time, dvtt_time_t end_time,
+                             uint64_t parent_track, bool is_root) {
+    if (!is_root && !parent_track) {
+        return 0;
+    }
+    if (s->filtered.load(std::memory_order_relaxed) &&
+            !admit_transaction(s, start_time, is_root)) {
+        return 0;
+    }
+    // Children stay in their parent's file so their tracks resolve
+    if (is_root && (trace->options.rotate_bytes || trace->options.rotate_time)) {
+        maybe_rotate(trace, end_time);
+    }
+    if (!s->described) {
+        s->described = true;
+        emit_track_descriptor(trace, s);
+    }
+    if (is_root) {
+        return s->uuid;
+    }
+    // A complete record hands its lane back as soon as it takes it
+    ChildLanes* lanes = find_child_lanes(s, parent_track, name);
+    uint32_t lane = acquire_lane(trace, lanes, start_time);
+    describe_lane(trace, lanes, lane);
+    release_lane(lanes, lane, end_time);
+    return lanes->lanes[lane].uuid;
+}
+
+// Writes a complete transaction, or queues it in the reorder window.
+// 'attrs' is left empty.
+static void record_slice(TraceImpl* trace, uint64_t track, dvtt_time_t start_time,
+                         dvtt_time_t end_time, const char* name, const char* type_name,
+                         AttrBuffer& attrs) {
+    if (trace->options.stats_interval) {
+        maybe_write_stats(trace, end_time);
+    }
+    if (!trace->options.reorder_window) {
+        emit_slice_begin(trace, track, start_time, name, type_name,
+                         attrs.empty() ? nullptr : &attrs);
+        emit_slice_end(trace, track, end_time);
+        return;
+    }
+    SequenceImpl* seq = current_sequence(trace);
+    AttrBuffer* queued = nullptr;
+    if (!attrs.empty()) {
+        queued = seq->attr_pool.alloc();
+        queued->owner = seq;
+        // Pooled buffers keep their capacity, so copying does not allocate
+        queued->buffer().assign(attrs.buffer().begin(), attrs.buffer().end());
+        attrs.clear();
+    }
+    queue_slice(trace, seq, track, start_time, end_time, name, type_name, queued, nullptr, false);
+}
+
+// Decodes a packed attribute list (see DVTT_PACKED_HEADER) into 'attrs'.
+// Returns false if an attribute was skipped for an unknown name id
+static bool add_packed_attrs(AttrBuffer& attrs, const NameTable& names,
+                             const uint32_t* words, int num_words, bool raw_bits) {
+    bool ok = true;
+    int i = 0;
+    while (i + 1 < num_words && words[i]) {
+        const char* name = names.lookup(words[i]);
+        dvtt_radix_t radix = static_cast<dvtt_radix_t>(words[i + 1] >> 24);
+        size_t num_bits = words[i + 1] & 0xFFFFFFu;
+        const uint32_t* value = words + i + 2;
+        size_t value_words = (num_bits + 31) / 32;
+        i += 2;
+        if (value_words > static_cast<size_t>(num_words - i)) {
+            return false;
+        }
+        i += static_cast<int>(value_words);
+        if (!name) {
+            ok = false;
+            continue;
+        }
+        
+        dvtt_attr_value_t v;
+        if (radix == DVTT_RADIX_STRING) {
+            v.type = DVTT_ATTR_STRING;
+            v.value.str = value_words ? names.lookup(value[0]) : nullptr;
+            if (!v.value.str) {
+                ok = false;
+                continue;
+            }
+        } else if (num_bits > 64) {
+            v.type = DVTT_ATTR_BITSTRING;
+            v.value.bits.data = value;
+            v.value.bits.num_bits = num_bits;
+        } else {
+            uint64_t bits = value_words ? value[0] : 0;
+            if (value_words > 1) {
+                bits |= static_cast<uint64_t>(value[1]) << 32;
+            }
+            if (num_bits < 64) {
+                bits &= (uint64_t(1) << num_bits) - 1;
+            }
+            if (radix == DVTT_RADIX_REAL) {
+                v.type = DVTT_ATTR_DOUBLE;
+                std::memcpy(&v.value.d, &bits, sizeof(bits));
+            } else if (radix == DVTT_RADIX_DEC && num_bits) {
+                // Sign-extend from the declared width
+                uint64_t sign = uint64_t(1) << (num_bits - 1);
+                v.type = DVTT_ATTR_INT64;
+                v.value.i64 = static_cast<int64_t>((bits ^ sign) - sign);
+            } else {
+                v.type = DVTT_ATTR_UINT64;
+                v.value.u64 = bits;
+            }
+        }
+        add_attr_value(attrs, name, radix, v, raw_bits);
+    }
+    return ok;
+}
+
+// Bits [offset, offset + num_bits) of a packed value of 'num_words'
+// words, for num_bits <= 64
+static uint64_t load_field(const uint32_t* words, size_t num_words, size_t offset,
+                           size_t num_bits) {
+    size_t index = offset / 32;
+    size_t have = 32 - offset % 32;
+    uint64_t value = words[index] >> (offset % 32);
+    for (size_t i = index + 1; have < num_bits && i < num_words; i++, have += 32) {
+        value |= static_cast<uint64_t>(words[i]) << have;
+    }
+    return num_bits < 64 ? value & ((uint64_t(1) << num_bits) - 1) : value;
+}
+
+// Adds the fields of 'schema' from packed value 'values' to 'attrs'.
+// Returns false if a string field held an unknown name id
+static bool add_schema_attrs(AttrBuffer& attrs, const SchemaImpl& schema,
+                             const NameTable& names, const uint32_t* values,
+                             bool raw_bits, std::vector<uint32_t>& scratch) {
+    bool ok = true;
+    for (uint32_t i = 0; i < schema.fields.size(); i++) {
+        const SchemaImpl::Field& f = schema.fields[i];
+        if (f.kind == SchemaImpl::KIND_BITS) {
+            scratch.resize((f.num_bits + 31) / 32);
+            for (size_t w = 0; w < scratch.size(); w++) {
+                size_t bits = std::min<size_t>(32, f.num_bits - w * 32);
+                scratch[w] = static_cast<uint32_t>(
+                    load_field(values, schema.num_words, f.offset + w * 32, bits));
+            }
+            size_t attr = attrs.begin_attr(&schema, i);
+            if (raw_bits) {
+                attrs.write_bits_raw(scratch.data(), f.num_bits, f.radix);
+            } else {
+                attrs.write_bits_field(pb::DebugAnnotation::string_value, scratch.data(),
+                                       f.num_bits, f.radix);
+            }
+            attrs.end_attr(attr);
+            continue;
+        }
+        
+        uint64_t bits = load_field(values, schema.num_words, f.offset, f.num_bits);
+        if (f.kind == SchemaImpl::KIND_STRING) {
+            const char* str = names.lookup(static_cast<uint32_t>(bits));
+            if (!str) {
+                ok = false;
+                continue;
+            }
+            size_t attr = attrs.begin_attr(&schema, i);
+            attrs.write_string_field(pb::DebugAnnotation::string_value, str, strlen(str));
+            attrs.end_attr(attr);
+            continue;
+        }
+        size_t attr = attrs.begin_attr(&schema, i);
+        switch (f.kind) {
+            case SchemaImpl::KIND_INT: {
+                uint64_t sign = uint64_t(1) << (f.num_bits - 1);
+                attrs.write_int64_field(pb::DebugAnnotation::int_value,
+                                        static_cast<int64_t>((bits ^ sign) - sign));
+                break;
+            }
+            case SchemaImpl::KIND_DOUBLE: {
+                double d;
+                std::memcpy(&d, &bits, sizeof(d));
+                attrs.write_double_field(pb::DebugAnnotation::double_value, d);
+                break;
+            }
+            default:
+                attrs.write_uint64_field(pb::DebugAnnotation::uint_value, bits);
+                break;
+        }
+        attrs.end_attr(attr);
+    }
+    return ok;
+}
+
+// Lays out the fields of a schema, most significant first. Returns NULL
+// and sets the last error if a field is invalid
+static SchemaImpl* build_schema(StreamImpl* stream, const char* const* names,
+                                const dvtt_radix_t* radixes, const uint32_t* widths,
+                                int num_fields) {
+    uint64_t total_bits = 0;
+    for (int i = 0; i < num_fields; i++) {
+        if ((radixes[i] == DVTT_RADIX_STRING && widths[i] != 32) ||
+                (radixes[i] == DVTT_RADIX_REAL && widths[i] != 64) || !widths[i]) {
+            g_last_error = DVTT_ERROR_INVALID_ARGUMENT;
+            return nullptr;
+        }
+        total_bits += widths[i];
+    }
+    if (!num_fields || total_bits > UINT32_MAX) {
+        g_last_error = DVTT_ERROR_INVALID_ARGUMENT;
+        return nullptr;
+    }
+    
+    SchemaImpl* schema = new SchemaImpl;
+    schema->num_words = static_cast<size_t>((total_bits + 31) / 32);
+    schema->index = stream->trace->impl->next_schema_index.fetch_add(1, std::memory_order_relaxed);
+    schema->stream = stream;
+    schema->fields.resize(num_fields);
+    uint64_t offset = total_bits;
+    for (int i = 0; i < num_fields; i++) {
+        SchemaImpl::Field& f = schema->fields[i];
+        f.name = std::string(names[i]) + radix_suffix(radixes[i]);
+        f.radix = radixes[i];
+        f.num_bits = widths[i];
+        offset -= widths[i];
+        f.offset = static_cast<uint32_t>(offset);
+        f.kind = f.radix == DVTT_RADIX_STRING ? SchemaImpl::KIND_STRING :
+                 f.radix == DVTT_RADIX_REAL ? SchemaImpl::KIND_DOUBLE :
+                 f.num_bits > 64 ? SchemaImpl::KIND_BITS :
+                 f.radix == DVTT_RADIX_DEC ? SchemaImpl::KIND_INT : SchemaImpl::KIND_UINT;
+    }
+    schema->self = new dvtt_schema_s;
+    schema->self->impl = schema;
+    stream->schemas.push_back(schema);
+    g_last_error = DVTT_OK;
+    return schema;
+}
+
+} // namespace dvtt
+
+size_t dvtt_record_transactions(dvtt_stream_t stream, const dvtt_txn_record_t* records,
+                                size_t count) {
+    if (!stream || !stream->impl) {
+        g_last_error = DVTT_ERROR_NULL_HANDLE;
+        return 0;
+    }
+    if (stream->impl->state != dvtt::STATE_OPEN) {
+        g_last_error = DVTT_ERROR_NOT_INITIALIZED;
+        return 0;
+    }
+    if (!records && count) {
+        g_last_error = DVTT_ERROR_NULL_POINTER;
+        return 0;
+    }
+    g_last_error = DVTT_OK;
+    
+    dvtt::StreamImpl* s = stream->impl;
+    dvtt::TraceImpl* trace = s->trace->impl;
+    dvtt::SequenceImpl* seq = dvtt::current_sequence(trace);
+    std::vector<uint64_t>& tracks = seq->batch_tracks;
+    tracks.assign(count, 0);
+    dvtt::AttrBuffer& attrs = seq->batch_attrs;
+    
+    size_t recorded = 0;
+    for (size_t i = 0; i < count; i++) {
+        const dvtt_txn_record_t& rec = records[i];
+        if (!rec.name) {
+            g_last_error = DVTT_ERROR_NULL_POINTER;
+            continue;
+        }
+        
+        // Resolve the parent track; children of unrecorded parents are skipped
+        uint64_t parent_track = 0;
+        bool is_root = true;
+        if (rec.parent_index >= 0) {
+            if (static_cast<size_t>(rec.parent_index) >= i) {
+                g_last_error = DVTT_ERROR_INVALID_ARGUMENT;
+                continue;
+            }
+            parent_track = tracks[rec.parent_index];
+            is_root = false;
+        } else if (rec.parent) {
+            parent_track = rec.parent->impl ? rec.parent->impl->track_uuid : 0;
+            is_root = false;
+        }
+        uint64_t track = dvtt::begin_record(trace, s, rec.name, rec.start_time, rec.end_time,
+                                            parent_track, is_root);
+        if (!track) {
+            continue;
+        }
+        tracks[i] = track;
+        
+        attrs.clear();
+        for (size_t a = 0; a < rec.num_attrs; a++) {
+            if (rec.attrs[a].name) {
+                dvtt::add_attr_value(attrs, rec.attrs[a].name, rec.attrs[a].radix,
+                                     rec.attrs[a].value, trace->options.raw_bits);
+            }
+        }
+        dvtt::record_slice(trace, track, rec.start_time, rec.end_time, rec.name,
+                           rec.type_name ? rec.type_name : "", attrs);
+        recorded++;
+    }
+    return recorded;
+}
+
+// Registered names and packed attributes
+int dvtt_register_name(dvtt_trace_t trace, const char* name) {
+    if (!trace || !trace->impl) {
+        g_last_error = DVTT_ERROR_NULL_HANDLE;
+        return 0;
+    }
+    if (!name) {
+        g_last_error = DVTT_ERROR_NULL_POINTER;
+        return 0;
+    }
+    uint32_t id = trace->impl->names.add(name);
+    g_last_error = id ? DVTT_OK : DVTT_ERROR_MEMORY;
+    return static_cast<int>(id);
+}
+
+dvtt_transaction_t dvtt_open_transaction_id(dvtt_stream_t stream, int name_id,
+                                            dvtt_time_t start_time, int type_id,
+                                            dvtt_transaction_t parent) {
+    if (!stream || !stream->impl) {
+        g_last_error = DVTT_ERROR_NULL_HANDLE;
+        return nullptr;
+    }
+    const dvtt::NameTable& names = stream->impl->trace->impl->names;
+    const char* name = names.lookup(name_id);
+    const char* type_name = type_id ? names.lookup(type_id) : nullptr;
+    if (!name || (type_id && !type_name)) {
+        g_last_error = DVTT_ERROR_INVALID_NAME;
+        return nullptr;
+    }
+    return dvtt_open_transaction(stream, name, start_time, type_name, parent);
+}
+
+void dvtt_add_packed_attributes(dvtt_transaction_t transaction, const uint32_t* words,
+                                int num_words) {
+    if (!transaction || !transaction->impl || !words) return;
+    
+    dvtt::AttrBuffer* attrs = dvtt::attribute_buffer(transaction->impl);
+    if (!attrs) return;
+    
+    dvtt::TraceImpl* trace = transaction->impl->stream->impl->trace->impl;
+    if (!dvtt::add_packed_attrs(*attrs, trace->names, words, num_words,
+                                trace->options.raw_bits)) {
+        g_last_error = DVTT_ERROR_INVALID_NAME;
+    }
+}
+
+int dvtt_record_packed(dvtt_stream_t stream, int name_id, int type_id,
+                       dvtt_time_t start_time, dvtt_time_t end_time,
+                       dvtt_transaction_t parent, const uint32_t* words, int num_words) {
+    if (!stream || !stream->impl) {
+        g_last_error = DVTT_ERROR_NULL_HANDLE;
+        return 0;
+    }
+    if (stream->impl->state != dvtt::STATE_OPEN) {
+        g_last_error = DVTT_ERROR_NOT_INITIALIZED;
+        return 0;
+    }
+    dvtt::StreamImpl* s = stream->impl;
+    dvtt::TraceImpl* trace = s->trace->impl;
+    const char* name = trace->names.lookup(name_id);
+    const char* type_name = type_id ? trace->names.lookup(type_id) : "";
+    if (!name || !type_name) {
+        g_last_error = DVTT_ERROR_INVALID_NAME;
+        return 0;
+    }
+    g_last_error = DVTT_OK;
+    
+    uint64_t parent_track = 0;
+    if (parent) {
+        parent_track = parent->impl ? parent->impl->track_uuid : 0;
+    }
+    uint64_t track = dvtt::begin_record(trace, s, name, start_time, end_time,
+                                        parent_track, !parent);
+    if (!track) {
+        return 0;
+    }
+    
+    dvtt::AttrBuffer& attrs = dvtt::current_sequence(trace)->batch_attrs;
+    attrs.clear();
+    if (words && !dvtt::add_packed_attrs(attrs, trace->names, words, num_words,
+                                         trace->options.raw_bits)) {
+        g_last_error = DVTT_ERROR_INVALID_NAME;
+    }
+    dvtt::record_slice(trace, track, start_time, end_time, name, type_name, attrs);
+    return 1;
+}
+
+// Attribute schemas
+dvtt_schema_t dvtt_register_schema(dvtt_stream_t stream, const dvtt_schema_field_t* fields,
+                                   int num_fields) {
+    if (!stream || !stream->impl) {
+        g_last_error = DVTT_ERROR_NULL_HANDLE;
+        return nullptr;
+    }
+    if (!fields) {
+        g_last_error = DVTT_ERROR_NULL_POINTER;
+        return nullptr;
+    }
+    if (num_fields < 0) {
+        g_last_error = DVTT_ERROR_INVALID_ARGUMENT;
+        return nullptr;
+    }
+    std::vector<const char*> names(num_fields);
+    std::vector<dvtt_radix_t> radixes(num_fields);
+    std::vector<uint32_t> widths(num_fields);
+    for (int i = 0; i < num_fields; i++) {
+        if (!fields[i].name) {
+            g_last_error = DVTT_ERROR_NULL_POINTER;
+            return nullptr;
+        }
+        names[i] = fields[i].name;
+        radixes[i] = fields[i].radix;
+        widths[i] = fields[i].num_bits;
+    }
+    dvtt::SchemaImpl* schema = dvtt::build_schema(stream->impl, names.data(), radixes.data(),
+                                                  widths.data(), num_fields);
+    return schema ? schema->self : nullptr;
+}
+
+dvtt_schema_t dvtt_register_schema_id(dvtt_stream_t stream, const uint32_t* words,
+                                      int num_fields) {
+    if (!stream || !stream->impl) {
+        g_last_error = DVTT_ERROR_NULL_HANDLE;
+        return nullptr;
+    }
+    if (!words) {
+        g_last_error = DVTT_ERROR_NULL_POINTER;
+        return nullptr;
+    }
+    if (num_fields < 0) {
+        g_last_error = DVTT_ERROR_INVALID_ARGUMENT;
+        return nullptr;
+    }
+    const dvtt::NameTable& table = stream->impl->trace->impl->names;
+    std::vector<const char*> names(num_fields);
+    std::vector<dvtt_radix_t> radixes(num_fields);
+    std::vector<uint32_t> widths(num_fields);
+    for (int i = 0; i < num_fields; i++) {
+        names[i] = table.lookup(words[2 * i]);
+        if (!names[i]) {
+            g_last_error = DVTT_ERROR_INVALID_NAME;
+            return nullptr;
+        }
+        radixes[i] = static_cast<dvtt_radix_t>(words[2 * i + 1] >> 24);
+        widths[i] = words[2 * i + 1] & 0xFFFFFFu;
+    }
+    dvtt::SchemaImpl* schema = dvtt::build_schema(stream->impl, names.data(), radixes.data(),
+                                                  widths.data(), num_fields);
+    return schema ? schema->self : nullptr;
+}
+
+void dvtt_set_attrs(dvtt_transaction_t transaction, dvtt_schema_t schema,
+                    const uint32_t* values) {
+    if (!transaction || !transaction->impl || !schema || !schema->impl || !values) return;
+    
+    dvtt::TraceImpl* trace = transaction->impl->stream->impl->trace->impl;
+    if (schema->impl->stream->trace->impl != trace) {
+        g_last_error = DVTT_ERROR_INVALID_ARGUMENT;
+        return;
+    }
+    dvtt::AttrBuffer* attrs = dvtt::attribute_buffer(transaction->impl);
+    if (!attrs) return;
+    
+    if (!dvtt::add_schema_attrs(*attrs, *schema->impl, trace->names, values,
+                                trace->options.raw_bits,
+                                dvtt::current_sequence(trace)->schema_bits)) {
+        g_last_error = DVTT_ERROR_INVALID_NAME;
+    }
 }
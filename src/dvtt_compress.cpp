@@ -0,0 +1,110 @@
+#include "dvtt_compress.h"
+
+#if defined(DVTT_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace dvtt {
+
+#if defined(DVTT_HAVE_ZLIB)
+
+bool compression_supported() {
+    return true;
+}
+
+CompressingSink::CompressingSink(Sink* inner, int level) : m_inner(inner) {
+    z_stream* zs = new z_stream();
+    if (deflateInit(zs, level ? level : Z_DEFAULT_COMPRESSION) != Z_OK) {
+        delete zs;
+        zs = nullptr;
+    }
+    m_stream = zs;
+}
+
+CompressingSink::~CompressingSink() {
+    close();
+    if (m_stream) {
+        z_stream* zs = static_cast<z_stream*>(m_stream);
+        deflateEnd(zs);
+        delete zs;
+    }
+    delete m_inner;
+}
+
+bool CompressingSink::write_chunk(std::vector<uint8_t>& chunk) {
+    if (chunk.empty()) {
+        return true;
+    }
+    if (!m_stream) {
+        // Deflate could not be set up; write the packets uncompressed
+        return m_inner->write_chunk(chunk);
+    }
+    z_stream* zs = static_cast<z_stream*>(m_stream);
+    m_deflated.resize(deflateBound(zs, chunk.size()));
+    zs->next_in = chunk.data();
+    zs->avail_in = static_cast<uInt>(chunk.size());
+    zs->next_out = m_deflated.data();
+    zs->avail_out = static_cast<uInt>(m_deflated.size());
+    int ret = deflate(zs, Z_FINISH);
+    size_t deflated = m_deflated.size() - zs->avail_out;
+    deflateReset(zs);
+    if (ret != Z_STREAM_END) {
+        return m_inner->write_chunk(chunk);
+    }
+    chunk.clear();
+
+    size_t packet = m_out.begin_nested(pb::Trace::packet);
+    m_out.write_bytes_field(pb::TracePacket::compressed_packets, m_deflated.data(), deflated);
+    m_out.end_nested(packet);
+    return m_inner->write_chunk(m_out.buffer());
+}
+
+#else
+
+bool compression_supported() {
+    return false;
+}
+
+CompressingSink::CompressingSink(Sink* inner, int level) : m_inner(inner), m_stream(nullptr) {
+    (void)level;
+}
+
+CompressingSink::~CompressingSink() {
+    close();
+    delete m_inner;
+}
+
+bool CompressingSink::write_chunk(std::vector<uint8_t>& chunk) {
+    return m_inner->write_chunk(chunk);
+}
+
+#endif
+
+void CompressingSink::flush() {
+    m_inner->flush();
+}
+
+void CompressingSink::sync() {
+    m_inner->sync();
+}
+
+bool CompressingSink::rotate(const std::string& filename) {
+    // Chunks are compressed independently, so nothing carries over
+    return m_inner->rotate(filename);
+}
+
+bool CompressingSink::write_from_signal(const uint8_t* data, size_t size) {
+    // Deflating is not safe in a signal handler. Readers take plain packets
+    // between compressed ones, so they are written as they are
+    return m_inner->write_from_signal(data, size);
+}
+
+bool CompressingSink::sync_from_signal() {
+    return m_inner->sync_from_signal();
+}
+
+void CompressingSink::close() {
+    m_inner->close();
+}
+
+} // namespace dvtt
@@ -0,0 +1,51 @@
+#ifndef DVTT_COMPRESS_H
+#define DVTT_COMPRESS_H
+
+#include "dvtt_writer.h"
+
+namespace dvtt {
+
+// True when the library was built with zlib and can compress chunks
+bool compression_supported();
+
+/**
+ * Sink that deflates each chunk into a single compressed_packets packet
+ *
+ * Chunks hold whole Trace.packet fields, which is exactly the payload
+ * TracePacket.compressed_packets expects, so a chunk is compressed as-is
+ * and the wrapping packet is written to the inner sink. Placed below an
+ * AsyncSink, compression runs on the writer thread. The deflate state and
+ * output buffer are reused across chunks.
+ */
+class CompressingSink : public Sink {
+public:
+    // 'level' is a zlib level, 1 (fastest) to 9 (smallest); 0 picks the default
+    CompressingSink(Sink* inner, int level);
+
+    virtual ~CompressingSink();
+
+    virtual bool write_chunk(std::vector<uint8_t>& chunk) override;
+
+    virtual void flush() override;
+
+    virtual void sync() override;
+
+    virtual bool rotate(const std::string& filename) override;
+
+    // Passes the packets through uncompressed
+    virtual bool write_from_signal(const uint8_t* data, size_t size) override;
+
+    virtual bool sync_from_signal() override;
+
+    virtual void close() override;
+
+private:
+    Sink*                   m_inner;
+    void*                   m_stream;     // z_stream, kept opaque to spare users zlib.h
+    std::vector<uint8_t>    m_deflated;
+    ProtoWriter             m_out;
+};
+
+} // namespace dvtt
+
+#endif // DVTT_COMPRESS_H
@@ -0,0 +1,246 @@
+#include "dvtt_decode.h"
+#include <algorithm>
+#include <cstdio>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define DVTT_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(DVTT_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace dvtt {
+
+MappedFile::MappedFile() : m_data(nullptr), m_size(0), m_map(nullptr) {
+}
+
+MappedFile::~MappedFile() {
+#if defined(DVTT_HAVE_MMAP)
+    if (m_map) {
+        munmap(m_map, m_size);
+    }
+#endif
+}
+
+bool MappedFile::open(const std::string& filename) {
+#if defined(DVTT_HAVE_MMAP)
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* map = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            m_map = map;
+            m_size = static_cast<size_t>(st.st_size);
+            m_data = static_cast<const uint8_t*>(map);
+            ::close(fd);
+            return true;
+        }
+    }
+    ::close(fd);
+#endif
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+    uint8_t buf[64 * 1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        m_copy.insert(m_copy.end(), buf, buf + n);
+    }
+    fclose(fp);
+    m_data = m_copy.data();
+    m_size = m_copy.size();
+    return true;
+}
+
+#if defined(DVTT_HAVE_ZLIB)
+
+bool inflate_packets(const uint8_t* data, size_t size, std::vector<uint8_t>& out) {
+    z_stream zs = {};
+    if (inflateInit(&zs) != Z_OK) {
+        return false;
+    }
+    out.resize(std::max<size_t>(size * 4, 4096));
+    zs.next_in = const_cast<uint8_t*>(data);
+    zs.avail_in = static_cast<uInt>(size);
+    int ret = Z_OK;
+    while (ret == Z_OK) {
+        if (zs.total_out == out.size()) {
+            out.resize(out.size() * 2);
+        }
+        zs.next_out = out.data() + zs.total_out;
+        zs.avail_out = static_cast<uInt>(out.size() - zs.total_out);
+        ret = inflate(&zs, Z_NO_FLUSH);
+    }
+    out.resize(zs.total_out);
+    inflateEnd(&zs);
+    return ret == Z_STREAM_END;
+}
+
+#else
+
+bool inflate_packets(const uint8_t* data, size_t size, std::vector<uint8_t>& out) {
+    (void)data;
+    (void)size;
+    out.clear();
+    return false;
+}
+
+#endif
+
+bool find_compressed_packets(const uint8_t* packet, size_t size,
+                             const uint8_t*& payload, size_t& payload_size) {
+    ProtoReader fields(packet, size);
+    while (fields.next()) {
+        if (fields.field() == pb::TracePacket::compressed_packets &&
+                fields.wire_type() == LENGTH_DELIMITED) {
+            payload = fields.data();
+            payload_size = fields.size();
+            return true;
+        }
+    }
+    return false;
+}
+
+PacketCursor::PacketCursor(const uint8_t* data, size_t size) :
+    m_outer(data, size), m_inner(nullptr, 0), m_in_chunk(false), m_error(false),
+    m_data(nullptr), m_size(0) {
+}
+
+bool PacketCursor::next() {
+    while (!m_error) {
+        ProtoReader& reader = m_in_chunk ? m_inner : m_outer;
+        if (!reader.next()) {
+            m_error = reader.error();
+            if (!m_in_chunk) {
+                return false;
+            }
+            m_in_chunk = false;
+            continue;
+        }
+        if (reader.field() != pb::Trace::packet || reader.wire_type() != LENGTH_DELIMITED) {
+            continue;
+        }
+        const uint8_t* payload;
+        size_t payload_size;
+        if (!m_in_chunk && find_compressed_packets(reader.data(), reader.size(),
+                                                   payload, payload_size)) {
+            if (!inflate_packets(payload, payload_size, m_inflated)) {
+                m_error = true;
+                return false;
+            }
+            m_inner = ProtoReader(m_inflated.data(), m_inflated.size());
+            m_in_chunk = true;
+            continue;
+        }
+        m_data = reader.data();
+        m_size = reader.size();
+        return true;
+    }
+    return false;
+}
+
+bool PacketClockFields::parse(const ProtoReader& field) {
+    switch (field.field()) {
+        case pb::TracePacket::timestamp:
+            has_timestamp = true;
+            timestamp = field.value();
+            return true;
+        case pb::TracePacket::timestamp_clock_id:
+            clock_id = static_cast<uint32_t>(field.value());
+            return true;
+        case pb::TracePacket::clock_snapshot:
+            snapshot = field.nested();
+            has_snapshot = true;
+            return true;
+        case pb::TracePacket::trace_packet_defaults:
+            defaults = field.nested();
+            has_defaults = true;
+            return true;
+    }
+    return false;
+}
+
+static void add_clocks(SequenceClocks::Sequence& seq, ProtoReader snapshot) {
+    while (snapshot.next()) {
+        if (snapshot.field() != pb::ClockSnapshot::clocks) {
+            continue;
+        }
+        SequenceClocks::Clock clock = {0, false, 1, 0};
+        ProtoReader fields = snapshot.nested();
+        while (fields.next()) {
+            switch (fields.field()) {
+                case pb::ClockSnapshot::Clock::clock_id:
+                    clock.id = static_cast<uint32_t>(fields.value());
+                    break;
+                case pb::ClockSnapshot::Clock::timestamp:
+                    clock.value = fields.value();
+                    break;
+                case pb::ClockSnapshot::Clock::is_incremental:
+                    clock.incremental = fields.value() != 0;
+                    break;
+                case pb::ClockSnapshot::Clock::unit_multiplier_ns:
+                    clock.unit_multiplier_ns = fields.value() ? fields.value() : 1;
+                    break;
+            }
+        }
+        // Builtin clocks count nanoseconds already; only the sequence's own
+        // scale its timestamps
+        if (clock.id < pb::FIRST_SEQUENCE_CLOCK || clock.id > pb::LAST_SEQUENCE_CLOCK) {
+            continue;
+        }
+        auto it = std::find_if(seq.clocks.begin(), seq.clocks.end(),
+                               [&](const SequenceClocks::Clock& c) { return c.id == clock.id; });
+        if (it != seq.clocks.end()) {
+            *it = clock;
+        } else {
+            seq.clocks.push_back(clock);
+        }
+    }
+}
+
+uint64_t SequenceClocks::on_packet(uint64_t sequence_id, bool state_cleared,
+                                   const PacketClockFields& fields) {
+    m_unit_multiplier_ns = 1;
+    if (!state_cleared && !fields.has_snapshot && !fields.has_defaults &&
+            !fields.has_timestamp) {
+        return 0;
+    }
+    Sequence& seq = m_sequences[sequence_id];
+    if (state_cleared) {
+        seq.default_clock = 0;
+    }
+    if (fields.has_snapshot) {
+        add_clocks(seq, fields.snapshot);
+    }
+    if (fields.has_defaults) {
+        ProtoReader defaults = fields.defaults;
+        while (defaults.next()) {
+            if (defaults.field() == pb::TracePacketDefaults::timestamp_clock_id) {
+                seq.default_clock = static_cast<uint32_t>(defaults.value());
+            }
+        }
+    }
+    if (!fields.has_timestamp) {
+        return 0;
+    }
+    uint32_t clock_id = fields.clock_id ? fields.clock_id : seq.default_clock;
+    for (Clock& clock : seq.clocks) {
+        if (clock.id == clock_id) {
+            m_unit_multiplier_ns = clock.unit_multiplier_ns;
+            clock.value = clock.incremental ? clock.value + fields.timestamp : fields.timestamp;
+            return clock.value;
+        }
+    }
+    return fields.timestamp;
+}
+
+} // namespace dvtt
@@ -0,0 +1,127 @@
+#ifndef DVTT_DECODE_H
+#define DVTT_DECODE_H
+
+#include "dvtt_proto.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dvtt {
+
+/**
+ * Read-only contents of a file: mapped where the platform has mmap,
+ * otherwise read into memory
+ */
+class MappedFile {
+public:
+    MappedFile();
+
+    ~MappedFile();
+
+    bool open(const std::string& filename);
+
+    const uint8_t* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t*          m_data;
+    size_t                  m_size;
+    void*                   m_map;
+    std::vector<uint8_t>    m_copy;
+};
+
+// Inflates a compressed_packets payload into 'out'. Always fails when the
+// library was built without zlib.
+bool inflate_packets(const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+
+// Payload of the compressed_packets field of a TracePacket, if it has one
+bool find_compressed_packets(const uint8_t* packet, size_t size,
+                             const uint8_t*& payload, size_t& payload_size);
+
+/**
+ * Walks the TracePackets of a trace in file order, expanding
+ * compressed_packets chunks into the packets they hold
+ */
+class PacketCursor {
+public:
+    PacketCursor(const uint8_t* data, size_t size);
+
+    // Advances to the next packet. Returns false at the end of the trace,
+    // and also if it is malformed or cannot be inflated (see error())
+    bool next();
+
+    const uint8_t* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+    bool error() const { return m_error; }
+
+private:
+    ProtoReader             m_outer;
+    ProtoReader             m_inner;
+    bool                    m_in_chunk;
+    bool                    m_error;
+    const uint8_t*          m_data;
+    size_t                  m_size;
+    std::vector<uint8_t>    m_inflated;
+};
+
+// The timestamp fields of one TracePacket
+struct PacketClockFields {
+    bool has_timestamp = false;
+    uint64_t timestamp = 0;
+    uint32_t clock_id = 0;          // 0: the sequence's default clock
+    ProtoReader snapshot = ProtoReader(nullptr, 0);
+    ProtoReader defaults = ProtoReader(nullptr, 0);
+    bool has_snapshot = false;
+    bool has_defaults = false;
+
+    // Takes 'field' of a TracePacket if it is one of these. Returns false
+    // for other fields.
+    bool parse(const ProtoReader& field);
+};
+
+/**
+ * Clocks of the sequences of a trace, turning packet timestamps into times
+ *
+ * Each sequence defines its clocks in a ClockSnapshot and names its default
+ * one in trace_packet_defaults; both apply from its next incremental state
+ * clear. Packets on an incremental clock carry the time since the previous
+ * one, so packets must be passed in file order (per sequence). Timestamps
+ * on clocks no sequence defined, as in traces without clocks, are taken
+ * as they are.
+ */
+class SequenceClocks {
+public:
+    struct Clock {
+        uint32_t id;
+        bool incremental;
+        uint64_t unit_multiplier_ns;
+        uint64_t value;
+    };
+
+    struct Sequence {
+        uint32_t default_clock = 0;
+        std::vector<Clock> clocks;
+    };
+
+    SequenceClocks() : m_unit_multiplier_ns(1) { }
+
+    // Applies the clock fields of a packet of 'sequence_id' and returns its
+    // time, in its clock's units (0 for packets without a timestamp)
+    uint64_t on_packet(uint64_t sequence_id, bool state_cleared, const PacketClockFields& fields);
+
+    // Nanoseconds per unit of the time on_packet() last returned
+    uint64_t unit_multiplier_ns() const { return m_unit_multiplier_ns; }
+
+    std::unordered_map<uint64_t, Sequence>  m_sequences;
+
+private:
+    uint64_t                                m_unit_multiplier_ns;
+};
+
+} // namespace dvtt
+
+#endif // DVTT_DECODE_H
@@ -0,0 +1,252 @@
+#include "dvtt_format.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+namespace dvtt {
+
+namespace {
+
+const char HEX_DIGITS[] = "0123456789abcdef";
+
+// Two hex digits for every byte value
+struct HexTable {
+    char pairs[256][2];
+
+    constexpr HexTable() : pairs() {
+        for (int i = 0; i < 256; i++) {
+            pairs[i][0] = HEX_DIGITS[i >> 4];
+            pairs[i][1] = HEX_DIGITS[i & 0xF];
+        }
+    }
+};
+
+// Eight binary digits, most significant first, for every byte value
+struct BinTable {
+    char octets[256][8];
+
+    constexpr BinTable() : octets() {
+        for (int i = 0; i < 256; i++) {
+            for (int bit = 0; bit < 8; bit++) {
+                octets[i][bit] = ((i >> (7 - bit)) & 1) ? '1' : '0';
+            }
+        }
+    }
+};
+
+constexpr HexTable HEX_TABLE;
+constexpr BinTable BIN_TABLE;
+
+// Largest power of ten held by one 32-bit limb, and its digit count
+constexpr uint32_t DEC_LIMB_BASE = 1000000000u;
+constexpr size_t DEC_LIMB_DIGITS = 9;
+
+// Limbs kept on the stack; wider vectors fall back to the heap
+constexpr size_t STACK_LIMBS = 64;
+
+// Mask for the valid bits of the most significant byte
+inline uint8_t top_byte_mask(size_t num_bits) {
+    size_t rem = num_bits % 8;
+    return rem ? static_cast<uint8_t>((1u << rem) - 1) : 0xFF;
+}
+
+size_t format_hex(char* out, const uint8_t* bytes, size_t num_bits) {
+    size_t i = (num_bits + 7) / 8;
+    char* p = out;
+    *p++ = '0';
+    *p++ = 'x';
+    if (i) {
+        i--;
+        std::memcpy(p, HEX_TABLE.pairs[bytes[i] & top_byte_mask(num_bits)], 2);
+        p += 2;
+    }
+#if defined(__SSSE3__)
+    // 16 bytes per step: reverse to MSB-first, split nibbles, map to digits
+    const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    const __m128i digits = _mm_loadu_si128(reinterpret_cast<const __m128i*>(HEX_DIGITS));
+    const __m128i low_nibble = _mm_set1_epi8(0x0F);
+    while (i >= 16) {
+        i -= 16;
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i));
+        v = _mm_shuffle_epi8(v, reverse);
+        __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), low_nibble));
+        __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, low_nibble));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 16), _mm_unpackhi_epi8(hi, lo));
+        p += 32;
+    }
+#endif
+    while (i) {
+        i--;
+        std::memcpy(p, HEX_TABLE.pairs[bytes[i]], 2);
+        p += 2;
+    }
+    return p - out;
+}
+
+size_t format_bin(char* out, const uint8_t* bytes, size_t num_bits) {
+    char* p = out;
+    *p++ = '0';
+    *p++ = 'b';
+    size_t i = num_bits / 8;
+    size_t rem = num_bits % 8;
+    if (rem) {
+        // Partial top byte: only its low 'rem' digits
+        std::memcpy(p, BIN_TABLE.octets[bytes[i]] + (8 - rem), rem);
+        p += rem;
+    }
+    while (i) {
+        i--;
+        std::memcpy(p, BIN_TABLE.octets[bytes[i]], 8);
+        p += 8;
+    }
+    return p - out;
+}
+
+// Returns the 3-bit group starting at bit 'pos', ignoring bits >= num_bits
+inline unsigned octal_digit(const uint8_t* bytes, size_t num_bits, size_t pos) {
+    unsigned value = 0;
+    for (size_t b = 0; b < 3 && pos + b < num_bits; b++) {
+        value |= ((bytes[(pos + b) / 8] >> ((pos + b) % 8)) & 1u) << b;
+    }
+    return value;
+}
+
+size_t format_oct(char* out, const uint8_t* bytes, size_t num_bits) {
+    char* p = out;
+    *p++ = '0';
+    *p++ = 'o';
+    size_t digit = (num_bits + 2) / 3;
+    // Skip leading zero digits, keeping at least one
+    while (digit > 1 && octal_digit(bytes, num_bits, (digit - 1) * 3) == 0) {
+        digit--;
+    }
+    while (digit) {
+        digit--;
+        *p++ = static_cast<char>('0' + octal_digit(bytes, num_bits, digit * 3));
+    }
+    return p - out;
+}
+
+size_t format_dec(char* out, const uint8_t* bytes, size_t num_bits, bool is_signed) {
+    size_t num_bytes = (num_bits + 7) / 8;
+    size_t num_limbs = (num_bits + 31) / 32;
+    uint32_t stack_limbs[STACK_LIMBS];
+    std::vector<uint32_t> heap_limbs;
+    uint32_t* limbs = stack_limbs;
+    if (num_limbs > STACK_LIMBS) {
+        heap_limbs.resize(num_limbs);
+        limbs = heap_limbs.data();
+    }
+
+    // Load little-endian limbs with the unused top bits cleared
+    for (size_t i = 0; i < num_limbs; i++) {
+        limbs[i] = 0;
+    }
+    for (size_t i = 0; i < num_bytes; i++) {
+        uint8_t b = (i + 1 == num_bytes) ? (bytes[i] & top_byte_mask(num_bits)) : bytes[i];
+        limbs[i / 4] |= static_cast<uint32_t>(b) << (8 * (i % 4));
+    }
+
+    char* p = out;
+    if (is_signed && num_bits &&
+        ((bytes[(num_bits - 1) / 8] >> ((num_bits - 1) % 8)) & 1)) {
+        // Negative: take the magnitude by two's complement within num_bits
+        *p++ = '-';
+        uint64_t carry = 1;
+        for (size_t i = 0; i < num_limbs; i++) {
+            uint64_t v = static_cast<uint64_t>(~limbs[i]) + carry;
+            limbs[i] = static_cast<uint32_t>(v);
+            carry = v >> 32;
+        }
+        size_t rem = num_bits % 32;
+        if (rem) {
+            limbs[num_limbs - 1] &= (1u << rem) - 1;
+        }
+    }
+
+    // Peel off base-1e9 groups, least significant first, into the tail of
+    // the output; then move them into place
+    char digits[DEC_LIMB_DIGITS];
+    char* end = out + format_bits_max(num_bits, DVTT_RADIX_DEC);
+    char* q = end;
+    size_t top = num_limbs;
+    while (top && limbs[top - 1] == 0) {
+        top--;
+    }
+    do {
+        uint64_t rem = 0;
+        for (size_t i = top; i > 0; i--) {
+            uint64_t cur = (rem << 32) | limbs[i - 1];
+            limbs[i - 1] = static_cast<uint32_t>(cur / DEC_LIMB_BASE);
+            rem = cur % DEC_LIMB_BASE;
+        }
+        while (top && limbs[top - 1] == 0) {
+            top--;
+        }
+        uint32_t group = static_cast<uint32_t>(rem);
+        size_t n = 0;
+        do {
+            digits[DEC_LIMB_DIGITS - 1 - n++] = static_cast<char>('0' + group % 10);
+            group /= 10;
+        } while (group);
+        if (top) {
+            // Inner groups keep their leading zeros
+            while (n < DEC_LIMB_DIGITS) {
+                digits[DEC_LIMB_DIGITS - 1 - n++] = '0';
+            }
+        }
+        q -= n;
+        std::memcpy(q, digits + DEC_LIMB_DIGITS - n, n);
+    } while (top);
+
+    size_t len = end - q;
+    std::memmove(p, q, len);
+    return (p - out) + len;
+}
+
+} // namespace
+
+size_t format_bits_max(size_t num_bits, dvtt_radix_t radix) {
+    switch (radix) {
+        case DVTT_RADIX_BIN:
+            return 2 + num_bits;
+        case DVTT_RADIX_OCT:
+            return 2 + (num_bits + 2) / 3 + 1;
+        case DVTT_RADIX_DEC:
+        case DVTT_RADIX_UNSIGNED:
+            // log10(2) < 0.30103; plus sign, rounding and a full last group
+            return 1 + (num_bits * 30103) / 100000 + 1 + DEC_LIMB_DIGITS;
+        default:
+            return 2 + 2 * ((num_bits + 7) / 8);
+    }
+}
+
+size_t format_bits(char* out, const void* bits, size_t num_bits, dvtt_radix_t radix) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(bits);
+    switch (radix) {
+        case DVTT_RADIX_BIN:
+            return format_bin(out, bytes, num_bits);
+        case DVTT_RADIX_OCT:
+            return format_oct(out, bytes, num_bits);
+        case DVTT_RADIX_DEC:
+            return format_dec(out, bytes, num_bits, true);
+        case DVTT_RADIX_UNSIGNED:
+            return format_dec(out, bytes, num_bits, false);
+        case DVTT_RADIX_HEX:
+        default:
+            return format_hex(out, bytes, num_bits);
+    }
+}
+
+std::string bits_to_string(const void* bits, size_t num_bits, dvtt_radix_t radix) {
+    std::string out(format_bits_max(num_bits, radix), '\0');
+    out.resize(format_bits(&out[0], bits, num_bits, radix));
+    return out;
+}
+
+} // namespace dvtt
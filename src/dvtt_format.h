@@ -0,0 +1,33 @@
+#ifndef DVTT_FORMAT_H
+#define DVTT_FORMAT_H
+
+#include "include/dvtt.h"
+#include <cstddef>
+#include <string>
+
+namespace dvtt {
+
+/**
+ * Returns an upper bound on the characters format_bits() writes for a
+ * vector of 'num_bits' bits in 'radix'
+ */
+size_t format_bits_max(size_t num_bits, dvtt_radix_t radix);
+
+/**
+ * Formats a bit vector (packed bytes, LSB first) into 'out'
+ *
+ * HEX and BIN print every bit position, most significant first, with a
+ * 0x/0b prefix. OCT prints the minimal number of digits with a 0o prefix.
+ * DEC treats the vector as a two's complement value of 'num_bits' bits,
+ * UNSIGNED as an unsigned one. Other radixes fall back to HEX. Bits above
+ * 'num_bits' in the last byte are ignored. No terminator is written.
+ *
+ * @return Number of characters written, at most format_bits_max()
+ */
+size_t format_bits(char* out, const void* bits, size_t num_bits, dvtt_radix_t radix);
+
+std::string bits_to_string(const void* bits, size_t num_bits, dvtt_radix_t radix);
+
+} // namespace dvtt
+
+#endif // DVTT_FORMAT_H
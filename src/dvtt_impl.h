@@ -2,13 +2,57 @@
 #define DVTT_IMPL_H
 
 #include "include/dvtt.h"
+#include "dvtt_compress.h"
+#include "dvtt_format.h"
+#include "dvtt_intern.h"
+#include "dvtt_mmap.h"
+#include "dvtt_pool.h"
+#include "dvtt_registry.h"
+#include "dvtt_reorder.h"
+#include "dvtt_writer.h"
 #include <string>
 #include <vector>
-#include <map>
 #include <memory>
 #include <cstdio>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 
 namespace dvtt {
+struct TraceImpl;
+struct StreamImpl;
+struct TransactionImpl;
+struct CounterImpl;
+struct SchemaImpl;
+}
+
+// C API structures
+struct dvtt_trace_s {
+    dvtt::TraceImpl* impl;
+};
+
+struct dvtt_stream_s {
+    dvtt::StreamImpl* impl;
+};
+
+struct dvtt_transaction_s {
+    dvtt::TransactionImpl* impl;
+};
+
+struct dvtt_counter_s {
+    dvtt::CounterImpl* impl;
+};
+
+struct dvtt_schema_s {
+    dvtt::SchemaImpl* impl;
+};
+
+namespace dvtt {
+
+struct SequenceImpl;
 
 enum ObjectState {
     STATE_OPEN,
@@ -16,19 +60,218 @@ enum ObjectState {
     STATE_FREED
 };
 
-struct DebugAnnotation {
+/**
+ * Attributes of one transaction, encoded as they are added
+ *
+ * Each attribute is a record holding its name and its encoded
+ * DebugAnnotation value field, each prefixed by a 32-bit length. Names are
+ * interned only when the transaction is emitted, because iids depend on the
+ * sequence state at that point. Attributes added from a schema name their
+ * field instead, whose iid the emitting sequence caches. Buffers are pooled
+ * per trace and keep their capacity, so in steady state adding an attribute
+ * does not allocate.
+ */
+class AttrBuffer : public ProtoWriter {
+public:
+    AttrBuffer() : pool_next(nullptr), owner(nullptr) { }
+
+    // Starts the record for attribute 'name' followed by 'suffix'. The
+    // value field is written next; returns a bookmark for end_attr()
+    size_t begin_attr(const char* name, const char* suffix = "") {
+        size_t name_len = std::strlen(name);
+        size_t suffix_len = std::strlen(suffix);
+        write_length(name_len + suffix_len);
+        write_raw(name, name_len);
+        write_raw(suffix, suffix_len);
+        size_t bookmark = m_buf.size();
+        grow(sizeof(uint32_t));
+        return bookmark;
+    }
+
+    // As above, for a name already carrying its suffix
+    size_t begin_attr(const std::string& name) {
+        write_length(name.size());
+        write_raw(name.data(), name.size());
+        size_t bookmark = m_buf.size();
+        grow(sizeof(uint32_t));
+        return bookmark;
+    }
+
+    // As above, for field 'field' of 'schema', written in place of the name
+    size_t begin_attr(const SchemaImpl* schema, uint32_t field) {
+        write_length(SCHEMA_FIELD);
+        std::memcpy(grow(sizeof(schema)), &schema, sizeof(schema));
+        write_length(field);
+        size_t bookmark = m_buf.size();
+        grow(sizeof(uint32_t));
+        return bookmark;
+    }
+
+    void end_attr(size_t bookmark) {
+        uint32_t len = static_cast<uint32_t>(m_buf.size() - bookmark - sizeof(uint32_t));
+        std::memcpy(&m_buf[bookmark], &len, sizeof(len));
+    }
+
+    // Writes 'data' as a lowercase hex string field without a temporary
+    void write_hex_field(uint32_t field_number, const void* data, size_t size) {
+        static const char digits[] = "0123456789abcdef";
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        write_tag(field_number, LENGTH_DELIMITED);
+        write_varint(size * 2);
+        uint8_t* p = grow(size * 2);
+        for (size_t i = 0; i < size; i++) {
+            p[2 * i] = digits[bytes[i] >> 4];
+            p[2 * i + 1] = digits[bytes[i] & 0xF];
+        }
+    }
+
+    // Writes a bit vector as a formatted string field, in place
+    void write_bits_field(uint32_t field_number, const void* bits, size_t num_bits,
+                          dvtt_radix_t radix) {
+        size_t str = begin_nested(field_number);
+        size_t pos = m_buf.size();
+        char* p = reinterpret_cast<char*>(grow(format_bits_max(num_bits, radix)));
+        m_buf.resize(pos + format_bits(p, bits, num_bits, radix));
+        end_nested(str);
+    }
+
+    // Writes a bit vector as numbers, leaving formatting to the viewer.
+    // Up to 64 bits become a single value (signed for DVTT_RADIX_DEC);
+    // wider vectors become an array of 64-bit words, least significant first.
+    void write_bits_raw(const void* bits, size_t num_bits, dvtt_radix_t radix) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(bits);
+        size_t num_words = (num_bits + 63) / 64;
+        if (num_words <= 1) {
+            uint64_t value = load_word(bytes, num_bits, 0);
+            if (radix == DVTT_RADIX_DEC && num_bits && num_bits < 64 &&
+                    ((value >> (num_bits - 1)) & 1)) {
+                value |= ~uint64_t(0) << num_bits;
+            }
+            if (radix == DVTT_RADIX_DEC) {
+                write_int64_field(pb::DebugAnnotation::int_value, static_cast<int64_t>(value));
+            } else {
+                write_uint64_field(pb::DebugAnnotation::uint_value, value);
+            }
+            return;
+        }
+        for (size_t i = 0; i < num_words; i++) {
+            size_t word = begin_nested(pb::DebugAnnotation::array_values);
+            write_uint64_field(pb::DebugAnnotation::uint_value, load_word(bytes, num_bits, i));
+            end_nested(word);
+        }
+    }
+
+    // Calls f(name, schema, field, value, value_size) for each attribute in
+    // insertion order. 'schema' is NULL unless the attribute was added from
+    // a schema, in which case 'name' is empty
+    template <typename F> void for_each(F f) const {
+        const uint8_t* p = m_buf.data();
+        const uint8_t* end = p + m_buf.size();
+        while (p < end) {
+            uint32_t name_len, value_len;
+            std::memcpy(&name_len, p, sizeof(name_len));
+            p += sizeof(name_len);
+            std::string_view name;
+            const SchemaImpl* schema = nullptr;
+            uint32_t field = 0;
+            if (name_len == SCHEMA_FIELD) {
+                std::memcpy(&schema, p, sizeof(schema));
+                p += sizeof(schema);
+                std::memcpy(&field, p, sizeof(field));
+                p += sizeof(field);
+            } else {
+                name = std::string_view(reinterpret_cast<const char*>(p), name_len);
+                p += name_len;
+            }
+            std::memcpy(&value_len, p, sizeof(value_len));
+            p += sizeof(value_len);
+            f(name, schema, field, p, value_len);
+            p += value_len;
+        }
+    }
+
+    AttrBuffer* pool_next;
+    SequenceImpl* owner;         // Sequence whose pool this buffer belongs to
+
+private:
+    // Name length marking a record that names a schema field
+    static constexpr uint32_t SCHEMA_FIELD = UINT32_MAX;
+
+    // Returns 64-bit word 'index' of the vector with bits >= num_bits cleared
+    static uint64_t load_word(const uint8_t* bytes, size_t num_bits, size_t index) {
+        size_t first = index * 8;
+        size_t num_bytes = (num_bits + 7) / 8;
+        size_t n = num_bytes - first < 8 ? num_bytes - first : 8;
+        uint64_t value = 0;
+        for (size_t i = 0; i < n; i++) {
+            value |= static_cast<uint64_t>(bytes[first + i]) << (8 * i);
+        }
+        size_t valid = num_bits - index * 64;
+        if (valid < 64) {
+            value &= (uint64_t(1) << valid) - 1;
+        }
+        return value;
+    }
+
+    void write_length(size_t len) {
+        uint32_t len32 = static_cast<uint32_t>(len);
+        std::memcpy(grow(sizeof(len32)), &len32, sizeof(len32));
+    }
+};
+
+// Flows written with a transaction's slice (see dvtt_add_link): links made
+// while both ends were open, and links ending here whose other end had
+// already closed
+struct SliceLinks {
+    std::vector<uint64_t> flow_ids;
+    std::vector<uint64_t> terminating_flow_ids;
+    uint64_t anchor;             // link_anchor_flow(id) once requested, else 0
+    
+    SliceLinks() : anchor(0) { }
+    
+    bool empty() const {
+        return flow_ids.empty() && terminating_flow_ids.empty() && !anchor;
+    }
+    
+    // Both keep the vectors' capacity
+    void clear_flows() {
+        flow_ids.clear();
+        terminating_flow_ids.clear();
+    }
+    
+    void clear() {
+        clear_flows();
+        anchor = 0;
+    }
+    
+    void swap(SliceLinks& other) {
+        flow_ids.swap(other.flow_ids);
+        terminating_flow_ids.swap(other.terminating_flow_ids);
+        std::swap(anchor, other.anchor);
+    }
+};
+
+// Child tracks under one parent track for children of one name. A lane is
+// reused once its last occupant has ended, so a parent ends up with about
+// as many lanes as it has such children open at once.
+struct ChildLanes {
+    struct Lane {
+        uint64_t uuid;
+        dvtt_time_t end_time;    // End of the latest occupant
+        uint32_t segment;        // Rotation segment last described in, or NO_SEGMENT
+    };
+    
+    uint64_t parent_uuid;
     std::string name;
-    dvtt_attr_type_t type;
-    dvtt_radix_t radix;
-    union {
-        int64_t i64;
-        uint64_t u64;
-        double d;
-    } numeric_value;
-    std::string string_value;
-    std::vector<uint8_t> blob_value;
+    std::vector<Lane> lanes;
+    std::vector<uint32_t> idle;  // Unoccupied lanes, most recently released last
+    std::unique_ptr<ChildLanes> next;  // Next name under the same parent
 };
 
+constexpr uint32_t NO_SEGMENT = UINT32_MAX;
+
+struct TransactionNode;
+
 struct TransactionImpl {
     uint64_t id;
     std::string name;
@@ -37,14 +280,45 @@ struct TransactionImpl {
     dvtt_time_t end_time;
     ObjectState state;
     dvtt_stream_s* stream;
-    int handle;
+    dvtt_transaction_s* self;    // Handle returned to the caller
+    TransactionNode* node;       // Pool element holding this transaction
+    int handle;                  // Registry handle, 0 until first requested
     
-    dvtt_transaction_s* parent;  // Parent transaction (NULL if root)
+    // Parent's track, captured at open so the parent may be freed first
+    // (0 if root)
+    uint64_t parent_track_uuid;
     uint64_t track_uuid;         // Track UUID (may be shared with parent or unique)
+    ChildLanes* lanes;           // Lanes of child transactions, else NULL
+    uint32_t lane;               // Lane held while open
     
-    std::vector<DebugAnnotation> attributes;
-    std::vector<uint64_t> flow_ids;
-    bool attributes_batch_mode;
+    // Position in StreamImpl::transactions while open
+    size_t stream_index;
+    
+    // Emitted at close and released immediately afterwards
+    AttrBuffer* attributes;      // NULL until the first attribute is added
+    SliceLinks links;            // Cleared at close; pooled nodes keep the capacity
+    
+    // Reorder window fallbacks: begin already written, or to be written
+    // at close out of order
+    bool begun;
+    bool unsorted;
+
+};
+
+// Pool element: the caller-visible handle and its implementation share
+// one allocation and are recycled together
+struct TransactionNode {
+    dvtt_transaction_s handle;
+    TransactionImpl impl;
+    TransactionNode* pool_next;
+    SequenceImpl* owner;         // Sequence whose pool this node belongs to
+    
+    TransactionNode() : pool_next(nullptr), owner(nullptr) {
+        handle.impl = nullptr;
+        impl.state = STATE_FREED;
+        impl.handle = 0;
+        impl.attributes = nullptr;
+    }
 };
 
 struct StreamImpl {
@@ -54,62 +328,297 @@ struct StreamImpl {
     std::string type_name;
     ObjectState state;
     dvtt_trace_s* trace;
-    int handle;
+    dvtt_stream_s* self;         // Handle returned to the caller
+    int handle;                  // Registry handle, 0 until first requested
+    
+    // Next live stream with the same scope and name, in open order
+    // (TraceImpl::stream_index)
+    StreamImpl* next_same_key;
     
+    // Currently-open transactions only
     std::vector<TransactionImpl*> transactions;
+    
+    // Counter tracks shown under the stream, and attribute schemas
+    // registered on it, freed with the trace
+    std::vector<CounterImpl*> counters;
+    std::vector<SchemaImpl*> schemas;
+    
+    // Lanes of child transactions opened on the stream, by parent track
+    std::unordered_map<uint64_t, std::unique_ptr<ChildLanes>> child_lanes;
+    
+    // Early-reject state, checked before a transaction is allocated.
+    // 'filtered' is set whenever any of it may reject, so unfiltered
+    // streams pay a single test
+    std::atomic<bool> enabled;
+    std::atomic<bool> filtered;
+    bool described;              // Track descriptor written
+    uint32_t sample_one_in;
+    uint32_t sample_count;
+    dvtt_time_t sample_start;
+    dvtt_time_t sample_end;      // 0: unbounded
+};
+
+// Counter track opened with dvtt_open_counter(), nested under its stream
+struct CounterImpl {
+    uint64_t uuid;
+    std::string name;
+    std::string unit;
+    StreamImpl* stream;
+    dvtt_counter_s* self;        // Handle returned to the caller
+    bool described;              // Track descriptor written
+    bool coalesce;               // Drop samples repeating the last value
+    
+    // Last value written: its bits and whether it was a double
+    bool has_value;
+    bool is_double;
+    uint64_t last_bits;
+};
+
+// Attribute schema registered with dvtt_register_schema(). Each field's
+// kind and its place in the packed value are worked out at registration,
+// so adding the attributes is a single pass with no string handling.
+struct SchemaImpl {
+    enum Kind {
+        KIND_UINT,
+        KIND_INT,                // DVTT_RADIX_DEC, sign-extended from the field width
+        KIND_DOUBLE,
+        KIND_STRING,             // Registered name id
+        KIND_BITS                // Wider than 64 bits
+    };
+    struct Field {
+        std::string name;        // With the radix suffix
+        dvtt_radix_t radix;
+        Kind kind;
+        uint32_t offset;         // Least significant bit in the packed value
+        uint32_t num_bits;
+    };
+    
+    std::vector<Field> fields;
+    size_t num_words;            // Words in the packed value
+    uint32_t index;              // Registration order within the trace
+    StreamImpl* stream;
+    dvtt_schema_s* self;         // Handle returned to the caller
+};
+
+// A closed transaction whose events wait in the reorder window. It holds
+// what the events need, so the transaction itself can be freed meanwhile.
+// Pooled per sequence like transactions.
+struct PendingSlice {
+    uint64_t track_uuid;
+    dvtt_time_t start_time;
+    dvtt_time_t end_time;
+    std::string name;
+    std::string type_name;
+    AttrBuffer* attributes;      // Taken over from the transaction, or NULL
+    SliceLinks links;
+    bool begun;                  // Begin already written; attributes and links go on the end
+    PendingSlice* pool_next;
+    
+    PendingSlice() : attributes(nullptr), pool_next(nullptr) { }
+};
+
+// Enable rule set with dvtt_set_scope_enabled()
+struct ScopeRule {
+    std::string pattern;
+    bool enabled;
+};
+
+// A Perfetto packet sequence: one writer plus the incremental state that
+// packets on the sequence refer to. In multi-threaded traces each producer
+// thread has its own, so encoding never contends.
+struct SequenceImpl {
+    uint32_t sequence_id;
+    PacketWriter* writer;
+    
+    InternTable event_names;
+    InternTable event_categories;
+    InternTable debug_annotation_names;
+    
+    // Bumped whenever the tables are cleared. The debug annotation name
+    // iids of each schema's fields, by SchemaImpl::index, are kept while
+    // their generation matches; a zero iid is not interned yet.
+    uint32_t intern_generation;
+    struct SchemaNameIids {
+        uint32_t generation;
+        std::vector<uint64_t> iids;
+    };
+    std::vector<SchemaNameIids> schema_name_iids;
+    
+    // Set when the incremental state must be (re)announced before the
+    // next packet, e.g. at start or after a chunk was dropped
+    bool state_reset_pending;
+    bool packets_lost;
+    
+    // Flight recorder: every chunk restarts the incremental state, so any
+    // run of retained chunks decodes on its own
+    bool chunk_local_state;
+    
+    // Timestamps: the latest time written on the incremental clock, which
+    // restarts from 0 with the incremental state, and the trace's time
+    // unit in nanoseconds (copied here for the packet path)
+    dvtt_time_t clock_time;
+    uint64_t unit_multiplier_ns;
+    
+    // Checkpoints (flush_time and flush_packets options, copied here for
+    // the packet path): the time the next one is due at and the packets
+    // left until the next one
+    dvtt_time_t flush_time;
+    uint64_t flush_packets;
+    bool flush_sync;
+    dvtt_time_t next_checkpoint_time;
+    uint64_t packets_to_checkpoint;
+    
+    // Strings first interned by the packet being encoded
+    struct PendingIntern {
+        uint32_t field;
+        uint64_t iid;
+        std::string_view str;
+    };
+    std::vector<PendingIntern> pending_interns;
+    
+    // Transactions opened and attribute buffers taken on this sequence's
+    // thread. Objects freed elsewhere are returned with release_remote().
+    SlabPool<TransactionNode> transaction_pool;
+    SlabPool<AttrBuffer, 64> attr_pool;
+    
+    // Scratch reused by dvtt_record_transactions(): one record's attributes
+    // and the track of each record in the batch (0 if not written)
+    AttrBuffer batch_attrs;
+    std::vector<uint64_t> batch_tracks;
+    
+    // Scratch for a schema field wider than 64 bits, realigned to bit 0
+    std::vector<uint32_t> schema_bits;
+    
+    // Reorder window: queued slice events, ranked so that at equal times
+    // ends of earlier slices come first; open transactions by start time
+    // (entries of closed or recycled transactions are skipped lazily); and
+    // the latest time seen
+    TimeHeap<PendingSlice> reorder_events;
+    TimeHeap<TransactionImpl> reorder_open;
+    dvtt_time_t reorder_now;
+    SlabPool<PendingSlice, 64> slice_pool;
+    
+    // Self-instrumentation (dvtt_get_trace_stats): packets encoded, the
+    // estimated encode time, strings in the intern tables, and transactions
+    // opened, closed and freed by this thread. 'encode_start' is set while
+    // a sampled packet is being encoded.
+    StatCounter packets;
+    StatCounter encode_ns;
+    StatCounter interned_strings;
+    StatCounter opened;
+    StatCounter closed;
+    StatCounter freed;
+    uint64_t encode_start;
+};
+
+// (scope, name) of a stream, viewing the stream's own strings
+typedef std::pair<std::string_view, std::string_view> StreamKey;
+
+struct StreamKeyHash {
+    size_t operator()(const StreamKey& key) const {
+        size_t h = std::hash<std::string_view>()(key.first);
+        return h ^ (std::hash<std::string_view>()(key.second) + 0x9E3779B97F4A7C15ull +
+                    (h << 6) + (h >> 2));
+    }
 };
 
 struct TraceImpl {
     std::string filename;
     std::string name;
     std::string time_units;
-    FILE* output_file;
-    uint64_t sequence_id;
+    uint64_t unit_multiplier_ns;  // Parsed from time_units at creation
+    dvtt_trace_options_t options;
+    Sink* sink;
+    RingSink* flight_recorder;   // Innermost sink when flight_recorder_bytes is set
+    AsyncSink* async_writer;     // Outermost sink when async_writer is set
+    size_t chunk_size;
     uint32_t clock_id;
     
+    // Distinguishes this trace from a later one allocated at the same address
+    uint64_t serial;
+    
+    // Current output file when rotating: its index, the writer's byte
+    // count when it started and the rotate_time window it covers
+    uint32_t segment;
+    uint64_t segment_start_bytes;
+    dvtt_time_t segment_window;
+    
+    // Sequence of the thread that created the trace; the only one unless
+    // the multi_thread option is set
+    SequenceImpl* sequence;
+    
+    // Guards the members below in multi-threaded traces
+    std::mutex mutex;
+    std::vector<SequenceImpl*> sequences;
+    std::unordered_map<std::thread::id, SequenceImpl*> thread_sequences;
     std::vector<StreamImpl*> streams;
-    std::map<int, StreamImpl*> stream_handles;
-    std::map<int, TransactionImpl*> transaction_handles;
+    std::vector<ScopeRule> scope_rules;
+    
+    // Earliest stream opened with each (scope, name) and not yet freed,
+    // for dvtt_find_or_open_stream(); later ones follow its next_same_key.
+    // Keys view the strings of the stream they map to.
+    std::unordered_map<StreamKey, StreamImpl*, StreamKeyHash> stream_index;
     
-    int next_stream_handle;
-    int next_transaction_handle;
-    uint64_t next_track_uuid;
-    uint64_t next_transaction_id;
-    uint64_t next_flow_id;
+    // Names registered for use by id (dvtt_register_name)
+    NameTable names;
+    
+    // stats_interval: time at which the counters are next written, and the
+    // uuid of the "dvtt" group track, whose counter tracks follow it
+    std::atomic<dvtt_time_t> next_stats_time;
+    uint64_t stats_track_uuid;
+    std::atomic<bool> stats_described;
+    
+    std::atomic<uint32_t> next_sequence_id;
+    std::atomic<uint64_t> next_track_uuid;
+    std::atomic<uint64_t> next_transaction_id;
+    std::atomic<uint64_t> next_flow_id;
+    std::atomic<uint32_t> next_schema_index;
 };
 
-// Protobuf writer functions
-void write_varint(FILE* f, uint64_t value);
-void write_tag(FILE* f, uint32_t field_number, uint32_t wire_type);
-void write_length_delimited(FILE* f, uint32_t field_number, const void* data, size_t size);
-void write_string_field(FILE* f, uint32_t field_number, const std::string& str);
-void write_uint64_field(FILE* f, uint32_t field_number, uint64_t value);
-void write_int64_field(FILE* f, uint32_t field_number, int64_t value);
-void write_double_field(FILE* f, uint32_t field_number, double value);
+// Returns the calling thread's sequence on 'trace', creating it on first use
+SequenceImpl* current_sequence(TraceImpl* trace);
+
+// Name of output file 'index' of a rotated trace
+std::string segment_filename(const std::string& filename, uint32_t index);
+
+// Sequence-scoped clocks each sequence defines in its ClockSnapshot, both
+// counting trace time units. Packets no earlier than the previous one carry
+// the difference on the incremental clock, the sequence's default; earlier
+// ones carry their absolute time on the other.
+constexpr uint32_t CLOCK_INCREMENTAL = pb::FIRST_SEQUENCE_CLOCK;
+constexpr uint32_t CLOCK_ABSOLUTE = pb::FIRST_SEQUENCE_CLOCK + 1;
+
+// Nanoseconds per unit of a time_units string such as "10ns"; 1 for units
+// that are not a whole number of nanoseconds, and for unrecognized ones
+uint64_t parse_unit_multiplier_ns(const char* time_units);
+
+// With id_namespace set, uuids and transaction and flow ids are allocated
+// from id_namespace << ID_NAMESPACE_SHIFT, sequence ids from
+// id_namespace << SEQUENCE_NAMESPACE_SHIFT
+constexpr uint32_t MAX_ID_NAMESPACE = 0xFFFF;
+constexpr unsigned ID_NAMESPACE_SHIFT = 40;
+constexpr unsigned SEQUENCE_NAMESPACE_SHIFT = 16;
+
+// Flow id anchoring transaction 'id' for links made after it closes. The
+// top bit keeps it apart from flow ids allocated from next_flow_id
+inline uint64_t link_anchor_flow(uint64_t id) {
+    return id | (uint64_t(1) << 63);
+}
 
 // Helper functions
-std::string format_radix_name(const std::string& name, dvtt_radix_t radix);
-std::string bits_to_string(const void* bits, size_t num_bits, dvtt_radix_t radix);
-void emit_clock_snapshot(TraceImpl* trace);
+const char* radix_suffix(dvtt_radix_t radix);
+void encode_attributes(SequenceImpl* seq, const AttrBuffer& attrs);
 void emit_track_descriptor(TraceImpl* trace, StreamImpl* stream);
 void emit_track_descriptor(TraceImpl* trace, TransactionImpl* txn);
 void emit_track_event_begin(TraceImpl* trace, TransactionImpl* txn);
 void emit_track_event_end(TraceImpl* trace, TransactionImpl* txn);
 
-} // namespace dvtt
-
-// C API structures
-struct dvtt_trace_s {
-    dvtt::TraceImpl* impl;
-};
-
-struct dvtt_stream_s {
-    dvtt::StreamImpl* impl;
-};
+// Transaction lifecycle
+TransactionImpl* alloc_transaction(TraceImpl* trace);
+AttrBuffer* attribute_buffer(TransactionImpl* txn);
+void release_transaction(TraceImpl* trace, TransactionImpl* txn);
 
-struct dvtt_transaction_s {
-    dvtt::TransactionImpl* impl;
-};
+} // namespace dvtt
 
 // Global state
 extern thread_local dvtt_error_t g_last_error;
@@ -0,0 +1,139 @@
+#ifndef DVTT_INTERN_H
+#define DVTT_INTERN_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace dvtt {
+
+// Entries per table after which the sequence's incremental state is reset,
+// bounding memory when callers use unique names
+constexpr size_t MAX_INTERN_ENTRIES = 64 * 1024;
+
+/**
+ * String-to-iid table for one kind of interned data on one packet sequence
+ *
+ * Perfetto iids must be non-zero and unique within a table for the
+ * lifetime of the sequence's incremental state.
+ */
+class InternTable {
+public:
+    InternTable() : m_next_iid(1) { }
+
+    // Returns the iid for 'str'. 'added' is set when the string is new and
+    // its definition must be emitted before, or with, its first use.
+    uint64_t intern(std::string_view str, bool& added) {
+        auto it = m_map.find(str);
+        if (it != m_map.end()) {
+            added = false;
+            return it->second;
+        }
+        m_storage.emplace_back(str);
+        uint64_t iid = m_next_iid++;
+        m_map.emplace(std::string_view(m_storage.back()), iid);
+        added = true;
+        return iid;
+    }
+
+    void clear() {
+        m_map.clear();
+        m_storage.clear();
+        m_next_iid = 1;
+    }
+
+    size_t size() const { return m_map.size(); }
+
+private:
+    // Keys view into m_storage; deque growth never moves existing strings
+    std::unordered_map<std::string_view, uint64_t>  m_map;
+    std::deque<std::string>                         m_storage;
+    uint64_t                                        m_next_iid;
+};
+
+/**
+ * Trace-wide table of registered names, addressed by small integer ids
+ *
+ * Lets callers that pay for every string argument (DPI, ctypes) pass a
+ * name once and refer to it by id afterwards. Ids start at 1 and stay
+ * valid for the lifetime of the table. Registration takes a mutex; lookup
+ * is lock-free and may race with registration from another thread.
+ */
+class NameTable {
+public:
+    NameTable() : m_size(0) {
+        for (uint32_t i = 0; i < NUM_SEGMENTS; i++) {
+            m_segments[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~NameTable() {
+        for (uint32_t i = 0; i < NUM_SEGMENTS; i++) {
+            delete m_segments[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    NameTable(const NameTable&) = delete;
+    NameTable& operator=(const NameTable&) = delete;
+
+    // Returns the id of 'name', registering it if new; 0 if the table is full
+    uint32_t add(std::string_view name) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_map.find(name);
+        if (it != m_map.end()) {
+            return it->second;
+        }
+        uint32_t index = m_size.load(std::memory_order_relaxed);
+        if (index >= NUM_SEGMENTS * SEGMENT_SIZE) {
+            return 0;
+        }
+        Segment* seg = m_segments[index >> SEGMENT_BITS].load(std::memory_order_relaxed);
+        if (!seg) {
+            seg = new Segment;
+            m_segments[index >> SEGMENT_BITS].store(seg, std::memory_order_relaxed);
+        }
+        m_storage.emplace_back(name);
+        seg->names[index & SEGMENT_MASK] = m_storage.back().c_str();
+        m_map.emplace(std::string_view(m_storage.back()), index + 1);
+        // Publishes the slot and its segment to lookup()
+        m_size.store(index + 1, std::memory_order_release);
+        return index + 1;
+    }
+
+    // Returns the NUL-terminated name registered as 'id', or nullptr
+    const char* lookup(uint32_t id) const {
+        if (id == 0 || id > m_size.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        uint32_t index = id - 1;
+        return m_segments[index >> SEGMENT_BITS].load(std::memory_order_relaxed)
+            ->names[index & SEGMENT_MASK];
+    }
+
+    size_t size() const { return m_size.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr uint32_t SEGMENT_BITS = 10;
+    static constexpr uint32_t SEGMENT_SIZE = 1u << SEGMENT_BITS;
+    static constexpr uint32_t SEGMENT_MASK = SEGMENT_SIZE - 1;
+    static constexpr uint32_t NUM_SEGMENTS = 1024;
+
+    struct Segment {
+        const char* names[SEGMENT_SIZE];
+    };
+
+    // Segments are allocated on demand and kept until the table is destroyed
+    std::atomic<Segment*>                           m_segments[NUM_SEGMENTS];
+    std::atomic<uint32_t>                           m_size;
+    std::mutex                                      m_mutex;
+    std::unordered_map<std::string_view, uint32_t>  m_map;
+    std::deque<std::string>                         m_storage;
+};
+
+} // namespace dvtt
+
+#endif // DVTT_INTERN_H
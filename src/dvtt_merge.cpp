@@ -0,0 +1,221 @@
+#include "dvtt_merge.h"
+#include "dvtt_compress.h"
+#include "dvtt_decode.h"
+#include "dvtt_writer.h"
+#include <memory>
+#include <queue>
+#include <unordered_map>
+
+namespace dvtt {
+
+constexpr size_t DEFAULT_MERGE_CHUNK_SIZE = 64 * 1024;
+
+constexpr uint64_t ANCHOR_FLOW_BIT = uint64_t(1) << 63;
+
+/**
+ * Moves the ids of input i of n to ids congruent to i modulo n.
+ * Interleaving keeps the small ids of an unnamespaced trace small, so they
+ * still encode in a byte or two.
+ */
+class IdRemap {
+public:
+    IdRemap(size_t input, size_t num_inputs, uint32_t& next_sequence_id) :
+        m_input(input), m_stride(num_inputs), m_next_sequence_id(next_sequence_id) { }
+
+    uint64_t uuid(uint64_t uuid) const {
+        return uuid ? uuid * m_stride + m_input : 0;
+    }
+
+    // Anchor flows (see link_anchor_flow) keep their top bit
+    uint64_t flow(uint64_t id) const {
+        return ((id & ~ANCHOR_FLOW_BIT) * m_stride + m_input) | (id & ANCHOR_FLOW_BIT);
+    }
+
+    uint64_t sequence(uint64_t id) {
+        auto it = m_sequences.find(id);
+        if (it == m_sequences.end()) {
+            it = m_sequences.emplace(id, m_next_sequence_id++).first;
+        }
+        return it->second;
+    }
+
+private:
+    uint64_t                                m_input;
+    uint64_t                                m_stride;
+    uint32_t&                               m_next_sequence_id;
+    std::unordered_map<uint64_t, uint64_t>  m_sequences;
+};
+
+// Copies the fields of 'msg' to 'out', passing those 'rewrite' handles
+// through it; rewrite(field, out) returns false to copy a field unchanged
+template <typename F> static void copy_fields(ProtoReader msg, ProtoWriter& out, F rewrite) {
+    const uint8_t* start = msg.position();
+    while (msg.next()) {
+        if (!rewrite(msg, out)) {
+            out.write_raw(start, static_cast<size_t>(msg.position() - start));
+        }
+        start = msg.position();
+    }
+}
+
+// Writes 'packet' to 'out' as a Trace.packet, with its ids remapped
+static void write_remapped(const uint8_t* packet, size_t size, IdRemap& remap, ProtoWriter& out) {
+    size_t msg = out.begin_nested(pb::Trace::packet);
+    copy_fields(ProtoReader(packet, size), out, [&](const ProtoReader& field, ProtoWriter& w) {
+        switch (field.field()) {
+            case pb::TracePacket::trusted_packet_sequence_id:
+                w.write_uint64_field(field.field(), remap.sequence(field.value()));
+                return true;
+            case pb::TracePacket::track_event: {
+                size_t event = w.begin_nested(field.field());
+                copy_fields(field.nested(), w, [&](const ProtoReader& f, ProtoWriter& e) {
+                    switch (f.field()) {
+                        case pb::TrackEvent::track_uuid:
+                            e.write_uint64_field(f.field(), remap.uuid(f.value()));
+                            return true;
+                        case pb::TrackEvent::flow_ids:
+                        case pb::TrackEvent::terminating_flow_ids:
+                            e.write_fixed64_field(f.field(), remap.flow(f.value()));
+                            return true;
+                    }
+                    return false;
+                });
+                w.end_nested(event);
+                return true;
+            }
+            case pb::TracePacket::track_descriptor: {
+                size_t desc = w.begin_nested(field.field());
+                copy_fields(field.nested(), w, [&](const ProtoReader& f, ProtoWriter& d) {
+                    if (f.field() == pb::TrackDescriptor::uuid ||
+                            f.field() == pb::TrackDescriptor::parent_uuid) {
+                        d.write_uint64_field(f.field(), remap.uuid(f.value()));
+                        return true;
+                    }
+                    return false;
+                });
+                w.end_nested(desc);
+                return true;
+            }
+        }
+        return false;
+    });
+    out.end_nested(msg);
+}
+
+// One input trace and its next packet
+struct MergeInput {
+    MergeInput(size_t index, size_t num_inputs, uint32_t& next_sequence_id) :
+        remap(index, num_inputs, next_sequence_id), time_ns(0) { }
+
+    bool advance() {
+        if (!cursor->next()) {
+            return false;
+        }
+        PacketClockFields clock;
+        uint64_t sequence_id = 0;
+        bool state_cleared = false;
+        ProtoReader fields(cursor->data(), cursor->size());
+        while (fields.next()) {
+            if (clock.parse(fields)) {
+                continue;
+            }
+            switch (fields.field()) {
+                case pb::TracePacket::trusted_packet_sequence_id:
+                    sequence_id = fields.value();
+                    break;
+                case pb::TracePacket::sequence_flags:
+                    state_cleared = state_cleared ||
+                        (fields.value() & pb::TracePacket::SEQ_INCREMENTAL_STATE_CLEARED);
+                    break;
+                case pb::TracePacket::incremental_state_cleared:
+                    state_cleared = state_cleared || fields.value() != 0;
+                    break;
+            }
+        }
+        uint64_t time = clocks.on_packet(sequence_id, state_cleared, clock);
+        // Inputs may count different time units, so they interleave in ns;
+        // untimed packets stay where the input's time is
+        if (clock.has_timestamp) {
+            time_ns = time * clocks.unit_multiplier_ns();
+        }
+        return true;
+    }
+
+    MappedFile                      file;
+    std::unique_ptr<PacketCursor>   cursor;
+    IdRemap                         remap;
+    SequenceClocks                  clocks;
+    dvtt_time_t                     time_ns;
+};
+
+dvtt_error_t merge_traces(const std::string& output, const std::vector<std::string>& inputs,
+                          const dvtt_merge_options_t& options) {
+    if (inputs.empty() || (options.remap_ids && inputs.size() > MAX_REMAPPED_INPUTS) ||
+            (options.compression != DVTT_COMPRESSION_NONE &&
+             (options.compression != DVTT_COMPRESSION_DEFLATE || !compression_supported()))) {
+        return DVTT_ERROR_INVALID_ARGUMENT;
+    }
+
+    uint32_t next_sequence_id = 1;
+    std::vector<std::unique_ptr<MergeInput>> sources;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        sources.emplace_back(new MergeInput(i, inputs.size(), next_sequence_id));
+        MergeInput& input = *sources.back();
+        if (inputs[i] == output || !input.file.open(inputs[i])) {
+            return DVTT_ERROR_INVALID_ARGUMENT;
+        }
+        input.cursor.reset(new PacketCursor(input.file.data(), input.file.size()));
+    }
+
+    Sink* sink = FileSink::open(output);
+    if (!sink) {
+        return DVTT_ERROR_MEMORY;
+    }
+    if (options.compression == DVTT_COMPRESSION_DEFLATE) {
+        sink = new CompressingSink(sink, options.compression_level);
+    }
+    std::unique_ptr<Sink> out_sink(sink);
+    size_t chunk_size = options.chunk_size ? options.chunk_size : DEFAULT_MERGE_CHUNK_SIZE;
+    ProtoWriter out;
+    out.reserve(chunk_size + 1024);
+
+    // Earliest head first; ties go to the lower input, keeping merges stable
+    typedef std::pair<dvtt_time_t, size_t> Head;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    for (size_t i = 0; i < sources.size(); i++) {
+        if (sources[i]->advance()) {
+            heads.emplace(sources[i]->time_ns, i);
+        }
+    }
+    bool ok = true;
+    while (!heads.empty() && ok) {
+        MergeInput& input = *sources[heads.top().second];
+        size_t index = heads.top().second;
+        heads.pop();
+        if (options.remap_ids) {
+            write_remapped(input.cursor->data(), input.cursor->size(), input.remap, out);
+        } else {
+            out.write_bytes_field(pb::Trace::packet, input.cursor->data(), input.cursor->size());
+        }
+        if (out.size() >= chunk_size) {
+            ok = sink->write_chunk(out.buffer());
+        }
+        if (input.advance()) {
+            heads.emplace(input.time_ns, index);
+        }
+    }
+    if (ok && !out.empty()) {
+        ok = sink->write_chunk(out.buffer());
+    }
+    sink->close();
+
+    for (const auto& input : sources) {
+        if (input->cursor->error()) {
+            // Everything before the damage was merged
+            return DVTT_ERROR_INVALID_ARGUMENT;
+        }
+    }
+    return ok ? DVTT_OK : DVTT_ERROR_MEMORY;
+}
+
+} // namespace dvtt
@@ -0,0 +1,34 @@
+#ifndef DVTT_MERGE_H
+#define DVTT_MERGE_H
+
+#include "include/dvtt.h"
+#include <string>
+#include <vector>
+
+namespace dvtt {
+
+// Inputs whose ids merge_traces() can move apart. Remapping multiplies
+// ids by the number of inputs; this keeps ids below 2^56, which covers
+// every id_namespace, clear of the anchor flow bit (63).
+constexpr size_t MAX_REMAPPED_INPUTS = 127;
+
+/**
+ * Merges 'inputs' into one trace at 'output'
+ *
+ * Inputs are read through file mappings and interleaved by packet time,
+ * resolved through each sequence's clocks and compared in nanoseconds, one
+ * packet per input in flight, so memory does not grow with the traces. Each input keeps its own packet order, which its interned
+ * state depends on; inputs recorded with a reorder window merge into a
+ * fully time-ordered trace. Compressed chunks are expanded.
+ *
+ * With options.remap_ids, track uuids and flow ids of input i of n become
+ * id * n + i and sequence ids are renumbered, so inputs recorded with the
+ * same ids do not collide. Without it packets are copied unchanged, for
+ * inputs recorded with distinct id_namespace values.
+ */
+dvtt_error_t merge_traces(const std::string& output, const std::vector<std::string>& inputs,
+                          const dvtt_merge_options_t& options);
+
+} // namespace dvtt
+
+#endif // DVTT_MERGE_H
@@ -0,0 +1,221 @@
+#include "dvtt_mmap.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define DVTT_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace dvtt {
+
+#if defined(DVTT_HAVE_MMAP)
+
+bool mmap_supported() {
+    return true;
+}
+
+static int open_output(const std::string& filename) {
+    return ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+}
+
+MmapSink::MmapSink(int fd, size_t window) :
+    m_fd(fd), m_window(window), m_map(nullptr), m_map_offset(0), m_offset(0), m_file_size(0) {
+}
+
+MmapSink::~MmapSink() {
+    close();
+}
+
+MmapSink* MmapSink::open(const std::string& filename, size_t window) {
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    window = (std::max(window, page) + page - 1) / page * page;
+    int fd = open_output(filename);
+    if (fd < 0) {
+        return nullptr;
+    }
+    return new MmapSink(fd, window);
+}
+
+bool MmapSink::map_window() {
+    unmap_window();
+    m_map_offset = m_offset;
+    uint64_t end = m_map_offset + m_window;
+    if (m_file_size < end) {
+        if (ftruncate(m_fd, static_cast<off_t>(end)) != 0) {
+            return false;
+        }
+        m_file_size = end;
+    }
+    void* map = mmap(nullptr, m_window, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd,
+                     static_cast<off_t>(m_map_offset));
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    m_map = static_cast<uint8_t*>(map);
+    madvise(m_map, m_window, MADV_SEQUENTIAL);
+    return true;
+}
+
+void MmapSink::unmap_window() {
+    if (m_map) {
+        // Dirty pages stay in the page cache and are written back by the kernel
+        munmap(m_map, m_window);
+        m_map = nullptr;
+    }
+}
+
+bool MmapSink::write(const uint8_t* p, size_t left) {
+    bool ok = m_fd >= 0;
+    while (ok && left) {
+        uint64_t end = m_map_offset + m_window;
+        if (!m_map || m_offset == end) {
+            ok = map_window();
+            continue;
+        }
+        if (m_file_size < end) {
+            // Truncated by flush(); the mapping is only valid within the file
+            ok = ftruncate(m_fd, static_cast<off_t>(end)) == 0;
+            m_file_size = ok ? end : m_file_size;
+            continue;
+        }
+        size_t n = static_cast<size_t>(std::min<uint64_t>(left, end - m_offset));
+        std::memcpy(m_map + (m_offset - m_map_offset), p, n);
+        m_offset += n;
+        p += n;
+        left -= n;
+    }
+    return ok;
+}
+
+bool MmapSink::write_chunk(std::vector<uint8_t>& chunk) {
+    bool ok = write(chunk.data(), chunk.size());
+    chunk.clear();
+    return ok;
+}
+
+// Copying, mapping and truncating take neither locks nor memory, so the
+// usual paths serve from a signal handler as well
+bool MmapSink::write_from_signal(const uint8_t* data, size_t size) {
+    return write(data, size);
+}
+
+bool MmapSink::sync_from_signal() {
+    sync();
+    return m_fd >= 0;
+}
+
+void MmapSink::flush() {
+    if (m_fd >= 0 && m_file_size > m_offset &&
+            ftruncate(m_fd, static_cast<off_t>(m_offset)) == 0) {
+        m_file_size = m_offset;
+    }
+}
+
+void MmapSink::sync() {
+    flush();
+    if (m_fd < 0) {
+        return;
+    }
+    if (m_map && m_offset > m_map_offset) {
+        msync(m_map, static_cast<size_t>(m_offset - m_map_offset), MS_SYNC);
+    }
+#if defined(__linux__)
+    fdatasync(m_fd);
+#else
+    fsync(m_fd);
+#endif
+}
+
+bool MmapSink::rotate(const std::string& filename) {
+    // Open the new file first so a failure leaves the current file in use
+    int fd = open_output(filename);
+    if (fd < 0) {
+        return false;
+    }
+    close();
+    m_fd = fd;
+    m_map_offset = 0;
+    m_offset = 0;
+    m_file_size = 0;
+    return true;
+}
+
+void MmapSink::close() {
+    if (m_fd < 0) {
+        return;
+    }
+    unmap_window();
+    if (m_file_size != m_offset) {
+        (void)ftruncate(m_fd, static_cast<off_t>(m_offset));
+    }
+    ::close(m_fd);
+    m_fd = -1;
+}
+
+#else
+
+bool mmap_supported() {
+    return false;
+}
+
+MmapSink::MmapSink(int fd, size_t window) :
+    m_fd(fd), m_window(window), m_map(nullptr), m_map_offset(0), m_offset(0), m_file_size(0) {
+}
+
+MmapSink::~MmapSink() {
+}
+
+MmapSink* MmapSink::open(const std::string& filename, size_t window) {
+    (void)filename;
+    (void)window;
+    return nullptr;
+}
+
+bool MmapSink::map_window() {
+    return false;
+}
+
+void MmapSink::unmap_window() {
+}
+
+bool MmapSink::write(const uint8_t* p, size_t left) {
+    (void)p;
+    (void)left;
+    return false;
+}
+
+bool MmapSink::write_chunk(std::vector<uint8_t>& chunk) {
+    chunk.clear();
+    return false;
+}
+
+bool MmapSink::write_from_signal(const uint8_t* data, size_t size) {
+    (void)data;
+    (void)size;
+    return false;
+}
+
+bool MmapSink::sync_from_signal() {
+    return false;
+}
+
+void MmapSink::flush() {
+}
+
+void MmapSink::sync() {
+}
+
+bool MmapSink::rotate(const std::string& filename) {
+    (void)filename;
+    return false;
+}
+
+void MmapSink::close() {
+}
+
+#endif
+
+} // namespace dvtt
@@ -0,0 +1,65 @@
+#ifndef DVTT_MMAP_H
+#define DVTT_MMAP_H
+
+#include "dvtt_writer.h"
+
+namespace dvtt {
+
+// True when the platform supports memory-mapped output
+bool mmap_supported();
+
+/**
+ * Sink writing chunks into a memory-mapped file
+ *
+ * The file is extended one window at a time and each window is mapped
+ * shared; chunks are copied straight into the mapping, so writing a chunk
+ * is a memcpy with no system call except when a window fills up. Data is
+ * in the page cache, visible to readers and safe from a process crash, as
+ * soon as it is copied. Because the file is longer than its contents
+ * while a window is mapped, flush() and close() truncate it to the bytes
+ * written so it always loads; the next write extends it again.
+ */
+class MmapSink : public Sink {
+public:
+    virtual ~MmapSink();
+
+    // 'window' is rounded up to whole pages
+    static MmapSink* open(const std::string& filename, size_t window);
+
+    virtual bool write_chunk(std::vector<uint8_t>& chunk) override;
+
+    // Truncates the file to the bytes written
+    virtual void flush() override;
+
+    // Flushes, then commits the mapping and the file size to storage
+    virtual void sync() override;
+
+    virtual bool rotate(const std::string& filename) override;
+
+    virtual bool write_from_signal(const uint8_t* data, size_t size) override;
+
+    virtual bool sync_from_signal() override;
+
+    virtual void close() override;
+
+private:
+    MmapSink(int fd, size_t window);
+
+    // Copies 'left' bytes into the mapping, mapping windows as needed
+    bool write(const uint8_t* p, size_t left);
+
+    // Maps the window starting at the current offset, extending the file
+    bool map_window();
+    void unmap_window();
+
+    int         m_fd;
+    size_t      m_window;
+    uint8_t*    m_map;          // Current window, or nullptr
+    uint64_t    m_map_offset;   // File offset of the current window
+    uint64_t    m_offset;       // Bytes written
+    uint64_t    m_file_size;    // Current file length
+};
+
+} // namespace dvtt
+
+#endif // DVTT_MMAP_H
@@ -0,0 +1,110 @@
+#ifndef DVTT_POOL_H
+#define DVTT_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace dvtt {
+
+/**
+ * Fixed-size object pool carved from slabs, with freelist recycling
+ *
+ * Objects are constructed once when their slab is allocated and are not
+ * destroyed when released, so members that own memory (strings, vectors)
+ * keep their capacity for the next user. T must provide a 'T* pool_next'
+ * member for the freelist link. All slabs are freed with the pool.
+ *
+ * alloc() and release() are for the owning thread only. Other threads
+ * hand objects back with release_remote(), a lock-free push onto a second
+ * list that the owner takes over in one exchange when its freelist runs dry.
+ */
+template <typename T, size_t SLAB_SIZE = 256> class SlabPool {
+public:
+    SlabPool() : m_free(nullptr), m_remote(nullptr), m_live(0) { }
+
+    ~SlabPool() {
+        for (T* slab : m_slabs) {
+            delete [] slab;
+        }
+    }
+
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+
+    T* alloc() {
+        if (!m_free) {
+            reclaim_remote();
+        }
+        if (!m_free) {
+            grow();
+        }
+        T* obj = m_free;
+        m_free = obj->pool_next;
+        obj->pool_next = nullptr;
+        m_live++;
+        return obj;
+    }
+
+    void release(T* obj) {
+        obj->pool_next = m_free;
+        m_free = obj;
+        m_live--;
+    }
+
+    // Returns an object from a thread other than the owner
+    void release_remote(T* obj) {
+        T* head = m_remote.load(std::memory_order_relaxed);
+        do {
+            obj->pool_next = head;
+        } while (!m_remote.compare_exchange_weak(head, obj,
+                    std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // Calls f(obj) for every object in every slab, handed out or not
+    template <typename F> void for_each_slot(F f) {
+        for (T* slab : m_slabs) {
+            for (size_t i = 0; i < SLAB_SIZE; i++) {
+                f(slab[i]);
+            }
+        }
+    }
+
+    // Number of objects handed out and not yet released. Remote releases
+    // are counted once the owner reclaims them.
+    size_t live() const { return m_live; }
+
+    // Number of objects allocated across all slabs
+    size_t capacity() const { return m_slabs.size() * SLAB_SIZE; }
+
+private:
+    void reclaim_remote() {
+        T* list = m_remote.exchange(nullptr, std::memory_order_acquire);
+        while (list) {
+            T* next = list->pool_next;
+            list->pool_next = m_free;
+            m_free = list;
+            m_live--;
+            list = next;
+        }
+    }
+
+    void grow() {
+        T* slab = new T[SLAB_SIZE];
+        m_slabs.push_back(slab);
+        for (size_t i = 0; i < SLAB_SIZE; i++) {
+            slab[i].pool_next = (i + 1 < SLAB_SIZE) ? &slab[i + 1] : m_free;
+        }
+        m_free = slab;
+    }
+
+private:
+    std::vector<T*>     m_slabs;
+    T*                  m_free;
+    std::atomic<T*>     m_remote;
+    size_t              m_live;
+};
+
+} // namespace dvtt
+
+#endif // DVTT_POOL_H
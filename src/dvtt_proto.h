@@ -0,0 +1,361 @@
+#ifndef DVTT_PROTO_H
+#define DVTT_PROTO_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dvtt {
+
+// Protobuf wire types
+enum WireType {
+    VARINT = 0,
+    FIXED64 = 1,
+    LENGTH_DELIMITED = 2,
+    FIXED32 = 5
+};
+
+// Perfetto field numbers used by the emitter (see perfetto/protos/perfetto/trace)
+namespace pb {
+
+namespace Trace {
+constexpr uint32_t packet = 1;
+}
+
+namespace TracePacket {
+constexpr uint32_t clock_snapshot = 6;
+constexpr uint32_t timestamp = 8;
+constexpr uint32_t trusted_packet_sequence_id = 10;
+constexpr uint32_t track_event = 11;
+constexpr uint32_t interned_data = 12;
+constexpr uint32_t sequence_flags = 13;
+constexpr uint32_t incremental_state_cleared = 41;
+constexpr uint32_t previous_packet_dropped = 42;
+constexpr uint32_t compressed_packets = 50;
+constexpr uint32_t timestamp_clock_id = 58;
+constexpr uint32_t trace_packet_defaults = 59;
+constexpr uint32_t track_descriptor = 60;
+
+enum SequenceFlags {
+    SEQ_UNSPECIFIED = 0,
+    SEQ_INCREMENTAL_STATE_CLEARED = 1,
+    SEQ_NEEDS_INCREMENTAL_STATE = 2
+};
+}
+
+namespace TracePacketDefaults {
+constexpr uint32_t timestamp_clock_id = 58;
+}
+
+namespace ClockSnapshot {
+constexpr uint32_t clocks = 1;
+
+namespace Clock {
+constexpr uint32_t clock_id = 1;
+constexpr uint32_t timestamp = 2;
+constexpr uint32_t is_incremental = 3;
+constexpr uint32_t unit_multiplier_ns = 4;
+}
+}
+
+// BuiltinClock values, and the range of ids a sequence may define for itself
+constexpr uint32_t BUILTIN_CLOCK_BOOTTIME = 6;
+constexpr uint32_t FIRST_SEQUENCE_CLOCK = 64;
+constexpr uint32_t LAST_SEQUENCE_CLOCK = 127;
+
+namespace TrackDescriptor {
+constexpr uint32_t uuid = 1;
+constexpr uint32_t name = 2;
+constexpr uint32_t parent_uuid = 5;
+constexpr uint32_t counter = 8;
+}
+
+namespace CounterDescriptor {
+constexpr uint32_t unit = 3;
+constexpr uint32_t unit_name = 6;
+
+enum Unit {
+    UNIT_UNSPECIFIED = 0,
+    UNIT_TIME_NS = 1,
+    UNIT_COUNT = 2,
+    UNIT_SIZE_BYTES = 3
+};
+}
+
+namespace TrackEvent {
+constexpr uint32_t category_iids = 3;
+constexpr uint32_t debug_annotations = 4;
+constexpr uint32_t type = 9;
+constexpr uint32_t name_iid = 10;
+constexpr uint32_t track_uuid = 11;
+constexpr uint32_t categories = 22;
+constexpr uint32_t name = 23;
+constexpr uint32_t counter_value = 30;
+constexpr uint32_t double_counter_value = 44;
+constexpr uint32_t flow_ids = 47;
+constexpr uint32_t terminating_flow_ids = 48;
+
+enum Type {
+    TYPE_UNSPECIFIED = 0,
+    TYPE_SLICE_BEGIN = 1,
+    TYPE_SLICE_END = 2,
+    TYPE_INSTANT = 3,
+    TYPE_COUNTER = 4
+};
+}
+
+namespace DebugAnnotation {
+constexpr uint32_t name_iid = 1;
+constexpr uint32_t uint_value = 3;
+constexpr uint32_t int_value = 4;
+constexpr uint32_t double_value = 5;
+constexpr uint32_t string_value = 6;
+constexpr uint32_t name = 10;
+constexpr uint32_t array_values = 12;
+}
+
+namespace InternedData {
+constexpr uint32_t event_categories = 1;
+constexpr uint32_t event_names = 2;
+constexpr uint32_t debug_annotation_names = 3;
+}
+
+// EventCategory, EventName and DebugAnnotationName share this layout
+namespace InternedString {
+constexpr uint32_t iid = 1;
+constexpr uint32_t name = 2;
+}
+
+} // namespace pb
+
+// Size of the placeholder reserved for a nested message length. The length
+// is backfilled as a redundant (zero-padded) varint, which limits a single
+// nested message to 2^28-1 bytes but lets messages be encoded in one pass.
+constexpr size_t NESTED_LENGTH_SIZE = 4;
+
+/**
+ * Single-pass protobuf encoder writing into a growable byte buffer
+ *
+ * Nested messages are opened with begin_nested(), which reserves space for
+ * the length prefix, and closed with end_nested(), which backfills it.
+ */
+class ProtoWriter {
+public:
+    ProtoWriter() { }
+
+    void write_varint(uint64_t value) {
+        uint8_t* p = grow(10);
+        size_t n = 0;
+        while (value >= 0x80) {
+            p[n++] = static_cast<uint8_t>(value | 0x80);
+            value >>= 7;
+        }
+        p[n++] = static_cast<uint8_t>(value);
+        m_buf.resize(m_buf.size() - 10 + n);
+    }
+
+    void write_tag(uint32_t field_number, WireType wire_type) {
+        write_varint((static_cast<uint64_t>(field_number) << 3) | wire_type);
+    }
+
+    void write_uint64_field(uint32_t field_number, uint64_t value) {
+        write_tag(field_number, VARINT);
+        write_varint(value);
+    }
+
+    // Plain 'int64' fields encode the two's complement value
+    void write_int64_field(uint32_t field_number, int64_t value) {
+        write_uint64_field(field_number, static_cast<uint64_t>(value));
+    }
+
+    // 'sint64' fields use ZigZag encoding
+    void write_sint64_field(uint32_t field_number, int64_t value) {
+        write_uint64_field(field_number,
+            (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+    }
+
+    void write_bool_field(uint32_t field_number, bool value) {
+        write_uint64_field(field_number, value ? 1 : 0);
+    }
+
+    void write_fixed64_field(uint32_t field_number, uint64_t value) {
+        write_tag(field_number, FIXED64);
+        std::memcpy(grow(sizeof(value)), &value, sizeof(value));
+    }
+
+    void write_double_field(uint32_t field_number, double value) {
+        write_tag(field_number, FIXED64);
+        std::memcpy(grow(sizeof(value)), &value, sizeof(value));
+    }
+
+    void write_bytes_field(uint32_t field_number, const void* data, size_t size) {
+        write_tag(field_number, LENGTH_DELIMITED);
+        write_varint(size);
+        write_raw(data, size);
+    }
+
+    void write_string_field(uint32_t field_number, const char* str, size_t len) {
+        write_bytes_field(field_number, str, len);
+    }
+
+    void write_string_field(uint32_t field_number, const std::string& str) {
+        write_bytes_field(field_number, str.data(), str.size());
+    }
+
+    void write_raw(const void* data, size_t size) {
+        if (size) {
+            std::memcpy(grow(size), data, size);
+        }
+    }
+
+    // Opens a nested message. Returns a bookmark for end_nested()
+    size_t begin_nested(uint32_t field_number) {
+        write_tag(field_number, LENGTH_DELIMITED);
+        size_t bookmark = m_buf.size();
+        grow(NESTED_LENGTH_SIZE);
+        return bookmark;
+    }
+
+    // Closes a nested message by backfilling its length prefix
+    void end_nested(size_t bookmark) {
+        size_t len = m_buf.size() - bookmark - NESTED_LENGTH_SIZE;
+        uint8_t* p = &m_buf[bookmark];
+        for (size_t i = 0; i < NESTED_LENGTH_SIZE - 1; i++) {
+            p[i] = static_cast<uint8_t>((len & 0x7F) | 0x80);
+            len >>= 7;
+        }
+        p[NESTED_LENGTH_SIZE - 1] = static_cast<uint8_t>(len & 0x7F);
+    }
+
+    size_t size() const { return m_buf.size(); }
+    bool empty() const { return m_buf.empty(); }
+    void clear() { m_buf.clear(); }
+    void reserve(size_t n) { m_buf.reserve(n); }
+
+    std::vector<uint8_t>& buffer() { return m_buf; }
+    const std::vector<uint8_t>& buffer() const { return m_buf; }
+
+protected:
+    // Extends the buffer by n bytes and returns a pointer to the new space
+    uint8_t* grow(size_t n) {
+        size_t pos = m_buf.size();
+        m_buf.resize(pos + n);
+        return &m_buf[pos];
+    }
+
+    std::vector<uint8_t> m_buf;
+};
+
+/**
+ * Decoder walking the fields of one encoded message in place
+ *
+ * Each next() advances to the following field, whose number, wire type and
+ * payload are then available: the value of varint and fixed fields, or the
+ * bytes of a length-delimited one. Malformed input ends the walk and sets
+ * error(). Nothing is copied; the data must outlive the reader.
+ */
+class ProtoReader {
+public:
+    ProtoReader(const uint8_t* data, size_t size) :
+        m_p(data), m_end(data + size), m_field(0), m_wire_type(VARINT), m_value(0),
+        m_data(nullptr), m_error(false) { }
+
+    bool next() {
+        if (m_p >= m_end || m_error) {
+            return false;
+        }
+        uint64_t tag;
+        if (!read_varint(tag)) {
+            return fail();
+        }
+        m_field = static_cast<uint32_t>(tag >> 3);
+        m_wire_type = static_cast<WireType>(tag & 7);
+        m_data = nullptr;
+        switch (m_wire_type) {
+            case VARINT:
+                return read_varint(m_value) || fail();
+            case FIXED64:
+                return read_fixed(8) || fail();
+            case FIXED32:
+                return read_fixed(4) || fail();
+            case LENGTH_DELIMITED:
+                if (!read_varint(m_value) || m_value > static_cast<uint64_t>(m_end - m_p)) {
+                    return fail();
+                }
+                m_data = m_p;
+                m_p += m_value;
+                return true;
+            default:
+                return fail();
+        }
+    }
+
+    uint32_t field() const { return m_field; }
+    WireType wire_type() const { return m_wire_type; }
+
+    // Varint or fixed payload; the length of a length-delimited field
+    uint64_t value() const { return m_value; }
+
+    double as_double() const {
+        double d;
+        std::memcpy(&d, &m_value, sizeof(d));
+        return d;
+    }
+
+    const uint8_t* data() const { return m_data; }
+    size_t size() const { return m_data ? static_cast<size_t>(m_value) : 0; }
+
+    std::string_view as_string() const {
+        return std::string_view(reinterpret_cast<const char*>(m_data), size());
+    }
+
+    // Reader over the current length-delimited field
+    ProtoReader nested() const { return ProtoReader(m_data, size()); }
+
+    // First byte after the current field
+    const uint8_t* position() const { return m_p; }
+
+    bool error() const { return m_error; }
+
+private:
+    bool fail() {
+        m_error = true;
+        return false;
+    }
+
+    bool read_varint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && m_p < m_end; shift += 7) {
+            uint8_t byte = *m_p++;
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool read_fixed(size_t n) {
+        if (static_cast<size_t>(m_end - m_p) < n) {
+            return false;
+        }
+        m_value = 0;
+        std::memcpy(&m_value, m_p, n);
+        m_p += n;
+        return true;
+    }
+
+    const uint8_t*  m_p;
+    const uint8_t*  m_end;
+    uint32_t        m_field;
+    WireType        m_wire_type;
+    uint64_t        m_value;
+    const uint8_t*  m_data;
+    bool            m_error;
+};
+
+} // namespace dvtt
+
+#endif // DVTT_PROTO_H
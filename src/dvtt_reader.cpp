@@ -0,0 +1,1100 @@
+#include "include/dvtt_reader.h"
+#include "dvtt_decode.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <unordered_map>
+
+namespace dvtt {
+
+// Uncompressed packets are grouped into blocks of about this many bytes.
+// Each compressed_packets packet is a block of its own.
+constexpr size_t INDEX_BLOCK_BYTES = 64 * 1024;
+
+// Bumped whenever the sidecar layout changes; older indexes are rebuilt
+constexpr uint64_t INDEX_VERSION = 2;
+
+// Field numbers of the sidecar index. It is a protobuf message, written
+// and read with the trace's own encoder and decoder.
+namespace idx {
+namespace Index {
+constexpr uint32_t version = 1;
+constexpr uint32_t trace_size = 2;
+constexpr uint32_t trace_mtime = 3;
+constexpr uint32_t end_time = 4;
+constexpr uint32_t track = 5;
+constexpr uint32_t intern = 6;
+constexpr uint32_t block = 7;
+}
+namespace Track {
+constexpr uint32_t uuid = 1;
+constexpr uint32_t parent_uuid = 2;
+constexpr uint32_t name = 3;
+constexpr uint32_t is_counter = 4;
+constexpr uint32_t unit = 5;
+}
+namespace Intern {
+constexpr uint32_t state = 1;
+constexpr uint32_t kind = 2;
+constexpr uint32_t iid = 3;
+constexpr uint32_t str = 4;
+}
+namespace Block {
+constexpr uint32_t offset = 1;
+constexpr uint32_t size = 2;
+constexpr uint32_t compressed = 3;
+constexpr uint32_t next_state = 4;
+constexpr uint32_t sequence_state = 5;
+constexpr uint32_t range = 6;
+constexpr uint32_t sequence_clocks = 7;
+}
+namespace SequenceState {
+constexpr uint32_t sequence_id = 1;
+constexpr uint32_t state = 2;
+}
+namespace SequenceClock {
+constexpr uint32_t sequence_id = 1;
+constexpr uint32_t default_clock = 2;
+constexpr uint32_t clock = 3;
+}
+namespace Clock {
+constexpr uint32_t id = 1;
+constexpr uint32_t incremental = 2;
+constexpr uint32_t unit_multiplier_ns = 3;
+constexpr uint32_t value = 4;
+}
+namespace Range {
+constexpr uint32_t root_uuid = 1;
+constexpr uint32_t min_time = 2;
+constexpr uint32_t max_time = 3;
+constexpr uint32_t last_block = 4;
+}
+} // namespace idx
+
+std::string_view TraceAttribute::base_name() const {
+    std::string_view base(name);
+    size_t bracket = base.find('[');
+    return bracket == std::string_view::npos ? base : base.substr(0, bracket);
+}
+
+const TraceAttribute* TraceTransaction::find_attribute(std::string_view name) const {
+    for (const auto& attr : attributes) {
+        if (attr.name == name || attr.base_name() == name) {
+            return &attr;
+        }
+    }
+    return nullptr;
+}
+
+std::vector<TraceTransaction> TraceReader::transactions(const TraceQuery& query) const {
+    std::vector<TraceTransaction> result;
+    for_each_transaction(query, [&](const TraceTransaction& txn) {
+        result.push_back(txn);
+    });
+    return result;
+}
+
+std::string trace_index_filename(const std::string& filename) {
+    return filename + ".dvtti";
+}
+
+// Calls f(data, size) for each Trace.packet in 'data'. Returns false if
+// the packets are malformed or a compressed block cannot be inflated.
+template <typename F> static bool for_each_packet(const uint8_t* data, size_t size,
+                                                  bool compressed,
+                                                  std::vector<uint8_t>& scratch, F f) {
+    if (compressed) {
+        // A compressed block is one Trace.packet holding compressed_packets
+        ProtoReader outer(data, size);
+        const uint8_t* payload;
+        size_t payload_size;
+        if (!outer.next() || !find_compressed_packets(outer.data(), outer.size(),
+                                                      payload, payload_size) ||
+                !inflate_packets(payload, payload_size, scratch)) {
+            return false;
+        }
+        data = scratch.data();
+        size = scratch.size();
+    }
+    ProtoReader trace(data, size);
+    while (trace.next()) {
+        if (trace.field() == pb::Trace::packet && trace.wire_type() == LENGTH_DELIMITED) {
+            f(trace.data(), trace.size());
+        }
+    }
+    return !trace.error();
+}
+
+// The fields of one TracePacket the reader uses
+struct PacketFields {
+    dvtt_time_t timestamp = 0;      // Set by resolve_time()
+    PacketClockFields clock;
+    uint64_t sequence_id = 0;
+    uint64_t flags = 0;
+    bool state_cleared = false;
+    ProtoReader event = ProtoReader(nullptr, 0);
+    ProtoReader interned = ProtoReader(nullptr, 0);
+    ProtoReader descriptor = ProtoReader(nullptr, 0);
+    bool has_event = false;
+    bool has_interned = false;
+    bool has_descriptor = false;
+    bool compressed = false;
+};
+
+static PacketFields parse_packet(const uint8_t* data, size_t size) {
+    PacketFields fields;
+    ProtoReader packet(data, size);
+    while (packet.next()) {
+        switch (packet.field()) {
+            case pb::TracePacket::trusted_packet_sequence_id:
+                fields.sequence_id = packet.value();
+                break;
+            case pb::TracePacket::sequence_flags:
+                fields.flags = packet.value();
+                break;
+            case pb::TracePacket::incremental_state_cleared:
+                fields.state_cleared = packet.value() != 0;
+                break;
+            case pb::TracePacket::track_event:
+                fields.event = packet.nested();
+                fields.has_event = true;
+                break;
+            case pb::TracePacket::interned_data:
+                fields.interned = packet.nested();
+                fields.has_interned = true;
+                break;
+            case pb::TracePacket::track_descriptor:
+                fields.descriptor = packet.nested();
+                fields.has_descriptor = true;
+                break;
+            case pb::TracePacket::compressed_packets:
+                fields.compressed = true;
+                break;
+            default:
+                fields.clock.parse(packet);
+                break;
+        }
+    }
+    if (fields.flags & pb::TracePacket::SEQ_INCREMENTAL_STATE_CLEARED) {
+        fields.state_cleared = true;
+    }
+    return fields;
+}
+
+static void resolve_time(PacketFields& packet, SequenceClocks& clocks) {
+    packet.timestamp = clocks.on_packet(packet.sequence_id, packet.state_cleared, packet.clock);
+}
+
+// The type and track of a TrackEvent, read without decoding the rest
+struct EventHeader {
+    uint64_t type = pb::TrackEvent::TYPE_UNSPECIFIED;
+    uint64_t track_uuid = 0;
+};
+
+static EventHeader parse_event_header(ProtoReader event) {
+    EventHeader header;
+    while (event.next()) {
+        if (event.field() == pb::TrackEvent::type) {
+            header.type = event.value();
+        } else if (event.field() == pb::TrackEvent::track_uuid) {
+            header.track_uuid = event.value();
+        }
+    }
+    return header;
+}
+
+/**
+ * Interning state of every sequence
+ *
+ * Each time a sequence clears its incremental state it moves to a new
+ * state id, and its interned strings are keyed by that id. Ids are handed
+ * out in file order, so replaying the packets of a block from the block's
+ * snapshot reproduces the ids the index was built with.
+ */
+class SequenceStates {
+public:
+    SequenceStates() : m_next(1) { }
+
+    uint64_t on_packet(const PacketFields& packet) {
+        auto it = m_current.find(packet.sequence_id);
+        if (it == m_current.end()) {
+            it = m_current.emplace(packet.sequence_id, m_next++).first;
+        } else if (packet.state_cleared) {
+            it->second = m_next++;
+        }
+        return it->second;
+    }
+
+    std::unordered_map<uint64_t, uint64_t>  m_current;
+    uint64_t                                m_next;
+};
+
+struct InternKey {
+    uint64_t state;
+    uint64_t iid;
+    uint32_t kind;
+
+    bool operator==(const InternKey& other) const {
+        return state == other.state && iid == other.iid && kind == other.kind;
+    }
+};
+
+struct InternKeyHash {
+    size_t operator()(const InternKey& key) const {
+        uint64_t h = key.state * 0x9E3779B97F4A7C15ull ^ (key.iid << 2 | key.kind);
+        return static_cast<size_t>(h ^ (h >> 29));
+    }
+};
+
+// Time range of the slices that begin in a block and the counter samples
+// in it, per stream (root track), and the last block holding their ends
+struct BlockRange {
+    uint64_t root_uuid;
+    dvtt_time_t min_time;
+    dvtt_time_t max_time;
+    uint32_t last_block;
+};
+
+struct IndexBlock {
+    uint64_t offset;
+    uint64_t size;
+    bool compressed;
+    uint64_t next_state;
+    std::vector<std::pair<uint64_t, uint64_t>> sequence_states;
+    std::vector<BlockRange> ranges;        // Sorted by root_uuid
+    std::vector<std::pair<uint64_t, SequenceClocks::Sequence>> sequence_clocks;
+};
+
+class TraceReaderImpl : public TraceReader {
+public:
+    TraceReaderImpl() : m_end_time(0), m_index_loaded(false), m_blocks_decoded(0) { }
+
+    bool open(const std::string& filename, bool write_index);
+
+    virtual const std::vector<TraceTrack>& tracks() const override { return m_tracks; }
+
+    virtual const TraceTrack* find_track(uint64_t uuid) const override {
+        auto it = m_track_index.find(uuid);
+        return it == m_track_index.end() ? nullptr : &m_tracks[it->second];
+    }
+
+    virtual const TraceTrack* find_stream(std::string_view name) const override {
+        for (const auto& track : m_tracks) {
+            if (!track.parent_uuid && !track.is_counter && track.name == name) {
+                return &track;
+            }
+        }
+        return nullptr;
+    }
+
+    virtual size_t for_each_transaction(
+        const TraceQuery& query,
+        const std::function<void(const TraceTransaction&)>& visit) const override;
+
+    virtual size_t for_each_counter_sample(
+        const TraceQuery& query,
+        const std::function<void(const TraceCounterSample&)>& visit) const override;
+
+    virtual size_t num_blocks() const override { return m_blocks.size(); }
+
+    virtual size_t blocks_decoded() const override {
+        return m_blocks_decoded.load(std::memory_order_relaxed);
+    }
+
+    virtual bool index_loaded() const override { return m_index_loaded; }
+
+private:
+    // A slice begin waiting for its end while the index is built
+    struct OpenSlice {
+        dvtt_time_t start_time;
+        uint32_t block;
+    };
+
+    bool build_index();
+    bool load_index(const std::string& filename);
+    void save_index(const std::string& filename) const;
+
+    void add_track(ProtoReader descriptor);
+    void add_interned(uint64_t state, ProtoReader interned);
+    uint64_t root_of(uint64_t uuid) const;
+
+    const std::string* lookup(uint64_t state, uint32_t kind, uint64_t iid) const {
+        auto it = m_interns.find(InternKey{state, iid, kind});
+        return it == m_interns.end() ? nullptr : &it->second;
+    }
+
+    // True if events on track 'uuid' match 'query'; 'cache' memoizes the
+    // ancestry walk for child tracks
+    bool track_selected(const TraceQuery& query, uint64_t uuid,
+                        std::unordered_map<uint64_t, bool>& cache) const;
+
+    // Runs of blocks to decode for 'query', as [first, last] block indexes
+    std::vector<std::pair<uint32_t, uint32_t>> select_blocks(const TraceQuery& query) const;
+
+    // Calls f(packet, state) for every packet of blocks first..last
+    template <typename F> void decode_run(uint32_t first, uint32_t last, F f) const;
+
+    void decode_begin(ProtoReader event, uint64_t state, TraceTransaction& txn) const;
+    void decode_end(ProtoReader event, uint64_t state, TraceTransaction& txn) const;
+    void decode_attribute(ProtoReader annotation, uint64_t state,
+                          TraceAttribute& attr) const;
+
+    MappedFile                                          m_file;
+    std::string                                         m_filename;
+    uint64_t                                            m_trace_size;
+    uint64_t                                            m_trace_mtime;
+    dvtt_time_t                                         m_end_time;
+    std::vector<TraceTrack>                             m_tracks;
+    std::unordered_map<uint64_t, size_t>                m_track_index;
+    std::unordered_map<InternKey, std::string, InternKeyHash> m_interns;
+    std::vector<IndexBlock>                             m_blocks;
+    bool                                                m_index_loaded;
+    mutable std::atomic<size_t>                         m_blocks_decoded;
+};
+
+static uint64_t file_mtime(const std::string& filename) {
+    std::error_code ec;
+    auto time = std::filesystem::last_write_time(filename, ec);
+    return ec ? 0 : static_cast<uint64_t>(time.time_since_epoch().count());
+}
+
+bool TraceReaderImpl::open(const std::string& filename, bool write_index) {
+    m_filename = filename;
+    if (!m_file.open(filename)) {
+        return false;
+    }
+    m_trace_size = m_file.size();
+    m_trace_mtime = file_mtime(filename);
+    std::string index_filename = trace_index_filename(filename);
+    if (load_index(index_filename)) {
+        m_index_loaded = true;
+        return true;
+    }
+    if (!build_index()) {
+        return false;
+    }
+    if (write_index) {
+        save_index(index_filename);
+    }
+    return true;
+}
+
+void TraceReaderImpl::add_track(ProtoReader descriptor) {
+    TraceTrack track = {0, 0, std::string(), false, std::string()};
+    while (descriptor.next()) {
+        switch (descriptor.field()) {
+            case pb::TrackDescriptor::uuid:
+                track.uuid = descriptor.value();
+                break;
+            case pb::TrackDescriptor::name:
+                track.name.assign(descriptor.as_string());
+                break;
+            case pb::TrackDescriptor::parent_uuid:
+                track.parent_uuid = descriptor.value();
+                break;
+            case pb::TrackDescriptor::counter: {
+                track.is_counter = true;
+                ProtoReader counter = descriptor.nested();
+                while (counter.next()) {
+                    if (counter.field() == pb::CounterDescriptor::unit_name) {
+                        track.unit.assign(counter.as_string());
+                    } else if (counter.field() == pb::CounterDescriptor::unit &&
+                               track.unit.empty()) {
+                        track.unit = counter.value() == pb::CounterDescriptor::UNIT_TIME_NS ?
+                            "ns" : counter.value() == pb::CounterDescriptor::UNIT_COUNT ?
+                            "count" : counter.value() == pb::CounterDescriptor::UNIT_SIZE_BYTES ?
+                            "bytes" : "";
+                    }
+                }
+                break;
+            }
+        }
+    }
+    // Descriptors are repeated after rotation and in flight recorder dumps
+    if (track.uuid && m_track_index.emplace(track.uuid, m_tracks.size()).second) {
+        m_tracks.push_back(std::move(track));
+    }
+}
+
+void TraceReaderImpl::add_interned(uint64_t state, ProtoReader interned) {
+    while (interned.next()) {
+        uint32_t kind = interned.field();
+        if (kind != pb::InternedData::event_categories && kind != pb::InternedData::event_names &&
+                kind != pb::InternedData::debug_annotation_names) {
+            continue;
+        }
+        ProtoReader entry = interned.nested();
+        uint64_t iid = 0;
+        std::string_view str;
+        while (entry.next()) {
+            if (entry.field() == pb::InternedString::iid) {
+                iid = entry.value();
+            } else if (entry.field() == pb::InternedString::name) {
+                str = entry.as_string();
+            }
+        }
+        m_interns[InternKey{state, iid, kind}].assign(str);
+    }
+}
+
+uint64_t TraceReaderImpl::root_of(uint64_t uuid) const {
+    // Bounded walk, in case of a malformed parent cycle
+    for (size_t depth = 0; depth <= m_tracks.size(); depth++) {
+        const TraceTrack* track = find_track(uuid);
+        if (!track || !track->parent_uuid) {
+            return uuid;
+        }
+        uuid = track->parent_uuid;
+    }
+    return uuid;
+}
+
+bool TraceReaderImpl::build_index() {
+    const uint8_t* data = m_file.data();
+    size_t size = m_file.size();
+    SequenceStates states;
+    SequenceClocks clocks;
+    std::vector<uint8_t> scratch;
+    // Ranges per raw track, resolved to streams once every descriptor is known
+    std::vector<std::unordered_map<uint64_t, BlockRange>> track_ranges;
+    std::unordered_map<uint64_t, std::vector<OpenSlice>> open_slices;
+    bool block_open = false;
+
+    auto start_block = [&](uint64_t offset, bool compressed) {
+        IndexBlock block;
+        block.offset = offset;
+        block.size = 0;
+        block.compressed = compressed;
+        block.next_state = states.m_next;
+        block.sequence_states.assign(states.m_current.begin(), states.m_current.end());
+        block.sequence_clocks.assign(clocks.m_sequences.begin(), clocks.m_sequences.end());
+        m_blocks.push_back(std::move(block));
+        track_ranges.emplace_back();
+    };
+    auto range_for = [&](uint32_t block, uint64_t track_uuid) -> BlockRange& {
+        auto it = track_ranges[block].emplace(track_uuid,
+            BlockRange{track_uuid, ~dvtt_time_t(0), 0, block}).first;
+        return it->second;
+    };
+    auto process = [&](const uint8_t* packet_data, size_t packet_size) {
+        PacketFields packet = parse_packet(packet_data, packet_size);
+        resolve_time(packet, clocks);
+        uint64_t state = states.on_packet(packet);
+        uint32_t block = static_cast<uint32_t>(m_blocks.size() - 1);
+        if (packet.has_interned) {
+            add_interned(state, packet.interned);
+        }
+        if (packet.has_descriptor) {
+            add_track(packet.descriptor);
+        }
+        if (!packet.has_event) {
+            return;
+        }
+        m_end_time = std::max(m_end_time, packet.timestamp);
+        EventHeader event = parse_event_header(packet.event);
+        if (event.type == pb::TrackEvent::TYPE_SLICE_BEGIN) {
+            open_slices[event.track_uuid].push_back({packet.timestamp, block});
+            BlockRange& range = range_for(block, event.track_uuid);
+            range.min_time = std::min(range.min_time, packet.timestamp);
+        } else if (event.type == pb::TrackEvent::TYPE_SLICE_END) {
+            auto it = open_slices.find(event.track_uuid);
+            if (it == open_slices.end() || it->second.empty()) {
+                return;
+            }
+            OpenSlice slice = it->second.back();
+            it->second.pop_back();
+            BlockRange& range = range_for(slice.block, event.track_uuid);
+            range.max_time = std::max(range.max_time, packet.timestamp);
+            range.last_block = std::max(range.last_block, block);
+        } else if (event.type == pb::TrackEvent::TYPE_COUNTER) {
+            BlockRange& range = range_for(block, event.track_uuid);
+            range.min_time = std::min(range.min_time, packet.timestamp);
+            range.max_time = std::max(range.max_time, packet.timestamp);
+        }
+    };
+
+    ProtoReader trace(data, size);
+    const uint8_t* start = data;
+    while (trace.next()) {
+        uint64_t offset = static_cast<uint64_t>(start - data);
+        uint64_t length = static_cast<uint64_t>(trace.position() - start);
+        start = trace.position();
+        if (trace.field() != pb::Trace::packet || trace.wire_type() != LENGTH_DELIMITED) {
+            continue;
+        }
+        PacketFields packet = parse_packet(trace.data(), trace.size());
+        if (packet.compressed) {
+            start_block(offset, true);
+            m_blocks.back().size = length;
+            block_open = false;
+            bool ok = for_each_packet(data + offset, length, true, scratch, process);
+            if (!ok) {
+                return false;
+            }
+            continue;
+        }
+        if (!block_open || m_blocks.back().size >= INDEX_BLOCK_BYTES) {
+            start_block(offset, false);
+            block_open = true;
+        }
+        m_blocks.back().size += length;
+        process(trace.data(), trace.size());
+    }
+    // A trace cut short by a crash ends at its last whole packet
+    if (m_blocks.empty() && size) {
+        return false;
+    }
+
+    // Slices the trace ends inside could end anywhere after their begin
+    uint32_t last_block = m_blocks.empty() ? 0 : static_cast<uint32_t>(m_blocks.size() - 1);
+    for (const auto& entry : open_slices) {
+        for (const OpenSlice& slice : entry.second) {
+            BlockRange& range = range_for(slice.block, entry.first);
+            range.max_time = ~dvtt_time_t(0);
+            range.last_block = last_block;
+        }
+    }
+
+    for (size_t i = 0; i < m_blocks.size(); i++) {
+        std::unordered_map<uint64_t, BlockRange> roots;
+        for (const auto& entry : track_ranges[i]) {
+            uint64_t root = root_of(entry.first);
+            auto it = roots.emplace(root, entry.second).first;
+            BlockRange& range = it->second;
+            range.root_uuid = root;
+            range.min_time = std::min(range.min_time, entry.second.min_time);
+            range.max_time = std::max(range.max_time, entry.second.max_time);
+            range.last_block = std::max(range.last_block, entry.second.last_block);
+        }
+        std::vector<BlockRange>& ranges = m_blocks[i].ranges;
+        for (const auto& entry : roots) {
+            ranges.push_back(entry.second);
+        }
+        std::sort(ranges.begin(), ranges.end(), [](const BlockRange& a, const BlockRange& b) {
+            return a.root_uuid < b.root_uuid;
+        });
+    }
+    return true;
+}
+
+void TraceReaderImpl::save_index(const std::string& filename) const {
+    ProtoWriter w;
+    w.write_uint64_field(idx::Index::version, INDEX_VERSION);
+    w.write_uint64_field(idx::Index::trace_size, m_trace_size);
+    w.write_uint64_field(idx::Index::trace_mtime, m_trace_mtime);
+    w.write_uint64_field(idx::Index::end_time, m_end_time);
+    for (const auto& track : m_tracks) {
+        size_t msg = w.begin_nested(idx::Index::track);
+        w.write_uint64_field(idx::Track::uuid, track.uuid);
+        w.write_uint64_field(idx::Track::parent_uuid, track.parent_uuid);
+        w.write_string_field(idx::Track::name, track.name);
+        w.write_bool_field(idx::Track::is_counter, track.is_counter);
+        w.write_string_field(idx::Track::unit, track.unit);
+        w.end_nested(msg);
+    }
+    for (const auto& entry : m_interns) {
+        size_t msg = w.begin_nested(idx::Index::intern);
+        w.write_uint64_field(idx::Intern::state, entry.first.state);
+        w.write_uint64_field(idx::Intern::kind, entry.first.kind);
+        w.write_uint64_field(idx::Intern::iid, entry.first.iid);
+        w.write_string_field(idx::Intern::str, entry.second);
+        w.end_nested(msg);
+    }
+    for (const auto& block : m_blocks) {
+        size_t msg = w.begin_nested(idx::Index::block);
+        w.write_uint64_field(idx::Block::offset, block.offset);
+        w.write_uint64_field(idx::Block::size, block.size);
+        w.write_bool_field(idx::Block::compressed, block.compressed);
+        w.write_uint64_field(idx::Block::next_state, block.next_state);
+        for (const auto& entry : block.sequence_states) {
+            size_t sub = w.begin_nested(idx::Block::sequence_state);
+            w.write_uint64_field(idx::SequenceState::sequence_id, entry.first);
+            w.write_uint64_field(idx::SequenceState::state, entry.second);
+            w.end_nested(sub);
+        }
+        for (const auto& range : block.ranges) {
+            size_t sub = w.begin_nested(idx::Block::range);
+            w.write_uint64_field(idx::Range::root_uuid, range.root_uuid);
+            w.write_uint64_field(idx::Range::min_time, range.min_time);
+            w.write_uint64_field(idx::Range::max_time, range.max_time);
+            w.write_uint64_field(idx::Range::last_block, range.last_block);
+            w.end_nested(sub);
+        }
+        for (const auto& entry : block.sequence_clocks) {
+            size_t sub = w.begin_nested(idx::Block::sequence_clocks);
+            w.write_uint64_field(idx::SequenceClock::sequence_id, entry.first);
+            w.write_uint64_field(idx::SequenceClock::default_clock, entry.second.default_clock);
+            for (const auto& clock : entry.second.clocks) {
+                size_t c = w.begin_nested(idx::SequenceClock::clock);
+                w.write_uint64_field(idx::Clock::id, clock.id);
+                w.write_bool_field(idx::Clock::incremental, clock.incremental);
+                w.write_uint64_field(idx::Clock::unit_multiplier_ns, clock.unit_multiplier_ns);
+                w.write_uint64_field(idx::Clock::value, clock.value);
+                w.end_nested(c);
+            }
+            w.end_nested(sub);
+        }
+        w.end_nested(msg);
+    }
+
+    // Written aside and renamed, so a concurrent reader never sees half an index
+    std::string tmp = filename + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (!fp) {
+        return;
+    }
+    bool ok = fwrite(w.buffer().data(), 1, w.size(), fp) == w.size();
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || std::rename(tmp.c_str(), filename.c_str()) != 0) {
+        std::remove(tmp.c_str());
+    }
+}
+
+static std::pair<uint64_t, SequenceClocks::Sequence> load_sequence_clocks(ProtoReader msg) {
+    std::pair<uint64_t, SequenceClocks::Sequence> entry;
+    entry.first = 0;
+    while (msg.next()) {
+        switch (msg.field()) {
+            case idx::SequenceClock::sequence_id:
+                entry.first = msg.value();
+                break;
+            case idx::SequenceClock::default_clock:
+                entry.second.default_clock = static_cast<uint32_t>(msg.value());
+                break;
+            case idx::SequenceClock::clock: {
+                SequenceClocks::Clock clock = {0, false, 1, 0};
+                ProtoReader sub = msg.nested();
+                while (sub.next()) {
+                    switch (sub.field()) {
+                        case idx::Clock::id: clock.id = static_cast<uint32_t>(sub.value()); break;
+                        case idx::Clock::incremental: clock.incremental = sub.value() != 0; break;
+                        case idx::Clock::unit_multiplier_ns:
+                            clock.unit_multiplier_ns = sub.value();
+                            break;
+                        case idx::Clock::value: clock.value = sub.value(); break;
+                    }
+                }
+                entry.second.clocks.push_back(clock);
+                break;
+            }
+        }
+    }
+    return entry;
+}
+
+bool TraceReaderImpl::load_index(const std::string& filename) {
+    MappedFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
+    uint64_t version = 0, trace_size = ~uint64_t(0), trace_mtime = 0;
+    ProtoReader index(file.data(), file.size());
+    while (index.next()) {
+        switch (index.field()) {
+            case idx::Index::version:
+                version = index.value();
+                break;
+            case idx::Index::trace_size:
+                trace_size = index.value();
+                break;
+            case idx::Index::trace_mtime:
+                trace_mtime = index.value();
+                break;
+            case idx::Index::end_time:
+                m_end_time = index.value();
+                break;
+            case idx::Index::track: {
+                TraceTrack track = {0, 0, std::string(), false, std::string()};
+                ProtoReader msg = index.nested();
+                while (msg.next()) {
+                    switch (msg.field()) {
+                        case idx::Track::uuid: track.uuid = msg.value(); break;
+                        case idx::Track::parent_uuid: track.parent_uuid = msg.value(); break;
+                        case idx::Track::name: track.name.assign(msg.as_string()); break;
+                        case idx::Track::is_counter: track.is_counter = msg.value() != 0; break;
+                        case idx::Track::unit: track.unit.assign(msg.as_string()); break;
+                    }
+                }
+                m_track_index.emplace(track.uuid, m_tracks.size());
+                m_tracks.push_back(std::move(track));
+                break;
+            }
+            case idx::Index::intern: {
+                InternKey key = {0, 0, 0};
+                std::string_view str;
+                ProtoReader msg = index.nested();
+                while (msg.next()) {
+                    switch (msg.field()) {
+                        case idx::Intern::state: key.state = msg.value(); break;
+                        case idx::Intern::kind: key.kind = static_cast<uint32_t>(msg.value()); break;
+                        case idx::Intern::iid: key.iid = msg.value(); break;
+                        case idx::Intern::str: str = msg.as_string(); break;
+                    }
+                }
+                m_interns[key].assign(str);
+                break;
+            }
+            case idx::Index::block: {
+                IndexBlock block = {0, 0, false, 0, {}, {}, {}};
+                ProtoReader msg = index.nested();
+                while (msg.next()) {
+                    switch (msg.field()) {
+                        case idx::Block::offset: block.offset = msg.value(); break;
+                        case idx::Block::size: block.size = msg.value(); break;
+                        case idx::Block::compressed: block.compressed = msg.value() != 0; break;
+                        case idx::Block::next_state: block.next_state = msg.value(); break;
+                        case idx::Block::sequence_state: {
+                            std::pair<uint64_t, uint64_t> entry(0, 0);
+                            ProtoReader sub = msg.nested();
+                            while (sub.next()) {
+                                if (sub.field() == idx::SequenceState::sequence_id) {
+                                    entry.first = sub.value();
+                                } else if (sub.field() == idx::SequenceState::state) {
+                                    entry.second = sub.value();
+                                }
+                            }
+                            block.sequence_states.push_back(entry);
+                            break;
+                        }
+                        case idx::Block::range: {
+                            BlockRange range = {0, 0, 0, 0};
+                            ProtoReader sub = msg.nested();
+                            while (sub.next()) {
+                                switch (sub.field()) {
+                                    case idx::Range::root_uuid: range.root_uuid = sub.value(); break;
+                                    case idx::Range::min_time: range.min_time = sub.value(); break;
+                                    case idx::Range::max_time: range.max_time = sub.value(); break;
+                                    case idx::Range::last_block:
+                                        range.last_block = static_cast<uint32_t>(sub.value());
+                                        break;
+                                }
+                            }
+                            block.ranges.push_back(range);
+                            break;
+                        }
+                        case idx::Block::sequence_clocks:
+                            block.sequence_clocks.push_back(load_sequence_clocks(msg.nested()));
+                            break;
+                    }
+                }
+                m_blocks.push_back(std::move(block));
+                break;
+            }
+        }
+    }
+
+    bool valid = !index.error() && version == INDEX_VERSION && trace_size == m_trace_size &&
+                 trace_mtime == m_trace_mtime;
+    for (const auto& block : m_blocks) {
+        valid = valid && block.offset + block.size <= m_trace_size;
+        for (const auto& range : block.ranges) {
+            valid = valid && range.last_block < m_blocks.size();
+        }
+    }
+    if (!valid) {
+        // Stale or damaged: start over from the trace
+        m_end_time = 0;
+        m_tracks.clear();
+        m_track_index.clear();
+        m_interns.clear();
+        m_blocks.clear();
+    }
+    return valid;
+}
+
+std::vector<std::pair<uint32_t, uint32_t>>
+TraceReaderImpl::select_blocks(const TraceQuery& query) const {
+    std::vector<std::pair<uint32_t, uint32_t>> runs;
+    uint64_t root = query.track_uuid ? root_of(query.track_uuid) : 0;
+    for (uint32_t i = 0; i < m_blocks.size(); i++) {
+        const std::vector<BlockRange>& ranges = m_blocks[i].ranges;
+        uint32_t last = 0;
+        bool selected = false;
+        auto match = [&](const BlockRange& range) {
+            if (range.min_time <= query.end_time && range.max_time >= query.start_time) {
+                last = selected ? std::max(last, range.last_block) : range.last_block;
+                selected = true;
+            }
+        };
+        if (root) {
+            auto it = std::lower_bound(ranges.begin(), ranges.end(), root,
+                [](const BlockRange& range, uint64_t uuid) { return range.root_uuid < uuid; });
+            if (it != ranges.end() && it->root_uuid == root) {
+                match(*it);
+            }
+        } else {
+            for (const auto& range : ranges) {
+                match(range);
+            }
+        }
+        if (!selected) {
+            continue;
+        }
+        last = std::max(last, i);
+        if (!runs.empty() && i <= runs.back().second + 1) {
+            runs.back().second = std::max(runs.back().second, last);
+        } else {
+            runs.emplace_back(i, last);
+        }
+    }
+    return runs;
+}
+
+template <typename F> void TraceReaderImpl::decode_run(uint32_t first, uint32_t last, F f) const {
+    SequenceStates states;
+    states.m_next = m_blocks[first].next_state;
+    states.m_current.insert(m_blocks[first].sequence_states.begin(),
+                            m_blocks[first].sequence_states.end());
+    SequenceClocks clocks;
+    clocks.m_sequences.insert(m_blocks[first].sequence_clocks.begin(),
+                              m_blocks[first].sequence_clocks.end());
+    std::vector<uint8_t> scratch;
+    for (uint32_t i = first; i <= last; i++) {
+        const IndexBlock& block = m_blocks[i];
+        m_blocks_decoded.fetch_add(1, std::memory_order_relaxed);
+        for_each_packet(m_file.data() + block.offset, static_cast<size_t>(block.size),
+                        block.compressed, scratch,
+                        [&](const uint8_t* data, size_t size) {
+            PacketFields packet = parse_packet(data, size);
+            resolve_time(packet, clocks);
+            uint64_t state = states.on_packet(packet);
+            if (packet.has_event) {
+                f(packet, state);
+            }
+        });
+    }
+}
+
+void TraceReaderImpl::decode_attribute(ProtoReader annotation, uint64_t state,
+                                       TraceAttribute& attr) const {
+    attr.type = TraceAttribute::STRING;
+    attr.uint_value = 0;
+    attr.int_value = 0;
+    attr.double_value = 0.0;
+    while (annotation.next()) {
+        switch (annotation.field()) {
+            case pb::DebugAnnotation::name_iid: {
+                const std::string* name = lookup(state, pb::InternedData::debug_annotation_names,
+                                                 annotation.value());
+                if (name) {
+                    attr.name = *name;
+                }
+                break;
+            }
+            case pb::DebugAnnotation::name:
+                attr.name.assign(annotation.as_string());
+                break;
+            case pb::DebugAnnotation::uint_value:
+                attr.type = TraceAttribute::UINT;
+                attr.uint_value = annotation.value();
+                break;
+            case pb::DebugAnnotation::int_value:
+                attr.type = TraceAttribute::INT;
+                attr.int_value = static_cast<int64_t>(annotation.value());
+                break;
+            case pb::DebugAnnotation::double_value:
+                attr.type = TraceAttribute::DOUBLE;
+                attr.double_value = annotation.as_double();
+                break;
+            case pb::DebugAnnotation::string_value:
+                attr.type = TraceAttribute::STRING;
+                attr.string_value.assign(annotation.as_string());
+                break;
+            case pb::DebugAnnotation::array_values: {
+                attr.type = TraceAttribute::WORDS;
+                ProtoReader word = annotation.nested();
+                while (word.next()) {
+                    if (word.field() == pb::DebugAnnotation::uint_value) {
+                        attr.words.push_back(word.value());
+                    }
+                }
+                break;
+            }
+        }
+    }
+}
+
+void TraceReaderImpl::decode_end(ProtoReader event, uint64_t state, TraceTransaction& txn) const {
+    while (event.next()) {
+        switch (event.field()) {
+            case pb::TrackEvent::debug_annotations:
+                txn.attributes.emplace_back();
+                decode_attribute(event.nested(), state, txn.attributes.back());
+                break;
+            case pb::TrackEvent::flow_ids:
+                txn.flow_ids.push_back(event.value());
+                break;
+            case pb::TrackEvent::terminating_flow_ids:
+                txn.terminating_flow_ids.push_back(event.value());
+                break;
+        }
+    }
+}
+
+void TraceReaderImpl::decode_begin(ProtoReader event, uint64_t state,
+                                   TraceTransaction& txn) const {
+    ProtoReader fields = event;
+    while (fields.next()) {
+        const std::string* str;
+        switch (fields.field()) {
+            case pb::TrackEvent::name_iid:
+                str = lookup(state, pb::InternedData::event_names, fields.value());
+                if (str) {
+                    txn.name = *str;
+                }
+                break;
+            case pb::TrackEvent::name:
+                txn.name.assign(fields.as_string());
+                break;
+            case pb::TrackEvent::category_iids:
+                str = lookup(state, pb::InternedData::event_categories, fields.value());
+                if (str) {
+                    txn.type_name = *str;
+                }
+                break;
+            case pb::TrackEvent::categories:
+                txn.type_name.assign(fields.as_string());
+                break;
+        }
+    }
+    decode_end(event, state, txn);
+}
+
+bool TraceReaderImpl::track_selected(const TraceQuery& query, uint64_t uuid,
+                                     std::unordered_map<uint64_t, bool>& cache) const {
+    if (!query.track_uuid || uuid == query.track_uuid) {
+        return true;
+    }
+    if (!query.include_children) {
+        return false;
+    }
+    auto it = cache.find(uuid);
+    if (it != cache.end()) {
+        return it->second;
+    }
+    bool descendant = false;
+    uint64_t ancestor = uuid;
+    for (size_t depth = 0; depth < m_tracks.size() && !descendant; depth++) {
+        const TraceTrack* track = find_track(ancestor);
+        if (!track || !track->parent_uuid) {
+            break;
+        }
+        ancestor = track->parent_uuid;
+        descendant = ancestor == query.track_uuid;
+    }
+    cache.emplace(uuid, descendant);
+    return descendant;
+}
+
+size_t TraceReaderImpl::for_each_transaction(
+        const TraceQuery& query,
+        const std::function<void(const TraceTransaction&)>& visit) const {
+    std::unordered_map<uint64_t, bool> selected_tracks;
+    auto selected = [&](const TraceTransaction& txn) {
+        return txn.start_time <= query.end_time &&
+               (!txn.finished || txn.end_time >= query.start_time) &&
+               (query.attribute.empty() || txn.find_attribute(query.attribute));
+    };
+
+    size_t visited = 0;
+    for (const auto& run : select_blocks(query)) {
+        // Slices nest per track, so pairing restarts cleanly at a run boundary:
+        // ends of slices begun before it find an empty stack and are skipped
+        std::unordered_map<uint64_t, std::vector<TraceTransaction>> open;
+        decode_run(run.first, run.second, [&](const PacketFields& packet, uint64_t state) {
+            EventHeader event = parse_event_header(packet.event);
+            if ((event.type != pb::TrackEvent::TYPE_SLICE_BEGIN &&
+                 event.type != pb::TrackEvent::TYPE_SLICE_END) ||
+                    !track_selected(query, event.track_uuid, selected_tracks)) {
+                return;
+            }
+            std::vector<TraceTransaction>& stack = open[event.track_uuid];
+            if (event.type == pb::TrackEvent::TYPE_SLICE_BEGIN) {
+                stack.emplace_back();
+                TraceTransaction& txn = stack.back();
+                txn.track_uuid = event.track_uuid;
+                txn.start_time = packet.timestamp;
+                txn.end_time = 0;
+                txn.finished = false;
+                decode_begin(packet.event, state, txn);
+                return;
+            }
+            if (stack.empty()) {
+                return;
+            }
+            TraceTransaction txn = std::move(stack.back());
+            stack.pop_back();
+            txn.end_time = packet.timestamp;
+            txn.finished = true;
+            decode_end(packet.event, state, txn);
+            if (selected(txn)) {
+                visit(txn);
+                visited++;
+            }
+        });
+        if (run.second + 1 != m_blocks.size()) {
+            continue;
+        }
+        for (auto& entry : open) {
+            for (auto& txn : entry.second) {
+                txn.end_time = std::max(m_end_time, txn.start_time);
+                if (selected(txn)) {
+                    visit(txn);
+                    visited++;
+                }
+            }
+        }
+    }
+    return visited;
+}
+
+size_t TraceReaderImpl::for_each_counter_sample(
+        const TraceQuery& query,
+        const std::function<void(const TraceCounterSample&)>& visit) const {
+    std::unordered_map<uint64_t, bool> selected_tracks;
+    size_t visited = 0;
+    for (const auto& run : select_blocks(query)) {
+        decode_run(run.first, run.second, [&](const PacketFields& packet, uint64_t) {
+            if (packet.timestamp < query.start_time || packet.timestamp > query.end_time) {
+                return;
+            }
+            TraceCounterSample sample = {0, packet.timestamp, false, 0, 0.0};
+            bool counter = false;
+            ProtoReader event = packet.event;
+            while (event.next()) {
+                switch (event.field()) {
+                    case pb::TrackEvent::type:
+                        counter = event.value() == pb::TrackEvent::TYPE_COUNTER;
+                        break;
+                    case pb::TrackEvent::track_uuid:
+                        sample.track_uuid = event.value();
+                        break;
+                    case pb::TrackEvent::counter_value:
+                        sample.int_value = static_cast<int64_t>(event.value());
+                        break;
+                    case pb::TrackEvent::double_counter_value:
+                        sample.is_double = true;
+                        sample.double_value = event.as_double();
+                        break;
+                }
+            }
+            if (!counter || !track_selected(query, sample.track_uuid, selected_tracks)) {
+                return;
+            }
+            visit(sample);
+            visited++;
+        });
+    }
+    return visited;
+}
+
+std::unique_ptr<TraceReader> TraceReader::open(const std::string& filename, bool write_index) {
+    std::unique_ptr<TraceReaderImpl> reader(new TraceReaderImpl);
+    if (!reader->open(filename, write_index)) {
+        return nullptr;
+    }
+    return std::unique_ptr<TraceReader>(reader.release());
+}
+
+} // namespace dvtt
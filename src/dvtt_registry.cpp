@@ -0,0 +1,78 @@
+#include "dvtt_registry.h"
+
+namespace dvtt {
+
+HandleRegistry::HandleRegistry() : m_next_index(1), m_live(0) {
+    // Index 0 is never handed out so that no handle encodes as 0
+    for (uint32_t i = 0; i < NUM_SEGMENTS; i++) {
+        m_segments[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+HandleRegistry::~HandleRegistry() {
+    for (uint32_t i = 0; i < NUM_SEGMENTS; i++) {
+        delete m_segments[i].load(std::memory_order_relaxed);
+    }
+}
+
+int HandleRegistry::add(void* object, HandleKind kind) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint32_t index;
+    if (!m_free.empty()) {
+        index = m_free.front();
+        m_free.pop_front();
+    } else {
+        if (m_next_index > HANDLE_INDEX_MASK) {
+            return 0;
+        }
+        index = m_next_index++;
+        if (!m_segments[index >> SEGMENT_BITS].load(std::memory_order_relaxed)) {
+            Segment* seg = new Segment;
+            for (Slot& s : seg->slots) {
+                s.tag.store(0, std::memory_order_relaxed);
+                s.object.store(nullptr, std::memory_order_relaxed);
+                s.generation = 0;
+            }
+            m_segments[index >> SEGMENT_BITS].store(seg, std::memory_order_release);
+        }
+    }
+    Slot& s = slot(index);
+    s.object.store(object, std::memory_order_relaxed);
+    s.tag.store(make_tag(s.generation, kind), std::memory_order_release);
+    m_live++;
+    return static_cast<int>((s.generation << HANDLE_INDEX_BITS) | index);
+}
+
+void HandleRegistry::remove(int handle) {
+    if (handle <= 0) {
+        return;
+    }
+    uint32_t index = static_cast<uint32_t>(handle) & HANDLE_INDEX_MASK;
+    uint32_t generation = static_cast<uint32_t>(handle) >> HANDLE_INDEX_BITS;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (index == 0 || index >= m_next_index) {
+        return;
+    }
+    Slot& s = slot(index);
+    if (s.generation != generation || s.tag.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    s.tag.store(0, std::memory_order_release);
+    s.object.store(nullptr, std::memory_order_relaxed);
+    s.generation = (s.generation + 1) & HANDLE_GENERATION_MASK;
+    m_free.push_back(index);
+    m_live--;
+}
+
+size_t HandleRegistry::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_live;
+}
+
+HandleRegistry& handle_registry() {
+    // Never destroyed: handles may be looked up from static destructors
+    static HandleRegistry* registry = new HandleRegistry;
+    return *registry;
+}
+
+} // namespace dvtt
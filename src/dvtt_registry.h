@@ -0,0 +1,117 @@
+#ifndef DVTT_REGISTRY_H
+#define DVTT_REGISTRY_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+namespace dvtt {
+
+// Integer handles pack a slot index with the slot's generation at
+// registration. The sign bit stays clear so handles are positive.
+constexpr uint32_t HANDLE_INDEX_BITS = 22;
+constexpr uint32_t HANDLE_GENERATION_BITS = 9;
+constexpr uint32_t HANDLE_INDEX_MASK = (1u << HANDLE_INDEX_BITS) - 1;
+constexpr uint32_t HANDLE_GENERATION_MASK = (1u << HANDLE_GENERATION_BITS) - 1;
+
+enum HandleKind {
+    HANDLE_KIND_NONE = 0,
+    HANDLE_KIND_STREAM = 1,
+    HANDLE_KIND_TRANSACTION = 2
+};
+
+/**
+ * Process-wide table mapping integer handles to objects
+ *
+ * Lookup is two array indexes and a generation compare, without locks, so
+ * it can sit on the DPI call path. Releasing a slot bumps its generation;
+ * a handle kept past its object's release therefore no longer matches and
+ * resolves to NULL instead of a dangling pointer. Released slots are
+ * reused oldest-first to keep generations from wrapping quickly.
+ *
+ * Registration and release take a mutex. Lookup racing with release of
+ * the same object is not protected: the caller owns that lifetime.
+ */
+class HandleRegistry {
+public:
+    HandleRegistry();
+
+    ~HandleRegistry();
+
+    HandleRegistry(const HandleRegistry&) = delete;
+    HandleRegistry& operator=(const HandleRegistry&) = delete;
+
+    // Returns a new non-zero handle for 'object', or 0 if the table is full
+    int add(void* object, HandleKind kind);
+
+    // Invalidates 'handle'. Unknown or stale handles are ignored
+    void remove(int handle);
+
+    // Returns the object registered as 'handle' with 'kind', or nullptr
+    void* lookup(int handle, HandleKind kind) const {
+        if (handle <= 0) {
+            return nullptr;
+        }
+        uint32_t index = static_cast<uint32_t>(handle) & HANDLE_INDEX_MASK;
+        uint32_t generation = static_cast<uint32_t>(handle) >> HANDLE_INDEX_BITS;
+        const Segment* seg = m_segments[index >> SEGMENT_BITS].load(std::memory_order_acquire);
+        if (!seg) {
+            return nullptr;
+        }
+        const Slot& slot = seg->slots[index & SEGMENT_MASK];
+        uint32_t tag = slot.tag.load(std::memory_order_acquire);
+        if (tag != make_tag(generation, kind)) {
+            return nullptr;
+        }
+        void* object = slot.object.load(std::memory_order_acquire);
+        // Re-check in case the slot was released while reading it
+        if (slot.tag.load(std::memory_order_acquire) != tag) {
+            return nullptr;
+        }
+        return object;
+    }
+
+    // Number of live handles
+    size_t size() const;
+
+private:
+    static constexpr uint32_t SEGMENT_BITS = 12;
+    static constexpr uint32_t SEGMENT_SIZE = 1u << SEGMENT_BITS;
+    static constexpr uint32_t SEGMENT_MASK = SEGMENT_SIZE - 1;
+    static constexpr uint32_t NUM_SEGMENTS = 1u << (HANDLE_INDEX_BITS - SEGMENT_BITS);
+
+    struct Slot {
+        std::atomic<uint32_t> tag;       // make_tag() while live, 0 when free
+        std::atomic<void*> object;
+        uint32_t generation;             // Guarded by m_mutex
+    };
+
+    struct Segment {
+        Slot slots[SEGMENT_SIZE];
+    };
+
+    static uint32_t make_tag(uint32_t generation, HandleKind kind) {
+        return (generation << 2) | kind;
+    }
+
+    Slot& slot(uint32_t index) {
+        return m_segments[index >> SEGMENT_BITS].load(std::memory_order_relaxed)
+            ->slots[index & SEGMENT_MASK];
+    }
+
+private:
+    // Segments are allocated on demand and kept until the registry is destroyed
+    std::atomic<Segment*>   m_segments[NUM_SEGMENTS];
+    mutable std::mutex      m_mutex;
+    std::deque<uint32_t>    m_free;
+    uint32_t                m_next_index;
+    size_t                  m_live;
+};
+
+// The registry shared by all traces
+HandleRegistry& handle_registry();
+
+} // namespace dvtt
+
+#endif // DVTT_REGISTRY_H
@@ -0,0 +1,59 @@
+#ifndef DVTT_REORDER_H
+#define DVTT_REORDER_H
+
+#include "include/dvtt.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace dvtt {
+
+/**
+ * Min-heap of timestamped items, used by the reorder window
+ *
+ * Entries are ordered by time, then by a caller-defined rank, then by
+ * insertion. The heap is a plain vector, so once it has reached its
+ * working size pushing and popping do not allocate.
+ */
+template <typename T> class TimeHeap {
+public:
+    struct Entry {
+        dvtt_time_t time;
+        uint64_t rank;
+        uint64_t order;
+        T* item;
+    };
+
+    TimeHeap() : m_next_order(0) { }
+
+    void push(dvtt_time_t time, uint64_t rank, T* item) {
+        m_heap.push_back(Entry{time, rank, m_next_order++, item});
+        std::push_heap(m_heap.begin(), m_heap.end(), later);
+    }
+
+    const Entry& top() const { return m_heap.front(); }
+
+    void pop() {
+        std::pop_heap(m_heap.begin(), m_heap.end(), later);
+        m_heap.pop_back();
+    }
+
+    bool empty() const { return m_heap.empty(); }
+    size_t size() const { return m_heap.size(); }
+    void clear() { m_heap.clear(); }
+
+private:
+    static bool later(const Entry& a, const Entry& b) {
+        if (a.time != b.time) return a.time > b.time;
+        if (a.rank != b.rank) return a.rank > b.rank;
+        return a.order > b.order;
+    }
+
+private:
+    std::vector<Entry>  m_heap;
+    uint64_t            m_next_order;
+};
+
+} // namespace dvtt
+
+#endif // DVTT_REORDER_H
@@ -0,0 +1,415 @@
+#include "dvtt_writer.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#endif
+
+namespace dvtt {
+
+FileSink::FileSink(FILE* fp) : m_fp(fp) {
+    // Chunks are already batched; bypass the stdio buffer
+    setvbuf(m_fp, nullptr, _IONBF, 0);
+}
+
+FileSink::~FileSink() {
+    close();
+}
+
+FileSink* FileSink::open(const std::string& filename) {
+    FILE* fp = fopen(filename.c_str(), "wb");
+    if (!fp) {
+        return nullptr;
+    }
+    return new FileSink(fp);
+}
+
+bool FileSink::write_chunk(std::vector<uint8_t>& chunk) {
+    bool ok = true;
+    if (m_fp && !chunk.empty()) {
+        ok = fwrite(chunk.data(), 1, chunk.size(), m_fp) == chunk.size();
+    }
+    chunk.clear();
+    return ok;
+}
+
+void FileSink::flush() {
+    if (m_fp) {
+        fflush(m_fp);
+    }
+}
+
+void FileSink::sync() {
+    if (!m_fp) {
+        return;
+    }
+    fflush(m_fp);
+#if defined(__linux__)
+    fdatasync(fileno(m_fp));
+#elif defined(__unix__) || defined(__APPLE__)
+    fsync(fileno(m_fp));
+#endif
+}
+
+bool FileSink::rotate(const std::string& filename) {
+    // Open the new file first so a failure leaves the current file in use
+    FILE* fp = fopen(filename.c_str(), "wb");
+    if (!fp) {
+        return false;
+    }
+    setvbuf(fp, nullptr, _IONBF, 0);
+    if (m_fp) {
+        fclose(m_fp);
+    }
+    m_fp = fp;
+    return true;
+}
+
+bool FileSink::write_from_signal(const uint8_t* data, size_t size) {
+#if defined(__unix__) || defined(__APPLE__)
+    if (!m_fp) {
+        return false;
+    }
+    int fd = fileno(m_fp);
+    while (size) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+#else
+    (void)data;
+    (void)size;
+    return false;
+#endif
+}
+
+bool FileSink::sync_from_signal() {
+#if defined(__linux__)
+    return m_fp && fdatasync(fileno(m_fp)) == 0;
+#elif defined(__unix__) || defined(__APPLE__)
+    return m_fp && fsync(fileno(m_fp)) == 0;
+#else
+    return false;
+#endif
+}
+
+void FileSink::close() {
+    if (m_fp) {
+        fclose(m_fp);
+        m_fp = nullptr;
+    }
+}
+
+AsyncSink::AsyncSink(Sink* inner, size_t ring_chunks, size_t chunk_size,
+                     dvtt_ring_full_policy_t policy) :
+    m_inner(inner), m_policy(policy), m_rotate_ok(false), m_busy(false), m_stop(false),
+    m_dropped(0), m_high_water(0), m_stalls(0) {
+    for (size_t i = 0; i < ring_chunks; i++) {
+        m_free.emplace_back();
+        m_free.back().reserve(chunk_size + chunk_size / 4);
+    }
+    m_thread = std::thread(&AsyncSink::run, this);
+}
+
+AsyncSink::~AsyncSink() {
+    close();
+    delete m_inner;
+}
+
+bool AsyncSink::write_chunk(std::vector<uint8_t>& chunk) {
+    if (chunk.empty()) {
+        return true;
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_stop) {
+        chunk.clear();
+        return false;
+    }
+    if (m_free.empty()) {
+        switch (m_policy) {
+            case DVTT_RING_FULL_DROP:
+                m_dropped++;
+                chunk.clear();
+                return false;
+            case DVTT_RING_FULL_GROW:
+                m_free.emplace_back();
+                m_free.back().reserve(chunk.capacity());
+                break;
+            case DVTT_RING_FULL_BLOCK:
+            default:
+                m_stalls++;
+                m_cond_free.wait(lock, [this] { return !m_free.empty(); });
+                break;
+        }
+    }
+    // Hand the filled chunk to the writer and give the producer an empty one
+    m_ready.emplace_back();
+    m_ready.back().chunk.swap(chunk);
+    chunk.swap(m_free.front());
+    m_free.pop_front();
+    if (m_ready.size() > m_high_water) {
+        m_high_water = m_ready.size();
+    }
+    lock.unlock();
+    m_cond_ready.notify_one();
+    return true;
+}
+
+void AsyncSink::flush() {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond_free.wait(lock, [this] { return m_ready.empty() && !m_busy; });
+    }
+    if (m_inner) {
+        m_inner->flush();
+    }
+}
+
+void AsyncSink::sync() {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond_free.wait(lock, [this] { return m_ready.empty() && !m_busy; });
+    }
+    if (m_inner) {
+        m_inner->sync();
+    }
+}
+
+void AsyncSink::ring_stats(uint64_t& high_water, uint64_t& stalls, uint64_t& dropped) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    high_water = m_high_water;
+    stalls = m_stalls;
+    dropped = m_dropped;
+}
+
+bool AsyncSink::rotate(const std::string& filename) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_stop) {
+        return false;
+    }
+    m_ready.emplace_back();
+    m_ready.back().rotate_to = filename;
+    m_cond_ready.notify_one();
+    m_cond_free.wait(lock, [this] { return m_ready.empty() && !m_busy; });
+    return m_rotate_ok;
+}
+
+bool AsyncSink::write_from_signal(const uint8_t* data, size_t size) {
+#if defined(__unix__) || defined(__APPLE__)
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        if (m_mutex.try_lock()) {
+            if (!m_busy) {
+                // The writer thread cannot take an entry while the lock is
+                // held; the emptied ones are released as usual afterwards
+                bool ok = m_inner != nullptr;
+                for (auto& entry : m_ready) {
+                    if (!ok || !entry.rotate_to.empty()) {
+                        ok = false;
+                        break;
+                    }
+                    ok = m_inner->write_from_signal(entry.chunk.data(), entry.chunk.size());
+                    entry.chunk.clear();
+                }
+                ok = ok && m_inner->write_from_signal(data, size);
+                m_mutex.unlock();
+                return ok;
+            }
+            m_mutex.unlock();
+        }
+        struct timespec pause = { 0, 1000000 };
+        nanosleep(&pause, nullptr);
+    }
+#else
+    (void)data;
+    (void)size;
+#endif
+    return false;
+}
+
+bool AsyncSink::sync_from_signal() {
+    // Only commits what is already written, so needs no lock
+    return m_inner && m_inner->sync_from_signal();
+}
+
+void AsyncSink::close() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stop) {
+            return;
+        }
+        m_stop = true;
+    }
+    m_cond_ready.notify_one();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    if (m_inner) {
+        m_inner->close();
+    }
+}
+
+void AsyncSink::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_cond_ready.wait(lock, [this] { return m_stop || !m_ready.empty(); });
+        if (m_ready.empty()) {
+            // Stopped and fully drained
+            break;
+        }
+        Entry entry;
+        entry.chunk.swap(m_ready.front().chunk);
+        entry.rotate_to.swap(m_ready.front().rotate_to);
+        m_ready.pop_front();
+        m_busy = true;
+        lock.unlock();
+
+        bool rotated = false;
+        if (!entry.rotate_to.empty()) {
+            rotated = m_inner->rotate(entry.rotate_to);
+        } else {
+            m_inner->write_chunk(entry.chunk);
+        }
+
+        lock.lock();
+        m_busy = false;
+        if (!entry.rotate_to.empty()) {
+            m_rotate_ok = rotated;
+        } else {
+            m_free.emplace_back();
+            m_free.back().swap(entry.chunk);
+        }
+        m_cond_free.notify_all();
+    }
+}
+
+RingSink::RingSink(size_t capacity_bytes) :
+    m_capacity(capacity_bytes), m_bytes(0), m_capturing(false), m_discarded(0) {
+}
+
+bool RingSink::write_chunk(std::vector<uint8_t>& chunk) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (chunk.empty()) {
+        return true;
+    }
+    if (m_capturing) {
+        m_header.emplace_back(std::move(chunk));
+        chunk.clear();
+        return true;
+    }
+    m_bytes += chunk.size();
+    m_chunks.emplace_back(std::move(chunk));
+    chunk.clear();
+    while (m_bytes > m_capacity && m_chunks.size() > 1) {
+        m_bytes -= m_chunks.front().size();
+        chunk.swap(m_chunks.front());
+        chunk.clear();
+        m_chunks.pop_front();
+        m_discarded++;
+    }
+    return true;
+}
+
+void RingSink::close() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_chunks.clear();
+    m_header.clear();
+    m_bytes = 0;
+}
+
+void RingSink::begin_header() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_header.clear();
+    m_capturing = true;
+}
+
+void RingSink::end_header() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_capturing = false;
+}
+
+bool RingSink::dump(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    FILE* fp = fopen(filename.c_str(), "wb");
+    if (!fp) {
+        m_header.clear();
+        return false;
+    }
+    bool ok = true;
+    for (const auto& chunk : m_header) {
+        ok = ok && fwrite(chunk.data(), 1, chunk.size(), fp) == chunk.size();
+    }
+    for (const auto& chunk : m_chunks) {
+        ok = ok && fwrite(chunk.data(), 1, chunk.size(), fp) == chunk.size();
+    }
+    m_header.clear();
+    return fclose(fp) == 0 && ok;
+}
+
+size_t RingSink::retained_bytes() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bytes;
+}
+
+uint64_t RingSink::discarded_chunks() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_discarded;
+}
+
+PacketWriter::PacketWriter(Sink* sink, size_t chunk_size) :
+    m_sink(sink), m_chunk_size(chunk_size), m_packet(0), m_packet_start(0), m_in_packet(false),
+    m_lost(false) {
+    // Leave headroom for the packet that crosses the threshold
+    m_buf.reserve(m_chunk_size + m_chunk_size / 4);
+}
+
+void PacketWriter::flush() {
+    if (m_buf.empty()) {
+        return;
+    }
+    m_flushed.add(m_buf.size());
+    uint64_t start = monotonic_ns();
+    if (m_sink && !m_sink->write_chunk(m_buf)) {
+        m_lost = true;
+    }
+    m_io_ns.add(monotonic_ns() - start);
+    m_buf.clear();
+    if (m_buf.capacity() < m_chunk_size) {
+        m_buf.reserve(m_chunk_size + m_chunk_size / 4);
+    }
+}
+
+bool PacketWriter::flush_from_signal() {
+    if (m_buf.empty()) {
+        return true;
+    }
+    if (!m_sink || !m_sink->write_from_signal(m_buf.data(), m_buf.size())) {
+        return false;
+    }
+    m_flushed.add(m_buf.size());
+    m_buf.clear();
+    return true;
+}
+
+void PacketWriter::checkpoint(bool sync) {
+    flush();
+    if (!m_sink) {
+        return;
+    }
+    uint64_t start = monotonic_ns();
+    if (sync) {
+        m_sink->sync();
+    } else {
+        m_sink->flush();
+    }
+    m_io_ns.add(monotonic_ns() - start);
+}
+
+} // namespace dvtt
@@ -0,0 +1,359 @@
+#ifndef DVTT_WRITER_H
+#define DVTT_WRITER_H
+
+#include "include/dvtt.h"
+#include "dvtt_proto.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dvtt {
+
+// Default size at which an encoded chunk is handed to the sink
+constexpr size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+// Default number of chunks in the asynchronous writer ring
+constexpr size_t DEFAULT_RING_CHUNKS = 8;
+
+// Monotonic wall-clock time for the self-instrumentation counters
+inline uint64_t monotonic_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/**
+ * Self-instrumentation counter updated by one thread and read by any
+ *
+ * Updates are a plain load and store, so they cost no more than a
+ * non-atomic increment; readers may see a slightly stale value.
+ */
+class StatCounter {
+public:
+    StatCounter() : m_value(0) { }
+
+    void add(uint64_t n) {
+        m_value.store(m_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void set(uint64_t value) { m_value.store(value, std::memory_order_relaxed); }
+
+    uint64_t get() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_value;
+};
+
+/**
+ * Destination for chunks of encoded TracePackets
+ *
+ * Chunks always contain whole packets. write_chunk() consumes the chunk
+ * and leaves the vector empty (its capacity may be reused by the caller).
+ */
+class Sink {
+public:
+    virtual ~Sink() { }
+
+    virtual bool write_chunk(std::vector<uint8_t>& chunk) = 0;
+
+    virtual void flush() { }
+
+    // Flushes and asks the OS to commit the written data to storage
+    virtual void sync() { flush(); }
+
+    // Directs chunks written after this call to a new file. Returns false
+    // if the sink cannot rotate or the file cannot be created, in which
+    // case output continues to the current file.
+    virtual bool rotate(const std::string& filename) { (void)filename; return false; }
+
+    // Write 'size' bytes, and commit what was written to storage, from a
+    // signal handler: without allocating and giving up rather than waiting
+    // on a lock the interrupted code may hold. Return false if they could
+    // not, as sinks that cannot do this at all always do.
+    virtual bool write_from_signal(const uint8_t* data, size_t size) {
+        (void)data;
+        (void)size;
+        return false;
+    }
+
+    virtual bool sync_from_signal() { return false; }
+
+    virtual void close() = 0;
+};
+
+/**
+ * Synchronous sink writing each chunk to a file with a single fwrite
+ */
+class FileSink : public Sink {
+public:
+    FileSink(FILE* fp);
+
+    virtual ~FileSink();
+
+    static FileSink* open(const std::string& filename);
+
+    virtual bool write_chunk(std::vector<uint8_t>& chunk) override;
+
+    virtual void flush() override;
+
+    virtual void sync() override;
+
+    virtual bool rotate(const std::string& filename) override;
+
+    // write(2) and fdatasync(2) on the file, which is unbuffered
+    virtual bool write_from_signal(const uint8_t* data, size_t size) override;
+
+    virtual bool sync_from_signal() override;
+
+    virtual void close() override;
+
+private:
+    FILE* m_fp;
+};
+
+/**
+ * Serializes chunks from several producer threads onto an inner sink
+ *
+ * Only chunk hand-off is locked; packets are encoded into per-thread
+ * buffers without synchronization.
+ */
+class LockedSink : public Sink {
+public:
+    LockedSink(Sink* inner) : m_inner(inner) { }
+
+    virtual ~LockedSink() {
+        delete m_inner;
+    }
+
+    virtual bool write_chunk(std::vector<uint8_t>& chunk) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_inner->write_chunk(chunk);
+    }
+
+    virtual void flush() override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_inner->flush();
+    }
+
+    virtual void sync() override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_inner->sync();
+    }
+
+    virtual bool rotate(const std::string& filename) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_inner->rotate(filename);
+    }
+
+    virtual bool write_from_signal(const uint8_t* data, size_t size) override {
+        std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+        return lock.owns_lock() && m_inner->write_from_signal(data, size);
+    }
+
+    virtual bool sync_from_signal() override {
+        std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+        return lock.owns_lock() && m_inner->sync_from_signal();
+    }
+
+    virtual void close() override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_inner->close();
+    }
+
+private:
+    Sink*       m_inner;
+    std::mutex  m_mutex;
+};
+
+/**
+ * Sink that queues chunks in a fixed ring and writes them to an inner
+ * sink from a dedicated thread
+ *
+ * The producer swaps its filled chunk with an empty ring buffer, so no
+ * bytes are copied on the simulator thread. When every ring buffer is
+ * queued the configured policy decides whether the producer waits, drops
+ * the chunk or allocates another buffer.
+ */
+class AsyncSink : public Sink {
+public:
+    AsyncSink(Sink* inner, size_t ring_chunks, size_t chunk_size,
+              dvtt_ring_full_policy_t policy);
+
+    virtual ~AsyncSink();
+
+    virtual bool write_chunk(std::vector<uint8_t>& chunk) override;
+
+    // Waits until all queued chunks have been written
+    virtual void flush() override;
+
+    virtual void sync() override;
+
+    // Queues the rotation behind the chunks already in the ring and waits
+    // for the writer thread to perform it
+    virtual bool rotate(const std::string& filename) override;
+
+    // Writes the queued chunks, then 'data', to the inner sink on the
+    // calling thread. Gives up if the writer thread stays busy or the lock
+    // stays taken for about a second, or a rotation is queued.
+    virtual bool write_from_signal(const uint8_t* data, size_t size) override;
+
+    virtual bool sync_from_signal() override;
+
+    // Drains the ring, stops the writer thread and closes the inner sink
+    virtual void close() override;
+
+    uint64_t dropped_chunks() const { return m_dropped; }
+
+    // Most chunks queued at once, times a producer waited for a free
+    // buffer (DVTT_RING_FULL_BLOCK) and chunks dropped (DVTT_RING_FULL_DROP)
+    void ring_stats(uint64_t& high_water, uint64_t& stalls, uint64_t& dropped);
+
+private:
+    // Queued work: a chunk, or a rotation request when rotate_to is set
+    struct Entry {
+        std::vector<uint8_t> chunk;
+        std::string rotate_to;
+    };
+
+    void run();
+
+private:
+    Sink*                               m_inner;
+    dvtt_ring_full_policy_t             m_policy;
+    std::mutex                          m_mutex;
+    std::condition_variable             m_cond_ready;    // Signaled when a chunk is queued
+    std::condition_variable             m_cond_free;     // Signaled when a chunk is released
+    std::deque<std::vector<uint8_t>>    m_free;
+    std::deque<Entry>                   m_ready;
+    bool                                m_rotate_ok;
+    bool                                m_busy;
+    bool                                m_stop;
+    uint64_t                            m_dropped;
+    uint64_t                            m_high_water;
+    uint64_t                            m_stalls;
+    std::thread                         m_thread;
+};
+
+/**
+ * Sink keeping the newest chunks in memory within a byte budget
+ *
+ * Nothing reaches a file until dump(). Once the retained chunks exceed the
+ * budget the oldest are discarded, though the newest is always kept; the
+ * discarded buffer is handed back to the producer so steady-state writes
+ * do not allocate. Chunks written between begin_header() and end_header()
+ * are held apart and written ahead of the ring by the next dump().
+ */
+class RingSink : public Sink {
+public:
+    RingSink(size_t capacity_bytes);
+
+    virtual bool write_chunk(std::vector<uint8_t>& chunk) override;
+
+    // Discards the retained chunks
+    virtual void close() override;
+
+    void begin_header();
+
+    void end_header();
+
+    // Writes the header chunks, then the retained chunks oldest first, and
+    // drops the header. The ring itself is kept.
+    bool dump(const std::string& filename);
+
+    size_t retained_bytes();
+
+    uint64_t discarded_chunks();
+
+private:
+    std::mutex                          m_mutex;
+    size_t                              m_capacity;
+    size_t                              m_bytes;
+    std::deque<std::vector<uint8_t>>    m_chunks;
+    std::vector<std::vector<uint8_t>>   m_header;
+    bool                                m_capturing;
+    uint64_t                            m_discarded;
+};
+
+/**
+ * Encodes TracePackets into an in-memory chunk
+ *
+ * Each packet is written as a Trace.packet field whose length is
+ * backfilled by end_packet(). Once the chunk reaches the configured size
+ * it is passed to the sink, so the sink only ever sees whole packets.
+ */
+class PacketWriter : public ProtoWriter {
+public:
+    PacketWriter(Sink* sink, size_t chunk_size = DEFAULT_CHUNK_SIZE);
+
+    void begin_packet() {
+        m_packet_start = m_buf.size();
+        m_packet = begin_nested(pb::Trace::packet);
+        m_in_packet = true;
+    }
+
+    // With 'may_flush' false the chunk is left open even if full, so the
+    // next packet is guaranteed to land in the same chunk
+    void end_packet(bool may_flush = true) {
+        end_nested(m_packet);
+        m_in_packet = false;
+        if (may_flush && m_buf.size() >= m_chunk_size) {
+            flush();
+        }
+    }
+
+    // Hands any buffered packets to the sink
+    void flush();
+
+    // Flushes, then flushes the sink, or syncs it
+    void checkpoint(bool sync);
+
+    // Writes the buffered packets with Sink::write_from_signal()
+    bool flush_from_signal();
+
+    // Drops a packet left half-encoded, e.g. when a signal interrupted it.
+    // It may have carried interned definitions or moved the sequence's
+    // clock, so it is reported like a lost chunk.
+    void discard_open_packet() {
+        if (m_in_packet) {
+            m_buf.resize(m_packet_start);
+            m_in_packet = false;
+            m_lost = true;
+        }
+    }
+
+    // Total bytes encoded, including those still buffered
+    uint64_t bytes_written() const { return m_flushed.get() + m_buf.size(); }
+
+    // Bytes handed to the sink, and the time spent handing them over and in
+    // checkpoints. Any thread may read these.
+    uint64_t flushed_bytes() const { return m_flushed.get(); }
+    uint64_t io_ns() const { return m_io_ns.get(); }
+
+    // Returns true, once, if the sink discarded a chunk since the last call
+    bool take_packets_lost() {
+        bool lost = m_lost;
+        m_lost = false;
+        return lost;
+    }
+
+    Sink* sink() const { return m_sink; }
+
+private:
+    Sink*   m_sink;
+    size_t  m_chunk_size;
+    size_t  m_packet;
+    size_t  m_packet_start;
+    bool    m_in_packet;
+    bool    m_lost;
+    StatCounter m_flushed;
+    StatCounter m_io_ns;
+};
+
+} // namespace dvtt
+
+#endif // DVTT_WRITER_H
@@ -26,6 +26,8 @@ extern "C" {
 typedef struct dvtt_trace_s* dvtt_trace_t;
 typedef struct dvtt_stream_s* dvtt_stream_t;
 typedef struct dvtt_transaction_s* dvtt_transaction_t;
+typedef struct dvtt_counter_s* dvtt_counter_t;
+typedef struct dvtt_schema_s* dvtt_schema_t;
 
 /**
  * Radix for displaying numeric values
@@ -81,6 +83,10 @@ typedef struct {
             const void* data;
             size_t size_bytes;
         } blob;
+        struct {
+            const void* data;     /* Packed bits, least significant first */
+            size_t num_bits;
+        } bits;                   /* For DVTT_ATTR_BITSTRING */
     } value;
 } dvtt_attr_value_t;
 
@@ -103,6 +109,10 @@ typedef uint64_t dvtt_time_t;
  * 
  * Note: A trace object is the top-level container for all streams.
  * The time_units parameter defines the resolution of all timestamps in the trace.
+ * Packets carry them as deltas on a per-sequence clock whose ClockSnapshot
+ * records the unit, so viewers show real time for units that are a whole
+ * number of nanoseconds ("10ns", "1us"). Finer units are kept as they are
+ * and display as nanoseconds.
  * 
  * Example:
  *   trace = dvtt_create_trace("sim.perfetto", "my_simulation", "1ns");
@@ -111,12 +121,169 @@ dvtt_trace_t dvtt_create_trace(const char* filename,
                                 const char* name,
                                 const char* time_units);
 
+/**
+ * Policy applied by the asynchronous writer when its chunk ring is full
+ */
+typedef enum {
+    DVTT_RING_FULL_BLOCK,  /* Wait for the writer thread to free a chunk */
+    DVTT_RING_FULL_DROP,   /* Discard the chunk and count it as dropped */
+    DVTT_RING_FULL_GROW    /* Allocate an additional chunk */
+} dvtt_ring_full_policy_t;
+
+/**
+ * Compression applied to chunks of trace packets
+ */
+typedef enum {
+    DVTT_COMPRESSION_NONE,     /* Write packets as-is */
+    DVTT_COMPRESSION_DEFLATE   /* Write each chunk as a zlib-compressed compressed_packets packet */
+} dvtt_compression_t;
+
+/**
+ * Handling of transactions open longer than the reorder window
+ */
+typedef enum {
+    DVTT_REORDER_SPLIT,     /* Write the begin as it leaves the window; later attributes go on the end */
+    DVTT_REORDER_UNSORTED   /* Write the whole transaction at close, out of order */
+} dvtt_reorder_fallback_t;
+
+/**
+ * Trace creation options
+ * 
+ * Initialize with dvtt_trace_options_init() before setting fields, so that
+ * fields added in later versions receive their defaults.
+ */
+typedef struct {
+    size_t chunk_size;                        /* Bytes buffered before a chunk is written (0: default) */
+    int async_writer;                         /* Non-zero: write chunks from a background thread */
+    size_t ring_chunks;                       /* Chunks in the async writer ring (0: default) */
+    dvtt_ring_full_policy_t ring_full_policy; /* Behavior when the ring is full */
+    int free_on_close;                        /* Non-zero: free transactions when they are closed */
+    int raw_bits;                             /* Non-zero: record bit vectors as numbers, not strings */
+    int multi_thread;                         /* Non-zero: allow recording from several threads */
+    size_t rotate_bytes;                      /* Start a new file after this many bytes (0: never) */
+    dvtt_time_t rotate_time;                  /* Start a new file every this many time units (0: never) */
+    dvtt_compression_t compression;           /* Chunk compression */
+    int compression_level;                    /* zlib level 1-9 (0: default) */
+    size_t flight_recorder_bytes;             /* Keep only the newest bytes, in memory (0: off) */
+    dvtt_time_t reorder_window;               /* Write events in time order within this window (0: at close) */
+    dvtt_reorder_fallback_t reorder_fallback; /* Transactions open longer than the window */
+    dvtt_time_t flush_time;                   /* Checkpoint as events pass each multiple of this time (0: off) */
+    uint64_t flush_packets;                   /* Checkpoint after this many packets (0: off) */
+    int flush_sync;                           /* Also commit each checkpoint to storage (fdatasync) */
+    size_t mmap_window;                       /* Write through file mappings of this many bytes (0: stdio) */
+    dvtt_time_t stats_interval;               /* Write dvtt_get_trace_stats() counters every this much time (0: off) */
+    uint32_t id_namespace;                    /* Allocate ids apart from other traces' (0-65535, see below) */
+} dvtt_trace_options_t;
+
+/**
+ * Initialize trace options to their defaults
+ * 
+ * @param options Options to initialize
+ * 
+ * Defaults: 64KiB chunks, synchronous writes, 8-chunk ring, block when full,
+ * transactions retained until freed, single-threaded
+ * 
+ * With multi_thread set, each recording thread writes its own packet
+ * sequence with its own intern tables and chunk buffer. Different streams
+ * may then be used concurrently; a stream and its transactions must be used
+ * by one thread at a time, though they may move between threads.
+ * dvtt_close_trace() must be called after all recording threads are done.
+ * 
+ * With rotate_bytes or rotate_time set, output is split into self-contained
+ * files: "run.perfetto", then "run.1.perfetto", "run.2.perfetto", ... Each
+ * file restates the descriptors of open streams and child tracks and its
+ * own interned strings, so any one can be opened alone. Rotation happens
+ * between transactions; rotate_time windows are based on close times.
+ * Rotation cannot be combined with multi_thread (DVTT_ERROR_INVALID_ARGUMENT).
+ * rotate_bytes counts bytes before compression.
+ * 
+ * With compression set to DVTT_COMPRESSION_DEFLATE each chunk is written as
+ * one TracePacket.compressed_packets, which the Perfetto UI and
+ * trace_processor decompress on load. Combine with async_writer to move
+ * compression off the recording thread. Creating a compressed trace fails
+ * with DVTT_ERROR_INVALID_ARGUMENT if the library was built without zlib.
+ * 
+ * With flight_recorder_bytes set, nothing is written to the file: chunks
+ * are kept in memory and the oldest are discarded once they exceed the
+ * budget. dvtt_dump_trace() writes the retained window. Each chunk restarts
+ * the interned state so it decodes without the chunks before it, and child
+ * track descriptors are written with their transaction's events. Memory
+ * use is bounded by flight_recorder_bytes plus one chunk. With compression
+ * the budget counts compressed bytes. Cannot be combined with rotation
+ * (DVTT_ERROR_INVALID_ARGUMENT).
+ * 
+ * With reorder_window set, events are written in timestamp order rather
+ * than as each transaction closes, so readers need not sort the trace. A
+ * closed transaction's begin and end wait until no open transaction starts
+ * earlier, and no later than reorder_window behind the latest time seen.
+ * A transaction open longer than the window is handled by
+ * reorder_fallback: DVTT_REORDER_SPLIT writes its begin then, with the
+ * attributes added so far, and puts later attributes on its end;
+ * DVTT_REORDER_UNSORTED writes it at close, out of order. Transactions
+ * starting more than the window behind the latest time are out of order
+ * as well. Cannot be combined with multi_thread, rotation or the flight
+ * recorder (DVTT_ERROR_INVALID_ARGUMENT).
+ * 
+ * flush_time and flush_packets set checkpoints at which the packets encoded
+ * so far are handed to the file, as dvtt_flush_trace() does, so a process
+ * that dies without closing the trace still leaves every event up to the
+ * last checkpoint on disk. Time checkpoints are taken when the first
+ * packet at or past each multiple of flush_time is written. Each thread of
+ * a multi_thread trace checkpoints its own packets. Checkpoints have no
+ * meaning for a flight recorder (DVTT_ERROR_INVALID_ARGUMENT).
+ * 
+ * With mmap_window set, the file is extended and mapped that many bytes at
+ * a time (rounded up to whole pages) and chunks are copied into the
+ * mapping, so writing a chunk makes no system call until a window fills.
+ * Written data survives a process crash as soon as it is copied. The file
+ * is truncated to its contents at each checkpoint and at close; a
+ * process killed in between leaves zero padding after the last chunk.
+ * Use with async_writer to move window changes off the recording thread.
+ * Not available on platforms without mmap, nor for flight recorders
+ * (DVTT_ERROR_INVALID_ARGUMENT).
+ * 
+ * With stats_interval set, the first transaction to close in each
+ * multiple of that time also writes the dvtt_get_trace_stats() totals to
+ * counter tracks grouped under a "dvtt" track, so the cost of tracing can
+ * be read next to the simulation it measures.
+ * 
+ * With id_namespace set, track uuids, transaction ids and flow ids are
+ * allocated from id_namespace << 40 and packet sequence ids from
+ * id_namespace << 16. Traces recorded with different namespaces, e.g. one
+ * per process of a partitioned simulation, then merge with
+ * dvtt_merge_traces() without remapping. Values above 65535 fail with
+ * DVTT_ERROR_INVALID_ARGUMENT.
+ */
+void dvtt_trace_options_init(dvtt_trace_options_t* options);
+
+/**
+ * Create a new trace object with explicit options
+ * 
+ * @param filename Output trace filename
+ * @param name Trace name for display/identification
+ * @param time_units Time unit string (e.g., "1ns", "1ps", "1us")
+ * @param options Trace options (may be NULL for defaults)
+ * @return Trace handle, or NULL on failure
+ * 
+ * Example:
+ *   dvtt_trace_options_t opts;
+ *   dvtt_trace_options_init(&opts);
+ *   opts.async_writer = 1;
+ *   trace = dvtt_create_trace_ex("sim.perfetto", "my_simulation", "1ns", &opts);
+ */
+dvtt_trace_t dvtt_create_trace_ex(const char* filename,
+                                   const char* name,
+                                   const char* time_units,
+                                   const dvtt_trace_options_t* options);
+
 /**
  * Close and free a trace object and all its streams
  * 
  * @param trace Trace handle to close
  * 
- * Note: This flushes all pending data and closes the output file
+ * Note: This flushes all pending data and closes the output file.
+ * When the asynchronous writer is enabled, all queued chunks are
+ * written before this returns.
  */
 void dvtt_close_trace(dvtt_trace_t trace);
 
@@ -144,6 +311,169 @@ const char* dvtt_get_trace_filename(dvtt_trace_t trace);
  */
 const char* dvtt_get_trace_time_units(dvtt_trace_t trace);
 
+/**
+ * Write the window retained by a flight-recorder trace
+ * 
+ * @param trace Trace created with flight_recorder_bytes set
+ * @param filename Output file, or NULL or "" for the trace filename
+ * @return Non-zero on success, 0 on failure: DVTT_ERROR_INVALID_ARGUMENT if
+ *         the trace is not a flight recorder, DVTT_ERROR_MEMORY if the file
+ *         cannot be written
+ * 
+ * Note: The file opens on its own: it starts with the descriptors of every
+ * stream and open child track, followed by the retained chunks. Recording
+ * continues afterwards and the trace may be dumped again. In multi-threaded
+ * traces other threads must not be recording during the call, and packets
+ * they have not yet handed off are not included.
+ */
+int dvtt_dump_trace(dvtt_trace_t trace, const char* filename);
+
+/**
+ * Create a flight-recorder trace with otherwise default options
+ * 
+ * @param filename Default dump filename (nothing is written until a dump)
+ * @param name Trace name for display/identification
+ * @param time_units Time unit string (e.g., "1ns")
+ * @param max_bytes Size of the in-memory window (flight_recorder_bytes)
+ * @return Trace handle, or NULL on failure
+ * 
+ * Note: Equivalent to dvtt_create_trace_ex() with flight_recorder_bytes set;
+ * it exists for callers such as DPI that cannot fill in the options struct.
+ */
+dvtt_trace_t dvtt_create_flight_recorder(const char* filename, const char* name,
+                                         const char* time_units, uint64_t max_bytes);
+
+/**
+ * Dump a flight-recorder trace if the process aborts
+ * 
+ * @param trace Trace to dump, or NULL to remove the hook
+ * @param filename Output file, or NULL for the trace filename
+ * 
+ * Note: Installs a SIGABRT handler that calls dvtt_dump_trace() and then
+ * re-raises the signal, so a failed assert() or std::abort() leaves the
+ * window behind. One trace can be registered at a time; closing it removes
+ * the hook. The dump is best effort, since it is not async-signal-safe;
+ * if the signal interrupts a call holding the trace's lock, such as
+ * dvtt_open_stream(), the stream descriptors are left out of the dump.
+ * From SystemVerilog, dvtt::dvtt_fatal_catcher dumps on UVM_FATAL instead.
+ */
+void dvtt_dump_on_abort(dvtt_trace_t trace, const char* filename);
+
+/**
+ * Write out everything recorded so far
+ * 
+ * @param trace Trace handle
+ * 
+ * Note: Hands the calling thread's buffered packets to the file and waits
+ * until they are written; with the flush_sync option they are also
+ * committed to storage. Transactions that are still open are not written.
+ * For a flight recorder the packets go to the in-memory window.
+ */
+void dvtt_flush_trace(dvtt_trace_t trace);
+
+/**
+ * Leave a loadable trace if the process ends without closing it
+ * 
+ * @param trace Trace to finish, or NULL to remove the hooks
+ * 
+ * Note: Installs handlers for SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT,
+ * SIGTERM and SIGXCPU (the usual ways a simulation crashes or a farm
+ * job is killed) and an atexit() hook. They write every buffered packet,
+ * and the begin of each transaction that is still open, so it shows as
+ * unfinished, then sync the file; signals are then re-raised with the
+ * previous handler. A flight recorder is dumped to its filename instead.
+ * SIGINT is left alone, as simulators use it to enter their prompt. One
+ * trace is registered at a time, shared with dvtt_dump_on_abort();
+ * closing it removes the hooks. This is best effort: the signal handlers
+ * write to the file directly, bypassing the async writer's thread, and
+ * give up rather than wait on a lock held elsewhere, and events held in a
+ * reorder window are lost. Nothing helps against SIGKILL, so combine it
+ * with flush_time or flush_packets checkpoints.
+ */
+void dvtt_flush_on_exit(dvtt_trace_t trace);
+
+/**
+ * What tracing has cost so far (see dvtt_get_trace_stats)
+ */
+typedef struct {
+    uint64_t packets_written;        /* TracePackets encoded */
+    uint64_t bytes_written;          /* Bytes encoded, before compression */
+    uint64_t open_transactions;      /* Transactions currently open */
+    uint64_t retained_transactions;  /* Closed transactions not yet freed */
+    uint64_t interned_strings;       /* Entries in the intern tables */
+    uint64_t registered_names;       /* Names from dvtt_register_name() */
+    uint64_t ring_high_water;        /* Most chunks queued at once in the async writer ring */
+    uint64_t ring_stalls;            /* Times a producer waited for a free ring buffer */
+    uint64_t ring_drops;             /* Chunks dropped because the ring was full */
+    uint64_t encode_ns;              /* Estimated time spent encoding packets */
+    uint64_t io_ns;                  /* Time spent handing chunks to the output */
+} dvtt_trace_stats_t;
+
+/**
+ * Report what tracing has cost so far
+ * 
+ * @param trace Trace handle
+ * @param stats Filled in with totals since the trace was created
+ * @return 1 on success, 0 on failure
+ * 
+ * Note: Cheap enough to poll, e.g. to alarm when tracing exceeds a budget.
+ * encode_ns is extrapolated from timing one packet in 64; io_ns is the
+ * time recording threads spent in the output path (writing, waiting for a
+ * free ring buffer and checkpoints), not the async writer thread's own
+ * time. The ring counters stay 0 without async_writer. In multi-threaded
+ * traces the totals cover every thread; packets another thread has not
+ * handed off yet are not in bytes_written.
+ */
+int dvtt_get_trace_stats(dvtt_trace_t trace, dvtt_trace_stats_t* stats);
+
+/* ========================================================================
+ * Trace Merging
+ * ======================================================================== */
+
+/**
+ * Trace merge options
+ * 
+ * Initialize with dvtt_merge_options_init() before setting fields.
+ */
+typedef struct {
+    int remap_ids;                            /* Non-zero: move each input's ids apart (default) */
+    dvtt_compression_t compression;           /* Output chunk compression */
+    int compression_level;                    /* zlib level 1-9 (0: default) */
+    size_t chunk_size;                        /* Bytes buffered before a chunk is written (0: default) */
+} dvtt_merge_options_t;
+
+/**
+ * Initialize merge options to their defaults: ids remapped, no compression
+ * 
+ * @param options Options to initialize
+ */
+void dvtt_merge_options_init(dvtt_merge_options_t* options);
+
+/**
+ * Merge closed traces, e.g. the shards of a partitioned simulation, into one
+ * 
+ * @param output Output trace filename
+ * @param inputs Input trace filenames
+ * @param num_inputs Number of inputs
+ * @param options Merge options (may be NULL for defaults)
+ * @return 1 on success, 0 on failure
+ * 
+ * Note: Inputs are memory-mapped and interleaved by packet timestamp, so
+ * memory use does not grow with their size. Each input's packets keep
+ * their order; inputs recorded with reorder_window merge into a fully
+ * time-ordered trace. Every process starts its ids at 1, so by default the
+ * track uuids and flow ids of input i of n become id * n + i and sequence
+ * ids are renumbered, which allows up to 127 inputs. Inputs recorded
+ * with distinct id_namespace values need no remapping: with remap_ids 0
+ * their packets are copied unchanged. Compressed inputs are expanded and
+ * need a library built with zlib. Fails with DVTT_ERROR_INVALID_ARGUMENT
+ * for a missing or malformed input (after merging what precedes the
+ * damage) or too many inputs to remap, and DVTT_ERROR_MEMORY if the output
+ * cannot be written.
+ */
+int dvtt_merge_traces(const char* output, const char* const* inputs, int num_inputs,
+                      const dvtt_merge_options_t* options);
+
 /* ========================================================================
  * Stream Management
  * ======================================================================== */
@@ -157,11 +487,30 @@ const char* dvtt_get_trace_time_units(dvtt_trace_t trace);
  * @param type_name Optional type name (may be NULL)
  * @return Stream handle, or NULL on failure
  * 
- * Note: Stream is automatically opened upon creation
+ * Note: Stream is automatically opened upon creation. Nothing is written
+ * until it records: its track descriptor goes out with its first
+ * transaction or counter sample, so streams that never fire cost no
+ * trace bytes.
  */
 dvtt_stream_t dvtt_open_stream(dvtt_trace_t trace, const char* name, 
                                 const char* scope, const char* type_name);
 
+/**
+ * Return the stream with 'scope' and 'name', opening it on first use
+ * 
+ * @param trace Trace handle
+ * @param scope Hierarchical scope (may be NULL, same as "")
+ * @param name Stream name
+ * @return Stream handle, or NULL on failure
+ * 
+ * Note: Looks the pair up in a hash index of the trace's streams, which
+ * also holds streams opened with dvtt_open_stream(); the earliest one not
+ * yet freed is returned. Streams opened here have no type name. Lets
+ * monitors instantiated by scope share a stream without a registry of
+ * their own.
+ */
+dvtt_stream_t dvtt_find_or_open_stream(dvtt_trace_t trace, const char* scope, const char* name);
+
 /**
  * Close a transaction stream
  * 
@@ -235,9 +584,88 @@ int dvtt_get_stream_handle(dvtt_stream_t stream);
  * 
  * @param handle Integer handle returned from dvtt_get_stream_handle
  * @return Stream handle, or NULL if not found or freed
+ * 
+ * Note: Handles are process-wide and lookup is constant time and lock-free.
+ * A handle whose stream has been freed (or whose trace was closed) returns
+ * NULL rather than a dangling pointer.
  */
 dvtt_stream_t dvtt_get_stream_from_handle(int handle);
 
+/* ========================================================================
+ * Enables and Sampling
+ * ======================================================================== */
+
+/**
+ * Sampling policy for the root transactions of a stream
+ * 
+ * A root transaction is recorded only if its start time lies in
+ * [start_time, end_time) and it is the first of each group of 'one_in'
+ * root transactions passing the window. Child transactions follow their
+ * parent: children of a transaction that was not recorded are not recorded.
+ */
+typedef struct {
+    uint32_t one_in;          /* Record one root transaction in this many (0 or 1: all) */
+    dvtt_time_t start_time;   /* Start of the recording window */
+    dvtt_time_t end_time;     /* End of the recording window (0: unbounded) */
+} dvtt_sampling_t;
+
+/**
+ * Enable or disable recording on a stream
+ * 
+ * @param stream Stream handle
+ * @param enabled Non-zero to record, 0 to reject new transactions
+ * 
+ * Note: Rejected transactions are never allocated. dvtt_open_transaction()
+ * returns a shared sentinel on which attribute, link, close and free calls
+ * return immediately. Transactions already open are unaffected. May be
+ * called from any thread.
+ */
+void dvtt_set_stream_enabled(dvtt_stream_t stream, int enabled);
+
+/**
+ * Check if recording is enabled on a stream
+ * 
+ * @param stream Stream handle
+ * @return 1 if enabled, 0 otherwise
+ */
+int dvtt_is_stream_enabled(dvtt_stream_t stream);
+
+/**
+ * Enable or disable every stream whose path matches a pattern
+ * 
+ * @param trace Trace handle
+ * @param pattern Glob pattern ('*' matches any run of characters, '?' one)
+ * @param enabled Non-zero to record, 0 to reject new transactions
+ * 
+ * Note: A stream's path is "<scope>.<name>", or just the name if it has no
+ * scope. The rule applies to matching open streams and to streams opened
+ * later; when several rules match a stream, the last one set wins. This is
+ * meant to be driven from plusargs, e.g. +dvtt_disable=top.env.*.mon
+ */
+void dvtt_set_scope_enabled(dvtt_trace_t trace, const char* pattern, int enabled);
+
+/**
+ * Set the sampling policy of a stream
+ * 
+ * @param stream Stream handle
+ * @param sampling Policy to apply, or NULL to record every transaction
+ * 
+ * Note: The 1-in-N count restarts when the policy is set. Must be called
+ * from the thread recording on the stream.
+ */
+void dvtt_set_stream_sampling(dvtt_stream_t stream, const dvtt_sampling_t* sampling);
+
+/**
+ * Check if a transaction is being recorded
+ * 
+ * @param transaction Transaction handle
+ * @return 1 if recorded, 0 for the sentinel returned when the stream was
+ *         disabled or the transaction was sampled out
+ * 
+ * Note: Query functions on the sentinel behave as for a NULL handle.
+ */
+int dvtt_is_transaction_enabled(dvtt_transaction_t transaction);
+
 /* ========================================================================
  * Transaction Lifecycle
  * ======================================================================== */
@@ -252,10 +680,14 @@ dvtt_stream_t dvtt_get_stream_from_handle(int handle);
  * @param parent Optional parent transaction for hierarchical nesting (may be NULL)
  * @return Transaction handle, or NULL on failure
  * 
- * Note: Transactions can only be opened on open streams.
+ * Note: Transactions can only be opened on open streams. When the stream is
+ * disabled or its sampling policy skips this transaction, a sentinel is
+ * returned instead (see dvtt_is_transaction_enabled()).
  * If parent is specified, the transaction will be rendered as a child in the trace viewer,
- * using a sub-track allocated under the parent's track. This makes track allocation
- * explicit and simplifies parent-child relationship tracking.
+ * using a sub-track allocated under the parent's track. Sub-tracks are lanes
+ * shared by children of the same name: a child reuses a lane whose last
+ * occupant ended by its start time, so a parent gets as many lanes as it has
+ * such children open at once rather than one per child.
  */
 dvtt_transaction_t dvtt_open_transaction(dvtt_stream_t stream, 
                                           const char* name,
@@ -270,6 +702,9 @@ dvtt_transaction_t dvtt_open_transaction(dvtt_stream_t stream,
  * @param end_time Transaction end time
  * 
  * Note: Transaction remains valid for adding relations and querying until freed.
+ * Attributes are written out and released at close; only the handle and
+ * its name/time information are retained. If the trace was created with
+ * free_on_close set, the handle is freed on close and must not be used again.
  */
 void dvtt_close_transaction(dvtt_transaction_t transaction, dvtt_time_t end_time);
 
@@ -280,7 +715,8 @@ void dvtt_close_transaction(dvtt_transaction_t transaction, dvtt_time_t end_time
  * @param close_time Optional close time (used if transaction not yet closed)
  * 
  * Note: If transaction is not closed, it will be closed first with close_time.
- * Frees all resources associated with the transaction.
+ * Frees all resources associated with the transaction; the handle must not
+ * be used afterwards. Open child transactions are unaffected.
  */
 void dvtt_free_transaction(dvtt_transaction_t transaction, dvtt_time_t close_time);
 
@@ -353,6 +789,10 @@ int dvtt_get_transaction_handle(dvtt_transaction_t transaction);
  * 
  * @param handle Integer handle returned from dvtt_get_transaction_handle
  * @return Transaction handle, or NULL if not found or freed
+ * 
+ * Note: Handles are process-wide and lookup is constant time and lock-free.
+ * A stale handle (transaction freed, or its trace closed) returns NULL even
+ * if the transaction's storage has since been reused.
  */
 dvtt_transaction_t dvtt_get_transaction_from_handle(int handle);
 
@@ -414,7 +854,10 @@ void dvtt_add_attr_time(dvtt_transaction_t transaction, const char* name, dvtt_t
  * @param num_bits Number of bits in the vector
  * @param radix Display radix
  * 
- * Note: Data is copied, caller retains ownership
+ * Note: Data is copied, caller retains ownership. HEX and BIN print every
+ * bit position; OCT prints minimal digits; DEC is a two's complement value
+ * of num_bits bits and UNSIGNED an unsigned one. Other radixes use HEX.
+ * With the raw_bits trace option the value is recorded as numbers instead.
  */
 void dvtt_add_attr_bits(dvtt_transaction_t transaction, const char* name, 
                          const void* bits, size_t num_bits, dvtt_radix_t radix);
@@ -464,14 +907,55 @@ typedef enum {
  * @param link_type Type of link
  * @param relation_name Optional relationship name (for DVTT_LINK_CUSTOM)
  * 
- * Note: Relations are useful for showing dependencies but can be expensive
- * to maintain. Consider using ID attributes instead for simpler tracking.
+ * Note: Links are written as Perfetto flows, drawn as arrows from the
+ * earlier slice to the later one. Each transaction carries the flow ids
+ * of its links until it closes, so neither needs to outlive its own close.
+ * While both are open any number of links may be added. Once one of them
+ * has closed the link only resolves if dvtt_get_transaction_id() was
+ * called on it while it was open; otherwise DVTT_ERROR_ALREADY_ENDED is
+ * set. Flows carry no name, so while the source is open the link is also
+ * recorded as an unsigned attribute of it holding the target's id, called
+ * relation_name, or parent_transaction, cause_transaction or
+ * related_transaction by link_type.
  */
 void dvtt_add_link(dvtt_transaction_t source, 
                     dvtt_transaction_t target,
                     dvtt_link_type_t link_type,
                     const char* relation_name);
 
+/**
+ * Get a transaction's id and make it linkable after it closes
+ * 
+ * @param transaction Transaction handle
+ * @return Id unique within the trace, or 0 if the handle is invalid
+ * 
+ * Note: Call while the transaction is open: its slice then carries an
+ * anchor flow, and dvtt_add_link_id() may refer to it by this id after it
+ * has been closed and freed. Calling it after close, or in a reorder
+ * window once its begin has been written, returns the id without making
+ * the transaction linkable.
+ */
+uint64_t dvtt_get_transaction_id(dvtt_transaction_t transaction);
+
+/**
+ * Link a transaction to an earlier one by id
+ * 
+ * @param source Open transaction handle
+ * @param target_id Id returned by dvtt_get_transaction_id()
+ * @param link_type Type of link
+ * @param relation_name Optional relationship name (for DVTT_LINK_CUSTOM)
+ * 
+ * Note: The target may already be closed and freed, so e.g. a scoreboard
+ * can link a response to its request without keeping the request. The
+ * flow ends at the source: the target must start before the source, and
+ * each target resolves only its first such link. The link is recorded as
+ * an attribute of the source, as by dvtt_add_link().
+ */
+void dvtt_add_link_id(dvtt_transaction_t source,
+                      uint64_t target_id,
+                      dvtt_link_type_t link_type,
+                      const char* relation_name);
+
 /**
  * Add a link between a stream and a transaction
  * 
@@ -479,12 +963,67 @@ void dvtt_add_link(dvtt_transaction_t source,
  * @param transaction Transaction handle
  * @param link_type Type of link
  * @param relation_name Optional relationship name (for DVTT_LINK_CUSTOM)
+ * 
+ * Note: Perfetto flows connect slices, and a stream has none, so the link
+ * is recorded as a string attribute of the transaction holding the
+ * stream's scope and name. The attribute is named relation_name, or after
+ * link_type. The transaction must be open.
  */
 void dvtt_add_stream_link(dvtt_stream_t stream,
                            dvtt_transaction_t transaction,
                            dvtt_link_type_t link_type,
                            const char* relation_name);
 
+/* ========================================================================
+ * Counter Tracks
+ * ======================================================================== */
+
+/**
+ * Open a counter track for a sampled numeric signal
+ * 
+ * @param stream Stream the track is shown under
+ * @param name Counter name (e.g., "fifo_level", "credits")
+ * @param unit Unit shown with the values (e.g., "bytes", may be NULL)
+ * @return Counter handle, or NULL on failure
+ * 
+ * Note: Suited to signals such as FIFO occupancy, credits or bandwidth,
+ * where a transaction per sample would waste a handle, a begin/end pair
+ * and an annotation. Each sample is one small packet on the counter's
+ * track. The track is described on the first sample, and the counter is
+ * freed with its stream's trace. Samples are dropped while the stream is
+ * disabled and once it is closed.
+ */
+dvtt_counter_t dvtt_open_counter(dvtt_stream_t stream, const char* name, const char* unit);
+
+/**
+ * Record a counter value
+ * 
+ * @param counter Counter handle
+ * @param time Time of the sample; the value holds until the next one
+ * @param value New value
+ * 
+ * Note: With reorder_window set, samples are written as they are taken,
+ * ahead of transactions still held in the window.
+ */
+void dvtt_counter_set(dvtt_counter_t counter, dvtt_time_t time, int64_t value);
+
+/**
+ * Record a floating-point counter value (see dvtt_counter_set)
+ */
+void dvtt_counter_set_double(dvtt_counter_t counter, dvtt_time_t time, double value);
+
+/**
+ * Skip samples equal to the counter's previous value
+ * 
+ * @param counter Counter handle
+ * @param enabled Non-zero to drop repeated values (default: off)
+ * 
+ * Note: The viewer holds each value until the next sample, so dropping
+ * repeats loses nothing but the times they were taken at. Useful when a
+ * signal is sampled every cycle but rarely changes.
+ */
+void dvtt_set_counter_coalescing(dvtt_counter_t counter, int enabled);
+
 /* ========================================================================
  * Error Handling
  * ======================================================================== */
@@ -500,7 +1039,8 @@ typedef enum {
     DVTT_ERROR_MEMORY,
     DVTT_ERROR_NOT_INITIALIZED,
     DVTT_ERROR_ALREADY_ENDED,
-    DVTT_ERROR_NOT_ENDED
+    DVTT_ERROR_NOT_ENDED,
+    DVTT_ERROR_INVALID_ARGUMENT
 } dvtt_error_t;
 
 /**
@@ -538,6 +1078,33 @@ dvtt_error_t dvtt_init(void);
  */
 void dvtt_shutdown(void);
 
+/**
+ * Process-wide recording switch tested inline at each recording call
+ * 
+ * Read it through the macros in dvtt_inline.h; set it with dvtt_set_enabled().
+ */
+extern int dvtt_runtime_enabled;
+
+/**
+ * Turn recording on or off for the whole process
+ * 
+ * @param enabled Non-zero to record (the default), 0 to skip recording calls
+ * 
+ * Note: While off, transaction, attribute and link calls made through this
+ * header return at the call site without evaluating their arguments;
+ * dvtt_open_transaction() returns NULL. Traces and streams are unaffected.
+ * Calls made through the exported symbols directly (e.g. DPI or ctypes)
+ * are not gated; use stream enables for those.
+ */
+void dvtt_set_enabled(int enabled);
+
+/**
+ * Check if recording is on for the process
+ * 
+ * @return 1 if on, 0 otherwise
+ */
+int dvtt_is_enabled(void);
+
 /* ========================================================================
  * Optional: Bulk Operations
  * ======================================================================== */
@@ -547,8 +1114,10 @@ void dvtt_shutdown(void);
  * 
  * @param transaction Transaction handle
  * 
- * Note: Can improve performance when adding many attributes.
- * Must be paired with dvtt_end_attributes()
+ * Note: Attributes are always encoded as they are added. Bracketing a run
+ * of additions acquires the transaction's encode buffer once, so the run
+ * is written as one contiguous encode with no per-attribute objects.
+ * The closing dvtt_end_attributes() is optional.
  */
 void dvtt_begin_attributes(dvtt_transaction_t transaction);
 
@@ -556,14 +1125,227 @@ void dvtt_begin_attributes(dvtt_transaction_t transaction);
  * Complete attribute additions
  * 
  * @param transaction Transaction handle
+ * 
+ * Note: Does nothing; the buffer is written out and released when the
+ * transaction closes. Kept so brackets read symmetrically.
  */
 void dvtt_end_attributes(dvtt_transaction_t transaction);
 
+/**
+ * One attribute of a batched transaction record
+ */
+typedef struct {
+    const char* name;
+    dvtt_radix_t radix;           /* Display radix for integer and bit vector values */
+    dvtt_attr_value_t value;
+} dvtt_attr_t;
+
+/**
+ * A complete transaction for dvtt_record_transactions()
+ */
+typedef struct {
+    const char* name;
+    const char* type_name;        /* May be NULL */
+    dvtt_time_t start_time;
+    dvtt_time_t end_time;
+    dvtt_transaction_t parent;    /* Open parent transaction, or NULL */
+    int32_t parent_index;         /* Index of an earlier record in the batch as parent, or -1 */
+    const dvtt_attr_t* attrs;
+    size_t num_attrs;
+} dvtt_txn_record_t;
+
+/**
+ * Record a batch of complete transactions in one call
+ * 
+ * @param stream Stream handle
+ * @param records Array of records
+ * @param count Number of records
+ * @return Number of records written
+ * 
+ * Each record is encoded straight into the trace as if it had been opened,
+ * given its attributes and closed, but no transaction object is created
+ * and no handle is returned. This suits monitors that only learn about a
+ * transaction once it has completed, and amortizes call overhead (e.g. DPI
+ * crossings) over the batch. A record may nest under an open transaction
+ * ('parent') or under an earlier record of the same batch
+ * ('parent_index'); like opened children it gets its own child track.
+ * 
+ * Stream enables and sampling apply per record. Records that are rejected,
+ * or whose parent was, are skipped without error. Records with a NULL name
+ * or an invalid parent_index are skipped and the last error is set.
+ */
+size_t dvtt_record_transactions(dvtt_stream_t stream, const dvtt_txn_record_t* records,
+                                size_t count);
+
+/* ========================================================================
+ * Registered Names and Packed Attributes
+ *
+ * For bindings where every string argument is converted on each call,
+ * such as SystemVerilog DPI. Names are registered once and passed as
+ * integer ids; attributes are packed into one array of 32-bit words.
+ * ======================================================================== */
+
+/**
+ * Register a name for use by id
+ * 
+ * @param trace Trace handle
+ * @param name Transaction, type, attribute or string value name
+ * @return Non-zero name id, or 0 on failure
+ * 
+ * Registering the same string again returns the same id. Ids are valid
+ * for the lifetime of the trace and may be used from any thread.
+ */
+int dvtt_register_name(dvtt_trace_t trace, const char* name);
+
+/**
+ * Header word of a packed attribute: radix in the top 8 bits and the value
+ * width in bits below
+ * 
+ * A packed attribute list is a sequence of 32-bit words ordered as a
+ * SystemVerilog packed vector is passed through DPI (word 0 holds bits
+ * [31:0]). Each attribute takes:
+ * 
+ *   word 0   name id
+ *   word 1   DVTT_PACKED_HEADER(radix, num_bits)
+ *   value    (num_bits + 31) / 32 words, least significant first
+ * 
+ * A name id of 0 ends the list before the last word. Values of up to 64
+ * bits are recorded as integers (signed for DVTT_RADIX_DEC), wider ones as
+ * bit vectors. A DVTT_RADIX_STRING value is one word holding the id of a
+ * registered name; a DVTT_RADIX_REAL value is the 64 bits of a double.
+ */
+#define DVTT_PACKED_HEADER(radix, num_bits) \
+    (((uint32_t)(radix) << 24) | ((uint32_t)(num_bits) & 0xFFFFFFu))
+
+/**
+ * Open a transaction given registered name ids
+ * 
+ * @param stream Stream handle
+ * @param name_id Id of the transaction name
+ * @param start_time Start time in simulation time units
+ * @param type_id Id of the type name, or 0 for none
+ * @param parent Parent transaction, or NULL
+ * @return Transaction handle, or NULL on failure
+ * 
+ * Equivalent to dvtt_open_transaction() with the registered strings.
+ * Fails with DVTT_ERROR_INVALID_NAME for an unknown id.
+ */
+dvtt_transaction_t dvtt_open_transaction_id(dvtt_stream_t stream, int name_id,
+                                            dvtt_time_t start_time, int type_id,
+                                            dvtt_transaction_t parent);
+
+/**
+ * Add packed attributes to an open transaction
+ * 
+ * @param transaction Transaction handle
+ * @param words Packed attribute list (see DVTT_PACKED_HEADER)
+ * @param num_words Number of words in 'words'
+ * 
+ * Attributes with an unknown name id are skipped and set
+ * DVTT_ERROR_INVALID_NAME.
+ */
+void dvtt_add_packed_attributes(dvtt_transaction_t transaction, const uint32_t* words,
+                                int num_words);
+
+/**
+ * Record one complete transaction given name ids and packed attributes
+ * 
+ * @param stream Stream handle
+ * @param name_id Id of the transaction name
+ * @param type_id Id of the type name, or 0 for none
+ * @param start_time Start time in simulation time units
+ * @param end_time End time in simulation time units
+ * @param parent Open parent transaction, or NULL
+ * @param words Packed attribute list (see DVTT_PACKED_HEADER), or NULL
+ * @param num_words Number of words in 'words'
+ * @return 1 if the transaction was written, 0 if it was rejected or invalid
+ * 
+ * The single-record form of dvtt_record_transactions(): one call per
+ * transaction, with no strings crossing the call.
+ */
+int dvtt_record_packed(dvtt_stream_t stream, int name_id, int type_id,
+                       dvtt_time_t start_time, dvtt_time_t end_time,
+                       dvtt_transaction_t parent, const uint32_t* words, int num_words);
+
+/* ========================================================================
+ * Attribute Schemas
+ *
+ * For monitors that record the same fields in the same order on every
+ * transaction. The fields are described once; each transaction then
+ * passes only their values, packed as a SystemVerilog packed struct with
+ * those fields is passed through DPI.
+ * ======================================================================== */
+
+/**
+ * One field of an attribute schema
+ * 
+ * Values of up to 64 bits are recorded as integers (signed for
+ * DVTT_RADIX_DEC), wider ones as bit vectors. A DVTT_RADIX_STRING field is
+ * 32 bits holding the id of a registered name; a DVTT_RADIX_REAL field is
+ * the 64 bits of a double.
+ */
+typedef struct {
+    const char* name;            /* Attribute name */
+    dvtt_radix_t radix;          /* Display radix, as for dvtt_add_attr_bits() */
+    uint32_t num_bits;           /* Width of the field's value */
+} dvtt_schema_field_t;
+
+/**
+ * Register an attribute schema on a stream
+ * 
+ * @param stream Stream handle
+ * @param fields Fields, most significant first
+ * @param num_fields Number of fields
+ * @return Schema handle, or NULL on failure
+ * 
+ * The packed value of a schema is a bit vector holding the fields from
+ * fields[0] in its most significant bits down to the last field at bit 0,
+ * as the members of a SystemVerilog packed struct declared in the same
+ * order. It is passed as 32-bit words, least significant first (word 0
+ * holds bits [31:0]). Attribute names are formatted once here. Fails with
+ * DVTT_ERROR_INVALID_ARGUMENT for an empty schema, a zero-width field, or a
+ * string or real field of another width than 32 or 64 bits. The schema is
+ * freed with the trace.
+ */
+dvtt_schema_t dvtt_register_schema(dvtt_stream_t stream, const dvtt_schema_field_t* fields,
+                                   int num_fields);
+
+/**
+ * Register an attribute schema given registered name ids
+ * 
+ * @param stream Stream handle
+ * @param words Two words per field, most significant field first: the name
+ *     id, then DVTT_PACKED_HEADER(radix, num_bits)
+ * @param num_fields Number of fields
+ * @return Schema handle, or NULL on failure
+ * 
+ * Equivalent to dvtt_register_schema() with the registered strings, for
+ * bindings that pass no strings. Fails with DVTT_ERROR_INVALID_NAME for an
+ * unknown id.
+ */
+dvtt_schema_t dvtt_register_schema_id(dvtt_stream_t stream, const uint32_t* words,
+                                      int num_fields);
+
+/**
+ * Add the attributes of a schema to an open transaction
+ * 
+ * @param transaction Transaction handle
+ * @param schema Schema registered on a stream of the transaction's trace
+ * @param values Packed value (see dvtt_register_schema())
+ * 
+ * Encodes every field of the schema in order. String fields holding an
+ * unknown name id are skipped and set DVTT_ERROR_INVALID_NAME.
+ */
+void dvtt_set_attrs(dvtt_transaction_t transaction, dvtt_schema_t schema,
+                    const uint32_t* values);
+
 /* ========================================================================
  * Helper Macros
  * ======================================================================== */
 
-/* Convenience macros for common integer types with default radix */
+/* Convenience macros for common integer types with default radix.
+ * dvtt_inline.h provides the gated (and C++) forms */
+#if defined(DVTT_NO_INLINE) && !defined(__cplusplus)
 #define dvtt_add_attr_int(txn, name, val) \
     _Generic((val), \
         int8_t: dvtt_add_attr_int8, \
@@ -576,6 +1358,7 @@ void dvtt_end_attributes(dvtt_transaction_t transaction);
         uint64_t: dvtt_add_attr_uint64, \
         default: dvtt_add_attr_int32 \
     )(txn, name, val, DVTT_RADIX_HEX)
+#endif
 
 /* Simplified names for backward compatibility */
 #define dvtt_begin_transaction(stream, name, time) \
@@ -588,4 +1371,6 @@ void dvtt_end_attributes(dvtt_transaction_t transaction);
 }
 #endif
 
+#include "dvtt_inline.h"
+
 #endif /* DVTT_H */
@@ -0,0 +1,280 @@
+/**
+ * @file dvtt_inline.h
+ * @brief Call-site gating for the DV Transaction Trace C API
+ *
+ * Included by dvtt.h; do not include directly.
+ *
+ * By default the recording calls (opening, closing and freeing
+ * transactions, attributes, links, batched records, counter samples) are wrapped in macros of the same name
+ * that test dvtt_runtime_enabled before calling into the library. While
+ * tracing is off at runtime a call costs one load and a predicted branch,
+ * and its arguments are not evaluated.
+ *
+ * Defining DVTT_DISABLE before including dvtt.h (or on the compiler command
+ * line) turns every API call into nothing: arguments are referenced only in
+ * an unevaluated context, so no code is generated and no library symbol is
+ * referenced. Calls returning handles yield NULL, dvtt_init() and
+ * dvtt_get_last_error() yield DVTT_OK, and name queries yield NULL.
+ *
+ * Defining DVTT_NO_INLINE exposes the plain functions with neither layer;
+ * the library itself is built this way.
+ */
+
+#ifndef DVTT_INLINE_H
+#define DVTT_INLINE_H
+
+#if !defined(DVTT_NO_INLINE)
+
+#if defined(__GNUC__)
+#define DVTT_LIKELY(x) __builtin_expect(!!(x), 1)
+#else
+#define DVTT_LIKELY(x) (x)
+#endif
+
+#if defined(DVTT_DISABLE)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Never defined: only named inside sizeof, so calls are never emitted */
+int dvtt_unused_args_(int, ...);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define DVTT_IGNORE(...) ((void)sizeof(dvtt_unused_args_(0, __VA_ARGS__)))
+#define DVTT_IGNORE_RET(type, ...) (DVTT_IGNORE(__VA_ARGS__), (type)0)
+
+/* Trace management */
+#define dvtt_create_trace(...)              DVTT_IGNORE_RET(dvtt_trace_t, __VA_ARGS__)
+#define dvtt_trace_options_init(...)        DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_create_trace_ex(...)           DVTT_IGNORE_RET(dvtt_trace_t, __VA_ARGS__)
+#define dvtt_close_trace(...)               DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_get_trace_name(...)            DVTT_IGNORE_RET(const char*, __VA_ARGS__)
+#define dvtt_get_trace_filename(...)        DVTT_IGNORE_RET(const char*, __VA_ARGS__)
+#define dvtt_get_trace_time_units(...)      DVTT_IGNORE_RET(const char*, __VA_ARGS__)
+#define dvtt_create_flight_recorder(...)    DVTT_IGNORE_RET(dvtt_trace_t, __VA_ARGS__)
+#define dvtt_dump_trace(...)                DVTT_IGNORE_RET(int, __VA_ARGS__)
+#define dvtt_dump_on_abort(...)             DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_flush_trace(...)               DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_flush_on_exit(...)             DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_get_trace_stats(...)           DVTT_IGNORE_RET(int, __VA_ARGS__)
+#define dvtt_merge_options_init(...)        DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_merge_traces(...)              DVTT_IGNORE_RET(int, __VA_ARGS__)
+
+/* Stream management */
+#define dvtt_open_stream(...)               DVTT_IGNORE_RET(dvtt_stream_t, __VA_ARGS__)
+#define dvtt_find_or_open_stream(...)       DVTT_IGNORE_RET(dvtt_stream_t, __VA_ARGS__)
+#define dvtt_close_stream(...)              DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_free_stream(...)               DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_is_stream_open(...)            DVTT_IGNORE_RET(int, __VA_ARGS__)
+#define dvtt_is_stream_closed(...)          DVTT_IGNORE_RET(int, __VA_ARGS__)
+#define dvtt_get_stream_name(...)           DVTT_IGNORE_RET(const char*, __VA_ARGS__)
+#define dvtt_get_stream_scope(...)          DVTT_IGNORE_RET(const char*, __VA_ARGS__)
+#define dvtt_get_stream_type_name(...)      DVTT_IGNORE_RET(const char*, __VA_ARGS__)
+#define dvtt_get_stream_handle(...)         DVTT_IGNORE_RET(int, __VA_ARGS__)
+#define dvtt_get_stream_from_handle(...)    DVTT_IGNORE_RET(dvtt_stream_t, __VA_ARGS__)
+
+/* Enables and sampling */
+#define dvtt_set_stream_enabled(...)        DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_is_stream_enabled(...)         DVTT_IGNORE_RET(int, __VA_ARGS__)
+#define dvtt_set_scope_enabled(...)         DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_set_stream_sampling(...)       DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_is_transaction_enabled(...)    DVTT_IGNORE_RET(int, __VA_ARGS__)
+#define dvtt_set_enabled(...)               DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_is_enabled()                   (0)
+
+/* Transaction lifecycle */
+#define dvtt_open_transaction(...)          DVTT_IGNORE_RET(dvtt_transaction_t, __VA_ARGS__)
+#define dvtt_close_transaction(...)         DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_free_transaction(...)          DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_is_transaction_open(...)       DVTT_IGNORE_RET(int, __VA_ARGS__)
+#define dvtt_is_transaction_closed(...)     DVTT_IGNORE_RET(int, __VA_ARGS__)
+#define dvtt_get_transaction_name(...)      DVTT_IGNORE_RET(const char*, __VA_ARGS__)
+#define dvtt_get_transaction_type_name(...) DVTT_IGNORE_RET(const char*, __VA_ARGS__)
+#define dvtt_get_transaction_start_time(...) DVTT_IGNORE_RET(dvtt_time_t, __VA_ARGS__)
+#define dvtt_get_transaction_end_time(...)  DVTT_IGNORE_RET(dvtt_time_t, __VA_ARGS__)
+#define dvtt_get_transaction_stream(...)    DVTT_IGNORE_RET(dvtt_stream_t, __VA_ARGS__)
+#define dvtt_get_transaction_handle(...)    DVTT_IGNORE_RET(int, __VA_ARGS__)
+#define dvtt_get_transaction_from_handle(...) DVTT_IGNORE_RET(dvtt_transaction_t, __VA_ARGS__)
+
+/* Attributes */
+#define dvtt_add_attr_int64(...)            DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_add_attr_int32(...)            DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_add_attr_int16(...)            DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_add_attr_int8(...)             DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_add_attr_uint64(...)           DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_add_attr_uint32(...)           DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_add_attr_uint16(...)           DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_add_attr_uint8(...)            DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_add_attr_float(...)            DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_add_attr_double(...)           DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_add_attr_string(...)           DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_add_attr_time(...)             DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_add_attr_bits(...)             DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_add_attr_blob(...)             DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_add_attribute(...)             DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_add_attr_int(...)              DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_begin_attributes(...)          DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_end_attributes(...)            DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_record_transactions(...)       DVTT_IGNORE_RET(size_t, __VA_ARGS__)
+
+/* Registered names and packed attributes */
+#define dvtt_register_name(...)             DVTT_IGNORE_RET(int, __VA_ARGS__)
+#define dvtt_open_transaction_id(...)       DVTT_IGNORE_RET(dvtt_transaction_t, __VA_ARGS__)
+#define dvtt_add_packed_attributes(...)     DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_record_packed(...)             DVTT_IGNORE_RET(int, __VA_ARGS__)
+
+/* Attribute schemas */
+#define dvtt_register_schema(...)           DVTT_IGNORE_RET(dvtt_schema_t, __VA_ARGS__)
+#define dvtt_register_schema_id(...)        DVTT_IGNORE_RET(dvtt_schema_t, __VA_ARGS__)
+#define dvtt_set_attrs(...)                 DVTT_IGNORE(__VA_ARGS__)
+
+/* Links */
+#define dvtt_add_link(...)                  DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_get_transaction_id(...)        DVTT_IGNORE_RET(uint64_t, __VA_ARGS__)
+#define dvtt_add_link_id(...)               DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_add_stream_link(...)           DVTT_IGNORE(__VA_ARGS__)
+
+/* Counter tracks */
+#define dvtt_open_counter(...)              DVTT_IGNORE_RET(dvtt_counter_t, __VA_ARGS__)
+#define dvtt_counter_set(...)               DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_counter_set_double(...)        DVTT_IGNORE(__VA_ARGS__)
+#define dvtt_set_counter_coalescing(...)    DVTT_IGNORE(__VA_ARGS__)
+
+/* Errors and initialization */
+#define dvtt_get_last_error()               (DVTT_OK)
+#define dvtt_error_string(...)              DVTT_IGNORE_RET(const char*, __VA_ARGS__)
+#define dvtt_init()                         (DVTT_OK)
+#define dvtt_shutdown()                     ((void)0)
+
+#else /* !DVTT_DISABLE */
+
+/*
+ * Each macro expands to a test of the runtime flag around a call to the
+ * function of the same name; a macro's own name is not re-expanded inside
+ * its replacement, so the call reaches the library.
+ */
+#define DVTT_GATE(call)               (DVTT_LIKELY(dvtt_runtime_enabled) ? (void)(call) : (void)0)
+#define DVTT_GATE_RET(type, call)     (DVTT_LIKELY(dvtt_runtime_enabled) ? (call) : (type)0)
+
+#define dvtt_open_transaction(stream, name, start_time, type_name, parent) \
+    DVTT_GATE_RET(dvtt_transaction_t, \
+        dvtt_open_transaction(stream, name, start_time, type_name, parent))
+#define dvtt_close_transaction(transaction, end_time) \
+    DVTT_GATE(dvtt_close_transaction(transaction, end_time))
+#define dvtt_free_transaction(transaction, close_time) \
+    DVTT_GATE(dvtt_free_transaction(transaction, close_time))
+
+#define dvtt_add_attr_int64(transaction, name, value, radix) \
+    DVTT_GATE(dvtt_add_attr_int64(transaction, name, value, radix))
+#define dvtt_add_attr_int32(transaction, name, value, radix) \
+    DVTT_GATE(dvtt_add_attr_int32(transaction, name, value, radix))
+#define dvtt_add_attr_int16(transaction, name, value, radix) \
+    DVTT_GATE(dvtt_add_attr_int16(transaction, name, value, radix))
+#define dvtt_add_attr_int8(transaction, name, value, radix) \
+    DVTT_GATE(dvtt_add_attr_int8(transaction, name, value, radix))
+#define dvtt_add_attr_uint64(transaction, name, value, radix) \
+    DVTT_GATE(dvtt_add_attr_uint64(transaction, name, value, radix))
+#define dvtt_add_attr_uint32(transaction, name, value, radix) \
+    DVTT_GATE(dvtt_add_attr_uint32(transaction, name, value, radix))
+#define dvtt_add_attr_uint16(transaction, name, value, radix) \
+    DVTT_GATE(dvtt_add_attr_uint16(transaction, name, value, radix))
+#define dvtt_add_attr_uint8(transaction, name, value, radix) \
+    DVTT_GATE(dvtt_add_attr_uint8(transaction, name, value, radix))
+#define dvtt_add_attr_float(transaction, name, value) \
+    DVTT_GATE(dvtt_add_attr_float(transaction, name, value))
+#define dvtt_add_attr_double(transaction, name, value) \
+    DVTT_GATE(dvtt_add_attr_double(transaction, name, value))
+#define dvtt_add_attr_string(transaction, name, value) \
+    DVTT_GATE(dvtt_add_attr_string(transaction, name, value))
+#define dvtt_add_attr_time(transaction, name, value) \
+    DVTT_GATE(dvtt_add_attr_time(transaction, name, value))
+#define dvtt_add_attr_bits(transaction, name, bits, num_bits, radix) \
+    DVTT_GATE(dvtt_add_attr_bits(transaction, name, bits, num_bits, radix))
+#define dvtt_add_attr_blob(transaction, name, data, size) \
+    DVTT_GATE(dvtt_add_attr_blob(transaction, name, data, size))
+#define dvtt_add_attribute(transaction, name, value) \
+    DVTT_GATE(dvtt_add_attribute(transaction, name, value))
+#define dvtt_begin_attributes(transaction) \
+    DVTT_GATE(dvtt_begin_attributes(transaction))
+#define dvtt_end_attributes(transaction) \
+    DVTT_GATE(dvtt_end_attributes(transaction))
+#define dvtt_record_transactions(stream, records, count) \
+    DVTT_GATE_RET(size_t, dvtt_record_transactions(stream, records, count))
+#define dvtt_open_transaction_id(stream, name_id, start_time, type_id, parent) \
+    DVTT_GATE_RET(dvtt_transaction_t, \
+        dvtt_open_transaction_id(stream, name_id, start_time, type_id, parent))
+#define dvtt_add_packed_attributes(transaction, words, num_words) \
+    DVTT_GATE(dvtt_add_packed_attributes(transaction, words, num_words))
+#define dvtt_record_packed(stream, name_id, type_id, start_time, end_time, parent, words, \
+                           num_words) \
+    DVTT_GATE_RET(int, dvtt_record_packed(stream, name_id, type_id, start_time, end_time, \
+                                          parent, words, num_words))
+#define dvtt_set_attrs(transaction, schema, values) \
+    DVTT_GATE(dvtt_set_attrs(transaction, schema, values))
+
+#define dvtt_add_link(source, target, link_type, relation_name) \
+    DVTT_GATE(dvtt_add_link(source, target, link_type, relation_name))
+#define dvtt_add_link_id(source, target_id, link_type, relation_name) \
+    DVTT_GATE(dvtt_add_link_id(source, target_id, link_type, relation_name))
+#define dvtt_add_stream_link(stream, transaction, link_type, relation_name) \
+    DVTT_GATE(dvtt_add_stream_link(stream, transaction, link_type, relation_name))
+
+#define dvtt_counter_set(counter, time, value) \
+    DVTT_GATE(dvtt_counter_set(counter, time, value))
+#define dvtt_counter_set_double(counter, time, value) \
+    DVTT_GATE(dvtt_counter_set_double(counter, time, value))
+
+#ifndef __cplusplus
+/* Convenience macro for common integer types with default radix */
+#define dvtt_add_attr_int(txn, name, val) \
+    DVTT_GATE(_Generic((val), \
+        int8_t: dvtt_add_attr_int8, \
+        int16_t: dvtt_add_attr_int16, \
+        int32_t: dvtt_add_attr_int32, \
+        int64_t: dvtt_add_attr_int64, \
+        uint8_t: dvtt_add_attr_uint8, \
+        uint16_t: dvtt_add_attr_uint16, \
+        uint32_t: dvtt_add_attr_uint32, \
+        uint64_t: dvtt_add_attr_uint64, \
+        default: dvtt_add_attr_int32 \
+    )(txn, name, val, DVTT_RADIX_HEX))
+#else
+/* C++ has no _Generic; overloads give the same selection. They call the
+ * plain functions since the macro below has already tested the flag */
+inline void dvtt_add_attr_int(dvtt_transaction_t txn, const char* name, int8_t val) {
+    (dvtt_add_attr_int8)(txn, name, val, DVTT_RADIX_HEX);
+}
+inline void dvtt_add_attr_int(dvtt_transaction_t txn, const char* name, int16_t val) {
+    (dvtt_add_attr_int16)(txn, name, val, DVTT_RADIX_HEX);
+}
+inline void dvtt_add_attr_int(dvtt_transaction_t txn, const char* name, int32_t val) {
+    (dvtt_add_attr_int32)(txn, name, val, DVTT_RADIX_HEX);
+}
+inline void dvtt_add_attr_int(dvtt_transaction_t txn, const char* name, int64_t val) {
+    (dvtt_add_attr_int64)(txn, name, val, DVTT_RADIX_HEX);
+}
+inline void dvtt_add_attr_int(dvtt_transaction_t txn, const char* name, uint8_t val) {
+    (dvtt_add_attr_uint8)(txn, name, val, DVTT_RADIX_HEX);
+}
+inline void dvtt_add_attr_int(dvtt_transaction_t txn, const char* name, uint16_t val) {
+    (dvtt_add_attr_uint16)(txn, name, val, DVTT_RADIX_HEX);
+}
+inline void dvtt_add_attr_int(dvtt_transaction_t txn, const char* name, uint32_t val) {
+    (dvtt_add_attr_uint32)(txn, name, val, DVTT_RADIX_HEX);
+}
+inline void dvtt_add_attr_int(dvtt_transaction_t txn, const char* name, uint64_t val) {
+    (dvtt_add_attr_uint64)(txn, name, val, DVTT_RADIX_HEX);
+}
+#define dvtt_add_attr_int(txn, name, val) \
+    DVTT_GATE(dvtt_add_attr_int(txn, name, val))
+#endif
+
+#endif /* DVTT_DISABLE */
+
+#endif /* !DVTT_NO_INLINE */
+
+#endif /* DVTT_INLINE_H */
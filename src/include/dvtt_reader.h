@@ -0,0 +1,185 @@
+/**
+ * @file dvtt_reader.h
+ * @brief Indexed reader for DV Transaction Trace files
+ *
+ * C++ API for post-processing traces written by libdvtt, e.g. by post-sim
+ * checkers, without protobuf bindings or trace_processor. The trace file is
+ * memory-mapped and packets are decoded only when a query needs them.
+ *
+ * The first open scans the trace once and writes a sidecar index next to
+ * it (<trace>.dvtti). The index divides the file into blocks of packets and
+ * records, for each block, the time range of the transactions and counter
+ * samples of each stream that start there, plus every interned string and
+ * track descriptor. Later opens load the index instead of scanning, and a
+ * query decodes only the blocks whose ranges match it.
+ *
+ * Example:
+ * @code
+ *   auto reader = dvtt::TraceReader::open("sim.perfetto");
+ *   dvtt::TraceQuery query;
+ *   query.track_uuid = reader->find_stream("axi_master")->uuid;
+ *   query.start_time = 1000;
+ *   query.end_time = 2000;
+ *   query.attribute = "addr";
+ *   reader->for_each_transaction(query, [](const dvtt::TraceTransaction& txn) {
+ *       const dvtt::TraceAttribute* addr = txn.find_attribute("addr");
+ *       ...
+ *   });
+ * @endcode
+ */
+
+#ifndef DVTT_READER_H
+#define DVTT_READER_H
+
+#include "dvtt.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dvtt {
+
+/**
+ * A stream, child transaction or counter track
+ */
+struct TraceTrack {
+    uint64_t uuid;
+    uint64_t parent_uuid;        // 0 for streams
+    std::string name;
+    bool is_counter;
+    std::string unit;            // Counter unit, if any
+};
+
+/**
+ * One transaction attribute, as the writer encoded it
+ *
+ * Integer and bit vector names carry the radix suffix, e.g. "addr[hex]".
+ * Raw bit vectors wider than 64 bits are WORDS, least significant first.
+ */
+struct TraceAttribute {
+    enum Type {
+        UINT,
+        INT,
+        DOUBLE,
+        STRING,
+        WORDS
+    };
+
+    std::string name;
+    Type type;
+    uint64_t uint_value;         // UINT
+    int64_t int_value;           // INT
+    double double_value;         // DOUBLE
+    std::string string_value;    // STRING, including formatted bit vectors
+    std::vector<uint64_t> words; // WORDS
+
+    // Name without the radix suffix
+    std::string_view base_name() const;
+};
+
+/**
+ * A transaction: the slice between a begin and an end event on one track
+ */
+struct TraceTransaction {
+    uint64_t track_uuid;
+    std::string name;
+    std::string type_name;
+    dvtt_time_t start_time;
+    dvtt_time_t end_time;        // Time the trace ends at if unfinished
+    bool finished;               // False if the trace ends before the transaction
+    std::vector<TraceAttribute> attributes;
+    std::vector<uint64_t> flow_ids;
+    std::vector<uint64_t> terminating_flow_ids;
+
+    // Attribute 'name', with or without its radix suffix; NULL if absent
+    const TraceAttribute* find_attribute(std::string_view name) const;
+};
+
+/**
+ * One counter sample (dvtt_counter_set)
+ */
+struct TraceCounterSample {
+    uint64_t track_uuid;
+    dvtt_time_t time;
+    bool is_double;
+    int64_t int_value;
+    double double_value;
+};
+
+/**
+ * Selects transactions or counter samples
+ *
+ * Transactions match if they overlap [start_time, end_time]; samples if
+ * they fall in it.
+ */
+struct TraceQuery {
+    uint64_t track_uuid = 0;                 // 0: every track
+    bool include_children = true;            // Also tracks nested under track_uuid
+    dvtt_time_t start_time = 0;
+    dvtt_time_t end_time = ~dvtt_time_t(0);
+    std::string attribute;                   // Only transactions with it (empty: any)
+};
+
+/**
+ * Read-only view of a trace file
+ *
+ * Queries may run concurrently. The trace must not change while it is
+ * open; an index older than its trace is rebuilt.
+ */
+class TraceReader {
+public:
+    virtual ~TraceReader() { }
+
+    /**
+     * Open a trace, loading its sidecar index or building it
+     *
+     * @param filename Trace file
+     * @param write_index Save a newly built index next to the trace
+     * @return Reader, or NULL if the file cannot be read or is not a trace
+     *         (including compressed traces when built without zlib)
+     */
+    static std::unique_ptr<TraceReader> open(const std::string& filename,
+                                             bool write_index = true);
+
+    // Every described track, in file order
+    virtual const std::vector<TraceTrack>& tracks() const = 0;
+
+    virtual const TraceTrack* find_track(uint64_t uuid) const = 0;
+
+    // First stream (top-level track) named 'name', or NULL
+    virtual const TraceTrack* find_stream(std::string_view name) const = 0;
+
+    /**
+     * Visit the matching transactions in file order of their end events;
+     * unfinished ones come last. Returns the number visited.
+     *
+     * As in Perfetto, slices on one track nest: an end event closes the
+     * most recent open begin on its track.
+     */
+    virtual size_t for_each_transaction(
+        const TraceQuery& query,
+        const std::function<void(const TraceTransaction&)>& visit) const = 0;
+
+    std::vector<TraceTransaction> transactions(const TraceQuery& query) const;
+
+    // Visit the matching counter samples in file order. Returns the number visited
+    virtual size_t for_each_counter_sample(
+        const TraceQuery& query,
+        const std::function<void(const TraceCounterSample&)>& visit) const = 0;
+
+    // Blocks in the index, and blocks decoded by queries so far
+    virtual size_t num_blocks() const = 0;
+    virtual size_t blocks_decoded() const = 0;
+
+    // True if open() loaded the index rather than building it
+    virtual bool index_loaded() const = 0;
+};
+
+// Name of the sidecar index of trace 'filename'
+std::string trace_index_filename(const std::string& filename);
+
+} // namespace dvtt
+
+#endif // DVTT_READER_H
@@ -1,6 +1,363 @@
 
+`include "dvtt_macros.svh"
+
+// SystemVerilog binding of the dvtt C API
+//
+// Handles cross DPI as chandles. Strings are the expensive part of a DPI
+// call, so the hot path takes integer ids instead: names are registered
+// once (dvtt_recorder::name_id) and attributes are packed into one
+// bit vector (dvtt_attrs) passed to dvtt_record_packed() or
+// dvtt_add_packed_attributes(). Monitors recording the same fields on
+// every transaction can instead describe them once as a dvtt_schema and
+// pass a packed struct of the values to dvtt_set_attrs(). Resolve ids
+// outside the per-beat code, e.g. in build_phase, and keep them in int
+// members.
+//
+// Compile with +define+DVTT_UVM for the uvm_component stream cache.
 package dvtt;
+`ifdef DVTT_UVM
+    import uvm_pkg::uvm_component;
+`endif
+
     int _dvtt_debug_level = 0;
 
-endpackage
+    // Mirrors dvtt_radix_t
+    typedef enum int {
+        DVTT_RADIX_BIN,
+        DVTT_RADIX_OCT,
+        DVTT_RADIX_DEC,
+        DVTT_RADIX_HEX,
+        DVTT_RADIX_UNSIGNED,
+        DVTT_RADIX_STRING,
+        DVTT_RADIX_TIME,
+        DVTT_RADIX_REAL
+    } dvtt_radix_e;
+
+    // Size of a packed attribute list, and of the widest single attribute
+`ifndef DVTT_PACKED_WORDS
+`define DVTT_PACKED_WORDS 64
+`endif
+`ifndef DVTT_MAX_ATTR_BITS
+`define DVTT_MAX_ATTR_BITS 1024
+`endif
+    localparam int PACKED_WORDS = `DVTT_PACKED_WORDS;
+    localparam int MAX_ATTR_BITS = `DVTT_MAX_ATTR_BITS;
+
+    typedef bit [PACKED_WORDS*32-1:0] dvtt_packed_t;
+    typedef bit [MAX_ATTR_BITS-1:0] dvtt_wide_t;
+
+    // ------------------------------------------------------------------
+    // C API
+    // ------------------------------------------------------------------
+
+    // Setup and control; strings are fine here
+    import "DPI-C" function chandle dvtt_create_trace(string filename, string name,
+                                                      string time_units);
+    import "DPI-C" function chandle dvtt_create_flight_recorder(string filename, string name,
+                                                                string time_units,
+                                                                longint unsigned max_bytes);
+    import "DPI-C" function int dvtt_dump_trace(chandle trace, string filename);
+    import "DPI-C" function void dvtt_close_trace(chandle trace);
+    import "DPI-C" function void dvtt_flush_trace(chandle trace);
+    import "DPI-C" function void dvtt_flush_on_exit(chandle trace);
+    import "DPI-C" function chandle dvtt_open_stream(chandle trace, string name,
+                                                     string scope, string type_name);
+    import "DPI-C" function chandle dvtt_find_or_open_stream(chandle trace, string scope,
+                                                             string name);
+    import "DPI-C" function void dvtt_close_stream(chandle stream);
+    import "DPI-C" function void dvtt_set_stream_enabled(chandle stream, int enabled);
+    import "DPI-C" function void dvtt_set_enabled(int enabled);
+    import "DPI-C" function int dvtt_register_name(chandle trace, string name);
+    import "DPI-C" function chandle dvtt_register_schema_id(chandle stream,
+                                                            input dvtt_packed_t words,
+                                                            int num_fields);
+    import "DPI-C" function chandle dvtt_open_counter(chandle stream, string name, string unit);
+    import "DPI-C" function void dvtt_set_counter_coalescing(chandle counter, int enabled);
+
+    // Per-transaction calls; no strings
+    import "DPI-C" function chandle dvtt_open_transaction_id(chandle stream, int name_id,
+                                                             longint unsigned start_time,
+                                                             int type_id, chandle parent);
+    import "DPI-C" function void dvtt_add_packed_attributes(chandle transaction,
+                                                            input dvtt_packed_t words,
+                                                            int num_words);
+    import "DPI-C" function void dvtt_close_transaction(chandle transaction,
+                                                        longint unsigned end_time);
+    import "DPI-C" function void dvtt_free_transaction(chandle transaction,
+                                                       longint unsigned close_time);
+    import "DPI-C" function int dvtt_record_packed(chandle stream, int name_id, int type_id,
+                                                   longint unsigned start_time,
+                                                   longint unsigned end_time,
+                                                   chandle parent,
+                                                   input dvtt_packed_t words,
+                                                   int num_words);
+    import "DPI-C" function void dvtt_set_attrs(chandle transaction, chandle schema,
+                                                input dvtt_packed_t values);
+    import "DPI-C" function void dvtt_counter_set(chandle counter, longint unsigned time,
+                                                  longint value);
+    import "DPI-C" function void dvtt_counter_set_double(chandle counter, longint unsigned time,
+                                                         real value);
+
+    // ------------------------------------------------------------------
+    // Packed attribute list, laid out as described at DVTT_PACKED_HEADER
+    // in dvtt.h: name id, radix and width header, then the value words
+    // ------------------------------------------------------------------
+    class dvtt_attrs;
+        dvtt_packed_t words;
+        int num_words;
+
+        function void clear();
+            num_words = 0;
+        endfunction
+
+        // Appends an attribute of up to 64 bits
+        function void add(int name_id, bit [63:0] value, int num_bits = 64,
+                          dvtt_radix_e radix = DVTT_RADIX_HEX);
+            int value_words = (num_bits > 32) ? 2 : 1;
+            if (!reserve(value_words)) return;
+            put_header(name_id, radix, num_bits);
+            words[num_words*32 +: 32] = value[31:0];
+            if (value_words > 1) begin
+                words[(num_words+1)*32 +: 32] = value[63:32];
+            end
+            num_words += value_words;
+        endfunction
+
+        // Appends a bit vector attribute of up to MAX_ATTR_BITS bits
+        function void add_bits(int name_id, dvtt_wide_t value, int num_bits,
+                               dvtt_radix_e radix = DVTT_RADIX_HEX);
+            int value_words = (num_bits + 31) / 32;
+            if (num_bits > MAX_ATTR_BITS || !reserve(value_words)) return;
+            put_header(name_id, radix, num_bits);
+            for (int i = 0; i < value_words; i++) begin
+                words[(num_words+i)*32 +: 32] = value[i*32 +: 32];
+            end
+            num_words += value_words;
+        endfunction
+
+        // Appends a string attribute whose value is a registered name
+        function void add_string(int name_id, int value_id);
+            if (!reserve(1)) return;
+            put_header(name_id, DVTT_RADIX_STRING, 32);
+            words[num_words*32 +: 32] = value_id;
+            num_words += 1;
+        endfunction
+
+        function void add_real(int name_id, real value);
+            add(name_id, $realtobits(value), 64, DVTT_RADIX_REAL);
+        endfunction
+
+        protected function bit reserve(int value_words);
+            if (num_words + 2 + value_words > PACKED_WORDS) begin
+                $warning("dvtt_attrs: attribute dropped, list is full (DVTT_PACKED_WORDS=%0d)",
+                         PACKED_WORDS);
+                return 0;
+            end
+            return 1;
+        endfunction
+
+        protected function void put_header(int name_id, dvtt_radix_e radix, int num_bits);
+            int r = radix;
+            words[num_words*32 +: 32] = name_id;
+            words[(num_words+1)*32 +: 32] = {r[7:0], num_bits[23:0]};
+            num_words += 2;
+        endfunction
+    endclass
+
+    // ------------------------------------------------------------------
+    // Attribute schema: the fields of a packed struct, added in declaration
+    // order (see DVTT_SCHEMA_FIELD). After register(), pass the struct
+    // itself, cast to dvtt_packed_t, to dvtt_set_attrs().
+    // ------------------------------------------------------------------
+    class dvtt_schema;
+        chandle handle;
+
+        protected dvtt_packed_t m_words;
+        protected int m_num_fields;
+
+        function void add(int name_id, int num_bits, dvtt_radix_e radix = DVTT_RADIX_HEX);
+            int r = radix;
+            if (2 * m_num_fields + 2 > PACKED_WORDS) begin
+                $warning("dvtt_schema: field dropped, schema is full (DVTT_PACKED_WORDS=%0d)",
+                         PACKED_WORDS);
+                return;
+            end
+            m_words[2*m_num_fields*32 +: 32] = name_id;
+            m_words[(2*m_num_fields+1)*32 +: 32] = {r[7:0], num_bits[23:0]};
+            m_num_fields++;
+        endfunction
+
+        // Returns the schema handle, registering it on 'stream' on first use
+        function chandle register(chandle stream);
+            if (handle == null) begin
+                handle = dvtt_register_schema_id(stream, m_words, m_num_fields);
+            end
+            return handle;
+        endfunction
+    endclass
 
+    // ------------------------------------------------------------------
+    // One trace with cached name ids and stream handles
+    // ------------------------------------------------------------------
+    class dvtt_recorder;
+        chandle trace;
+
+        protected int m_names[string];
+        protected chandle m_streams[string];
+        protected chandle m_counters[string];
+`ifdef DVTT_UVM
+        protected chandle m_component_streams[uvm_component];
+`endif
+
+        protected static dvtt_recorder m_default;
+
+        // With flight_bytes set the trace is kept in memory, up to that many
+        // bytes, and written only by dump()
+        function new(string filename, string name = "sim", string time_units = "1ns",
+                     longint unsigned flight_bytes = 0);
+            if (flight_bytes) begin
+                trace = dvtt_create_flight_recorder(filename, name, time_units, flight_bytes);
+            end else begin
+                trace = dvtt_create_trace(filename, name, time_units);
+            end
+            if (trace == null) begin
+                $error("dvtt_recorder: cannot create trace '%s'", filename);
+            end
+        endfunction
+
+        // Shared recorder writing to +dvtt_trace=<file> (default dvtt.perfetto).
+        // +dvtt_flight=<bytes> makes it a flight recorder of that size, and
+        // +dvtt_flush_on_exit keeps the trace if the simulation crashes.
+        static function dvtt_recorder get();
+            if (m_default == null) begin
+                string filename;
+                longint unsigned flight_bytes = 0;
+                if (!$value$plusargs("dvtt_trace=%s", filename)) begin
+                    filename = "dvtt.perfetto";
+                end
+                void'($value$plusargs("dvtt_flight=%d", flight_bytes));
+                m_default = new(filename, "sim", "1ns", flight_bytes);
+                if ($test$plusargs("dvtt_flush_on_exit")) begin
+                    m_default.flush_on_exit();
+                end
+            end
+            return m_default;
+        endfunction
+
+        // Writes the retained window of a flight recorder ("" for the trace
+        // filename); returns 0 on failure
+        function bit dump(string filename = "");
+            return trace != null && dvtt_dump_trace(trace, filename) != 0;
+        endfunction
+
+        // Writes out everything recorded so far, e.g. from a periodic process
+        function void flush();
+            if (trace != null) dvtt_flush_trace(trace);
+        endfunction
+
+        // Writes the trace up to the crash if the simulation dies or is
+        // killed before close()
+        function void flush_on_exit();
+            if (trace != null) dvtt_flush_on_exit(trace);
+        endfunction
+
+        function void close();
+            if (trace != null) begin
+                dvtt_close_trace(trace);
+                trace = null;
+            end
+            m_names.delete();
+            m_streams.delete();
+            m_counters.delete();
+`ifdef DVTT_UVM
+            m_component_streams.delete();
+`endif
+        endfunction
+
+        // Returns the id for 'name'; only the first use crosses DPI
+        function int name_id(string name);
+            if (!m_names.exists(name)) begin
+                m_names[name] = dvtt_register_name(trace, name);
+            end
+            return m_names[name];
+        endfunction
+
+        // Returns the stream with hierarchical 'scope', opening it on first use
+        function chandle stream(string scope, string name = "", string type_name = "");
+            if (!m_streams.exists(scope)) begin
+                m_streams[scope] = dvtt_open_stream(trace, name == "" ? scope : name,
+                                                    scope, type_name);
+            end
+            return m_streams[scope];
+        endfunction
+
+        // Returns counter 'name' of the stream with hierarchical 'scope',
+        // opening both on first use; sample it with dvtt_counter_set()
+        function chandle counter(string scope, string name, string unit = "");
+            string key = {scope, ":", name};
+            if (!m_counters.exists(key)) begin
+                m_counters[key] = dvtt_open_counter(stream(scope), name, unit);
+            end
+            return m_counters[key];
+        endfunction
+
+`ifdef DVTT_UVM
+        // Returns the stream of 'comp'; later calls are one handle lookup
+        function chandle component_stream(uvm_component comp, string type_name = "");
+            if (!m_component_streams.exists(comp)) begin
+                m_component_streams[comp] = stream(comp.get_full_name(), comp.get_name(),
+                                                   type_name);
+            end
+            return m_component_streams[comp];
+        endfunction
+`endif
+
+        // Records a complete transaction in one DPI call
+        function int record(chandle stream, int name_id, longint unsigned start_time,
+                            longint unsigned end_time, dvtt_attrs attrs = null,
+                            int type_id = 0, chandle parent = null);
+            if (attrs == null) begin
+                dvtt_packed_t none;
+                return dvtt_record_packed(stream, name_id, type_id, start_time, end_time,
+                                          parent, none, 0);
+            end
+            return dvtt_record_packed(stream, name_id, type_id, start_time, end_time,
+                                      parent, attrs.words, attrs.num_words);
+        endfunction
+    endclass
+
+`ifdef DVTT_UVM
+    // ------------------------------------------------------------------
+    // Dumps a flight recorder when UVM_FATAL is reported, before the
+    // simulation exits. Install once, e.g. in the test's build_phase:
+    //   dvtt_fatal_catcher::install(dvtt_recorder::get());
+    // ------------------------------------------------------------------
+    class dvtt_fatal_catcher extends uvm_pkg::uvm_report_catcher;
+        dvtt_recorder recorder;
+        string filename;
+
+        function new(string name = "dvtt_fatal_catcher");
+            super.new(name);
+        endfunction
+
+        static function dvtt_fatal_catcher install(dvtt_recorder recorder,
+                                                   string filename = "");
+            dvtt_fatal_catcher catcher = new();
+            catcher.recorder = recorder;
+            catcher.filename = filename;
+            uvm_pkg::uvm_report_cb::add(null, catcher);
+            return catcher;
+        endfunction
+
+        virtual function action_e catch();
+            if (get_severity() == uvm_pkg::UVM_FATAL && recorder != null) begin
+                if (!recorder.dump(filename)) begin
+                    $display("dvtt_fatal_catcher: trace dump failed");
+                end
+            end
+            return THROW;
+        endfunction
+    endclass
+`endif
+
+endpackage
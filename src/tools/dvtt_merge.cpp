@@ -0,0 +1,47 @@
+/**
+ * dvtt-merge: merges the traces of a sharded or multi-process simulation
+ *
+ * Usage: dvtt-merge [-z] [--no-remap] -o OUTPUT INPUT...
+ *
+ *   -o OUTPUT    Merged trace to write
+ *   -z           Compress the output (needs a zlib build)
+ *   --no-remap   Copy packets unchanged; for inputs recorded with distinct
+ *                id_namespace options
+ */
+#include "include/dvtt.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static int usage() {
+    fprintf(stderr, "usage: dvtt-merge [-z] [--no-remap] -o OUTPUT INPUT...\n");
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    dvtt_merge_options_t opts;
+    dvtt_merge_options_init(&opts);
+    const char* output = nullptr;
+    std::vector<const char*> inputs;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            output = argv[++i];
+        } else if (!strcmp(argv[i], "-z")) {
+            opts.compression = DVTT_COMPRESSION_DEFLATE;
+        } else if (!strcmp(argv[i], "--no-remap")) {
+            opts.remap_ids = 0;
+        } else if (argv[i][0] == '-') {
+            return usage();
+        } else {
+            inputs.push_back(argv[i]);
+        }
+    }
+    if (!output || inputs.empty()) {
+        return usage();
+    }
+    if (!dvtt_merge_traces(output, inputs.data(), static_cast<int>(inputs.size()), &opts)) {
+        fprintf(stderr, "dvtt-merge: %s\n", dvtt_error_string(dvtt_get_last_error()));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,303 @@
+/**
+ * Throughput and size benchmarks for the dvtt C API
+ *
+ * Every benchmark records into a real trace file and reports, besides
+ * time, the encoded bytes per transaction and the process's peak RSS.
+ * Run with --benchmark_filter=<regex> to select benchmarks and
+ * --benchmark_format=json for machine-readable output.
+ */
+#include <benchmark/benchmark.h>
+#include "include/dvtt.h"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+const char* const BENCH_FILE = "bench_dvtt.perfetto";
+
+long peak_rss_kb() {
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+        return usage.ru_maxrss / 1024;
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+#endif
+    return 0;
+}
+
+long file_size(const char* filename) {
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) {
+        return 0;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+// Output paths compared by the *_Output benchmarks
+enum Output {
+    OUTPUT_STDIO,
+    OUTPUT_ASYNC,
+    OUTPUT_MMAP
+};
+
+/**
+ * Trace and stream for one benchmark run. finish() closes the trace
+ * outside the timed loop and reports bytes per transaction and peak RSS.
+ */
+class BenchTrace {
+public:
+    explicit BenchTrace(int output = OUTPUT_STDIO, bool raw_bits = false) {
+        dvtt_init();
+        dvtt_trace_options_t opts;
+        dvtt_trace_options_init(&opts);
+        opts.async_writer = output == OUTPUT_ASYNC;
+        opts.mmap_window = output == OUTPUT_MMAP ? 64 << 20 : 0;
+        opts.raw_bits = raw_bits;
+        opts.free_on_close = 1;
+        trace = dvtt_create_trace_ex(BENCH_FILE, "bench", "1ns", &opts);
+        stream = dvtt_open_stream(trace, "stream", "top.stream", "bench");
+    }
+
+    void finish(benchmark::State& state, int64_t transactions) {
+        dvtt_close_trace(trace);
+        dvtt_shutdown();
+        long bytes = file_size(BENCH_FILE);
+        std::remove(BENCH_FILE);
+        state.SetBytesProcessed(bytes);
+        state.counters["bytes_per_txn"] = transactions ?
+            static_cast<double>(bytes) / static_cast<double>(transactions) : 0.0;
+        state.counters["peak_rss_kb"] = static_cast<double>(peak_rss_kb());
+    }
+
+    dvtt_trace_t trace;
+    dvtt_stream_t stream;
+};
+
+// Open and close without attributes, through each output path
+void BM_OpenClose_Output(benchmark::State& state) {
+    BenchTrace bench(static_cast<int>(state.range(0)));
+    dvtt_time_t t = 0;
+    for (auto _ : state) {
+        dvtt_transaction_t txn = dvtt_open_transaction(bench.stream, "txn", t, nullptr, nullptr);
+        dvtt_close_transaction(txn, t + 5);
+        t += 10;
+    }
+    state.SetItemsProcessed(state.iterations());
+    bench.finish(state, state.iterations());
+}
+BENCHMARK(BM_OpenClose_Output)
+    ->ArgName("output")->Arg(OUTPUT_STDIO)->Arg(OUTPUT_ASYNC)->Arg(OUTPUT_MMAP);
+
+// Attribute cost: each transaction carries ATTRS attributes of one type.
+// Items are attributes, so compare items/s against BM_OpenClose_Output.
+constexpr int ATTRS = 8;
+const char* const ATTR_NAMES[ATTRS] = {
+    "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7"
+};
+
+template <typename AddFn> void run_attrs(benchmark::State& state, BenchTrace& bench,
+                                         AddFn add) {
+    dvtt_time_t t = 0;
+    for (auto _ : state) {
+        dvtt_transaction_t txn = dvtt_open_transaction(bench.stream, "txn", t, nullptr, nullptr);
+        for (int i = 0; i < ATTRS; i++) {
+            add(txn, ATTR_NAMES[i], i);
+        }
+        dvtt_close_transaction(txn, t + 5);
+        t += 10;
+    }
+    state.SetItemsProcessed(state.iterations() * ATTRS);
+    bench.finish(state, state.iterations());
+}
+
+void BM_Attr_Uint32(benchmark::State& state) {
+    BenchTrace bench;
+    run_attrs(state, bench, [](dvtt_transaction_t txn, const char* name, int i) {
+        dvtt_add_attr_uint32(txn, name, 0x1000u + i, DVTT_RADIX_HEX);
+    });
+}
+BENCHMARK(BM_Attr_Uint32);
+
+// The same eight 32-bit attributes set through a schema in one call
+void BM_Attr_Schema(benchmark::State& state) {
+    BenchTrace bench;
+    dvtt_schema_field_t fields[ATTRS];
+    uint32_t values[ATTRS];
+    for (int i = 0; i < ATTRS; i++) {
+        fields[i] = { ATTR_NAMES[i], DVTT_RADIX_HEX, 32 };
+        values[ATTRS - 1 - i] = 0x1000u + i;
+    }
+    dvtt_schema_t schema = dvtt_register_schema(bench.stream, fields, ATTRS);
+    dvtt_time_t t = 0;
+    for (auto _ : state) {
+        dvtt_transaction_t txn = dvtt_open_transaction(bench.stream, "txn", t, nullptr, nullptr);
+        dvtt_set_attrs(txn, schema, values);
+        dvtt_close_transaction(txn, t + 5);
+        t += 10;
+    }
+    state.SetItemsProcessed(state.iterations() * ATTRS);
+    bench.finish(state, state.iterations());
+}
+BENCHMARK(BM_Attr_Schema);
+
+void BM_Attr_Uint64(benchmark::State& state) {
+    BenchTrace bench;
+    run_attrs(state, bench, [](dvtt_transaction_t txn, const char* name, int i) {
+        dvtt_add_attr_uint64(txn, name, 0xDEADBEEF00000000ull + i, DVTT_RADIX_DEC);
+    });
+}
+BENCHMARK(BM_Attr_Uint64);
+
+void BM_Attr_Double(benchmark::State& state) {
+    BenchTrace bench;
+    run_attrs(state, bench, [](dvtt_transaction_t txn, const char* name, int i) {
+        dvtt_add_attr_double(txn, name, 0.5 * i);
+    });
+}
+BENCHMARK(BM_Attr_Double);
+
+void BM_Attr_String(benchmark::State& state) {
+    BenchTrace bench;
+    run_attrs(state, bench, [](dvtt_transaction_t txn, const char* name, int) {
+        dvtt_add_attr_string(txn, name, "OKAY");
+    });
+}
+BENCHMARK(BM_Attr_String);
+
+// Bit vectors of range(0) bits, formatted (range(1) == 0) or raw
+void BM_Attr_Bits(benchmark::State& state) {
+    size_t num_bits = static_cast<size_t>(state.range(0));
+    BenchTrace bench(OUTPUT_STDIO, state.range(1) != 0);
+    std::vector<uint8_t> bits((num_bits + 7) / 8);
+    for (size_t i = 0; i < bits.size(); i++) {
+        bits[i] = static_cast<uint8_t>(i * 37 + 11);
+    }
+    run_attrs(state, bench, [&](dvtt_transaction_t txn, const char* name, int) {
+        dvtt_add_attr_bits(txn, name, bits.data(), num_bits, DVTT_RADIX_HEX);
+    });
+}
+BENCHMARK(BM_Attr_Bits)
+    ->ArgNames({"bits", "raw"})
+    ->ArgsProduct({{64, 512, 4096}, {0, 1}});
+
+// A parent with range(0) children, each on its own child track
+void BM_NestedChildren(benchmark::State& state) {
+    int children = static_cast<int>(state.range(0));
+    BenchTrace bench;
+    dvtt_time_t t = 0;
+    for (auto _ : state) {
+        dvtt_transaction_t parent = dvtt_open_transaction(bench.stream, "burst", t, nullptr,
+                                                          nullptr);
+        for (int i = 0; i < children; i++) {
+            dvtt_transaction_t beat = dvtt_open_transaction(bench.stream, "beat", t + i,
+                                                            nullptr, parent);
+            dvtt_add_attr_uint32(beat, "index", i, DVTT_RADIX_DEC);
+            dvtt_close_transaction(beat, t + i + 1);
+        }
+        dvtt_close_transaction(parent, t + children + 1);
+        t += children + 2;
+    }
+    int64_t transactions = state.iterations() * (children + 1);
+    state.SetItemsProcessed(transactions);
+    bench.finish(state, transactions);
+}
+BENCHMARK(BM_NestedChildren)->ArgName("children")->Arg(1)->Arg(8)->Arg(64);
+
+// Request/response pairs linked while both are open, plus a link by id
+// to the previous request after it has closed
+void BM_Links(benchmark::State& state) {
+    BenchTrace bench;
+    dvtt_time_t t = 0;
+    uint64_t previous = 0;
+    for (auto _ : state) {
+        dvtt_transaction_t req = dvtt_open_transaction(bench.stream, "req", t, nullptr, nullptr);
+        dvtt_transaction_t rsp = dvtt_open_transaction(bench.stream, "rsp", t + 1, nullptr,
+                                                       nullptr);
+        dvtt_add_link(req, rsp, DVTT_LINK_CAUSE_EFFECT, nullptr);
+        if (previous) {
+            dvtt_add_link_id(rsp, previous, DVTT_LINK_RELATED, nullptr);
+        }
+        previous = dvtt_get_transaction_id(req);
+        dvtt_close_transaction(req, t + 2);
+        dvtt_close_transaction(rsp, t + 3);
+        t += 10;
+    }
+    int64_t transactions = state.iterations() * 2;
+    state.SetItemsProcessed(transactions);
+    bench.finish(state, transactions);
+}
+BENCHMARK(BM_Links);
+
+// A sampled numeric signal as counter samples; compare with the same
+// signal recorded as one transaction per sample in BM_Attr_Uint64
+void BM_CounterSet(benchmark::State& state) {
+    BenchTrace bench;
+    dvtt_counter_t level = dvtt_open_counter(bench.stream, "level", "entries");
+    dvtt_time_t t = 0;
+    for (auto _ : state) {
+        dvtt_counter_set(level, t, static_cast<int64_t>(t & 15));
+        t += 10;
+    }
+    state.SetItemsProcessed(state.iterations());
+    bench.finish(state, state.iterations());
+}
+BENCHMARK(BM_CounterSet);
+
+// The SystemVerilog hot path: registered names and a packed attribute list
+void BM_RecordPacked(benchmark::State& state) {
+    BenchTrace bench;
+    int name = dvtt_register_name(bench.trace, "beat");
+    int addr = dvtt_register_name(bench.trace, "addr");
+    int data = dvtt_register_name(bench.trace, "data");
+    uint32_t words[] = {
+        static_cast<uint32_t>(addr), DVTT_PACKED_HEADER(DVTT_RADIX_HEX, 32), 0x1000,
+        static_cast<uint32_t>(data), DVTT_PACKED_HEADER(DVTT_RADIX_HEX, 64), 0xBEEF, 0xDEAD
+    };
+    dvtt_time_t t = 0;
+    for (auto _ : state) {
+        dvtt_record_packed(bench.stream, name, 0, t, t + 5, nullptr, words,
+                           sizeof(words) / sizeof(words[0]));
+        t += 10;
+    }
+    state.SetItemsProcessed(state.iterations());
+    bench.finish(state, state.iterations());
+}
+BENCHMARK(BM_RecordPacked);
+
+// Stream lookup by scope among 100k instantiated monitors, none of which
+// record
+void BM_FindOrOpenStream(benchmark::State& state) {
+    const int streams = 100000;
+    BenchTrace bench;
+    std::vector<std::string> scopes;
+    for (int i = 0; i < streams; i++) {
+        scopes.push_back("top.env.agent" + std::to_string(i) + ".monitor");
+        dvtt_find_or_open_stream(bench.trace, scopes.back().c_str(), "mon");
+    }
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            dvtt_find_or_open_stream(bench.trace, scopes[i].c_str(), "mon"));
+        i = (i + 1) % scopes.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+    bench.finish(state, 0);
+}
+BENCHMARK(BM_FindOrOpenStream);
+
+} // namespace
+
+BENCHMARK_MAIN();
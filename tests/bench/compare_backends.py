@@ -0,0 +1,131 @@
+"""Compare the pure Python and libdvtt-backed Python backends
+
+Runs the same recording scenarios through each backend and reports
+transactions per second and encoded bytes per transaction. The native
+backend is measured only when libdvtt can be loaded; point DVTT_LIBRARY at
+the built library (e.g. build/lib/libdvtt.so). Speedups are relative to
+the first backend measured.
+
+Usage:
+    python tests/bench/compare_backends.py [--count N] [--scenario NAME ...]
+"""
+
+import argparse
+import os
+import sys
+import tempfile
+import time
+from pathlib import Path
+
+sys.path.insert(0, str(Path(__file__).parent.parent.parent / "python"))
+
+from dv_transaction_trace import create_trace, Radix, LinkType
+from dv_transaction_trace.impl import native_impl
+
+
+def flat(trace, count):
+    """Open, add a few attributes and close, one stream"""
+    stream = trace.create_stream("axi", "top.axi", "AXI4")
+    for i in range(count):
+        txn = stream.begin_transaction("read", i * 10)
+        txn.add_uint("addr", 0x1000 + i * 4, Radix.HEX)
+        txn.add_uint("len", 4, Radix.DEC)
+        txn.add_string("resp", "OKAY")
+        txn.close(i * 10 + 5)
+    return count
+
+
+def nested(trace, count):
+    """Bursts of eight beats, each on its own child track"""
+    stream = trace.create_stream("axi", "top.axi", "AXI4")
+    bursts = count // 9
+    for i in range(bursts):
+        t = i * 20
+        burst = stream.begin_transaction("burst", t)
+        for beat in range(8):
+            child = stream.begin_transaction("beat", t + beat, parent=burst)
+            child.add_uint("index", beat, Radix.DEC)
+            child.close(t + beat + 1)
+        burst.close(t + 10)
+    return bursts * 9
+
+
+def wide(trace, count):
+    """One 512-bit data attribute per transaction"""
+    stream = trace.create_stream("bus", "top.bus")
+    data = bytes(range(64))
+    for i in range(count):
+        txn = stream.begin_transaction("write", i * 10)
+        txn.add_bits("data", data, 512, Radix.HEX)
+        txn.close(i * 10 + 5)
+    return count
+
+
+def linked(trace, count):
+    """Request/response pairs linked while both are open"""
+    stream = trace.create_stream("link", "top.link")
+    pairs = count // 2
+    for i in range(pairs):
+        t = i * 10
+        req = stream.begin_transaction("req", t)
+        rsp = stream.begin_transaction("rsp", t + 1)
+        req.add_link(rsp, LinkType.CAUSE_EFFECT)
+        req.close(t + 2)
+        rsp.close(t + 3)
+    return pairs * 2
+
+
+SCENARIOS = {
+    "flat": flat,
+    "nested": nested,
+    "wide": wide,
+    "linked": linked,
+}
+
+
+def measure(backend, scenario, count, directory):
+    """Returns (transactions per second, bytes per transaction)"""
+    filename = os.path.join(directory, f"{backend}_{scenario}.perfetto")
+    start = time.perf_counter()
+    with create_trace(filename, "bench", "1ns", backend=backend) as trace:
+        transactions = SCENARIOS[scenario](trace, count)
+    elapsed = time.perf_counter() - start
+    size = os.path.getsize(filename)
+    os.remove(filename)
+    return transactions / elapsed, size / transactions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--count", type=int, default=20000,
+                        help="transactions per scenario (default: 20000)")
+    parser.add_argument("--scenario", nargs="+", choices=sorted(SCENARIOS),
+                        default=list(SCENARIOS), help="scenarios to run")
+    args = parser.parse_args()
+
+    backends = []
+    try:
+        from dv_transaction_trace.impl import perfetto_impl  # noqa: F401
+        backends.append("python")
+    except ImportError as e:
+        print(f"Python backend unavailable ({e})")
+    if native_impl.is_available():
+        backends.append("native")
+    else:
+        print("libdvtt not found (set DVTT_LIBRARY)")
+    if not backends:
+        sys.exit(1)
+
+    print(f"{'scenario':<10} {'backend':<8} {'txn/s':>12} {'bytes/txn':>10} {'speedup':>8}")
+    with tempfile.TemporaryDirectory() as directory:
+        for scenario in args.scenario:
+            baseline = None
+            for backend in backends:
+                rate, size = measure(backend, scenario, args.count, directory)
+                baseline = baseline or rate
+                print(f"{scenario:<10} {backend:<8} {rate:>12,.0f} {size:>10.1f} "
+                      f"{rate / baseline:>7.1f}x")
+
+
+if __name__ == "__main__":
+    main()
@@ -1,7 +1,18 @@
 #include <gtest/gtest.h>
 #include "include/dvtt.h"
+#include "dvtt_impl.h"
+#include "trace_decode.h"
+#include <csignal>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
 #include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
 
 class DVTTBasicTest : public ::testing::Test {
 protected:
@@ -81,7 +92,7 @@ TEST_F(DVTTBasicTest, OpenTransaction) {
     dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
     ASSERT_NE(stream, nullptr);
     
-    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn1", 1000, "type1");
+    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn1", 1000, "type1", nullptr);
     ASSERT_NE(txn, nullptr);
     
     EXPECT_STREQ(dvtt_get_transaction_name(txn), "txn1");
@@ -102,7 +113,7 @@ TEST_F(DVTTBasicTest, CloseTransaction) {
     dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
     ASSERT_NE(stream, nullptr);
     
-    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn1", 1000, nullptr);
+    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn1", 1000, nullptr, nullptr);
     ASSERT_NE(txn, nullptr);
     EXPECT_TRUE(dvtt_is_transaction_open(txn));
     
@@ -123,7 +134,7 @@ TEST_F(DVTTBasicTest, AddAttributes) {
     dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
     ASSERT_NE(stream, nullptr);
     
-    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn1", 1000, nullptr);
+    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn1", 1000, nullptr, nullptr);
     ASSERT_NE(txn, nullptr);
     
     // Add various attributes
@@ -147,7 +158,7 @@ TEST_F(DVTTBasicTest, AddBitVector) {
     dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
     ASSERT_NE(stream, nullptr);
     
-    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn1", 1000, nullptr);
+    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn1", 1000, nullptr, nullptr);
     ASSERT_NE(txn, nullptr);
     
     uint8_t bits[] = {0xAB, 0xCD, 0xEF};
@@ -167,7 +178,7 @@ TEST_F(DVTTBasicTest, AddBlob) {
     dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
     ASSERT_NE(stream, nullptr);
     
-    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn1", 1000, nullptr);
+    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn1", 1000, nullptr, nullptr);
     ASSERT_NE(txn, nullptr);
     
     uint8_t data[] = {0x01, 0x02, 0x03, 0x04, 0x05};
@@ -191,9 +202,9 @@ TEST_F(DVTTBasicTest, MultipleStreamsAndTransactions) {
     ASSERT_NE(stream2, nullptr);
     
     // Create transactions on different streams
-    dvtt_transaction_t txn1 = dvtt_open_transaction(stream1, "txn1", 1000, nullptr);
-    dvtt_transaction_t txn2 = dvtt_open_transaction(stream2, "txn2", 1500, nullptr);
-    dvtt_transaction_t txn3 = dvtt_open_transaction(stream1, "txn3", 2000, nullptr);
+    dvtt_transaction_t txn1 = dvtt_open_transaction(stream1, "txn1", 1000, nullptr, nullptr);
+    dvtt_transaction_t txn2 = dvtt_open_transaction(stream2, "txn2", 1500, nullptr, nullptr);
+    dvtt_transaction_t txn3 = dvtt_open_transaction(stream1, "txn3", 2000, nullptr, nullptr);
     
     ASSERT_NE(txn1, nullptr);
     ASSERT_NE(txn2, nullptr);
@@ -218,6 +229,14 @@ TEST_F(DVTTBasicTest, StreamHandle) {
     
     int handle = dvtt_get_stream_handle(stream);
     EXPECT_GT(handle, 0);
+    EXPECT_EQ(dvtt_get_stream_handle(stream), handle);
+    EXPECT_EQ(dvtt_get_stream_from_handle(handle), stream);
+    
+    // Handles are typed
+    EXPECT_EQ(dvtt_get_transaction_from_handle(handle), nullptr);
+    
+    dvtt_free_stream(stream);
+    EXPECT_EQ(dvtt_get_stream_from_handle(handle), nullptr);
     
     dvtt_close_trace(trace);
     std::remove(filename);
@@ -231,13 +250,32 @@ TEST_F(DVTTBasicTest, TransactionHandle) {
     dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
     ASSERT_NE(stream, nullptr);
     
-    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn1", 1000, nullptr);
+    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn1", 1000, nullptr, nullptr);
     ASSERT_NE(txn, nullptr);
     
     int handle = dvtt_get_transaction_handle(txn);
     EXPECT_GT(handle, 0);
+    EXPECT_EQ(dvtt_get_transaction_from_handle(handle), txn);
+    
+    // Still resolvable after close, until freed
+    dvtt_close_transaction(txn, 2000);
+    EXPECT_EQ(dvtt_get_transaction_from_handle(handle), txn);
+    dvtt_free_transaction(txn, 0);
+    EXPECT_EQ(dvtt_get_transaction_from_handle(handle), nullptr);
     
+    // A recycled node gets a new handle; the old one stays stale
+    dvtt_transaction_t reused = dvtt_open_transaction(stream, "txn2", 3000, nullptr, nullptr);
+    EXPECT_EQ(reused, txn);
+    int reused_handle = dvtt_get_transaction_handle(reused);
+    EXPECT_NE(reused_handle, handle);
+    EXPECT_EQ(dvtt_get_transaction_from_handle(handle), nullptr);
+    EXPECT_EQ(dvtt_get_transaction_from_handle(reused_handle), reused);
+    
+    // Closing the trace releases handles of unfreed transactions
     dvtt_close_trace(trace);
+    EXPECT_EQ(dvtt_get_transaction_from_handle(reused_handle), nullptr);
+    EXPECT_EQ(dvtt_get_transaction_from_handle(0), nullptr);
+    EXPECT_EQ(dvtt_get_transaction_from_handle(-1), nullptr);
     std::remove(filename);
 }
 
@@ -249,7 +287,7 @@ TEST_F(DVTTBasicTest, BatchAttributes) {
     dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
     ASSERT_NE(stream, nullptr);
     
-    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn1", 1000, nullptr);
+    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn1", 1000, nullptr, nullptr);
     ASSERT_NE(txn, nullptr);
     
     dvtt_begin_attributes(txn);
@@ -264,6 +302,1078 @@ TEST_F(DVTTBasicTest, BatchAttributes) {
     std::remove(filename);
 }
 
+TEST_F(DVTTBasicTest, EmitsTrackEventPackets) {
+    using namespace trace_decode;
+    const char* filename = "test_emit.perfetto";
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    dvtt_transaction_t txn = dvtt_open_transaction(stream, "READ", 1000, "axi", nullptr);
+    dvtt_add_attr_uint64(txn, "addr", 0x1000, DVTT_RADIX_HEX);
+    dvtt_add_attr_int64(txn, "delta", -5, DVTT_RADIX_DEC);
+    dvtt_close_transaction(txn, 2000);
+    dvtt_close_trace(trace);
+    
+    bool ok = false;
+    std::vector<std::string> packets = read_packets(filename, &ok);
+    ASSERT_TRUE(ok);
+    ASSERT_EQ(packets.size(), 4u);
+    
+    // First packet on the sequence clears its incremental state and
+    // defines its clocks
+    std::vector<Field> pkt = decode(packets[0]);
+    ASSERT_NE(find(pkt, 13), nullptr);
+    EXPECT_EQ(find(pkt, 13)->value & 1u, 1u);
+    EXPECT_EQ(find(pkt, 8), nullptr);
+    ASSERT_NE(find(pkt, 6), nullptr);
+    EXPECT_EQ(count(decode(find(pkt, 6)->bytes), 1), 3u);
+    ASSERT_NE(find(pkt, 59), nullptr);
+    EXPECT_EQ(find(decode(find(pkt, 59)->bytes), 58)->value, 64u);
+    
+    // Track descriptor for the stream
+    pkt = decode(packets[1]);
+    const Field* desc = find(pkt, 60);
+    ASSERT_NE(desc, nullptr);
+    std::vector<Field> desc_fields = decode(desc->bytes);
+    ASSERT_NE(find(desc_fields, 1), nullptr);
+    uint64_t stream_uuid = find(desc_fields, 1)->value;
+    EXPECT_EQ(find(desc_fields, 2)->bytes, "stream1");
+    
+    // Slice begin with interned name, category and annotation names
+    pkt = decode(packets[2]);
+    EXPECT_EQ(find(pkt, 8)->value, 1000u);
+    EXPECT_NE(find(pkt, 10), nullptr);
+    EXPECT_EQ(find(pkt, 13)->value, 2u);
+    std::vector<Field> ev = decode(find(pkt, 11)->bytes);
+    EXPECT_EQ(find(ev, 9)->value, 1u);
+    EXPECT_EQ(find(ev, 11)->value, stream_uuid);
+    EXPECT_EQ(find(ev, 23), nullptr);
+    EXPECT_EQ(find(ev, 22), nullptr);
+    ASSERT_NE(find(ev, 10), nullptr);
+    ASSERT_NE(find(ev, 3), nullptr);
+    ASSERT_EQ(count(ev, 4), 2u);
+    std::vector<Field> ann = decode(find(ev, 4)->bytes);
+    ASSERT_NE(find(ann, 1), nullptr);
+    EXPECT_EQ(find(ann, 3)->value, 0x1000u);
+    
+    ASSERT_NE(find(pkt, 12), nullptr);
+    std::vector<Field> interned = decode(find(pkt, 12)->bytes);
+    std::vector<Field> entry = decode(find(interned, 2)->bytes);
+    EXPECT_EQ(find(entry, 1)->value, find(ev, 10)->value);
+    EXPECT_EQ(find(entry, 2)->bytes, "READ");
+    entry = decode(find(interned, 1)->bytes);
+    EXPECT_EQ(find(entry, 1)->value, find(ev, 3)->value);
+    EXPECT_EQ(find(entry, 2)->bytes, "axi");
+    ASSERT_EQ(count(interned, 3), 2u);
+    entry = decode(find(interned, 3)->bytes);
+    EXPECT_EQ(find(entry, 1)->value, find(ann, 1)->value);
+    EXPECT_EQ(find(entry, 2)->bytes, "addr[hex]");
+    
+    // Slice end, timed relative to the begin
+    pkt = decode(packets[3]);
+    EXPECT_EQ(find(pkt, 8)->value, 1000u);
+    EXPECT_EQ(find(pkt, 58), nullptr);
+    ev = decode(find(pkt, 11)->bytes);
+    EXPECT_EQ(find(ev, 9)->value, 2u);
+    EXPECT_EQ(find(ev, 11)->value, stream_uuid);
+    
+    std::remove(filename);
+}
+
+TEST_F(DVTTBasicTest, TimestampsUseSequenceClocks) {
+    using namespace trace_decode;
+    EXPECT_EQ(dvtt::parse_unit_multiplier_ns("1ns"), 1u);
+    EXPECT_EQ(dvtt::parse_unit_multiplier_ns("10ns"), 10u);
+    EXPECT_EQ(dvtt::parse_unit_multiplier_ns("1 us"), 1000u);
+    EXPECT_EQ(dvtt::parse_unit_multiplier_ns("ms"), 1000000u);
+    EXPECT_EQ(dvtt::parse_unit_multiplier_ns("2000ps"), 2u);
+    EXPECT_EQ(dvtt::parse_unit_multiplier_ns("100ps"), 1u);
+    EXPECT_EQ(dvtt::parse_unit_multiplier_ns("cycles"), 1u);
+    
+    const char* filename = "test_clocks.perfetto";
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "10ns");
+    ASSERT_NE(trace, nullptr);
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    dvtt_transaction_t outer = dvtt_open_transaction(stream, "outer", 100, nullptr, nullptr);
+    dvtt_transaction_t inner = dvtt_open_transaction(stream, "inner", 150, nullptr, nullptr);
+    dvtt_close_transaction(inner, 160);
+    dvtt_close_transaction(outer, 120);
+    dvtt_close_trace(trace);
+    
+    bool ok = false;
+    std::vector<std::string> packets = read_packets(filename, &ok);
+    ASSERT_TRUE(ok);
+    ASSERT_EQ(packets.size(), 6u);
+    
+    // Both sequence clocks count 10ns units
+    std::vector<Field> snapshot = decode(find(decode(packets[0]), 6)->bytes);
+    std::map<uint64_t, uint64_t> multipliers;
+    for (const auto& f : snapshot) {
+        std::vector<Field> clock = decode(f.bytes);
+        const Field* multiplier = find(clock, 4);
+        multipliers[find(clock, 1)->value] = multiplier ? multiplier->value : 1;
+    }
+    EXPECT_EQ(multipliers.size(), 3u);
+    EXPECT_EQ(multipliers[64], 10u);
+    EXPECT_EQ(multipliers[65], 10u);
+    
+    // Transactions are written as they close: "inner" carries deltas, and
+    // "outer", earlier than its end, absolute times
+    std::vector<Field> pkt = decode(packets[3]);
+    EXPECT_EQ(find(pkt, 8)->value, 10u);
+    EXPECT_EQ(find(pkt, 58), nullptr);
+    for (size_t i = 4; i < packets.size(); i++) {
+        pkt = decode(packets[i]);
+        ASSERT_NE(find(pkt, 58), nullptr);
+        EXPECT_EQ(find(pkt, 58)->value, 65u);
+    }
+    
+    std::vector<uint64_t> times = packet_times(packets);
+    EXPECT_EQ(times[2], 150u);
+    EXPECT_EQ(times[3], 160u);
+    EXPECT_EQ(times[4], 100u);
+    EXPECT_EQ(times[5], 120u);
+    
+    std::remove(filename);
+}
+
+TEST_F(DVTTBasicTest, InternedStringsDefinedOnce) {
+    using namespace trace_decode;
+    const char* filename = "test_interned.perfetto";
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    for (int i = 0; i < 3; i++) {
+        dvtt_transaction_t txn = dvtt_open_transaction(stream, "READ", i * 10, "axi", nullptr);
+        dvtt_add_attr_uint32(txn, "index", i, DVTT_RADIX_DEC);
+        dvtt_close_transaction(txn, i * 10 + 5);
+    }
+    dvtt_close_trace(trace);
+    
+    bool ok = false;
+    std::vector<std::string> packets = read_packets(filename, &ok);
+    ASSERT_TRUE(ok);
+    ASSERT_EQ(packets.size(), 8u);
+    
+    // Only the first slice begin carries definitions; later ones reuse the iids
+    std::vector<Field> first = decode(find(decode(packets[2]), 11)->bytes);
+    EXPECT_NE(find(decode(packets[2]), 12), nullptr);
+    for (size_t i = 4; i < packets.size(); i += 2) {
+        std::vector<Field> pkt = decode(packets[i]);
+        EXPECT_EQ(find(pkt, 12), nullptr);
+        std::vector<Field> ev = decode(find(pkt, 11)->bytes);
+        EXPECT_EQ(find(ev, 10)->value, find(first, 10)->value);
+        EXPECT_EQ(find(ev, 3)->value, find(first, 3)->value);
+    }
+    
+    std::remove(filename);
+}
+
+TEST_F(DVTTBasicTest, BatchedAttributesKeepOrderAndValues) {
+    using namespace trace_decode;
+    const char* filename = "test_batch_attrs.perfetto";
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    dvtt_transaction_t txn = dvtt_open_transaction(stream, "WRITE", 0, nullptr, nullptr);
+    const uint8_t blob[] = {0xde, 0xad, 0x01};
+    dvtt_begin_attributes(txn);
+    for (int i = 0; i < 100; i++) {
+        dvtt_add_attr_uint32(txn, ("f" + std::to_string(i)).c_str(), i, DVTT_RADIX_DEC);
+    }
+    dvtt_add_attr_double(txn, "ratio", 0.5);
+    dvtt_add_attr_blob(txn, "payload", blob, sizeof(blob));
+    dvtt_end_attributes(txn);
+    dvtt_close_transaction(txn, 10);
+    
+    // Additions after close are dropped
+    dvtt_add_attr_string(txn, "late", "x");
+    dvtt_close_trace(trace);
+    
+    bool ok = false;
+    std::vector<std::string> packets = read_packets(filename, &ok);
+    ASSERT_TRUE(ok);
+    ASSERT_EQ(packets.size(), 4u);
+    
+    std::vector<Field> pkt = decode(packets[2]);
+    std::vector<Field> ev = decode(find(pkt, 11)->bytes);
+    ASSERT_EQ(count(ev, 4), 102u);
+    
+    // Annotation names are interned in order of first use
+    std::vector<Field> anns;
+    for (const auto& f : ev) {
+        if (f.number == 4) anns.push_back(f);
+    }
+    for (int i = 0; i < 100; i++) {
+        std::vector<Field> ann = decode(anns[i].bytes);
+        EXPECT_EQ(find(ann, 1)->value, static_cast<uint64_t>(i + 1));
+        EXPECT_EQ(find(ann, 3)->value, static_cast<uint64_t>(i));
+    }
+    std::vector<Field> ratio = decode(anns[100].bytes);
+    double d;
+    std::memcpy(&d, &find(ratio, 5)->value, sizeof(d));
+    EXPECT_EQ(d, 0.5);
+    EXPECT_EQ(find(decode(anns[101].bytes), 6)->bytes, "dead01");
+    
+    std::vector<Field> interned = decode(find(pkt, 12)->bytes);
+    ASSERT_EQ(count(interned, 3), 102u);
+    std::vector<Field> first = decode(find(interned, 3)->bytes);
+    EXPECT_EQ(find(first, 2)->bytes, "f0[dec]");
+    
+    std::remove(filename);
+}
+
+TEST_F(DVTTBasicTest, ChildTrackDescriptor) {
+    using namespace trace_decode;
+    const char* filename = "test_child_track.perfetto";
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    dvtt_transaction_t parent = dvtt_open_transaction(stream, "burst", 0, nullptr, nullptr);
+    dvtt_transaction_t child = dvtt_open_transaction(stream, "beat", 10, nullptr, parent);
+    dvtt_close_transaction(child, 20);
+    dvtt_close_transaction(parent, 30);
+    dvtt_close_trace(trace);
+    
+    bool ok = false;
+    std::vector<std::string> packets = read_packets(filename, &ok);
+    ASSERT_TRUE(ok);
+    ASSERT_EQ(packets.size(), 7u);
+    
+    std::vector<Field> stream_desc = decode(find(decode(packets[1]), 60)->bytes);
+    std::vector<Field> child_desc = decode(find(decode(packets[2]), 60)->bytes);
+    EXPECT_EQ(find(child_desc, 2)->bytes, "beat");
+    ASSERT_NE(find(child_desc, 5), nullptr);
+    EXPECT_EQ(find(child_desc, 5)->value, find(stream_desc, 1)->value);
+    EXPECT_NE(find(child_desc, 1)->value, find(stream_desc, 1)->value);
+    
+    std::remove(filename);
+}
+
+TEST_F(DVTTBasicTest, ChildLanesAreReused) {
+    using namespace trace_decode;
+    const char* filename = "test_child_lanes.perfetto";
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    
+    // A pipelined burst with up to 4 beats in flight, opened every 10 and
+    // lasting 40, and one complete record per beat
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    int ack_id = dvtt_register_name(trace, "ack");
+    dvtt_transaction_t burst = dvtt_open_transaction(stream, "burst", 0, nullptr, nullptr);
+    std::vector<dvtt_transaction_t> beats;
+    std::map<uint64_t, dvtt_time_t> lane_end;
+    const int count = 1000;
+    for (int i = 0; i < count; i++) {
+        dvtt_time_t start = i * 10;
+        if (i >= 4) {
+            dvtt_close_transaction(beats[i - 4], start);
+        }
+        beats.push_back(dvtt_open_transaction(stream, "beat", start, nullptr, burst));
+        uint64_t lane = beats.back()->impl->track_uuid;
+        EXPECT_LE(lane_end[lane], start);
+        lane_end[lane] = start + 40;
+        EXPECT_EQ(dvtt_record_packed(stream, ack_id, 0, start, start + 5, burst, nullptr, 0), 1);
+    }
+    for (int i = count - 4; i < count; i++) {
+        dvtt_close_transaction(beats[i], count * 10 + 30);
+    }
+    dvtt_close_transaction(burst, count * 10 + 40);
+    dvtt_close_trace(trace);
+    EXPECT_EQ(lane_end.size(), 4u);
+    
+    bool ok = false;
+    std::vector<std::string> packets = read_packets(filename, &ok);
+    ASSERT_TRUE(ok);
+    std::map<std::string, int> descriptors;
+    for (const auto& packet : packets) {
+        std::vector<Field> fields = decode(packet);
+        const Field* desc = find(fields, 60);
+        if (desc) {
+            descriptors[find(decode(desc->bytes), 2)->bytes]++;
+        }
+    }
+    EXPECT_EQ(descriptors["stream1"], 1);
+    EXPECT_EQ(descriptors["beat"], 4);
+    EXPECT_EQ(descriptors["ack"], 1);
+    
+    std::remove(filename);
+}
+
+TEST_F(DVTTBasicTest, FindOrOpenStreamByScope) {
+    using namespace trace_decode;
+    const char* filename = "test_find_stream.perfetto";
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    
+    // Many monitors, most of which never record
+    const int count = 1000;
+    std::vector<dvtt_stream_t> streams;
+    for (int i = 0; i < count; i++) {
+        std::string scope = "top.env.agent" + std::to_string(i);
+        streams.push_back(dvtt_find_or_open_stream(trace, scope.c_str(), "mon"));
+        ASSERT_NE(streams.back(), nullptr);
+    }
+    for (int i = 0; i < count; i++) {
+        std::string scope = "top.env.agent" + std::to_string(i);
+        EXPECT_EQ(dvtt_find_or_open_stream(trace, scope.c_str(), "mon"), streams[i]);
+    }
+    EXPECT_EQ(trace->impl->streams.size(), static_cast<size_t>(count));
+    
+    // Streams opened directly are found too; a NULL scope is the empty one
+    dvtt_stream_t plain = dvtt_open_stream(trace, "plain", nullptr, "bus");
+    EXPECT_EQ(dvtt_find_or_open_stream(trace, "", "plain"), plain);
+    EXPECT_EQ(dvtt_find_or_open_stream(trace, nullptr, "plain"), plain);
+    EXPECT_NE(dvtt_find_or_open_stream(trace, "top", "plain"), plain);
+    
+    // A freed stream is replaced
+    dvtt_free_stream(plain);
+    dvtt_stream_t reopened = dvtt_find_or_open_stream(trace, nullptr, "plain");
+    EXPECT_NE(reopened, plain);
+    EXPECT_TRUE(dvtt_is_stream_open(reopened));
+    EXPECT_EQ(dvtt_find_or_open_stream(trace, nullptr, "plain"), reopened);
+    
+    dvtt_transaction_t txn = dvtt_open_transaction(streams[7], "txn", 0, nullptr, nullptr);
+    dvtt_close_transaction(txn, 10);
+    dvtt_close_trace(trace);
+    
+    // Only the stream that recorded is described
+    bool ok = false;
+    std::vector<std::string> packets = read_packets(filename, &ok);
+    ASSERT_TRUE(ok);
+    size_t descriptors = 0;
+    for (const auto& packet : packets) {
+        std::vector<Field> fields = decode(packet);
+        if (const Field* desc = find(fields, 60)) {
+            EXPECT_EQ(find(decode(desc->bytes), 2)->bytes, "mon");
+            descriptors++;
+        }
+    }
+    EXPECT_EQ(descriptors, 1u);
+    EXPECT_EQ(dvtt_find_or_open_stream(nullptr, "top", "mon"), nullptr);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_NULL_HANDLE);
+    
+    std::remove(filename);
+}
+
+TEST_F(DVTTBasicTest, FindOrOpenStreamSkipsFreedDuplicates) {
+    dvtt_trace_t trace = dvtt_create_trace("test_find_dup.perfetto", "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    
+    dvtt_stream_t a = dvtt_open_stream(trace, "mon", "top.u0", nullptr);
+    dvtt_stream_t b = dvtt_open_stream(trace, "mon", "top.u0", nullptr);
+    dvtt_stream_t c = dvtt_open_stream(trace, "mon", "top.u0", nullptr);
+    EXPECT_EQ(dvtt_find_or_open_stream(trace, "top.u0", "mon"), a);
+    
+    // Freeing the earliest hands the key to the surviving duplicate
+    dvtt_free_stream(a);
+    EXPECT_EQ(dvtt_find_or_open_stream(trace, "top.u0", "mon"), b);
+    
+    // Freeing one further down the chain leaves the earliest in place
+    dvtt_free_stream(c);
+    EXPECT_EQ(dvtt_find_or_open_stream(trace, "top.u0", "mon"), b);
+    dvtt_free_stream(b);
+    dvtt_free_stream(b);
+    EXPECT_TRUE(trace->impl->stream_index.empty());
+    
+    dvtt_stream_t d = dvtt_find_or_open_stream(trace, "top.u0", "mon");
+    EXPECT_NE(d, a);
+    EXPECT_NE(d, b);
+    EXPECT_NE(d, c);
+    EXPECT_EQ(dvtt_find_or_open_stream(trace, "top.u0", "mon"), d);
+    EXPECT_EQ(trace->impl->streams.size(), 4u);
+    
+    dvtt_close_trace(trace);
+    std::remove("test_find_dup.perfetto");
+}
+
+TEST_F(DVTTBasicTest, ManyTransactionsSpanChunks) {
+    const char* filename = "test_many.perfetto";
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    const int count = 20000;
+    for (int i = 0; i < count; i++) {
+        dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn", i * 10, nullptr, nullptr);
+        dvtt_add_attr_uint32(txn, "index", i, DVTT_RADIX_DEC);
+        dvtt_add_attr_string(txn, "status", "OK");
+        dvtt_close_transaction(txn, i * 10 + 5);
+    }
+    dvtt_close_trace(trace);
+    
+    bool ok = false;
+    std::vector<std::string> packets = trace_decode::read_packets(filename, &ok);
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(packets.size(), 2u + 2u * count);
+    
+    std::remove(filename);
+}
+
+TEST_F(DVTTBasicTest, FreeReleasesTransaction) {
+    const char* filename = "test_free.perfetto";
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    dvtt_transaction_t parent = dvtt_open_transaction(stream, "burst", 0, nullptr, nullptr);
+    dvtt_transaction_t child = dvtt_open_transaction(stream, "beat", 10, nullptr, parent);
+    EXPECT_EQ(stream->impl->transactions.size(), 2u);
+    
+    // Parent may be freed while its child is still open
+    dvtt_free_transaction(parent, 15);
+    EXPECT_EQ(stream->impl->transactions.size(), 1u);
+    EXPECT_EQ(trace->impl->sequence->transaction_pool.live(), 1u);
+    EXPECT_TRUE(dvtt_is_transaction_open(child));
+    
+    dvtt_close_transaction(child, 20);
+    EXPECT_TRUE(stream->impl->transactions.empty());
+    EXPECT_EQ(trace->impl->sequence->transaction_pool.live(), 1u);
+    EXPECT_EQ(dvtt_get_transaction_end_time(child), 20u);
+    dvtt_free_transaction(child, 0);
+    EXPECT_TRUE(trace->impl->sequence->transaction_pool.live() == 0u);
+    
+    dvtt_close_trace(trace);
+    
+    bool ok = false;
+    EXPECT_EQ(trace_decode::read_packets(filename, &ok).size(), 7u);
+    EXPECT_TRUE(ok);
+    std::remove(filename);
+}
+
+TEST_F(DVTTBasicTest, FreeOnCloseKeepsOnlyOpenTransactions) {
+    const char* filename = "test_free_on_close.perfetto";
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.free_on_close = 1;
+    dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    ASSERT_NE(trace, nullptr);
+    
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    dvtt_transaction_t outer = dvtt_open_transaction(stream, "outer", 0, nullptr, nullptr);
+    for (int i = 0; i < 1000; i++) {
+        dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn", i, nullptr, outer);
+        dvtt_add_attr_uint32(txn, "index", i, DVTT_RADIX_DEC);
+        dvtt_close_transaction(txn, i + 1);
+    }
+    EXPECT_EQ(trace->impl->sequence->transaction_pool.live(), 1u);
+    EXPECT_EQ(stream->impl->transactions.size(), 1u);
+    
+    dvtt_close_trace(trace);
+    std::remove(filename);
+}
+
+TEST_F(DVTTBasicTest, TransactionNodesAreRecycled) {
+    const char* filename = "test_pool.perfetto";
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    for (int i = 0; i < 10000; i++) {
+        dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn", i, "type", nullptr);
+        dvtt_add_attr_uint32(txn, "a", i, DVTT_RADIX_HEX);
+        dvtt_add_attr_string(txn, "b", "value");
+        dvtt_free_transaction(txn, i + 1);
+    }
+    
+    // One open transaction at a time never needs more than the first slab
+    EXPECT_EQ(trace->impl->sequence->transaction_pool.live(), 0u);
+    EXPECT_LE(trace->impl->sequence->transaction_pool.capacity(), 256u);
+    EXPECT_LE(trace->impl->sequence->attr_pool.capacity(), 64u);
+    
+    // Attributes added after close are ignored
+    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn", 0, nullptr, nullptr);
+    dvtt_close_transaction(txn, 1);
+    dvtt_add_attr_uint32(txn, "late", 1, DVTT_RADIX_HEX);
+    EXPECT_EQ(txn->impl->attributes, nullptr);
+    
+    dvtt_close_trace(trace);
+    std::remove(filename);
+}
+
+// Counts slice begins per stream name in a trace written by the tests below
+static std::map<std::string, int> count_begins(const char* filename) {
+    using namespace trace_decode;
+    std::map<uint64_t, std::string> track_names;
+    std::map<std::string, int> begins;
+    for (const auto& pkt : read_packets(filename)) {
+        std::vector<Field> fields = decode(pkt);
+        if (const Field* desc = find(fields, 60)) {
+            std::vector<Field> desc_fields = decode(desc->bytes);
+            track_names[find(desc_fields, 1)->value] = find(desc_fields, 2)->bytes;
+        }
+        if (const Field* ev = find(fields, 11)) {
+            std::vector<Field> ev_fields = decode(ev->bytes);
+            if (find(ev_fields, 9)->value == 1) {
+                begins[track_names[find(ev_fields, 11)->value]]++;
+            }
+        }
+    }
+    return begins;
+}
+
+TEST_F(DVTTBasicTest, DisabledStreamRecordsNothing) {
+    const char* filename = "test_disabled.perfetto";
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    EXPECT_EQ(dvtt_is_stream_enabled(stream), 1);
+    dvtt_set_stream_enabled(stream, 0);
+    EXPECT_EQ(dvtt_is_stream_enabled(stream), 0);
+    
+    for (int i = 0; i < 100; i++) {
+        dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn", i * 10, nullptr, nullptr);
+        ASSERT_NE(txn, nullptr);
+        EXPECT_EQ(dvtt_get_last_error(), DVTT_OK);
+        EXPECT_EQ(dvtt_is_transaction_enabled(txn), 0);
+        dvtt_transaction_t child = dvtt_open_transaction(stream, "beat", i * 10, nullptr, txn);
+        EXPECT_EQ(dvtt_is_transaction_enabled(child), 0);
+        dvtt_add_attr_uint32(txn, "index", i, DVTT_RADIX_DEC);
+        dvtt_add_attr_string(txn, "status", "OK");
+        dvtt_begin_attributes(txn);
+        dvtt_end_attributes(txn);
+        dvtt_close_transaction(child, i * 10 + 1);
+        dvtt_close_transaction(txn, i * 10 + 5);
+        dvtt_free_transaction(txn, 0);
+    }
+    EXPECT_EQ(trace->impl->sequence->transaction_pool.live(), 0u);
+    EXPECT_EQ(trace->impl->sequence->transaction_pool.capacity(), 0u);
+    
+    dvtt_set_stream_enabled(stream, 1);
+    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn", 2000, nullptr, nullptr);
+    EXPECT_EQ(dvtt_is_transaction_enabled(txn), 1);
+    dvtt_close_transaction(txn, 2005);
+    dvtt_close_trace(trace);
+    
+    EXPECT_EQ(count_begins(filename)["stream1"], 1);
+    std::remove(filename);
+}
+
+TEST_F(DVTTBasicTest, ScopeRulesLastMatchWins) {
+    using namespace trace_decode;
+    const char* filename = "test_scope_rules.perfetto";
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    
+    dvtt_stream_t axi = dvtt_open_stream(trace, "axi_mon", "top.env", nullptr);
+    dvtt_set_scope_enabled(trace, "*", 0);
+    dvtt_set_scope_enabled(trace, "top.env.axi*", 1);
+    // Opened after the rules: picks them up
+    dvtt_stream_t apb = dvtt_open_stream(trace, "apb_mon", "top.env", nullptr);
+    dvtt_stream_t axi2 = dvtt_open_stream(trace, "axi_drv", "top.env", nullptr);
+    dvtt_stream_t bare = dvtt_open_stream(trace, "bare", nullptr, nullptr);
+    EXPECT_EQ(dvtt_is_stream_enabled(axi), 1);
+    EXPECT_EQ(dvtt_is_stream_enabled(apb), 0);
+    EXPECT_EQ(dvtt_is_stream_enabled(axi2), 1);
+    EXPECT_EQ(dvtt_is_stream_enabled(bare), 0);
+    
+    for (dvtt_stream_t s : {axi, apb, axi2, bare}) {
+        dvtt_transaction_t txn = dvtt_open_transaction(s, "txn", 0, nullptr, nullptr);
+        dvtt_close_transaction(txn, 10);
+    }
+    dvtt_close_trace(trace);
+    
+    // Disabled-from-the-start streams are never described
+    size_t descriptors = 0;
+    for (const auto& pkt : read_packets(filename)) {
+        descriptors += count(decode(pkt), 60);
+    }
+    EXPECT_EQ(descriptors, 2u);
+    std::map<std::string, int> begins = count_begins(filename);
+    EXPECT_EQ(begins["axi_mon"], 1);
+    EXPECT_EQ(begins["axi_drv"], 1);
+    EXPECT_EQ(begins.size(), 2u);
+    std::remove(filename);
+}
+
+TEST_F(DVTTBasicTest, SamplingOneInNWithinWindow) {
+    const char* filename = "test_sampling.perfetto";
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    dvtt_sampling_t sampling = { 4, 1000, 5000 };
+    dvtt_set_stream_sampling(stream, &sampling);
+    
+    int recorded = 0;
+    for (int i = 0; i < 100; i++) {
+        dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn", i * 100, nullptr, nullptr);
+        // Children follow their parent rather than being sampled
+        dvtt_transaction_t child = dvtt_open_transaction(stream, "beat", i * 100, nullptr, txn);
+        EXPECT_EQ(dvtt_is_transaction_enabled(child), dvtt_is_transaction_enabled(txn));
+        recorded += dvtt_is_transaction_enabled(txn);
+        dvtt_close_transaction(child, i * 100 + 10);
+        dvtt_close_transaction(txn, i * 100 + 50);
+    }
+    // Starts 1000..4900 are in the window: 40 transactions, every 4th kept
+    EXPECT_EQ(recorded, 10);
+    
+    dvtt_set_stream_sampling(stream, nullptr);
+    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn", 20000, nullptr, nullptr);
+    EXPECT_EQ(dvtt_is_transaction_enabled(txn), 1);
+    dvtt_close_transaction(txn, 20050);
+    dvtt_close_trace(trace);
+    
+    EXPECT_EQ(count_begins(filename)["stream1"], 11);
+    std::remove(filename);
+}
+
+static int g_name_evaluations = 0;
+
+static const char* counted(const char* name) {
+    g_name_evaluations++;
+    return name;
+}
+
+TEST_F(DVTTBasicTest, RuntimeDisableSkipsCallsAndArguments) {
+    const char* filename = "test_runtime_disable.perfetto";
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    
+    EXPECT_EQ(dvtt_is_enabled(), 1);
+    dvtt_set_enabled(0);
+    g_name_evaluations = 0;
+    for (int i = 0; i < 10; i++) {
+        dvtt_transaction_t txn = dvtt_open_transaction(stream, counted("txn"), i, nullptr, nullptr);
+        EXPECT_EQ(txn, nullptr);
+        dvtt_add_attr_uint32(txn, counted("a"), i, DVTT_RADIX_HEX);
+        dvtt_add_attr_int(txn, counted("b"), static_cast<uint16_t>(i));
+        dvtt_close_transaction(txn, i + 1);
+    }
+    EXPECT_EQ(g_name_evaluations, 0);
+    EXPECT_EQ(trace->impl->sequence->transaction_pool.live(), 0u);
+    
+    dvtt_set_enabled(1);
+    dvtt_transaction_t txn = dvtt_open_transaction(stream, counted("txn"), 100, nullptr, nullptr);
+    ASSERT_NE(txn, nullptr);
+    dvtt_add_attr_int(txn, "b", static_cast<uint16_t>(7));
+    dvtt_close_transaction(txn, 101);
+    EXPECT_EQ(g_name_evaluations, 1);
+    dvtt_close_trace(trace);
+    
+    EXPECT_EQ(count_begins(filename)["stream1"], 1);
+    std::remove(filename);
+}
+
+TEST_F(DVTTBasicTest, RecordTransactionsMatchesSingleCalls) {
+    const char* single = "test_batch_single.perfetto";
+    const char* batched = "test_batch_batched.perfetto";
+    const uint8_t bits[2] = { 0xA5, 0x01 };
+    
+    dvtt_trace_t trace = dvtt_create_trace(single, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    for (int i = 0; i < 100; i++) {
+        dvtt_transaction_t txn = dvtt_open_transaction(stream, "WRITE", i * 10, "axi", nullptr);
+        dvtt_add_attr_uint32(txn, "addr", 0x1000 + i, DVTT_RADIX_HEX);
+        dvtt_add_attr_int16(txn, "delta", -i, DVTT_RADIX_DEC);
+        dvtt_add_attr_double(txn, "load", i * 0.5);
+        dvtt_add_attr_string(txn, "status", "OK");
+        dvtt_add_attr_bits(txn, "strb", bits, 9, DVTT_RADIX_BIN);
+        dvtt_close_transaction(txn, i * 10 + 5);
+    }
+    dvtt_close_trace(trace);
+    
+    trace = dvtt_create_trace(batched, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    std::vector<dvtt_attr_t> attrs(5 * 100);
+    std::vector<dvtt_txn_record_t> records(100);
+    for (int i = 0; i < 100; i++) {
+        dvtt_attr_t* a = &attrs[5 * i];
+        a[0].name = "addr";
+        a[0].radix = DVTT_RADIX_HEX;
+        a[0].value.type = DVTT_ATTR_UINT32;
+        a[0].value.value.u32 = 0x1000 + i;
+        a[1].name = "delta";
+        a[1].radix = DVTT_RADIX_DEC;
+        a[1].value.type = DVTT_ATTR_INT16;
+        a[1].value.value.i16 = static_cast<int16_t>(-i);
+        a[2].name = "load";
+        a[2].value.type = DVTT_ATTR_DOUBLE;
+        a[2].value.value.d = i * 0.5;
+        a[3].name = "status";
+        a[3].value.type = DVTT_ATTR_STRING;
+        a[3].value.value.str = "OK";
+        a[4].name = "strb";
+        a[4].radix = DVTT_RADIX_BIN;
+        a[4].value.type = DVTT_ATTR_BITSTRING;
+        a[4].value.value.bits.data = bits;
+        a[4].value.value.bits.num_bits = 9;
+        records[i] = { "WRITE", "axi", dvtt_time_t(i * 10), dvtt_time_t(i * 10 + 5),
+                       nullptr, -1, a, 5 };
+    }
+    // Split the batch to check state carries across calls
+    EXPECT_EQ(dvtt_record_transactions(stream, records.data(), 40), 40u);
+    EXPECT_EQ(dvtt_record_transactions(stream, records.data() + 40, 60), 60u);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_OK);
+    EXPECT_EQ(trace->impl->sequence->transaction_pool.live(), 0u);
+    dvtt_close_trace(trace);
+    
+    std::string expected = trace_decode::read_file(single);
+    EXPECT_FALSE(expected.empty());
+    EXPECT_EQ(trace_decode::read_file(batched), expected);
+    std::remove(single);
+    std::remove(batched);
+}
+
+TEST_F(DVTTBasicTest, RecordTransactionsNestsAndSkips) {
+    using namespace trace_decode;
+    const char* filename = "test_batch_nested.perfetto";
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    dvtt_transaction_t open_parent = dvtt_open_transaction(stream, "burst", 0, nullptr, nullptr);
+    
+    dvtt_txn_record_t records[] = {
+        { "beat0", nullptr, 0, 10, open_parent, -1, nullptr, 0 },  // under an open transaction
+        { "sub", nullptr, 2, 8, nullptr, 0, nullptr, 0 },           // under record 0
+        { nullptr, nullptr, 10, 20, nullptr, -1, nullptr, 0 },      // no name: skipped
+        { "bad", nullptr, 10, 20, nullptr, 5, nullptr, 0 },         // forward parent: skipped
+        { "root", nullptr, 30, 40, nullptr, -1, nullptr, 0 },
+    };
+    EXPECT_EQ(dvtt_record_transactions(stream, records, 5), 3u);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_INVALID_ARGUMENT);
+    
+    // Sampled-out roots take their batch children with them
+    dvtt_sampling_t sampling = { 2, 0, 0 };
+    dvtt_set_stream_sampling(stream, &sampling);
+    dvtt_txn_record_t sampled[] = {
+        { "kept", nullptr, 100, 110, nullptr, -1, nullptr, 0 },
+        { "kept_child", nullptr, 101, 109, nullptr, 0, nullptr, 0 },
+        { "dropped", nullptr, 120, 130, nullptr, -1, nullptr, 0 },
+        { "dropped_child", nullptr, 121, 129, nullptr, 2, nullptr, 0 },
+    };
+    EXPECT_EQ(dvtt_record_transactions(stream, sampled, 4), 2u);
+    dvtt_close_transaction(open_parent, 50);
+    dvtt_close_trace(trace);
+    
+    std::map<std::string, uint64_t> track_of;
+    std::map<uint64_t, uint64_t> parent_of;
+    for (const auto& pkt : read_packets(filename)) {
+        std::vector<Field> fields = decode(pkt);
+        if (const Field* desc = find(fields, 60)) {
+            std::vector<Field> d = decode(desc->bytes);
+            track_of[find(d, 2)->bytes] = find(d, 1)->value;
+            if (const Field* parent = find(d, 5)) {
+                parent_of[find(d, 1)->value] = parent->value;
+            }
+        }
+    }
+    EXPECT_EQ(parent_of[track_of["beat0"]], track_of["stream1"]);
+    EXPECT_EQ(parent_of[track_of["sub"]], track_of["beat0"]);
+    EXPECT_EQ(parent_of[track_of["kept_child"]], track_of["stream1"]);
+    EXPECT_EQ(track_of.count("dropped_child"), 0u);
+    std::map<std::string, int> begins = count_begins(filename);
+    EXPECT_EQ(begins["stream1"], 3);   // root, kept, burst
+    EXPECT_EQ(begins.count("bad"), 0u);
+    std::remove(filename);
+}
+
+TEST_F(DVTTBasicTest, PackedRecordsMatchTypedRecords) {
+    const char* typed = "test_packed_typed.perfetto";
+    const char* packed = "test_packed_packed.perfetto";
+    const uint32_t wide[4] = { 0x89abcdef, 0x01234567, 0xfedcba98, 0xf };  // 100 bits
+    
+    dvtt_trace_t trace = dvtt_create_trace(typed, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    dvtt_attr_t attrs[5] = {};
+    attrs[0].name = "addr";
+    attrs[0].radix = DVTT_RADIX_HEX;
+    attrs[0].value.type = DVTT_ATTR_UINT64;
+    attrs[0].value.value.u64 = 0xbeef;
+    attrs[1].name = "delta";
+    attrs[1].radix = DVTT_RADIX_DEC;
+    attrs[1].value.type = DVTT_ATTR_INT64;
+    attrs[1].value.value.i64 = -5;
+    attrs[2].name = "data";
+    attrs[2].radix = DVTT_RADIX_HEX;
+    attrs[2].value.type = DVTT_ATTR_BITSTRING;
+    attrs[2].value.value.bits.data = wide;
+    attrs[2].value.value.bits.num_bits = 100;
+    attrs[3].name = "status";
+    attrs[3].radix = DVTT_RADIX_STRING;
+    attrs[3].value.type = DVTT_ATTR_STRING;
+    attrs[3].value.value.str = "OK";
+    attrs[4].name = "load";
+    attrs[4].radix = DVTT_RADIX_REAL;
+    attrs[4].value.type = DVTT_ATTR_DOUBLE;
+    attrs[4].value.value.d = 0.25;
+    dvtt_txn_record_t rec = { "WRITE", "axi", 10, 20, nullptr, -1, attrs, 5 };
+    ASSERT_EQ(dvtt_record_transactions(stream, &rec, 1), 1u);
+    dvtt_close_trace(trace);
+    
+    trace = dvtt_create_trace(packed, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    int write_id = dvtt_register_name(trace, "WRITE");
+    int axi_id = dvtt_register_name(trace, "axi");
+    int addr_id = dvtt_register_name(trace, "addr");
+    EXPECT_NE(write_id, 0);
+    EXPECT_EQ(dvtt_register_name(trace, "WRITE"), write_id);
+    
+    double load = 0.25;
+    uint64_t load_bits;
+    std::memcpy(&load_bits, &load, sizeof(load));
+    std::vector<uint32_t> words = {
+        // Upper bits beyond the declared width are ignored
+        uint32_t(addr_id), DVTT_PACKED_HEADER(DVTT_RADIX_HEX, 16), 0xffffbeef,
+        uint32_t(dvtt_register_name(trace, "delta")), DVTT_PACKED_HEADER(DVTT_RADIX_DEC, 12), 0xffb,
+        uint32_t(dvtt_register_name(trace, "data")), DVTT_PACKED_HEADER(DVTT_RADIX_HEX, 100),
+        wide[0], wide[1], wide[2], wide[3],
+        uint32_t(dvtt_register_name(trace, "status")), DVTT_PACKED_HEADER(DVTT_RADIX_STRING, 32),
+        uint32_t(dvtt_register_name(trace, "OK")),
+        uint32_t(dvtt_register_name(trace, "load")), DVTT_PACKED_HEADER(DVTT_RADIX_REAL, 64),
+        uint32_t(load_bits), uint32_t(load_bits >> 32),
+        0, 0, 0  // terminator and unused space
+    };
+    EXPECT_EQ(dvtt_record_packed(stream, write_id, axi_id, 10, 20, nullptr,
+                                 words.data(), static_cast<int>(words.size())), 1);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_OK);
+    
+    // Unknown ids are rejected rather than recorded under a wrong name
+    EXPECT_EQ(dvtt_record_packed(stream, 999, 0, 30, 40, nullptr, nullptr, 0), 0);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_INVALID_NAME);
+    EXPECT_EQ(dvtt_open_transaction_id(stream, write_id, 30, 999, nullptr), nullptr);
+    dvtt_close_trace(trace);
+    
+    std::string expected = trace_decode::read_file(typed);
+    EXPECT_FALSE(expected.empty());
+    EXPECT_EQ(trace_decode::read_file(packed), expected);
+    std::remove(typed);
+    std::remove(packed);
+}
+
+// Sets bits [offset, offset + num_bits) of a packed value
+static void put_bits(std::vector<uint32_t>& words, size_t offset, const uint32_t* value,
+                     size_t num_bits) {
+    for (size_t i = 0; i < num_bits; i++) {
+        if ((value[i / 32] >> (i % 32)) & 1) {
+            words[(offset + i) / 32] |= uint32_t(1) << ((offset + i) % 32);
+        }
+    }
+}
+
+TEST_F(DVTTBasicTest, SchemaAttrsMatchPackedAttrs) {
+    const char* packed = "test_schema_packed.perfetto";
+    const char* schema_file = "test_schema.perfetto";
+    const uint32_t wide[4] = { 0x89abcdef, 0x01234567, 0xfedcba98, 0xf };  // 100 bits
+    double load = 0.25;
+    uint32_t load_bits[2];
+    std::memcpy(load_bits, &load, sizeof(load));
+    
+    dvtt_trace_t trace = dvtt_create_trace(packed, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    uint32_t ok_id = uint32_t(dvtt_register_name(trace, "OK"));
+    std::vector<uint32_t> words = {
+        uint32_t(dvtt_register_name(trace, "addr")), DVTT_PACKED_HEADER(DVTT_RADIX_HEX, 16), 0xbeef,
+        uint32_t(dvtt_register_name(trace, "delta")), DVTT_PACKED_HEADER(DVTT_RADIX_DEC, 12), 0xffb,
+        uint32_t(dvtt_register_name(trace, "data")), DVTT_PACKED_HEADER(DVTT_RADIX_HEX, 100),
+        wide[0], wide[1], wide[2], wide[3],
+        uint32_t(dvtt_register_name(trace, "status")), DVTT_PACKED_HEADER(DVTT_RADIX_STRING, 32),
+        ok_id,
+        uint32_t(dvtt_register_name(trace, "load")), DVTT_PACKED_HEADER(DVTT_RADIX_REAL, 64),
+        load_bits[0], load_bits[1]
+    };
+    for (int i = 0; i < 3; i++) {
+        dvtt_transaction_t txn = dvtt_open_transaction(stream, "WRITE", i * 10, nullptr, nullptr);
+        dvtt_add_packed_attributes(txn, words.data(), static_cast<int>(words.size()));
+        dvtt_close_transaction(txn, i * 10 + 5);
+    }
+    dvtt_close_trace(trace);
+    
+    // The same fields as a 224-bit packed struct, addr in the top 16 bits
+    trace = dvtt_create_trace(schema_file, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    ok_id = uint32_t(dvtt_register_name(trace, "OK"));
+    dvtt_schema_field_t fields[5] = {
+        { "addr", DVTT_RADIX_HEX, 16 },
+        { "delta", DVTT_RADIX_DEC, 12 },
+        { "data", DVTT_RADIX_HEX, 100 },
+        { "status", DVTT_RADIX_STRING, 32 },
+        { "load", DVTT_RADIX_REAL, 64 }
+    };
+    dvtt_schema_t schema = dvtt_register_schema(stream, fields, 5);
+    ASSERT_NE(schema, nullptr);
+    std::vector<uint32_t> ids = {
+        uint32_t(dvtt_register_name(trace, "addr")), DVTT_PACKED_HEADER(DVTT_RADIX_HEX, 16),
+        uint32_t(dvtt_register_name(trace, "delta")), DVTT_PACKED_HEADER(DVTT_RADIX_DEC, 12),
+        uint32_t(dvtt_register_name(trace, "data")), DVTT_PACKED_HEADER(DVTT_RADIX_HEX, 100),
+        uint32_t(dvtt_register_name(trace, "status")), DVTT_PACKED_HEADER(DVTT_RADIX_STRING, 32),
+        uint32_t(dvtt_register_name(trace, "load")), DVTT_PACKED_HEADER(DVTT_RADIX_REAL, 64)
+    };
+    dvtt_schema_t schema_id = dvtt_register_schema_id(stream, ids.data(), 5);
+    ASSERT_NE(schema_id, nullptr);
+    
+    std::vector<uint32_t> values(7, 0);
+    const uint32_t addr = 0xbeef, delta = 0xffb;
+    put_bits(values, 208, &addr, 16);
+    put_bits(values, 196, &delta, 12);
+    put_bits(values, 96, wide, 100);
+    put_bits(values, 64, &ok_id, 32);
+    put_bits(values, 0, load_bits, 64);
+    for (int i = 0; i < 3; i++) {
+        dvtt_transaction_t txn = dvtt_open_transaction(stream, "WRITE", i * 10, nullptr, nullptr);
+        dvtt_set_attrs(txn, i == 1 ? schema_id : schema, values.data());
+        EXPECT_EQ(dvtt_get_last_error(), DVTT_OK);
+        dvtt_close_transaction(txn, i * 10 + 5);
+    }
+    
+    dvtt_schema_field_t bad[1] = { { "status", DVTT_RADIX_STRING, 8 } };
+    EXPECT_EQ(dvtt_register_schema(stream, bad, 1), nullptr);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_INVALID_ARGUMENT);
+    EXPECT_EQ(dvtt_register_schema(stream, fields, 0), nullptr);
+    uint32_t unknown[2] = { 999, DVTT_PACKED_HEADER(DVTT_RADIX_HEX, 8) };
+    EXPECT_EQ(dvtt_register_schema_id(stream, unknown, 1), nullptr);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_INVALID_NAME);
+    dvtt_close_trace(trace);
+    
+    std::string expected = trace_decode::read_file(packed);
+    EXPECT_FALSE(expected.empty());
+    EXPECT_EQ(trace_decode::read_file(schema_file), expected);
+    std::remove(packed);
+    std::remove(schema_file);
+}
+
+TEST_F(DVTTBasicTest, LinksBecomeFlows) {
+    using namespace trace_decode;
+    const char* filename = "test_links.perfetto";
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    dvtt_stream_t req_stream = dvtt_open_stream(trace, "req", "top.env", nullptr);
+    dvtt_stream_t rsp_stream = dvtt_open_stream(trace, "rsp", nullptr, nullptr);
+    
+    // Both open: a shared flow id
+    dvtt_transaction_t a = dvtt_open_transaction(req_stream, "a", 0, nullptr, nullptr);
+    dvtt_transaction_t b = dvtt_open_transaction(rsp_stream, "b", 5, nullptr, nullptr);
+    dvtt_add_link(a, b, DVTT_LINK_RELATED, nullptr);
+    dvtt_close_transaction(a, 10);
+    dvtt_close_transaction(b, 15);
+    
+    // The request is closed and released before the response links to it
+    dvtt_transaction_t req = dvtt_open_transaction(req_stream, "req", 20, nullptr, nullptr);
+    uint64_t req_id = dvtt_get_transaction_id(req);
+    EXPECT_NE(req_id, 0u);
+    dvtt_free_transaction(req, 30);
+    dvtt_transaction_t rsp = dvtt_open_transaction(rsp_stream, "rsp", 40, nullptr, nullptr);
+    dvtt_add_link_id(rsp, req_id, DVTT_LINK_CAUSE_EFFECT, nullptr);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_OK);
+    dvtt_add_stream_link(req_stream, rsp, DVTT_LINK_RELATED, "origin");
+    dvtt_close_transaction(rsp, 50);
+    
+    // A closed transaction that was never given out by id cannot be linked
+    dvtt_transaction_t c = dvtt_open_transaction(req_stream, "c", 60, nullptr, nullptr);
+    dvtt_transaction_t d = dvtt_open_transaction(rsp_stream, "d", 60, nullptr, nullptr);
+    dvtt_close_transaction(c, 70);
+    dvtt_add_link(c, d, DVTT_LINK_RELATED, nullptr);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_ALREADY_ENDED);
+    dvtt_close_transaction(d, 70);
+    dvtt_close_trace(trace);
+    
+    bool ok = false;
+    std::vector<std::vector<Field>> begins;
+    for (const auto& pkt : read_packets(filename, &ok)) {
+        std::vector<Field> packet = decode(pkt);
+        if (const Field* ev = find(packet, 11)) {
+            std::vector<Field> fields = decode(ev->bytes);
+            if (find(fields, 9)->value == 1) {
+                begins.push_back(fields);
+            }
+        }
+    }
+    ASSERT_TRUE(ok);
+    ASSERT_EQ(begins.size(), 6u);
+    
+    ASSERT_EQ(count(begins[0], 47), 1u);
+    ASSERT_EQ(count(begins[1], 47), 1u);
+    EXPECT_EQ(find(begins[0], 47)->value, find(begins[1], 47)->value);
+    
+    ASSERT_EQ(count(begins[2], 47), 1u);
+    ASSERT_EQ(count(begins[3], 48), 1u);
+    EXPECT_EQ(count(begins[3], 47), 0u);
+    EXPECT_EQ(find(begins[3], 48)->value, find(begins[2], 47)->value);
+    EXPECT_NE(find(begins[2], 47)->value, find(begins[0], 47)->value);
+    
+    // Each link is an attribute of its source holding the target's id
+    ASSERT_EQ(count(begins[0], 4), 1u);
+    EXPECT_NE(find(decode(find(begins[0], 4)->bytes), 3), nullptr);
+    EXPECT_EQ(count(begins[1], 4), 0u);
+    std::vector<std::vector<Field>> anns;
+    for (const Field& f : begins[3]) {
+        if (f.number == 4) anns.push_back(decode(f.bytes));
+    }
+    ASSERT_EQ(anns.size(), 2u);
+    ASSERT_NE(find(anns[0], 3), nullptr);
+    EXPECT_EQ(find(anns[0], 3)->value, req_id);
+    
+    // The stream link became an attribute naming the stream
+    ASSERT_NE(find(anns[1], 6), nullptr);
+    EXPECT_EQ(find(anns[1], 6)->bytes, "top.env.req");
+    
+    EXPECT_EQ(count(begins[4], 47) + count(begins[4], 48), 0u);
+    EXPECT_EQ(count(begins[5], 47) + count(begins[5], 48), 0u);
+    std::remove(filename);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+// Aborts with the trace mutex held, as a crash inside dvtt_open_stream()
+// would. The alarm turns a deadlocked handler into a failure
+static void abort_holding_trace_mutex(const char* filename, bool hold_mutex) {
+    dvtt_init();
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.flight_recorder_bytes = 64 * 1024;
+    dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    for (int i = 0; i < 10; i++) {
+        dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn", i * 10, nullptr, nullptr);
+        dvtt_close_transaction(txn, i * 10 + 5);
+    }
+    dvtt_dump_on_abort(trace, nullptr);
+    alarm(10);
+    if (hold_mutex) {
+        trace->impl->mutex.lock();
+    }
+    std::abort();
+}
+
+TEST_F(DVTTBasicTest, AbortDumpSkipsHeldTraceMutex) {
+    using namespace trace_decode;
+    const char* filename = "test_abort_locked.perfetto";
+    for (int locked = 0; locked < 2; locked++) {
+        std::remove(filename);
+        EXPECT_EXIT(abort_holding_trace_mutex(filename, locked),
+                    ::testing::KilledBySignal(SIGABRT), "");
+        
+        // Every retained slice is dumped; the header only re-describes the
+        // stream if the mutex was free
+        bool ok = false;
+        size_t begins = 0;
+        size_t descriptors = 0;
+        for (const auto& pkt : read_packets(filename, &ok)) {
+            std::vector<Field> packet = decode(pkt);
+            descriptors += count(packet, 60);
+            if (const Field* ev = find(packet, 11)) {
+                begins += find(decode(ev->bytes), 9)->value == 1;
+            }
+        }
+        EXPECT_TRUE(ok);
+        EXPECT_EQ(begins, 10u);
+        EXPECT_EQ(descriptors, locked ? 1u : 2u);
+    }
+    std::remove(filename);
+}
+#endif
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
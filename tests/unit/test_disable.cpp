@@ -0,0 +1,44 @@
+// Built with DVTT_DISABLE and without linking the library: every call
+// below must compile away, arguments included
+#define DVTT_DISABLE
+#include <gtest/gtest.h>
+#include "include/dvtt.h"
+
+static int g_evaluated = 0;
+
+static const char* side_effect(const char* s) {
+    g_evaluated++;
+    return s;
+}
+
+TEST(DVTTDisableTest, CallsCompileAway) {
+    EXPECT_EQ(dvtt_init(), DVTT_OK);
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    dvtt_trace_t trace = dvtt_create_trace_ex("unused.perfetto", "test", "1ns", &opts);
+    EXPECT_EQ(trace, nullptr);
+    dvtt_stream_t stream = dvtt_open_stream(trace, side_effect("stream"), nullptr, nullptr);
+    EXPECT_EQ(stream, nullptr);
+    EXPECT_EQ(dvtt_find_or_open_stream(trace, side_effect("top"), side_effect("stream")),
+              nullptr);
+    
+    dvtt_transaction_t txn = dvtt_open_transaction(stream, side_effect("txn"), 0, nullptr, nullptr);
+    EXPECT_EQ(txn, nullptr);
+    uint8_t bits[2] = { 0x12, 0x34 };
+    dvtt_add_attr_uint32(txn, side_effect("a"), 1, DVTT_RADIX_HEX);
+    dvtt_add_attr_string(txn, "b", side_effect("value"));
+    dvtt_add_attr_bits(txn, "c", bits, 16, DVTT_RADIX_BIN);
+    dvtt_add_attr_int(txn, "d", static_cast<int16_t>(-1));
+    dvtt_begin_attributes(txn);
+    dvtt_end_attributes(txn);
+    dvtt_add_link(txn, txn, DVTT_LINK_RELATED, nullptr);
+    dvtt_add_link_id(txn, dvtt_get_transaction_id(txn), DVTT_LINK_RELATED, nullptr);
+    dvtt_end_transaction(txn, 10);
+    EXPECT_EQ(dvtt_get_transaction_name(txn), nullptr);
+    EXPECT_EQ(dvtt_is_enabled(), 0);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_OK);
+    
+    dvtt_close_trace(trace);
+    dvtt_shutdown();
+    EXPECT_EQ(g_evaluated, 0);
+}
@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+#include "include/dvtt.h"
+#include "dvtt_format.h"
+#include "trace_decode.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using dvtt::bits_to_string;
+
+TEST(DVTTFormatTest, Hex) {
+    const uint8_t bits[] = {0xAB, 0xCD, 0xEF};
+    EXPECT_EQ(bits_to_string(bits, 24, DVTT_RADIX_HEX), "0xefcdab");
+    // Bits above num_bits are ignored
+    EXPECT_EQ(bits_to_string(bits, 20, DVTT_RADIX_HEX), "0x0fcdab");
+    // Radixes without a bit-vector form fall back to hex
+    EXPECT_EQ(bits_to_string(bits, 24, DVTT_RADIX_STRING), "0xefcdab");
+}
+
+TEST(DVTTFormatTest, WideHexMatchesScalar) {
+    // 1024-bit cache line exercises the vectorized path where enabled
+    std::vector<uint8_t> line(128);
+    std::string expected = "0x";
+    for (size_t i = 0; i < line.size(); i++) {
+        line[i] = static_cast<uint8_t>(i * 37 + 11);
+    }
+    for (size_t i = line.size(); i > 0; i--) {
+        char pair[3];
+        snprintf(pair, sizeof(pair), "%02x", line[i - 1]);
+        expected += pair;
+    }
+    EXPECT_EQ(bits_to_string(line.data(), 1024, DVTT_RADIX_HEX), expected);
+    EXPECT_EQ(bits_to_string(line.data() + 1, 1016, DVTT_RADIX_HEX),
+              "0x" + expected.substr(2, 254));
+}
+
+TEST(DVTTFormatTest, Binary) {
+    const uint8_t bits[] = {0x05, 0x81};
+    EXPECT_EQ(bits_to_string(bits, 16, DVTT_RADIX_BIN), "0b1000000100000101");
+    EXPECT_EQ(bits_to_string(bits, 10, DVTT_RADIX_BIN), "0b0100000101");
+    EXPECT_EQ(bits_to_string(bits, 3, DVTT_RADIX_BIN), "0b101");
+}
+
+TEST(DVTTFormatTest, Octal) {
+    const uint8_t bits[] = {0xFF, 0x01};
+    EXPECT_EQ(bits_to_string(bits, 9, DVTT_RADIX_OCT), "0o777");
+    EXPECT_EQ(bits_to_string(bits, 16, DVTT_RADIX_OCT), "0o777");
+    const uint8_t eight[] = {0x08};
+    EXPECT_EQ(bits_to_string(eight, 8, DVTT_RADIX_OCT), "0o10");
+    const uint8_t zero[] = {0x00, 0x00};
+    EXPECT_EQ(bits_to_string(zero, 16, DVTT_RADIX_OCT), "0o0");
+}
+
+TEST(DVTTFormatTest, Decimal) {
+    const uint8_t bits[] = {0xFF, 0xFF};
+    EXPECT_EQ(bits_to_string(bits, 16, DVTT_RADIX_UNSIGNED), "65535");
+    EXPECT_EQ(bits_to_string(bits, 16, DVTT_RADIX_DEC), "-1");
+    EXPECT_EQ(bits_to_string(bits, 12, DVTT_RADIX_DEC), "-1");
+    EXPECT_EQ(bits_to_string(bits, 12, DVTT_RADIX_UNSIGNED), "4095");
+    const uint8_t min8[] = {0x80};
+    EXPECT_EQ(bits_to_string(min8, 8, DVTT_RADIX_DEC), "-128");
+    const uint8_t zero[] = {0x00};
+    EXPECT_EQ(bits_to_string(zero, 8, DVTT_RADIX_DEC), "0");
+    
+    // Values spanning several base-1e9 groups keep inner zeros
+    uint64_t value = 1000000000000000001ull;
+    EXPECT_EQ(bits_to_string(&value, 64, DVTT_RADIX_UNSIGNED), "1000000000000000001");
+    
+    // 2^128 - 1
+    std::vector<uint8_t> ones(16, 0xFF);
+    EXPECT_EQ(bits_to_string(ones.data(), 128, DVTT_RADIX_UNSIGNED),
+              "340282366920938463463374607431768211455");
+    std::vector<uint8_t> line(128, 0xFF);
+    EXPECT_EQ(bits_to_string(line.data(), 1024, DVTT_RADIX_DEC), "-1");
+}
+
+TEST(DVTTFormatTest, RawBitsOption) {
+    using namespace trace_decode;
+    const char* filename = "test_raw_bits.perfetto";
+    dvtt_init();
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    EXPECT_EQ(opts.raw_bits, 0);
+    opts.raw_bits = 1;
+    dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    ASSERT_NE(trace, nullptr);
+    
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    dvtt_transaction_t txn = dvtt_open_transaction(stream, "beat", 0, nullptr, nullptr);
+    const uint8_t narrow[] = {0xFE, 0x1F};
+    dvtt_add_attr_bits(txn, "signed", narrow, 13, DVTT_RADIX_DEC);
+    std::vector<uint8_t> wide(16, 0);
+    wide[0] = 0x01;
+    wide[8] = 0x02;
+    dvtt_add_attr_bits(txn, "wide", wide.data(), 128, DVTT_RADIX_HEX);
+    dvtt_close_transaction(txn, 10);
+    dvtt_close_trace(trace);
+    dvtt_shutdown();
+    
+    bool ok = false;
+    std::vector<std::string> packets = read_packets(filename, &ok);
+    ASSERT_TRUE(ok);
+    ASSERT_EQ(packets.size(), 4u);
+    std::vector<Field> ev = decode(find(decode(packets[2]), 11)->bytes);
+    std::vector<Field> anns;
+    for (const auto& f : ev) {
+        if (f.number == 4) anns.push_back(f);
+    }
+    ASSERT_EQ(anns.size(), 2u);
+    
+    // 13-bit 0x1FFE sign-extends to -2
+    std::vector<Field> ann = decode(anns[0].bytes);
+    EXPECT_EQ(static_cast<int64_t>(find(ann, 4)->value), -2);
+    
+    ann = decode(anns[1].bytes);
+    ASSERT_EQ(count(ann, 12), 2u);
+    std::vector<Field> words;
+    for (const auto& f : ann) {
+        if (f.number == 12) words.push_back(f);
+    }
+    EXPECT_EQ(find(decode(words[0].bytes), 3)->value, 1u);
+    EXPECT_EQ(find(decode(words[1].bytes), 3)->value, 2u);
+    
+    std::remove(filename);
+}
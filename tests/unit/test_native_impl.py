@@ -0,0 +1,180 @@
+"""Test the libdvtt-backed native Python backend
+
+The native backend is exercised only when libdvtt can be loaded; point
+DVTT_LIBRARY at the built library (e.g. build/lib/libdvtt.so) to run these.
+Traces are decoded with a minimal wire-format reader, since the library
+interns names and the generated protobuf modules are not required here.
+"""
+
+import pytest
+import sys
+import struct
+from pathlib import Path
+
+# Add parent directory to path
+sys.path.insert(0, str(Path(__file__).parent.parent.parent / "python"))
+
+from dv_transaction_trace import create_trace, Radix
+from dv_transaction_trace.impl import native_impl
+
+pytestmark = pytest.mark.skipif(not native_impl.is_available(),
+                                reason="libdvtt not found (set DVTT_LIBRARY)")
+
+
+def _varint(data, pos):
+    value = shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        shift += 7
+        if b < 0x80:
+            return value, pos
+
+
+def decode(data):
+    """Return the (field, value) pairs of a message; bytes for length-delimited"""
+    fields = []
+    pos = 0
+    while pos < len(data):
+        key, pos = _varint(data, pos)
+        wire = key & 7
+        if wire == 0:
+            value, pos = _varint(data, pos)
+        elif wire == 1:
+            value = data[pos:pos + 8]
+            pos += 8
+        elif wire == 2:
+            size, pos = _varint(data, pos)
+            value = data[pos:pos + size]
+            pos += size
+        elif wire == 5:
+            value = data[pos:pos + 4]
+            pos += 4
+        else:
+            raise ValueError(f"unsupported wire type {wire}")
+        fields.append((key >> 3, value))
+    return fields
+
+
+def first(fields, number):
+    return next((v for n, v in fields if n == number), None)
+
+
+class TraceReader:
+    """Resolves interned names and collects slices and track parents"""
+
+    def __init__(self, filename):
+        self.event_names = {}
+        self.annotation_names = {}
+        self.track_names = {}
+        self.track_parents = {}
+        self.slices = []  # (name, track_uuid, {annotation name: value field})
+        for number, packet in decode(Path(filename).read_bytes()):
+            assert number == 1
+            self._packet(decode(packet))
+
+    def _packet(self, packet):
+        interned = first(packet, 12)
+        if interned is not None:
+            for number, entry in decode(interned):
+                table = {2: self.event_names, 3: self.annotation_names}.get(number)
+                if table is not None:
+                    entry = decode(entry)
+                    table[first(entry, 1)] = first(entry, 2).decode()
+        descriptor = first(packet, 60)
+        if descriptor is not None:
+            descriptor = decode(descriptor)
+            uuid = first(descriptor, 1)
+            self.track_names[uuid] = first(descriptor, 2).decode()
+            self.track_parents[uuid] = first(descriptor, 5)
+        event = first(packet, 11)
+        if event is not None:
+            event = decode(event)
+            if first(event, 9) == 1:  # TYPE_SLICE_BEGIN
+                attrs = {}
+                for number, annotation in event:
+                    if number == 4:
+                        annotation = decode(annotation)
+                        name = self.annotation_names[first(annotation, 1)]
+                        attrs[name] = [(n, v) for n, v in annotation if n != 1][0]
+                self.slices.append((self.event_names[first(event, 10)],
+                                    first(event, 11), attrs))
+
+    def slice(self, name):
+        return next(s for s in self.slices if s[0] == name)
+
+
+def test_backend_selection(tmp_path, monkeypatch):
+    """Test that the backend is chosen by argument or environment"""
+    from dv_transaction_trace.impl.native_impl import NativeTrace
+
+    with create_trace(str(tmp_path / "a.perfetto"), "T", "1ns", backend="native") as trace:
+        assert isinstance(trace, NativeTrace)
+    monkeypatch.setenv("DVTT_BACKEND", "native")
+    with create_trace(str(tmp_path / "b.perfetto"), "T", "1ns") as trace:
+        assert isinstance(trace, NativeTrace)
+    with pytest.raises(ValueError):
+        create_trace(str(tmp_path / "c.perfetto"), "T", "1ns", backend="vcd")
+
+
+def test_attributes_and_nesting(tmp_path):
+    """Test attribute values and child tracks written through libdvtt"""
+    filename = str(tmp_path / "native.perfetto")
+
+    with create_trace(filename, "Native", "1ns", backend="native") as trace:
+        stream = trace.create_stream("axi", "top.axi", "AXI4")
+        burst = stream.begin_transaction("burst", 0, "AXI4")
+        burst.add_uint("len", 4, Radix.DEC)
+        beat = stream.begin_transaction("beat", 1, parent=burst)
+        beat.add_int("delta", -3, Radix.DEC)
+        beat.add_uint("big", 1 << 63, Radix.DEC)
+        beat.add_uint("addr", 0x1000, Radix.HEX)
+        beat.add_bits("data", bytes(range(1, 10)), 72, Radix.HEX)
+        beat.add_string("status", "OK")
+        beat.add_float("load", 0.5)
+        beat.close(2)
+        assert beat.is_closed()
+        burst.add_blob("raw", b"\xde\xad")
+        burst.close(10)
+
+        # Left open: closed with the stream at its start time
+        stream.begin_transaction("dangling", 20)
+
+    reader = TraceReader(filename)
+    assert [s[0] for s in reader.slices] == ["beat", "burst", "dangling"]
+
+    _, beat_track, attrs = reader.slice("beat")
+    assert reader.track_names[beat_track] == "beat"
+    _, burst_track, burst_attrs = reader.slice("burst")
+    assert reader.track_parents[beat_track] == burst_track
+
+    assert attrs["delta[dec]"] == (4, (1 << 64) - 3)
+    assert attrs["big[dec]"] == (6, b"9223372036854775808")
+    assert attrs["addr[hex]"] == (3, 0x1000)
+    assert attrs["data[hex]"] == (6, b"0x090807060504030201")
+    assert attrs["status"] == (6, b"OK")
+    assert attrs["load"] == (5, struct.pack("<d", 0.5))
+    assert burst_attrs["len[dec]"] == (4, 4)
+    assert burst_attrs["raw"] == (6, b"dead")
+
+
+def test_many_transactions(tmp_path):
+    """Test that flat transactions stream out without native objects"""
+    filename = str(tmp_path / "many.perfetto")
+
+    with create_trace(filename, "Many", "1ns", backend="native") as trace:
+        stream = trace.create_stream("stream")
+        for i in range(2000):
+            txn = stream.begin_transaction("txn", i * 10)
+            txn.add_uint("id", i, Radix.DEC)
+            txn.close(i * 10 + 5)
+            assert txn._handle is None
+
+    reader = TraceReader(filename)
+    assert len(reader.slices) == 2000
+    assert reader.slices[-1][2]["id[dec]"] == (4, 1999)
+
+
+if __name__ == "__main__":
+    pytest.main([__file__, "-v"])
@@ -235,5 +235,35 @@ def test_large_trace(tmp_path):
     assert os.path.getsize(filename) > 1000
 
 
+def test_compressed_trace(tmp_path):
+    """Test that compress=True writes smaller compressed_packets chunks"""
+    from perfetto.protos.perfetto.trace import perfetto_trace_pb2 as pb
+    import zlib
+    
+    sizes = {}
+    for compress in (False, True):
+        filename = str(tmp_path / f"compress_{compress}.perfetto")
+        with create_trace(filename, "Compressed", "1ns", compress=compress) as trace:
+            stream = trace.create_stream("stream")
+            for txn_idx in range(500):
+                txn = stream.begin_transaction("txn", txn_idx * 100)
+                txn.add_uint("id", txn_idx, Radix.DEC)
+                txn.close(txn_idx * 100 + 50)
+        sizes[compress] = os.path.getsize(filename)
+        
+        with open(filename, 'rb') as f:
+            outer = pb.Trace.FromString(f.read())
+        if compress:
+            assert all(p.HasField("compressed_packets") for p in outer.packet)
+            packets = []
+            for p in outer.packet:
+                packets.extend(pb.Trace.FromString(zlib.decompress(p.compressed_packets)).packet)
+        else:
+            packets = list(outer.packet)
+        assert sum(p.HasField("track_event") for p in packets) == 1000
+    
+    assert sizes[True] < sizes[False]
+
+
 if __name__ == "__main__":
     pytest.main([__file__, "-v"])
@@ -0,0 +1,486 @@
+#include <gtest/gtest.h>
+#include "include/dvtt.h"
+#include "include/dvtt_reader.h"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+class DVTTReaderTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        dvtt_init();
+    }
+
+    void TearDown() override {
+        dvtt_shutdown();
+    }
+
+    static void remove_trace(const char* filename) {
+        std::remove(filename);
+        std::remove(dvtt::trace_index_filename(filename).c_str());
+    }
+
+    // Two streams of COUNT transactions, 10 time units apart. Every other
+    // transaction on "axi" has an "addr" attribute and every tenth a child
+    // beat; "apb" carries a counter sampled at each transaction.
+    static constexpr int COUNT = 20000;
+
+    static void record(const char* filename, const dvtt_trace_options_t& opts) {
+        remove_trace(filename);
+        dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+        ASSERT_NE(trace, nullptr);
+        dvtt_stream_t axi = dvtt_open_stream(trace, "axi", "top.axi", "AXI4");
+        dvtt_stream_t apb = dvtt_open_stream(trace, "apb", "top.apb", "APB");
+        dvtt_counter_t level = dvtt_open_counter(apb, "level", "entries");
+        for (int i = 0; i < COUNT; i++) {
+            dvtt_time_t t = static_cast<dvtt_time_t>(i) * 10;
+            dvtt_transaction_t txn = dvtt_open_transaction(axi, "read", t, "AXI_READ", nullptr);
+            dvtt_add_attr_uint32(txn, "index", i, DVTT_RADIX_DEC);
+            if (i % 2 == 0) {
+                dvtt_add_attr_uint64(txn, "addr", 0x1000 + i, DVTT_RADIX_HEX);
+            }
+            if (i % 10 == 0) {
+                dvtt_transaction_t beat = dvtt_open_transaction(axi, "beat", t + 1, nullptr, txn);
+                dvtt_add_attr_string(beat, "resp", "OKAY");
+                dvtt_close_transaction(beat, t + 2);
+            }
+            dvtt_close_transaction(txn, t + 5);
+            dvtt_transaction_t other = dvtt_open_transaction(apb, "write", t + 3, nullptr, nullptr);
+            dvtt_add_attr_double(other, "latency", i * 0.5);
+            dvtt_close_transaction(other, t + 8);
+            dvtt_counter_set(level, t, i % 16);
+        }
+        dvtt_close_trace(trace);
+    }
+
+    static dvtt_trace_options_t default_options() {
+        dvtt_trace_options_t opts;
+        dvtt_trace_options_init(&opts);
+        opts.free_on_close = 1;
+        return opts;
+    }
+
+    // Checks a window query on "axi" against what record() wrote
+    static void check_window(const dvtt::TraceReader& reader) {
+        const dvtt::TraceTrack* axi = reader.find_stream("axi");
+        ASSERT_NE(axi, nullptr);
+        dvtt::TraceQuery query;
+        query.track_uuid = axi->uuid;
+        query.include_children = false;
+        query.start_time = 100000;
+        query.end_time = 100999;
+        query.attribute = "addr";
+        std::vector<dvtt::TraceTransaction> txns = reader.transactions(query);
+
+        // i = 10000..10099, even only
+        ASSERT_EQ(txns.size(), 50u);
+        for (size_t k = 0; k < txns.size(); k++) {
+            const dvtt::TraceTransaction& txn = txns[k];
+            uint64_t i = 10000 + 2 * k;
+            EXPECT_EQ(txn.track_uuid, axi->uuid);
+            EXPECT_EQ(txn.name, "read");
+            EXPECT_EQ(txn.type_name, "AXI_READ");
+            EXPECT_EQ(txn.start_time, i * 10);
+            EXPECT_EQ(txn.end_time, i * 10 + 5);
+            EXPECT_TRUE(txn.finished);
+            const dvtt::TraceAttribute* addr = txn.find_attribute("addr");
+            ASSERT_NE(addr, nullptr);
+            EXPECT_EQ(addr->name, "addr[hex]");
+            EXPECT_EQ(addr->type, dvtt::TraceAttribute::UINT);
+            EXPECT_EQ(addr->uint_value, 0x1000 + i);
+            const dvtt::TraceAttribute* index = txn.find_attribute("index");
+            ASSERT_NE(index, nullptr);
+            EXPECT_EQ(index->uint_value, i);
+        }
+    }
+};
+
+TEST_F(DVTTReaderTest, QueryDecodesOnlyMatchingBlocks) {
+    const char* filename = "test_reader.perfetto";
+    record(filename, default_options());
+
+    std::unique_ptr<dvtt::TraceReader> reader = dvtt::TraceReader::open(filename);
+    ASSERT_NE(reader, nullptr);
+    EXPECT_FALSE(reader->index_loaded());
+    ASSERT_GT(reader->num_blocks(), 10u);
+    check_window(*reader);
+    EXPECT_LE(reader->blocks_decoded(), 3u);
+
+    // Children are nested under their stream
+    const dvtt::TraceTrack* axi = reader->find_stream("axi");
+    dvtt::TraceQuery query;
+    query.track_uuid = axi->uuid;
+    query.start_time = 100000;
+    query.end_time = 100999;
+    std::vector<dvtt::TraceTransaction> txns = reader->transactions(query);
+    ASSERT_EQ(txns.size(), 110u);
+    size_t beats = 0;
+    for (const auto& txn : txns) {
+        if (txn.name == "beat") {
+            beats++;
+            const dvtt::TraceTrack* track = reader->find_track(txn.track_uuid);
+            ASSERT_NE(track, nullptr);
+            EXPECT_NE(track->parent_uuid, 0u);
+            EXPECT_EQ(txn.find_attribute("resp")->string_value, "OKAY");
+        }
+    }
+    EXPECT_EQ(beats, 10u);
+
+    // Every transaction of both streams
+    size_t all = reader->for_each_transaction(dvtt::TraceQuery(), [](const dvtt::TraceTransaction&) { });
+    EXPECT_EQ(all, COUNT * 2u + COUNT / 10u);
+    reader.reset();
+
+    // The second open uses the sidecar index
+    reader = dvtt::TraceReader::open(filename);
+    ASSERT_NE(reader, nullptr);
+    EXPECT_TRUE(reader->index_loaded());
+    check_window(*reader);
+    EXPECT_LE(reader->blocks_decoded(), 3u);
+
+    remove_trace(filename);
+}
+
+TEST_F(DVTTReaderTest, CounterSamples) {
+    const char* filename = "test_reader_counter.perfetto";
+    record(filename, default_options());
+
+    std::unique_ptr<dvtt::TraceReader> reader = dvtt::TraceReader::open(filename, false);
+    ASSERT_NE(reader, nullptr);
+    const dvtt::TraceTrack* apb = reader->find_stream("apb");
+    ASSERT_NE(apb, nullptr);
+    dvtt::TraceQuery query;
+    query.track_uuid = apb->uuid;
+    query.start_time = 50000;
+    query.end_time = 50099;
+    std::vector<dvtt::TraceCounterSample> samples;
+    reader->for_each_counter_sample(query, [&](const dvtt::TraceCounterSample& sample) {
+        samples.push_back(sample);
+    });
+    ASSERT_EQ(samples.size(), 10u);
+    for (size_t k = 0; k < samples.size(); k++) {
+        EXPECT_EQ(samples[k].time, 50000 + k * 10);
+        EXPECT_EQ(samples[k].int_value, static_cast<int64_t>((5000 + k) % 16));
+        EXPECT_FALSE(samples[k].is_double);
+    }
+    const dvtt::TraceTrack* level = reader->find_track(samples[0].track_uuid);
+    ASSERT_NE(level, nullptr);
+    EXPECT_TRUE(level->is_counter);
+    EXPECT_EQ(level->parent_uuid, apb->uuid);
+    EXPECT_EQ(level->unit, "entries");
+
+    // Not asked to, so no index was written
+    EXPECT_EQ(std::fopen(dvtt::trace_index_filename(filename).c_str(), "rb"), nullptr);
+    remove_trace(filename);
+}
+
+TEST_F(DVTTReaderTest, StaleIndexIsRebuilt) {
+    const char* filename = "test_reader_stale.perfetto";
+    record(filename, default_options());
+    ASSERT_NE(dvtt::TraceReader::open(filename), nullptr);
+
+    // Rewritten trace, same name: the old index no longer matches
+    dvtt_trace_options_t opts = default_options();
+    dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    dvtt_stream_t stream = dvtt_open_stream(trace, "only", nullptr, nullptr);
+    dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn", 5, nullptr, nullptr);
+    dvtt_close_transaction(txn, 6);
+    dvtt_close_trace(trace);
+
+    std::unique_ptr<dvtt::TraceReader> reader = dvtt::TraceReader::open(filename);
+    ASSERT_NE(reader, nullptr);
+    EXPECT_FALSE(reader->index_loaded());
+    EXPECT_EQ(reader->find_stream("axi"), nullptr);
+    std::vector<dvtt::TraceTransaction> txns = reader->transactions(dvtt::TraceQuery());
+    ASSERT_EQ(txns.size(), 1u);
+    EXPECT_EQ(txns[0].start_time, 5u);
+    remove_trace(filename);
+}
+
+TEST_F(DVTTReaderTest, RejectsOtherFiles) {
+    EXPECT_EQ(dvtt::TraceReader::open("test_reader_missing.perfetto"), nullptr);
+
+    const char* filename = "test_reader_garbage.perfetto";
+    FILE* fp = std::fopen(filename, "wb");
+    ASSERT_NE(fp, nullptr);
+    std::fputs("not a trace\xff\xff\xff", fp);
+    std::fclose(fp);
+    EXPECT_EQ(dvtt::TraceReader::open(filename, false), nullptr);
+    std::remove(filename);
+}
+
+#if defined(DVTT_HAVE_ZLIB)
+TEST_F(DVTTReaderTest, CompressedTrace) {
+    const char* filename = "test_reader_compressed.perfetto";
+    dvtt_trace_options_t opts = default_options();
+    opts.compression = DVTT_COMPRESSION_DEFLATE;
+    record(filename, opts);
+
+    std::unique_ptr<dvtt::TraceReader> reader = dvtt::TraceReader::open(filename);
+    ASSERT_NE(reader, nullptr);
+    ASSERT_GT(reader->num_blocks(), 3u);
+    check_window(*reader);
+    EXPECT_LT(reader->blocks_decoded(), reader->num_blocks());
+    remove_trace(filename);
+}
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+static void record_and_exit(const char* filename, bool by_signal) {
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream", nullptr, nullptr);
+    dvtt_transaction_t done = dvtt_open_transaction(stream, "done", 10, nullptr, nullptr);
+    dvtt_close_transaction(done, 15);
+    dvtt_transaction_t open = dvtt_open_transaction(stream, "open", 20, nullptr, nullptr);
+    dvtt_add_attr_uint32(open, "index", 1, DVTT_RADIX_DEC);
+    dvtt_flush_on_exit(trace);
+    if (by_signal) {
+        std::raise(SIGTERM);
+    }
+    std::exit(3);
+}
+
+TEST_F(DVTTReaderTest, UnfinishedTransactions) {
+    const char* filename = "test_reader_exit.perfetto";
+    for (int by_signal = 0; by_signal < 2; by_signal++) {
+        // The signal handler writes the open begin with inline strings
+        remove_trace(filename);
+        if (by_signal) {
+            EXPECT_EXIT(record_and_exit(filename, true), ::testing::KilledBySignal(SIGTERM), "");
+        } else {
+            EXPECT_EXIT(record_and_exit(filename, false), ::testing::ExitedWithCode(3), "");
+        }
+
+        std::unique_ptr<dvtt::TraceReader> reader = dvtt::TraceReader::open(filename, false);
+        ASSERT_NE(reader, nullptr);
+        std::vector<dvtt::TraceTransaction> txns = reader->transactions(dvtt::TraceQuery());
+        ASSERT_EQ(txns.size(), 2u);
+        EXPECT_EQ(txns[0].name, "done");
+        EXPECT_TRUE(txns[0].finished);
+        EXPECT_EQ(txns[1].name, "open");
+        EXPECT_FALSE(txns[1].finished);
+        EXPECT_EQ(txns[1].start_time, 20u);
+        EXPECT_EQ(txns[1].end_time, 20u);
+        ASSERT_NE(txns[1].find_attribute("index"), nullptr);
+        EXPECT_EQ(txns[1].find_attribute("index")->uint_value, 1u);
+    }
+    remove_trace(filename);
+}
+#endif
+
+TEST_F(DVTTReaderTest, TimesResolveThroughSequenceClocks) {
+    const char* filename = "test_reader_clocks.perfetto";
+    remove_trace(filename);
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "10ns");
+    ASSERT_NE(trace, nullptr);
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    for (int i = 0; i < 1000; i++) {
+        // Each outer transaction closes before the inner one it contains
+        dvtt_time_t t = static_cast<dvtt_time_t>(i) * 100;
+        dvtt_transaction_t outer = dvtt_open_transaction(stream, "outer", t, nullptr, nullptr);
+        dvtt_transaction_t inner = dvtt_open_transaction(stream, "inner", t + 10, nullptr, nullptr);
+        dvtt_close_transaction(inner, t + 50);
+        dvtt_close_transaction(outer, t + 20);
+    }
+    dvtt_close_trace(trace);
+
+    for (int pass = 0; pass < 2; pass++) {
+        // Built, then loaded from the index
+        std::unique_ptr<dvtt::TraceReader> reader = dvtt::TraceReader::open(filename);
+        ASSERT_NE(reader, nullptr);
+        dvtt::TraceQuery query;
+        query.start_time = 50000;
+        query.end_time = 50099;
+        std::vector<dvtt::TraceTransaction> txns = reader->transactions(query);
+        ASSERT_EQ(txns.size(), 2u);
+        EXPECT_EQ(txns[0].name, "inner");
+        EXPECT_EQ(txns[0].start_time, 50010u);
+        EXPECT_EQ(txns[0].end_time, 50050u);
+        EXPECT_EQ(txns[1].name, "outer");
+        EXPECT_EQ(txns[1].start_time, 50000u);
+        EXPECT_EQ(txns[1].end_time, 50020u);
+    }
+    remove_trace(filename);
+}
+
+TEST_F(DVTTReaderTest, SchemaNamesSurviveInternResets) {
+    const char* filename = "test_reader_schema.perfetto";
+    remove_trace(filename);
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.chunk_size = 1024;
+    opts.flight_recorder_bytes = 8 * 1024;
+    dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    ASSERT_NE(trace, nullptr);
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    dvtt_schema_field_t fields[2] = {
+        { "addr", DVTT_RADIX_HEX, 16 },
+        { "len", DVTT_RADIX_UNSIGNED, 16 }
+    };
+    dvtt_schema_t schema = dvtt_register_schema(stream, fields, 2);
+    ASSERT_NE(schema, nullptr);
+
+    // Every chunk of a flight recorder restarts the intern tables, and the
+    // plain attribute takes a different iid in each depending on its order
+    for (uint32_t i = 0; i < 2000; i++) {
+        dvtt_transaction_t txn = dvtt_open_transaction(stream, "WRITE", i * 10, nullptr, nullptr);
+        if (i % 3 == 0) {
+            dvtt_add_attr_uint32(txn, "index", i, DVTT_RADIX_DEC);
+        }
+        uint32_t values[1] = { (i & 0xffff) << 16 | (i % 7) };
+        dvtt_set_attrs(txn, schema, values);
+        dvtt_close_transaction(txn, i * 10 + 5);
+    }
+    ASSERT_TRUE(dvtt_dump_trace(trace, nullptr));
+    dvtt_close_trace(trace);
+
+    std::unique_ptr<dvtt::TraceReader> reader = dvtt::TraceReader::open(filename, false);
+    ASSERT_NE(reader, nullptr);
+    std::vector<dvtt::TraceTransaction> txns = reader->transactions(dvtt::TraceQuery());
+    ASSERT_GT(txns.size(), 100u);
+    for (const auto& txn : txns) {
+        uint64_t i = txn.start_time / 10;
+        const dvtt::TraceAttribute* addr = txn.find_attribute("addr");
+        const dvtt::TraceAttribute* len = txn.find_attribute("len");
+        ASSERT_NE(addr, nullptr);
+        ASSERT_NE(len, nullptr);
+        EXPECT_EQ(addr->name, "addr[hex]");
+        EXPECT_EQ(addr->uint_value, i);
+        EXPECT_EQ(len->name, "len[u]");
+        EXPECT_EQ(len->uint_value, i % 7);
+        EXPECT_EQ(txn.find_attribute("index") != nullptr, i % 3 == 0);
+    }
+    remove_trace(filename);
+}
+
+// One stream of linked request/response pairs; every trace made this way
+// has the same uuids, sequence ids and flow ids
+static void record_shard(const char* filename, const char* stream_name, dvtt_time_t offset,
+                         uint32_t id_namespace) {
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.free_on_close = 1;
+    opts.reorder_window = 100;
+    opts.id_namespace = id_namespace;
+    dvtt_trace_t trace = dvtt_create_trace_ex(filename, "shard", "1ns", &opts);
+    ASSERT_NE(trace, nullptr);
+    dvtt_stream_t stream = dvtt_open_stream(trace, stream_name, nullptr, nullptr);
+    for (int i = 0; i < 1000; i++) {
+        dvtt_time_t t = offset + static_cast<dvtt_time_t>(i) * 10;
+        dvtt_transaction_t req = dvtt_open_transaction(stream, "req", t, nullptr, nullptr);
+        dvtt_transaction_t rsp = dvtt_open_transaction(stream, "rsp", t + 1, nullptr, req);
+        dvtt_add_link(req, rsp, DVTT_LINK_CAUSE_EFFECT, nullptr);
+        dvtt_close_transaction(rsp, t + 2);
+        dvtt_close_transaction(req, t + 4);
+    }
+    dvtt_close_trace(trace);
+}
+
+// Checks that a merge of record_shard() traces "s0" and "s1" keeps both
+// apart and in time order
+static void check_merged(const char* filename) {
+    std::unique_ptr<dvtt::TraceReader> reader = dvtt::TraceReader::open(filename, false);
+    ASSERT_NE(reader, nullptr);
+    const dvtt::TraceTrack* s0 = reader->find_stream("s0");
+    const dvtt::TraceTrack* s1 = reader->find_stream("s1");
+    ASSERT_NE(s0, nullptr);
+    ASSERT_NE(s1, nullptr);
+    EXPECT_NE(s0->uuid, s1->uuid);
+
+    std::map<uint64_t, uint64_t> flow_streams;
+    dvtt_time_t last_end = 0;
+    size_t count = 0;
+    for (const dvtt::TraceTrack* stream : {s0, s1}) {
+        dvtt::TraceQuery query;
+        query.track_uuid = stream->uuid;
+        count += reader->for_each_transaction(query, [&](const dvtt::TraceTransaction& txn) {
+            for (uint64_t id : txn.flow_ids) {
+                // Each flow joins a request and response of one shard
+                EXPECT_EQ(flow_streams.emplace(id, stream->uuid).first->second, stream->uuid);
+            }
+        });
+    }
+    EXPECT_EQ(count, 4000u);
+    EXPECT_EQ(flow_streams.size(), 2000u);
+
+    size_t in_order = reader->for_each_transaction(dvtt::TraceQuery(),
+                                                   [&](const dvtt::TraceTransaction& txn) {
+        EXPECT_GE(txn.end_time, last_end);
+        last_end = txn.end_time;
+    });
+    EXPECT_EQ(in_order, 4000u);
+}
+
+TEST_F(DVTTReaderTest, MergeRemapsCollidingIds) {
+    const char* inputs[] = {"test_merge_s0.perfetto", "test_merge_s1.perfetto"};
+    const char* filename = "test_merge.perfetto";
+    record_shard(inputs[0], "s0", 0, 0);
+    record_shard(inputs[1], "s1", 5, 0);
+
+    ASSERT_EQ(dvtt_merge_traces(filename, inputs, 2, nullptr), 1);
+    check_merged(filename);
+
+#if defined(DVTT_HAVE_ZLIB)
+    // Compressed inputs are expanded; the output may be compressed again
+    dvtt_merge_options_t opts;
+    dvtt_merge_options_init(&opts);
+    opts.compression = DVTT_COMPRESSION_DEFLATE;
+    const char* compressed = "test_merge_z.perfetto";
+    ASSERT_EQ(dvtt_merge_traces(compressed, inputs, 2, &opts), 1);
+    const char* nested[] = {compressed};
+    ASSERT_EQ(dvtt_merge_traces(filename, nested, 1, nullptr), 1);
+    check_merged(filename);
+    std::remove(compressed);
+#endif
+
+    std::remove(inputs[0]);
+    std::remove(inputs[1]);
+    std::remove(filename);
+}
+
+TEST_F(DVTTReaderTest, MergeNamespacedTracesUnchanged) {
+    const char* inputs[] = {"test_merge_ns0.perfetto", "test_merge_ns1.perfetto"};
+    const char* filename = "test_merge_ns.perfetto";
+    record_shard(inputs[0], "s0", 0, 1);
+    record_shard(inputs[1], "s1", 5, 2);
+
+    dvtt_merge_options_t opts;
+    dvtt_merge_options_init(&opts);
+    opts.remap_ids = 0;
+    ASSERT_EQ(dvtt_merge_traces(filename, inputs, 2, &opts), 1);
+    check_merged(filename);
+    std::unique_ptr<dvtt::TraceReader> reader = dvtt::TraceReader::open(filename, false);
+    ASSERT_NE(reader, nullptr);
+    EXPECT_EQ(reader->find_stream("s0")->uuid, (uint64_t(1) << 40) + 1);
+    EXPECT_EQ(reader->find_stream("s1")->uuid, (uint64_t(2) << 40) + 1);
+
+    std::remove(inputs[0]);
+    std::remove(inputs[1]);
+    std::remove(filename);
+}
+
+TEST_F(DVTTReaderTest, MergeRejectsBadArguments) {
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.id_namespace = 0x10000;
+    EXPECT_EQ(dvtt_create_trace_ex("test_merge_bad.perfetto", "bad", "1ns", &opts), nullptr);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_INVALID_ARGUMENT);
+
+    const char* missing[] = {"test_merge_missing.perfetto"};
+    EXPECT_EQ(dvtt_merge_traces("test_merge_bad.perfetto", missing, 1, nullptr), 0);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_INVALID_ARGUMENT);
+    EXPECT_EQ(dvtt_merge_traces("test_merge_bad.perfetto", missing, 0, nullptr), 0);
+    EXPECT_EQ(dvtt_merge_traces(nullptr, missing, 1, nullptr), 0);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_NULL_POINTER);
+    std::remove("test_merge_bad.perfetto");
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,948 @@
+#include <gtest/gtest.h>
+#include "include/dvtt.h"
+#include "trace_decode.h"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(DVTT_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+class DVTTWriterTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        dvtt_init();
+    }
+    
+    void TearDown() override {
+        dvtt_shutdown();
+    }
+    
+    // Records 'count' transactions with a couple of attributes each
+    static void record(dvtt_trace_t trace, int count) {
+        dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+        for (int i = 0; i < count; i++) {
+            dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn", i * 10, nullptr, nullptr);
+            dvtt_add_attr_uint32(txn, "index", i, DVTT_RADIX_DEC);
+            dvtt_add_attr_string(txn, "status", "OK");
+            dvtt_close_transaction(txn, i * 10 + 5);
+        }
+    }
+    
+    // Records two streams with a flush in between; reports whether the file
+    // was well-formed at the flush
+    static std::string record_flushed(const char* filename, const dvtt_trace_options_t& opts,
+                                      bool* ok_at_flush) {
+        dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+        EXPECT_NE(trace, nullptr);
+        if (!trace) {
+            return std::string();
+        }
+        record(trace, 1000);
+        dvtt_flush_trace(trace);
+        trace_decode::read_packets(filename, ok_at_flush);
+        record(trace, 1000);
+        dvtt_close_trace(trace);
+        std::string data = trace_decode::read_file(filename);
+        std::remove(filename);
+        return data;
+    }
+};
+
+TEST_F(DVTTWriterTest, OptionsDefaults) {
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    EXPECT_GT(opts.chunk_size, 0u);
+    EXPECT_EQ(opts.async_writer, 0);
+    EXPECT_GT(opts.ring_chunks, 0u);
+    EXPECT_EQ(opts.ring_full_policy, DVTT_RING_FULL_BLOCK);
+    EXPECT_EQ(opts.compression, DVTT_COMPRESSION_NONE);
+}
+
+TEST_F(DVTTWriterTest, AsyncWriterBlock) {
+    const char* filename = "test_async_block.perfetto";
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.async_writer = 1;
+    opts.chunk_size = 4096;
+    opts.ring_chunks = 2;
+    
+    dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    ASSERT_NE(trace, nullptr);
+    record(trace, 10000);
+    dvtt_close_trace(trace);
+    
+    bool ok = false;
+    std::vector<std::string> packets = trace_decode::read_packets(filename, &ok);
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(packets.size(), 2u + 2u * 10000);
+    
+    std::remove(filename);
+}
+
+TEST_F(DVTTWriterTest, AsyncWriterGrow) {
+    const char* filename = "test_async_grow.perfetto";
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.async_writer = 1;
+    opts.chunk_size = 1024;
+    opts.ring_chunks = 1;
+    opts.ring_full_policy = DVTT_RING_FULL_GROW;
+    
+    dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    ASSERT_NE(trace, nullptr);
+    record(trace, 10000);
+    dvtt_close_trace(trace);
+    
+    bool ok = false;
+    std::vector<std::string> packets = trace_decode::read_packets(filename, &ok);
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(packets.size(), 2u + 2u * 10000);
+    
+    std::remove(filename);
+}
+
+TEST_F(DVTTWriterTest, AsyncWriterDropKeepsWholePackets) {
+    const char* filename = "test_async_drop.perfetto";
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.async_writer = 1;
+    opts.chunk_size = 256;
+    opts.ring_chunks = 1;
+    opts.ring_full_policy = DVTT_RING_FULL_DROP;
+    
+    dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    ASSERT_NE(trace, nullptr);
+    record(trace, 10000);
+    dvtt_close_trace(trace);
+    
+    // Whatever was dropped, the file must still decode as whole packets
+    bool ok = false;
+    std::vector<std::string> packets = trace_decode::read_packets(filename, &ok);
+    EXPECT_TRUE(ok);
+    EXPECT_GT(packets.size(), 0u);
+    EXPECT_LE(packets.size(), 2u + 2u * 10000);
+    
+    // Packets after a drop restart the interned state and report the loss
+    if (packets.size() < 2u + 2u * 10000) {
+        size_t lost = 0;
+        for (const auto& pkt : packets) {
+            std::vector<trace_decode::Field> fields = trace_decode::decode(pkt);
+            const trace_decode::Field* dropped = trace_decode::find(fields, 42);
+            if (dropped && dropped->value) {
+                EXPECT_EQ(trace_decode::find(fields, 13)->value & 1u, 1u);
+                lost++;
+            }
+        }
+        EXPECT_GT(lost, 0u);
+    }
+    
+    std::remove(filename);
+}
+
+// Records from several threads and returns the decoded packets
+static std::vector<std::string> record_threads(const char* filename, int async_writer,
+                                               int threads, int count) {
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.multi_thread = 1;
+    opts.async_writer = async_writer;
+    opts.chunk_size = 4096;
+    
+    dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    EXPECT_NE(trace, nullptr);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([trace, t, count] {
+            std::string name = "stream" + std::to_string(t);
+            dvtt_stream_t stream = dvtt_open_stream(trace, name.c_str(), nullptr, nullptr);
+            for (int i = 0; i < count; i++) {
+                dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn", i * 10, "bus", nullptr);
+                dvtt_add_attr_uint32(txn, "index", i, DVTT_RADIX_DEC);
+                dvtt_close_transaction(txn, i * 10 + 5);
+                dvtt_free_transaction(txn, 0);
+            }
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    dvtt_close_trace(trace);
+    
+    bool ok = false;
+    std::vector<std::string> packets = trace_decode::read_packets(filename, &ok);
+    EXPECT_TRUE(ok);
+    return packets;
+}
+
+TEST_F(DVTTWriterTest, MultiThreadSequences) {
+    using namespace trace_decode;
+    const char* filename = "test_multi_thread.perfetto";
+    const int threads = 4;
+    const int count = 2000;
+    
+    for (int async_writer = 0; async_writer < 2; async_writer++) {
+        std::vector<std::string> packets = record_threads(filename, async_writer, threads, count);
+        ASSERT_EQ(packets.size(), static_cast<size_t>(threads * (2 + 2 * count)));
+        
+        // Each producer thread writes its own sequence, which starts with
+        // cleared incremental state and defines its own interned strings
+        std::map<uint64_t, size_t> per_sequence;
+        std::map<uint64_t, size_t> definitions;
+        for (const auto& pkt : packets) {
+            std::vector<Field> fields = decode(pkt);
+            uint64_t seq = find(fields, 10)->value;
+            if (per_sequence[seq]++ == 0) {
+                ASSERT_NE(find(fields, 13), nullptr);
+                EXPECT_EQ(find(fields, 13)->value & 1u, 1u);
+            }
+            if (find(fields, 12)) {
+                definitions[seq]++;
+            }
+        }
+        EXPECT_EQ(per_sequence.size(), static_cast<size_t>(threads));
+        for (const auto& entry : per_sequence) {
+            EXPECT_EQ(entry.second, static_cast<size_t>(2 + 2 * count));
+            EXPECT_EQ(definitions[entry.first], 1u);
+        }
+    }
+    
+    std::remove(filename);
+}
+
+TEST_F(DVTTWriterTest, MultiThreadCrossThreadFree) {
+    const char* filename = "test_cross_thread.perfetto";
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.multi_thread = 1;
+    dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    ASSERT_NE(trace, nullptr);
+    
+    // Transactions opened on a worker are closed and freed on this thread,
+    // returning their nodes to the worker's pool
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    for (int round = 0; round < 4; round++) {
+        std::vector<dvtt_transaction_t> txns;
+        std::thread worker([&] {
+            for (int i = 0; i < 500; i++) {
+                dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn", i, nullptr, nullptr);
+                dvtt_add_attr_uint32(txn, "index", i, DVTT_RADIX_DEC);
+                txns.push_back(txn);
+            }
+        });
+        worker.join();
+        for (size_t i = 0; i < txns.size(); i++) {
+            dvtt_close_transaction(txns[i], i + 1);
+            dvtt_free_transaction(txns[i], 0);
+        }
+    }
+    dvtt_close_trace(trace);
+    
+    bool ok = false;
+    std::vector<std::string> packets = trace_decode::read_packets(filename, &ok);
+    EXPECT_TRUE(ok);
+    // The first worker describes the stream; the events are written here
+    EXPECT_EQ(packets.size(), 3u + 2u * 4 * 500);
+    std::remove(filename);
+}
+
+// Checks that a rotated segment decodes on its own: it starts from cleared
+// incremental state, describes the tracks its events use and defines every
+// iid it references. Returns the number of slice begin events.
+static size_t check_segment(const std::string& filename) {
+    using namespace trace_decode;
+    bool ok = false;
+    std::vector<std::string> packets = read_packets(filename.c_str(), &ok);
+    EXPECT_TRUE(ok) << filename;
+    EXPECT_FALSE(packets.empty()) << filename;
+    if (packets.empty()) {
+        return 0;
+    }
+    EXPECT_EQ(find(decode(packets[0]), 13)->value & 1u, 1u) << filename;
+    
+    std::map<uint64_t, bool> tracks;
+    std::map<uint64_t, bool> names;
+    size_t begins = 0;
+    for (const auto& pkt : packets) {
+        std::vector<Field> fields = decode(pkt);
+        const Field* flags = find(fields, 13);
+        if (flags && (flags->value & 1u)) {
+            names.clear();
+        }
+        if (const Field* desc = find(fields, 60)) {
+            tracks[find(decode(desc->bytes), 1)->value] = true;
+        }
+        if (const Field* interned = find(fields, 12)) {
+            for (const auto& f : decode(interned->bytes)) {
+                if (f.number == 2) {
+                    names[find(decode(f.bytes), 1)->value] = true;
+                }
+            }
+        }
+        if (const Field* ev = find(fields, 11)) {
+            std::vector<Field> ev_fields = decode(ev->bytes);
+            EXPECT_TRUE(tracks[find(ev_fields, 11)->value]) << filename;
+            if (find(ev_fields, 9)->value == 1) {
+                EXPECT_TRUE(names[find(ev_fields, 10)->value]) << filename;
+                begins++;
+            }
+        }
+    }
+    return begins;
+}
+
+TEST_F(DVTTWriterTest, RotateBySize) {
+    const char* filename = "test_rotate_size.perfetto";
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.chunk_size = 1024;
+    opts.rotate_bytes = 16 * 1024;
+    
+    for (int async_writer = 0; async_writer < 2; async_writer++) {
+        opts.async_writer = async_writer;
+        dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+        ASSERT_NE(trace, nullptr);
+        record(trace, 5000);
+        dvtt_close_trace(trace);
+        
+        size_t begins = 0;
+        int segments = 0;
+        for (uint32_t i = 0;; i++) {
+            std::string name = i ? "test_rotate_size." + std::to_string(i) + ".perfetto"
+                                 : std::string(filename);
+            FILE* fp = fopen(name.c_str(), "rb");
+            if (!fp) {
+                break;
+            }
+            fclose(fp);
+            begins += check_segment(name);
+            std::remove(name.c_str());
+            segments++;
+        }
+        EXPECT_GT(segments, 2);
+        EXPECT_EQ(begins, 5000u);
+    }
+}
+
+TEST_F(DVTTWriterTest, RotateByTimeKeepsOpenTracks) {
+    const char* filename = "test_rotate_time.perfetto";
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.rotate_time = 1000;
+    dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    ASSERT_NE(trace, nullptr);
+    
+    // A parent and child stay open across every window
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    dvtt_transaction_t parent = dvtt_open_transaction(stream, "burst", 0, nullptr, nullptr);
+    dvtt_transaction_t child = dvtt_open_transaction(stream, "beat", 0, nullptr, parent);
+    for (int i = 0; i < 30; i++) {
+        dvtt_transaction_t txn = dvtt_open_transaction(stream, "txn", i * 100, nullptr, child);
+        dvtt_close_transaction(txn, i * 100 + 50);
+    }
+    dvtt_close_transaction(child, 3000);
+    dvtt_close_transaction(parent, 3000);
+    dvtt_close_trace(trace);
+    
+    // Windows [0,1000), [1000,2000), [2000,3000) and the closes at 3000
+    const char* segments[] = {
+        "test_rotate_time.perfetto", "test_rotate_time.1.perfetto",
+        "test_rotate_time.2.perfetto", "test_rotate_time.3.perfetto"
+    };
+    size_t begins = 0;
+    for (const char* name : segments) {
+        begins += check_segment(name);
+        std::remove(name);
+    }
+    EXPECT_EQ(begins, 32u);
+    FILE* fp = fopen("test_rotate_time.4.perfetto", "rb");
+    EXPECT_EQ(fp, nullptr);
+    if (fp) {
+        fclose(fp);
+    }
+}
+
+TEST_F(DVTTWriterTest, RotationRejectsMultiThread) {
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.multi_thread = 1;
+    opts.rotate_bytes = 1024;
+    EXPECT_EQ(dvtt_create_trace_ex("test_rotate_mt.perfetto", "test", "1ns", &opts), nullptr);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_INVALID_ARGUMENT);
+}
+
+static bool file_exists(const char* filename) {
+    FILE* fp = fopen(filename, "rb");
+    if (fp) {
+        fclose(fp);
+    }
+    return fp != nullptr;
+}
+
+TEST_F(DVTTWriterTest, FlightRecorderDumpsRetainedWindow) {
+    const char* filename = "test_flight.perfetto";
+    const char* dump = "test_flight.dump.perfetto";
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.chunk_size = 1024;
+    opts.flight_recorder_bytes = 8 * 1024;
+    
+    for (int async_writer = 0; async_writer < 2; async_writer++) {
+        opts.async_writer = async_writer;
+        dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+        ASSERT_NE(trace, nullptr);
+        
+        // Children of an open parent; their tracks are described either in
+        // the dump header or next to their events
+        dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+        dvtt_transaction_t parent = dvtt_open_transaction(stream, "burst", 0, nullptr, nullptr);
+        for (int i = 0; i < 5000; i++) {
+            dvtt_transaction_t txn = dvtt_open_transaction(stream, "beat", i * 10, nullptr,
+                                                           parent);
+            dvtt_add_attr_uint32(txn, "index", i, DVTT_RADIX_DEC);
+            dvtt_close_transaction(txn, i * 10 + 5);
+        }
+        EXPECT_FALSE(file_exists(filename));
+        
+        ASSERT_TRUE(dvtt_dump_trace(trace, dump));
+        size_t begins = check_segment(dump);
+        EXPECT_GT(begins, 0u);
+        EXPECT_LT(begins, 5000u);
+        FILE* fp = fopen(dump, "rb");
+        ASSERT_NE(fp, nullptr);
+        fseek(fp, 0, SEEK_END);
+        EXPECT_LE(static_cast<size_t>(ftell(fp)), opts.flight_recorder_bytes + 4 * opts.chunk_size);
+        fclose(fp);
+        
+        // Recording continues and the trace can be dumped again, by default
+        // to its own filename
+        dvtt_close_transaction(parent, 50000);
+        ASSERT_TRUE(dvtt_dump_trace(trace, nullptr));
+        size_t later = check_segment(filename);
+        EXPECT_GT(later, 0u);
+        EXPECT_LE(later, begins + 1);
+        dvtt_close_trace(trace);
+        std::remove(dump);
+        std::remove(filename);
+    }
+}
+
+TEST_F(DVTTWriterTest, FlightRecorderRejectsMisuse) {
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.flight_recorder_bytes = 1024;
+    opts.rotate_bytes = 1024;
+    EXPECT_EQ(dvtt_create_trace_ex("test_flight_rotate.perfetto", "test", "1ns", &opts), nullptr);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_INVALID_ARGUMENT);
+    
+    dvtt_trace_t trace = dvtt_create_trace("test_flight_plain.perfetto", "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    EXPECT_FALSE(dvtt_dump_trace(trace, "test_flight_plain.dump.perfetto"));
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_INVALID_ARGUMENT);
+    dvtt_close_trace(trace);
+    std::remove("test_flight_plain.perfetto");
+    EXPECT_FALSE(file_exists("test_flight_plain.dump.perfetto"));
+}
+
+struct SliceEvent {
+    uint64_t time;
+    uint64_t type;
+    size_t num_attrs;
+};
+
+// Returns the slice begin and end events of a trace in file order
+static std::vector<SliceEvent> read_slice_events(const char* filename) {
+    using namespace trace_decode;
+    std::vector<SliceEvent> events;
+    std::vector<std::string> packets = read_packets(filename);
+    std::vector<uint64_t> times = packet_times(packets);
+    for (size_t i = 0; i < packets.size(); i++) {
+        std::vector<Field> fields = decode(packets[i]);
+        const Field* ev = find(fields, 11);
+        if (!ev) {
+            continue;
+        }
+        std::vector<Field> ev_fields = decode(ev->bytes);
+        events.push_back({times[i], find(ev_fields, 9)->value, count(ev_fields, 4)});
+    }
+    return events;
+}
+
+// Returns the position of the first event with 'time' and 'type'
+static size_t find_event(const std::vector<SliceEvent>& events, uint64_t time, uint64_t type) {
+    size_t i = 0;
+    while (i < events.size() && !(events[i].time == time && events[i].type == type)) {
+        i++;
+    }
+    return i;
+}
+
+TEST_F(DVTTWriterTest, ReorderWindowSortsEvents) {
+    const char* filename = "test_reorder.perfetto";
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    EXPECT_EQ(opts.reorder_window, 0u);
+    opts.reorder_window = 1000;
+    
+    for (int fallback = DVTT_REORDER_SPLIT; fallback <= DVTT_REORDER_UNSORTED; fallback++) {
+        opts.reorder_fallback = static_cast<dvtt_reorder_fallback_t>(fallback);
+        dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+        ASSERT_NE(trace, nullptr);
+        dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+        
+        // Outlives the window
+        dvtt_transaction_t longest = dvtt_open_transaction(stream, "longest", 0, nullptr,
+                                                           nullptr);
+        dvtt_add_attr_uint32(longest, "first", 1, DVTT_RADIX_DEC);
+        for (int i = 0; i < 100; i++) {
+            // Overlapping children closed in reverse order, and complete records
+            dvtt_time_t t = 10 + i * 50;
+            dvtt_transaction_t outer = dvtt_open_transaction(stream, "outer", t, nullptr,
+                                                             longest);
+            dvtt_transaction_t inner = dvtt_open_transaction(stream, "inner", t + 10, nullptr,
+                                                             outer);
+            dvtt_add_attr_uint32(inner, "index", i, DVTT_RADIX_DEC);
+            dvtt_close_transaction(inner, t + 30);
+            dvtt_close_transaction(outer, t + 20);
+            dvtt_txn_record_t rec = {"record", nullptr, t + 5, t + 40, longest, -1, nullptr, 0};
+            EXPECT_EQ(dvtt_record_transactions(stream, &rec, 1), 1u);
+        }
+        dvtt_add_attr_uint32(longest, "last", 2, DVTT_RADIX_DEC);
+        dvtt_close_transaction(longest, 6000);
+        dvtt_close_trace(trace);
+        
+        std::vector<SliceEvent> events = read_slice_events(filename);
+        ASSERT_EQ(events.size(), 2u * 301);
+        size_t begin = find_event(events, 0, 1);
+        size_t end = find_event(events, 6000, 2);
+        ASSERT_LT(begin, events.size());
+        ASSERT_LT(end, events.size());
+        
+        size_t unordered = 0;
+        for (size_t i = 1; i < events.size(); i++) {
+            if (events[i].time < events[i - 1].time) {
+                unordered++;
+            }
+        }
+        if (fallback == DVTT_REORDER_SPLIT) {
+            // Written early, with the attributes added since on the end
+            EXPECT_EQ(unordered, 0u);
+            EXPECT_EQ(begin, 0u);
+            EXPECT_EQ(events[begin].num_attrs, 1u);
+            EXPECT_EQ(events[end].num_attrs, 1u);
+        } else {
+            // Written whole at close, ahead of the events still queued
+            EXPECT_GT(unordered, 0u);
+            EXPECT_GT(begin, 0u);
+            EXPECT_EQ(end, begin + 1);
+            EXPECT_EQ(events[begin].num_attrs, 2u);
+            EXPECT_EQ(events[end].num_attrs, 0u);
+        }
+        std::remove(filename);
+    }
+    
+    opts.multi_thread = 1;
+    EXPECT_EQ(dvtt_create_trace_ex(filename, "test", "1ns", &opts), nullptr);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_INVALID_ARGUMENT);
+    opts.multi_thread = 0;
+    opts.flight_recorder_bytes = 1024;
+    EXPECT_EQ(dvtt_create_trace_ex(filename, "test", "1ns", &opts), nullptr);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_INVALID_ARGUMENT);
+}
+
+// Counts the slice begin and end events in a trace that may still be open
+static void count_slices(const char* filename, size_t* begins, size_t* ends) {
+    *begins = 0;
+    *ends = 0;
+    bool ok = false;
+    trace_decode::read_packets(filename, &ok);
+    EXPECT_TRUE(ok) << filename;
+    for (const auto& ev : read_slice_events(filename)) {
+        (ev.type == 1 ? *begins : *ends) += 1;
+    }
+}
+
+TEST_F(DVTTWriterTest, CheckpointsWriteCompletedPackets) {
+    const char* filename = "test_checkpoint.perfetto";
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    EXPECT_EQ(opts.flush_time, 0u);
+    EXPECT_EQ(opts.flush_packets, 0u);
+    size_t begins, ends;
+    
+    // By packet count: at most a checkpoint's worth is still buffered
+    opts.flush_packets = 8;
+    opts.flush_sync = 1;
+    dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    ASSERT_NE(trace, nullptr);
+    record(trace, 50);
+    count_slices(filename, &begins, &ends);
+    EXPECT_GE(ends, 46u);
+    dvtt_close_trace(trace);
+    
+    // By time, and on demand
+    opts.flush_packets = 0;
+    opts.flush_sync = 0;
+    opts.flush_time = 100;
+    trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    ASSERT_NE(trace, nullptr);
+    record(trace, 50);
+    count_slices(filename, &begins, &ends);
+    EXPECT_EQ(ends, 40u);
+    dvtt_flush_trace(trace);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_OK);
+    count_slices(filename, &begins, &ends);
+    EXPECT_EQ(ends, 50u);
+    dvtt_close_trace(trace);
+    std::remove(filename);
+    
+    opts.flight_recorder_bytes = 1024;
+    EXPECT_EQ(dvtt_create_trace_ex(filename, "test", "1ns", &opts), nullptr);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_INVALID_ARGUMENT);
+}
+
+TEST_F(DVTTWriterTest, MmapMatchesStdio) {
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    EXPECT_EQ(opts.mmap_window, 0u);
+    opts.chunk_size = 1000;
+    bool ok = false;
+    std::string expected = record_flushed("test_stdio.perfetto", opts, &ok);
+    EXPECT_TRUE(ok);
+    
+    // Small windows, so chunks straddle them. Flushing truncates the padding
+    opts.mmap_window = 4096;
+    for (int async_writer = 0; async_writer < 2; async_writer++) {
+        opts.async_writer = async_writer;
+        ok = false;
+        EXPECT_EQ(record_flushed("test_mmap.perfetto", opts, &ok), expected);
+        EXPECT_TRUE(ok);
+    }
+    
+    opts.flight_recorder_bytes = 1024;
+    EXPECT_EQ(dvtt_create_trace_ex("test_mmap.perfetto", "test", "1ns", &opts), nullptr);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_INVALID_ARGUMENT);
+}
+
+#if defined(SIGTERM)
+// Records two transactions, one left open, and ends the process without
+// closing the trace
+static void record_and_die(const char* filename, bool by_signal, bool async_writer) {
+    dvtt_init();
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.async_writer = async_writer;
+    dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream1", nullptr, nullptr);
+    dvtt_transaction_t done = dvtt_open_transaction(stream, "done", 0, nullptr, nullptr);
+    dvtt_close_transaction(done, 10);
+    dvtt_transaction_t open = dvtt_open_transaction(stream, "open", 20, nullptr, nullptr);
+    dvtt_add_attr_uint32(open, "index", 1, DVTT_RADIX_DEC);
+    dvtt_flush_on_exit(trace);
+    if (by_signal) {
+        std::raise(SIGTERM);
+    }
+    std::exit(3);
+}
+
+TEST_F(DVTTWriterTest, FlushOnExitLeavesLoadableTrace) {
+    const char* filename = "test_exit.perfetto";
+    for (int run = 0; run < 4; run++) {
+        // In the handler, queued chunks bypass the writer thread
+        bool by_signal = run & 1;
+        bool async_writer = run & 2;
+        std::remove(filename);
+        if (by_signal) {
+            EXPECT_EXIT(record_and_die(filename, true, async_writer),
+                        ::testing::KilledBySignal(SIGTERM), "");
+        } else {
+            EXPECT_EXIT(record_and_die(filename, false, async_writer),
+                        ::testing::ExitedWithCode(3), "");
+        }
+        // The open transaction shows as unfinished
+        std::vector<SliceEvent> events = read_slice_events(filename);
+        ASSERT_EQ(events.size(), 3u);
+        EXPECT_EQ(events[2].time, 20u);
+        EXPECT_EQ(events[2].type, 1u);
+        EXPECT_EQ(events[2].num_attrs, 1u);
+    }
+    std::remove(filename);
+}
+#endif
+
+#if defined(DVTT_HAVE_ZLIB)
+// Expands compressed_packets packets in place, leaving other packets as-is
+static std::vector<std::string> inflate_packets(const std::vector<std::string>& packets) {
+    using namespace trace_decode;
+    std::vector<std::string> out;
+    for (const auto& pkt : packets) {
+        std::vector<Field> fields = decode(pkt);
+        const Field* compressed = find(fields, 50);
+        if (!compressed) {
+            out.push_back(pkt);
+            continue;
+        }
+        std::string trace;
+        z_stream zs = {};
+        EXPECT_EQ(inflateInit(&zs), Z_OK);
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed->bytes.data()));
+        zs.avail_in = static_cast<uInt>(compressed->bytes.size());
+        int ret;
+        do {
+            char buf[16384];
+            zs.next_out = reinterpret_cast<Bytef*>(buf);
+            zs.avail_out = sizeof(buf);
+            ret = inflate(&zs, Z_NO_FLUSH);
+            trace.append(buf, sizeof(buf) - zs.avail_out);
+        } while (ret == Z_OK);
+        EXPECT_EQ(ret, Z_STREAM_END);
+        inflateEnd(&zs);
+        for (const auto& f : decode(trace)) {
+            EXPECT_EQ(f.number, 1u);
+            out.push_back(f.bytes);
+        }
+    }
+    return out;
+}
+
+TEST_F(DVTTWriterTest, CompressedMatchesUncompressed) {
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.chunk_size = 4096;
+    dvtt_trace_t trace = dvtt_create_trace_ex("test_plain.perfetto", "test", "1ns", &opts);
+    ASSERT_NE(trace, nullptr);
+    record(trace, 5000);
+    dvtt_close_trace(trace);
+    std::vector<std::string> plain = trace_decode::read_packets("test_plain.perfetto");
+    std::string plain_file = trace_decode::read_file("test_plain.perfetto");
+    std::remove("test_plain.perfetto");
+    
+    opts.compression = DVTT_COMPRESSION_DEFLATE;
+    for (int async_writer = 0; async_writer < 2; async_writer++) {
+        const char* filename = "test_compressed.perfetto";
+        opts.async_writer = async_writer;
+        trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+        ASSERT_NE(trace, nullptr);
+        record(trace, 5000);
+        dvtt_close_trace(trace);
+        
+        bool ok = false;
+        std::vector<std::string> packets = trace_decode::read_packets(filename, &ok);
+        EXPECT_TRUE(ok);
+        for (const auto& pkt : packets) {
+            EXPECT_NE(trace_decode::find(trace_decode::decode(pkt), 50), nullptr);
+        }
+        EXPECT_LT(trace_decode::read_file(filename).size(), plain_file.size() / 4);
+        EXPECT_EQ(inflate_packets(packets), plain);
+        std::remove(filename);
+    }
+}
+#endif
+
+TEST_F(DVTTWriterTest, TraceStatsReportCost) {
+    const char* filename = "test_stats.perfetto";
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    EXPECT_EQ(opts.stats_interval, 0u);
+    opts.async_writer = 1;
+    dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    ASSERT_NE(trace, nullptr);
+    dvtt_register_name(trace, "beat");
+    record(trace, 100);
+    dvtt_stream_t stream = dvtt_open_stream(trace, "stream2", nullptr, nullptr);
+    dvtt_transaction_t open = dvtt_open_transaction(stream, "open", 2000, nullptr, nullptr);
+    dvtt_flush_trace(trace);
+    
+    dvtt_trace_stats_t stats;
+    ASSERT_EQ(dvtt_get_trace_stats(trace, &stats), 1);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_OK);
+    // A descriptor per stream plus a begin and an end per transaction
+    EXPECT_EQ(stats.packets_written, 202u);
+    EXPECT_EQ(stats.bytes_written, trace_decode::read_file(filename).size());
+    EXPECT_EQ(stats.open_transactions, 1u);
+    EXPECT_EQ(stats.retained_transactions, 100u);
+    EXPECT_EQ(stats.interned_strings, 3u);
+    EXPECT_EQ(stats.registered_names, 1u);
+    EXPECT_GE(stats.ring_high_water, 1u);
+    EXPECT_EQ(stats.ring_drops, 0u);
+    EXPECT_GT(stats.encode_ns, 0u);
+    EXPECT_GT(stats.io_ns, 0u);
+    
+    dvtt_free_transaction(open, 2005);
+    ASSERT_EQ(dvtt_get_trace_stats(trace, &stats), 1);
+    EXPECT_EQ(stats.open_transactions, 0u);
+    EXPECT_EQ(stats.retained_transactions, 100u);
+    EXPECT_EQ(dvtt_get_trace_stats(trace, nullptr), 0);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_NULL_POINTER);
+    EXPECT_EQ(dvtt_get_trace_stats(nullptr, &stats), 0);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_NULL_HANDLE);
+    dvtt_close_trace(trace);
+    
+    // Periodic samples: the first close, then the first in each 100ns
+    opts.async_writer = 0;
+    opts.stats_interval = 100;
+    trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    ASSERT_NE(trace, nullptr);
+    record(trace, 50);
+    dvtt_close_trace(trace);
+    size_t counter_tracks = 0, samples = 0;
+    for (const auto& packet : trace_decode::read_packets(filename)) {
+        auto fields = trace_decode::decode(packet);
+        if (auto* desc = trace_decode::find(fields, 60)) {
+            counter_tracks += trace_decode::count(trace_decode::decode(desc->bytes), 8);
+        }
+        if (auto* event = trace_decode::find(fields, 11)) {
+            auto ev = trace_decode::decode(event->bytes);
+            auto* type = trace_decode::find(ev, 9);
+            if (type && type->value == 4) {
+                EXPECT_NE(trace_decode::find(ev, 30), nullptr);
+                samples++;
+            }
+        }
+    }
+    EXPECT_EQ(counter_tracks, 7u);
+    EXPECT_EQ(samples, 5u * counter_tracks);
+    std::remove(filename);
+}
+
+// Counter samples in a trace: (track uuid, value, is double) in file order,
+// and the counter track descriptors by uuid
+struct CounterSample {
+    uint64_t track;
+    double value;
+    bool is_double;
+};
+
+static std::vector<CounterSample> read_counter_samples(
+        const char* filename, std::map<uint64_t, std::vector<trace_decode::Field>>* tracks) {
+    std::vector<CounterSample> samples;
+    for (const auto& packet : trace_decode::read_packets(filename)) {
+        auto fields = trace_decode::decode(packet);
+        if (auto* desc = trace_decode::find(fields, 60)) {
+            auto track = trace_decode::decode(desc->bytes);
+            if (trace_decode::find(track, 8)) {
+                (*tracks)[trace_decode::find(track, 1)->value] = track;
+            }
+        }
+        auto* event = trace_decode::find(fields, 11);
+        if (!event) {
+            continue;
+        }
+        auto ev = trace_decode::decode(event->bytes);
+        auto* type = trace_decode::find(ev, 9);
+        if (!type || type->value != 4) {
+            continue;
+        }
+        CounterSample sample = {trace_decode::find(ev, 11)->value, 0.0, false};
+        if (auto* value = trace_decode::find(ev, 30)) {
+            sample.value = static_cast<double>(static_cast<int64_t>(value->value));
+        } else if (auto* value = trace_decode::find(ev, 44)) {
+            std::memcpy(&sample.value, &value->value, sizeof(sample.value));
+            sample.is_double = true;
+        }
+        samples.push_back(sample);
+    }
+    return samples;
+}
+
+TEST_F(DVTTWriterTest, CounterTracks) {
+    const char* filename = "test_counter.perfetto";
+    dvtt_trace_t trace = dvtt_create_trace(filename, "test", "1ns");
+    ASSERT_NE(trace, nullptr);
+    dvtt_stream_t stream = dvtt_open_stream(trace, "fifo", "top.fifo", nullptr);
+    dvtt_counter_t level = dvtt_open_counter(stream, "level", "entries");
+    ASSERT_NE(level, nullptr);
+    dvtt_counter_t bandwidth = dvtt_open_counter(stream, "bandwidth", nullptr);
+    ASSERT_NE(bandwidth, nullptr);
+    dvtt_counter_t unused = dvtt_open_counter(stream, "unused", nullptr);
+    ASSERT_NE(unused, nullptr);
+    
+    const int64_t levels[] = {0, 1, 1, 2, 2, 2, -1};
+    for (int i = 0; i < 7; i++) {
+        dvtt_counter_set(level, i * 10, levels[i]);
+    }
+    // Coalesced: only changes are written
+    dvtt_set_counter_coalescing(level, 1);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_OK);
+    for (int i = 0; i < 7; i++) {
+        dvtt_counter_set(level, 100 + i * 10, levels[i]);
+    }
+    dvtt_counter_set_double(bandwidth, 200, 0.5);
+    // Disabled and closed streams drop samples
+    dvtt_set_stream_enabled(stream, 0);
+    dvtt_counter_set(level, 300, 7);
+    dvtt_set_stream_enabled(stream, 1);
+    dvtt_close_stream(stream);
+    dvtt_counter_set(level, 400, 8);
+    EXPECT_EQ(dvtt_open_counter(stream, "late", nullptr), nullptr);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_NOT_INITIALIZED);
+    EXPECT_EQ(dvtt_open_counter(nullptr, "none", nullptr), nullptr);
+    EXPECT_EQ(dvtt_get_last_error(), DVTT_ERROR_NULL_HANDLE);
+    dvtt_counter_set(nullptr, 0, 0);
+    dvtt_close_trace(trace);
+    
+    std::map<uint64_t, std::vector<trace_decode::Field>> tracks;
+    auto samples = read_counter_samples(filename, &tracks);
+    std::remove(filename);
+    
+    // Tracks are described on first use, under the stream's track
+    ASSERT_EQ(tracks.size(), 2u);
+    std::vector<double> values;
+    uint64_t stream_uuid = 0;
+    for (const auto& track : tracks) {
+        uint64_t parent = trace_decode::find(track.second, 5)->value;
+        EXPECT_TRUE(stream_uuid == 0 || parent == stream_uuid);
+        stream_uuid = parent;
+    }
+    const std::vector<double> expected = {0, 1, 1, 2, 2, 2, -1, 0, 1, 2, -1};
+    for (const auto& sample : samples) {
+        if (!sample.is_double) {
+            values.push_back(sample.value);
+        } else {
+            EXPECT_EQ(sample.value, 0.5);
+            auto counter = trace_decode::decode(trace_decode::find(tracks[sample.track], 8)->bytes);
+            EXPECT_EQ(trace_decode::find(counter, 6), nullptr);
+        }
+    }
+    EXPECT_EQ(values, expected);
+    EXPECT_EQ(samples.size(), expected.size() + 1);
+    auto counter = trace_decode::decode(trace_decode::find(tracks[samples[0].track], 8)->bytes);
+    ASSERT_NE(trace_decode::find(counter, 6), nullptr);
+    EXPECT_EQ(trace_decode::find(counter, 6)->bytes, "entries");
+}
+
+TEST_F(DVTTWriterTest, FlightRecorderDescribesCounters) {
+    const char* filename = "test_counter_flight.perfetto";
+    dvtt_trace_options_t opts;
+    dvtt_trace_options_init(&opts);
+    opts.flight_recorder_bytes = 4096;
+    opts.chunk_size = 1024;
+    dvtt_trace_t trace = dvtt_create_trace_ex(filename, "test", "1ns", &opts);
+    ASSERT_NE(trace, nullptr);
+    dvtt_stream_t stream = dvtt_open_stream(trace, "fifo", nullptr, nullptr);
+    dvtt_counter_t level = dvtt_open_counter(stream, "level", nullptr);
+    for (int i = 0; i < 10000; i++) {
+        dvtt_counter_set(level, i, i);
+    }
+    ASSERT_EQ(dvtt_dump_trace(trace, filename), 1);
+    dvtt_close_trace(trace);
+    
+    std::map<uint64_t, std::vector<trace_decode::Field>> tracks;
+    auto samples = read_counter_samples(filename, &tracks);
+    std::remove(filename);
+    ASSERT_FALSE(samples.empty());
+    EXPECT_LT(samples.size(), 10000u);
+    EXPECT_EQ(samples.back().value, 9999.0);
+    EXPECT_EQ(tracks.count(samples.back().track), 1u);
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,171 @@
+/**
+ * Minimal protobuf decoder used by the unit tests to inspect trace files
+ */
+#ifndef TRACE_DECODE_H
+#define TRACE_DECODE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace trace_decode {
+
+struct Field {
+    uint32_t number;
+    uint32_t wire_type;
+    uint64_t value;        // VARINT / FIXED64 / FIXED32 payload
+    std::string bytes;     // LENGTH_DELIMITED payload
+};
+
+inline bool read_varint(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        value |= static_cast<uint64_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Decodes the top-level fields of a message. Returns false on malformed input
+inline bool decode(const std::string& msg, std::vector<Field>& fields) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(msg.data());
+    const uint8_t* end = p + msg.size();
+    fields.clear();
+    while (p < end) {
+        uint64_t key;
+        if (!read_varint(p, end, key)) {
+            return false;
+        }
+        Field f;
+        f.number = static_cast<uint32_t>(key >> 3);
+        f.wire_type = static_cast<uint32_t>(key & 7);
+        f.value = 0;
+        switch (f.wire_type) {
+            case 0:
+                if (!read_varint(p, end, f.value)) return false;
+                break;
+            case 1:
+                if (end - p < 8) return false;
+                std::memcpy(&f.value, p, 8);
+                p += 8;
+                break;
+            case 2: {
+                uint64_t len;
+                if (!read_varint(p, end, len) || static_cast<uint64_t>(end - p) < len) {
+                    return false;
+                }
+                f.bytes.assign(reinterpret_cast<const char*>(p), len);
+                p += len;
+                break;
+            }
+            case 5:
+                if (end - p < 4) return false;
+                std::memcpy(&f.value, p, 4);
+                p += 4;
+                break;
+            default:
+                return false;
+        }
+        fields.push_back(f);
+    }
+    return true;
+}
+
+inline std::vector<Field> decode(const std::string& msg) {
+    std::vector<Field> fields;
+    decode(msg, fields);
+    return fields;
+}
+
+// Returns the first field with the given number, or nullptr
+inline const Field* find(const std::vector<Field>& fields, uint32_t number) {
+    for (const auto& f : fields) {
+        if (f.number == number) {
+            return &f;
+        }
+    }
+    return nullptr;
+}
+
+inline size_t count(const std::vector<Field>& fields, uint32_t number) {
+    size_t n = 0;
+    for (const auto& f : fields) {
+        if (f.number == number) {
+            n++;
+        }
+    }
+    return n;
+}
+
+inline std::string read_file(const char* filename) {
+    std::string data;
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) {
+        return data;
+    }
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        data.append(buf, n);
+    }
+    fclose(fp);
+    return data;
+}
+
+// Reads a trace file and returns the payload of each TracePacket.
+// 'ok' is cleared if the file is not a well-formed Trace message.
+inline std::vector<std::string> read_packets(const char* filename, bool* ok = nullptr) {
+    std::vector<std::string> packets;
+    std::vector<Field> fields;
+    bool valid = decode(read_file(filename), fields);
+    for (const auto& f : fields) {
+        if (f.number != 1 || f.wire_type != 2) {
+            valid = false;
+            continue;
+        }
+        packets.push_back(f.bytes);
+    }
+    if (ok) {
+        *ok = valid;
+    }
+    return packets;
+}
+
+// Resolves the timestamps of 'packets', in file order, through the clocks
+// the writer defines for each sequence: the default incremental clock,
+// which restarts from 0 when the sequence clears its state, and an
+// absolute clock (id 65). Packets without a timestamp get 0.
+inline std::vector<uint64_t> packet_times(const std::vector<std::string>& packets) {
+    std::vector<uint64_t> times;
+    std::map<uint64_t, uint64_t> clocks;
+    for (const auto& packet : packets) {
+        std::vector<Field> fields = decode(packet);
+        const Field* seq = find(fields, 10);
+        uint64_t& clock = clocks[seq ? seq->value : 0];
+        const Field* flags = find(fields, 13);
+        if (flags && (flags->value & 1u)) {
+            clock = 0;
+        }
+        const Field* timestamp = find(fields, 8);
+        const Field* clock_id = find(fields, 58);
+        if (!timestamp) {
+            times.push_back(0);
+        } else if (clock_id && clock_id->value == 65) {
+            times.push_back(timestamp->value);
+        } else {
+            clock += timestamp->value;
+            times.push_back(clock);
+        }
+    }
+    return times;
+}
+
+} // namespace trace_decode
+
+#endif // TRACE_DECODE_H